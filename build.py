@@ -11,6 +11,7 @@ __SUBPROCESS_TIMEOUT = 2
 
 __RE_PRAGMA_ONCE = re.compile(r'\s*#pragma\s+once\s+')
 __RE_INCLUDE_LOCAL = re.compile(r'\s*#include\s+".+')
+__RE_FEATURE_MACRO = re.compile(r'\s*#define\s+_\w+_SOURCE\b')
 
 __ML_TEST_SOURCE = """\
 function func a b c
@@ -62,12 +63,26 @@ def _do_write_files(suffix: str, out_file: typing.IO, in_paths: list[str]):
             out_file.write("\n\n")
             __do_write_separator(out_file, os.path.basename(in_path))
             for line in f.readlines():
-                if __RE_PRAGMA_ONCE.match(line) or __RE_INCLUDE_LOCAL.match(line):
+                if __RE_PRAGMA_ONCE.match(line) or __RE_INCLUDE_LOCAL.match(line) \
+                        or __RE_FEATURE_MACRO.match(line):
                     line = "// " + line
                 out_file.write(line)
             __do_write_separator(out_file)
 
 
+def _do_write_feature_macros(out_file: typing.IO, in_paths: list[str]):
+    # feature test macros only take effect before the first system header
+    macros = []
+    for in_path in in_paths:
+        with open(in_path) as f:
+            for line in f.readlines():
+                if __RE_FEATURE_MACRO.match(line) and line.strip() not in macros:
+                    macros.append(line.strip())
+    if macros:
+        out_file.write("\n")
+        out_file.writelines(m + "\n" for m in macros)
+
+
 def _write_combined_file(labels: list[str], in_paths: list[str], out_path: str):
     with open(out_path, "w") as out_file:
         # header
@@ -80,6 +95,7 @@ def _write_combined_file(labels: list[str], in_paths: list[str], out_path: str):
             "//  THIS IS GENERATED FROM MULTIPLE HEADER AND SOURCE FILES.\n"
         ))
 
+        _do_write_feature_macros(out_file, in_paths)
         _do_write_files(".h", out_file, in_paths)
         _do_write_files(".c", out_file, in_paths)
 
@@ -95,9 +111,13 @@ def _compile_and_check(out_path: str):
         ml_path = os.path.join(tmp_dir, "test.ml")
         with open(ml_path, "w") as f:
             f.write(__ML_TEST_SOURCE)
+        # the compiler probe record and the config of the user are left alone
+        env = dict(os.environ,
+                   RUNML_CACHE_DIR=os.path.join(tmp_dir, "cache"),
+                   RUNML_CONFIG=os.path.join(tmp_dir, "config"))
         p = subprocess.run([exec_path, ml_path, *__ML_TEST_ARGS],
                            check=True, cwd=tmp_dir, timeout=__SUBPROCESS_TIMEOUT,
-                           stdout=subprocess.PIPE)
+                           stdout=subprocess.PIPE, env=env)
         if p.stdout != __ML_TEST_RESULT.encode():
             sys.exit("test case failed")
 
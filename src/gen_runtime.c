@@ -0,0 +1,13 @@
+#include "ml_codegen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+    // writes the runtime source, which is built into the static library linked by generated programs
+    if (argc != 2 || !ml_codegen_export_runtime(argv[1])) {
+        fprintf(stderr, "failed to export runtime source\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -2,5 +2,7 @@
 
 int main(int argc, char *argv[]) {
     struct ml_exec_ctx ctx = {0};
-    return ml_exec_run_main(&ctx, argc, argv);
+    int ret = ml_exec_run_main(&ctx, argc, argv);
+    ml_exec_stop_server(&ctx);
+    return ret;
 }
@@ -0,0 +1,355 @@
+#include "ml_allocator.h"
+#include "ml_memory.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define ML_ALLOCATOR_ALIGNMENT          16
+#define ML_ALLOCATOR_HEADER_SIZE        ML_ALLOCATOR_ALIGN(sizeof(struct alloc_header))
+#define ML_ALLOCATOR_ALIGN(n)           (((n) + ML_ALLOCATOR_ALIGNMENT - 1) & ~(size_t) (ML_ALLOCATOR_ALIGNMENT - 1))
+#define ML_ARENA_CHUNK_SIZE_DEFAULT     65536
+#define ML_ARENA_CHUNK_HEADER_SIZE      ML_ALLOCATOR_ALIGN(sizeof(struct arena_chunk))
+#define ML_POOL_CLASS_MIN_SHIFT         4
+#define ML_POOL_CLASS_COUNT             9
+#define ML_POOL_CACHED_MAX              64
+#define ML_POOL_KIND_LARGE              ((size_t) -1)
+
+// every block is prefixed with its size, so it can be resized without asking the caller
+struct alloc_header {
+    size_t size;
+    size_t kind;
+};
+
+struct alloc_bump {
+    char *base;
+    size_t offset;
+    size_t capacity;
+    size_t last;
+    bool has_last;
+};
+
+struct arena_chunk {
+    struct arena_chunk *next;
+};
+
+struct ml_arena {
+    const struct ml_allocator *parent;
+    size_t chunk_size;
+    struct arena_chunk *chunks;
+    struct alloc_bump bump;
+};
+
+struct pool_link {
+    struct pool_link *next;
+};
+
+struct pool_cache {
+    struct pool_link *heads[ML_POOL_CLASS_COUNT];
+    int counts[ML_POOL_CLASS_COUNT];
+};
+
+static _Thread_local struct pool_cache pool_thread_cache;
+
+void *ml_allocator_alloc(const struct ml_allocator *allocator, size_t size) {
+    return allocator ? allocator->alloc(allocator->opaque, size) : ml_memory_malloc(size);
+}
+
+void *ml_allocator_realloc(const struct ml_allocator *allocator, void *ptr, size_t size) {
+    return allocator ? allocator->realloc(allocator->opaque, ptr, size) : ml_memory_realloc(ptr, size);
+}
+
+void ml_allocator_free(const struct ml_allocator *allocator, void *ptr) {
+    if (!ptr)
+        return;
+
+    if (allocator)
+        allocator->free(allocator->opaque, ptr);
+    else
+        ml_memory_free(ptr);
+}
+
+static struct alloc_header *resolve_alloc_header(void *ptr) {
+    return (struct alloc_header*) ((char*) ptr - ML_ALLOCATOR_HEADER_SIZE);
+}
+
+static bool check_bump_last(struct alloc_bump *bump, void *ptr) {
+    return bump->has_last && (char*) ptr == bump->base + bump->last + ML_ALLOCATOR_HEADER_SIZE;
+}
+
+static void *do_bump_alloc(struct alloc_bump *bump, size_t size) {
+    if (size > bump->capacity)
+        return NULL;
+
+    size_t need = ML_ALLOCATOR_HEADER_SIZE + ML_ALLOCATOR_ALIGN(size);
+    if (need > bump->capacity - bump->offset)
+        return NULL;
+
+    struct alloc_header *header = (struct alloc_header*) (bump->base + bump->offset);
+    header->size = size;
+    header->kind = 0;
+    bump->last = bump->offset;
+    bump->has_last = true;
+    bump->offset += need;
+    return (char*) header + ML_ALLOCATOR_HEADER_SIZE;
+}
+
+static bool do_bump_resize(struct alloc_bump *bump, void *ptr, size_t size) {
+    // any block can shrink, but only the last one can grow in place
+    struct alloc_header *header = resolve_alloc_header(ptr);
+    bool last = check_bump_last(bump, ptr);
+    if (size > header->size) {
+        if (!last || size > bump->capacity)
+            return false;
+        if (ML_ALLOCATOR_ALIGN(size) > bump->capacity - bump->last - ML_ALLOCATOR_HEADER_SIZE)
+            return false;
+    }
+
+    if (last)
+        bump->offset = bump->last + ML_ALLOCATOR_HEADER_SIZE + ML_ALLOCATOR_ALIGN(size);
+    header->size = size;
+    return true;
+}
+
+static void do_bump_free(struct alloc_bump *bump, void *ptr) {
+    // only the last block gives its space back, which suits the grow-then-free pattern of buffers
+    if (check_bump_last(bump, ptr)) {
+        bump->offset = bump->last;
+        bump->has_last = false;
+    }
+}
+
+static void *do_bump_realloc(struct alloc_bump *bump, void *opaque, void *ptr, size_t size,
+                             void *(*alloc)(void *opaque, size_t size)) {
+    if (!ptr)
+        return alloc(opaque, size);
+    if (do_bump_resize(bump, ptr, size))
+        return ptr;
+
+    void *p = alloc(opaque, size);
+    if (!p)
+        return NULL;
+
+    // the old block is left behind until everything is released
+    memcpy(p, ptr, resolve_alloc_header(ptr)->size);
+    resolve_alloc_header(p)->size = size;
+    return p;
+}
+
+static bool do_arena_grow(struct ml_arena *arena, size_t size) {
+    size_t capacity = arena->chunk_size;
+    size_t need = ML_ALLOCATOR_HEADER_SIZE + ML_ALLOCATOR_ALIGN(size);
+    if (need < size)
+        return false;
+    if (capacity < need)
+        capacity = need;
+
+    struct arena_chunk *chunk = ml_allocator_alloc(arena->parent, ML_ARENA_CHUNK_HEADER_SIZE + capacity);
+    if (!chunk)
+        return false;
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->bump = (struct alloc_bump) {
+        .base = (char*) chunk + ML_ARENA_CHUNK_HEADER_SIZE,
+        .offset = 0,
+        .capacity = capacity,
+        .last = 0,
+        .has_last = false,
+    };
+    return true;
+}
+
+static void *arena_cb_alloc(void *opaque, size_t size) {
+    struct ml_arena *arena = opaque;
+    void *p = do_bump_alloc(&arena->bump, size);
+    if (!p && do_arena_grow(arena, size))
+        p = do_bump_alloc(&arena->bump, size);
+    return p;
+}
+
+static void *arena_cb_realloc(void *opaque, void *ptr, size_t size) {
+    struct ml_arena *arena = opaque;
+    return do_bump_realloc(&arena->bump, arena, ptr, size, arena_cb_alloc);
+}
+
+static void arena_cb_free(void *opaque, void *ptr) {
+    struct ml_arena *arena = opaque;
+    do_bump_free(&arena->bump, ptr);
+}
+
+bool ml_arena_init(struct ml_arena **pp, const struct ml_allocator *parent, size_t chunk_size) {
+    struct ml_arena *arena = ml_allocator_alloc(parent, sizeof(struct ml_arena));
+    if (!arena)
+        return false;
+
+    *arena = (struct ml_arena) {
+        .parent = parent,
+        .chunk_size = chunk_size ? chunk_size : ML_ARENA_CHUNK_SIZE_DEFAULT,
+        .chunks = NULL,
+        .bump = {0},
+    };
+    *pp = arena;
+    return true;
+}
+
+void ml_arena_uninit(struct ml_arena **pp) {
+    struct ml_arena *arena = pp ? *pp : NULL;
+    if (!arena)
+        return;
+
+    while (arena->chunks) {
+        struct arena_chunk *next = arena->chunks->next;
+        ml_allocator_free(arena->parent, arena->chunks);
+        arena->chunks = next;
+    }
+    ml_allocator_free(arena->parent, arena);
+    *pp = NULL;
+}
+
+void ml_arena_reset(struct ml_arena *arena) {
+    // the newest chunk is kept for the next round, older ones go back to the parent
+    struct arena_chunk *head = arena->chunks;
+    if (!head)
+        return;
+
+    while (head->next) {
+        struct arena_chunk *next = head->next->next;
+        ml_allocator_free(arena->parent, head->next);
+        head->next = next;
+    }
+    arena->bump.offset = 0;
+    arena->bump.has_last = false;
+}
+
+void ml_arena_get_allocator(struct ml_arena *arena, struct ml_allocator *allocator) {
+    *allocator = (struct ml_allocator) {
+        .alloc = arena_cb_alloc,
+        .realloc = arena_cb_realloc,
+        .free = arena_cb_free,
+        .opaque = arena,
+    };
+}
+
+static void *fixed_cb_alloc(void *opaque, size_t size) {
+    return do_bump_alloc(opaque, size);
+}
+
+static void *fixed_cb_realloc(void *opaque, void *ptr, size_t size) {
+    return do_bump_realloc(opaque, opaque, ptr, size, fixed_cb_alloc);
+}
+
+static void fixed_cb_free(void *opaque, void *ptr) {
+    do_bump_free(opaque, ptr);
+}
+
+bool ml_fixed_init(struct ml_allocator *allocator, void *memory, size_t size) {
+    // the bookkeeping is placed at the start of the memory, so nothing is allocated elsewhere
+    uintptr_t start = ML_ALLOCATOR_ALIGN((uintptr_t) memory);
+    size_t skip = (start - (uintptr_t) memory) + ML_ALLOCATOR_ALIGN(sizeof(struct alloc_bump));
+    if (!memory || size < skip)
+        return false;
+
+    struct alloc_bump *bump = (struct alloc_bump*) start;
+    *bump = (struct alloc_bump) {
+        .base = (char*) memory + skip,
+        .offset = 0,
+        .capacity = size - skip,
+        .last = 0,
+        .has_last = false,
+    };
+    *allocator = (struct ml_allocator) {
+        .alloc = fixed_cb_alloc,
+        .realloc = fixed_cb_realloc,
+        .free = fixed_cb_free,
+        .opaque = bump,
+    };
+    return true;
+}
+
+static int resolve_pool_class(size_t size) {
+    for (int i = 0; i < ML_POOL_CLASS_COUNT; i++)
+        if (size <= ((size_t) 1 << (ML_POOL_CLASS_MIN_SHIFT + i)))
+            return i;
+    return -1;
+}
+
+static void *pool_cb_alloc(void *opaque, size_t size) {
+    // blocks of a class are cached by the thread freeing them, larger ones always go to the heap
+    int cls = resolve_pool_class(size);
+    struct pool_cache *cache = &pool_thread_cache;
+    struct alloc_header *header = NULL;
+    if (cls >= 0 && cache->heads[cls]) {
+        struct pool_link *link = cache->heads[cls];
+        cache->heads[cls] = link->next;
+        cache->counts[cls]--;
+        header = resolve_alloc_header(link);
+    } else {
+        size_t capacity = (cls >= 0) ? ((size_t) 1 << (ML_POOL_CLASS_MIN_SHIFT + cls)) : size;
+        if (capacity + ML_ALLOCATOR_HEADER_SIZE < capacity)
+            return NULL;
+
+        header = ml_memory_malloc(ML_ALLOCATOR_HEADER_SIZE + capacity);
+        if (!header)
+            return NULL;
+    }
+
+    header->size = size;
+    header->kind = (cls >= 0) ? (size_t) cls : ML_POOL_KIND_LARGE;
+    return (char*) header + ML_ALLOCATOR_HEADER_SIZE;
+}
+
+static void pool_cb_free(void *opaque, void *ptr) {
+    struct alloc_header *header = resolve_alloc_header(ptr);
+    struct pool_cache *cache = &pool_thread_cache;
+    size_t cls = header->kind;
+    if (cls == ML_POOL_KIND_LARGE || cache->counts[cls] >= ML_POOL_CACHED_MAX) {
+        ml_memory_free(header);
+        return;
+    }
+
+    struct pool_link *link = ptr;
+    link->next = cache->heads[cls];
+    cache->heads[cls] = link;
+    cache->counts[cls]++;
+}
+
+static void *pool_cb_realloc(void *opaque, void *ptr, size_t size) {
+    if (!ptr)
+        return pool_cb_alloc(opaque, size);
+
+    struct alloc_header *header = resolve_alloc_header(ptr);
+    if (header->kind != ML_POOL_KIND_LARGE && size <= ((size_t) 1 << (ML_POOL_CLASS_MIN_SHIFT + header->kind))) {
+        header->size = size;
+        return ptr;
+    }
+
+    void *p = pool_cb_alloc(opaque, size);
+    if (!p)
+        return NULL;
+
+    memcpy(p, ptr, header->size < size ? header->size : size);
+    pool_cb_free(opaque, ptr);
+    return p;
+}
+
+void ml_pool_get_allocator(struct ml_allocator *allocator) {
+    *allocator = (struct ml_allocator) {
+        .alloc = pool_cb_alloc,
+        .realloc = pool_cb_realloc,
+        .free = pool_cb_free,
+        .opaque = NULL,
+    };
+}
+
+void ml_pool_trim(void) {
+    // cached blocks belong to the calling thread, so it should trim them before exiting
+    struct pool_cache *cache = &pool_thread_cache;
+    for (int i = 0; i < ML_POOL_CLASS_COUNT; i++) {
+        while (cache->heads[i]) {
+            struct pool_link *link = cache->heads[i];
+            cache->heads[i] = link->next;
+            ml_memory_free(resolve_alloc_header(link));
+        }
+        cache->counts[i] = 0;
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct ml_arena;
+
+// a null allocator means the ml_memory functions, which are bound at link time
+struct ml_allocator {
+    void *(*alloc)(void *opaque, size_t size);
+    void *(*realloc)(void *opaque, void *ptr, size_t size);
+    void (*free)(void *opaque, void *ptr);
+    void *opaque;
+};
+
+void *ml_allocator_alloc(const struct ml_allocator *allocator, size_t size);
+
+void *ml_allocator_realloc(const struct ml_allocator *allocator, void *ptr, size_t size);
+
+void ml_allocator_free(const struct ml_allocator *allocator, void *ptr);
+
+bool ml_arena_init(struct ml_arena **pp, const struct ml_allocator *parent, size_t chunk_size);
+
+void ml_arena_uninit(struct ml_arena **pp);
+
+void ml_arena_reset(struct ml_arena *arena);
+
+void ml_arena_get_allocator(struct ml_arena *arena, struct ml_allocator *allocator);
+
+bool ml_fixed_init(struct ml_allocator *allocator, void *memory, size_t size);
+
+void ml_pool_get_allocator(struct ml_allocator *allocator);
+
+void ml_pool_trim(void);
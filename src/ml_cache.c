@@ -0,0 +1,451 @@
+#define _GNU_SOURCE
+
+#include "ml_cache.h"
+#include "ml_compile.h"
+#include "ml_memory.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define ML_CACHE_KEY_VERSION            1
+#define ML_CACHE_PROGRAM_KEY_VERSION    2
+#define ML_CACHE_ENTRY_SUFFIX           ".out"
+#define ML_CACHE_KEY_NAME_LENGTH        32
+#define ML_CACHE_PATH_CAPACITY          sizeof(ml_cache_path)
+
+static const char cache_entry_magic[8] = {'r', 'u', 'n', 'm', 'l', 'c', '0', '1'};
+
+struct cache_entry_header {
+    char magic[8];
+    struct ml_cache_key key;
+    uint32_t count;
+};
+
+struct ml_cache_ctx {
+    struct ml_cache_ctx_init_args args;
+    char dir[ML_CACHE_PATH_CAPACITY];
+};
+
+struct cache_group {
+    char name[ML_CACHE_KEY_NAME_LENGTH];
+    time_t used;
+    int count;
+};
+
+struct cache_key_ctx {
+    struct ml_cache_key *key;
+    int argc;
+    char **argv;
+};
+
+static const struct ml_cache_ctx_init_args ml_cache_ctx_init_args_default = {
+    .max_entries = 256,
+    .max_entry_size = 1 << 20,
+};
+
+static void cache_hash_bytes(struct ml_cache_key *key, const void *buf, size_t n) {
+    // two unrelated 64-bit lanes, so that a collision needs both of them to collide
+    const unsigned char *bytes = buf;
+    for (size_t i = 0; i < n; i++) {
+        key->parts[0] = (key->parts[0] ^ bytes[i]) * 0x100000001b3ULL;
+        key->parts[1] = ((key->parts[1] << 5) | (key->parts[1] >> 59)) ^ bytes[i];
+        key->parts[1] *= 0x9e3779b97f4a7c15ULL;
+    }
+}
+
+static void cache_hash_int(struct ml_cache_key *key, int value) {
+    int32_t fixed = value;
+    cache_hash_bytes(key, &fixed, sizeof(fixed));
+}
+
+static void cache_hash_number(struct ml_cache_key *key, double value) {
+    cache_hash_bytes(key, &value, sizeof(value));
+}
+
+static void cache_hash_name(struct ml_cache_key *key, const char *name) {
+    // the trailing zero separates adjacent names
+    cache_hash_bytes(key, name, strlen(name) + 1);
+}
+
+static double cache_parse_arg(struct cache_key_ctx *ctx, int idx) {
+    // the same conversion as "ml_parse_arg()" in the generated program
+    return (idx + 1 < ctx->argc) ? strtod(ctx->argv[idx + 1], NULL) : 0;
+}
+
+static void cache_fn_visit(void *opaque,
+                           enum ml_compile_visit_event event,
+                           const union ml_compile_visit_data *data) {
+    struct cache_key_ctx *ctx = opaque;
+    cache_hash_int(ctx->key, event);
+    switch (event) {
+        case ML_COMPILE_VISIT_EVENT_ARG_VISIT_INDEX:
+            // only the arguments referred by the program are part of the key
+            cache_hash_int(ctx->key, data->index);
+            if (ctx->argv)
+                cache_hash_number(ctx->key, cache_parse_arg(ctx, data->index));
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_MAIN_FUNC_VISIT_ARG:
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_ARG:
+            cache_hash_int(ctx->key, data->index);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_GLOBAL_VISIT_VAR:
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_SYMBOL:
+            cache_hash_name(ctx->key, data->name);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_NUMBER:
+            cache_hash_number(ctx->key, data->number);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_TOKEN:
+            cache_hash_int(ctx->key, data->token);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START:
+            cache_hash_int(ctx->key, data->func.ret);
+            cache_hash_name(ctx->key, data->func.name);
+            cache_hash_int(ctx->key, data->func.count);
+            for (int i = 0; i < data->func.count; i++)
+                cache_hash_name(ctx->key, data->func.params[i]);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool cache_make_dir(char *path) {
+    // creates every missing parent like "mkdir -p"
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/')
+            continue;
+
+        *p = 0;
+        bool created = (mkdir(path, 0700) == 0 || errno == EEXIST);
+        *p = '/';
+        if (!created)
+            return false;
+    }
+    return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+static bool cache_make_path(struct ml_cache_ctx *ctx, const struct ml_cache_key *key,
+                            const char *suffix, char *path) {
+    int n = snprintf(path, ML_CACHE_PATH_CAPACITY, "%s/%016llx%016llx%s", ctx->dir,
+                     (unsigned long long) key->parts[0],
+                     (unsigned long long) key->parts[1],
+                     suffix);
+    return n > 0 && n < ML_CACHE_PATH_CAPACITY;
+}
+
+static bool check_artifact_name(const char *name) {
+    // every artifact is named by its key, e.g. "0123456789abcdef0123456789abcdef.out"
+    for (int i = 0; i < ML_CACHE_KEY_NAME_LENGTH; i++)
+        if (!strchr("0123456789abcdef", name[i]) || !name[i])
+            return false;
+    return name[ML_CACHE_KEY_NAME_LENGTH] == '.';
+}
+
+static bool cache_scan_groups(struct ml_cache_ctx *ctx, struct cache_group **groups,
+                              int *group_count, int *file_count) {
+    DIR *dir = opendir(ctx->dir);
+    if (!dir)
+        return false;
+
+    // a group is as recent as its most recently used artifact
+    bool succeed = true;
+    int capacity = 0;
+    char path[ML_CACHE_PATH_CAPACITY];
+    *groups = NULL;
+    *group_count = 0;
+    *file_count = 0;
+    for (struct dirent *entry; (entry = readdir(dir));) {
+        if (!check_artifact_name(entry->d_name))
+            continue;
+
+        struct stat s;
+        int n = snprintf(path, sizeof(path), "%s/%s", ctx->dir, entry->d_name);
+        if (n <= 0 || n >= sizeof(path) || stat(path, &s) != 0)
+            continue;
+
+        int idx = 0;
+        while (idx < *group_count && memcmp((*groups)[idx].name, entry->d_name, ML_CACHE_KEY_NAME_LENGTH) != 0)
+            idx++;
+        if (idx == *group_count) {
+            if (idx == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                struct cache_group *grown = ml_memory_realloc(*groups, capacity * sizeof(struct cache_group));
+                if (!grown) {
+                    succeed = false;
+                    break;
+                }
+                *groups = grown;
+            }
+            (*groups)[idx] = (struct cache_group) {0};
+            memcpy((*groups)[idx].name, entry->d_name, ML_CACHE_KEY_NAME_LENGTH);
+            (*group_count)++;
+        }
+
+        time_t used = (s.st_atime > s.st_mtime) ? s.st_atime : s.st_mtime;
+        if (used > (*groups)[idx].used)
+            (*groups)[idx].used = used;
+        (*groups)[idx].count++;
+        (*file_count)++;
+    }
+    closedir(dir);
+    return succeed;
+}
+
+static bool cache_remove_group(struct ml_cache_ctx *ctx, const struct cache_group *group) {
+    DIR *dir = opendir(ctx->dir);
+    if (!dir)
+        return false;
+
+    bool removed = true;
+    char path[ML_CACHE_PATH_CAPACITY];
+    for (struct dirent *entry; (entry = readdir(dir));) {
+        if (!check_artifact_name(entry->d_name)
+            || memcmp(group->name, entry->d_name, ML_CACHE_KEY_NAME_LENGTH) != 0)
+            continue;
+
+        int n = snprintf(path, sizeof(path), "%s/%s", ctx->dir, entry->d_name);
+        if (n <= 0 || n >= sizeof(path) || (unlink(path) != 0 && errno != ENOENT))
+            removed = false;
+    }
+    closedir(dir);
+    return removed;
+}
+
+static bool cache_evict_oldest(struct ml_cache_ctx *ctx, const struct ml_cache_key *keep) {
+    // every artifact counts towards the limit, and all artifacts of the least recently used key go together
+    // the key making room is never evicted, because its artifacts are about to be used
+    struct cache_group *groups = NULL;
+    int group_count = 0;
+    int file_count = 0;
+    bool succeed = cache_scan_groups(ctx, &groups, &group_count, &file_count);
+    if (!succeed)
+        goto done;
+
+    char keep_name[ML_CACHE_KEY_NAME_LENGTH + 1];
+    snprintf(keep_name, sizeof(keep_name), "%016llx%016llx",
+             (unsigned long long) keep->parts[0], (unsigned long long) keep->parts[1]);
+
+    while (file_count >= ctx->args.max_entries) {
+        struct cache_group *oldest = NULL;
+        for (int i = 0; i < group_count; i++) {
+            struct cache_group *group = &groups[i];
+            if (!group->count || memcmp(group->name, keep_name, ML_CACHE_KEY_NAME_LENGTH) == 0)
+                continue;
+            if (!oldest || group->used < oldest->used)
+                oldest = group;
+        }
+
+        // only the key in use is left, which may go beyond the limit by itself
+        if (!oldest)
+            break;
+        if (!cache_remove_group(ctx, oldest)) {
+            succeed = false;
+            break;
+        }
+        file_count -= oldest->count;
+        oldest->count = 0;
+    }
+
+done:
+    if (groups)
+        ml_memory_free(groups);
+    return succeed;
+}
+
+static bool cache_read_full(int fd, void *buf, size_t n) {
+    char *p = buf;
+    while (n > 0) {
+        ssize_t count = read(fd, p, n);
+        if (count <= 0)
+            return false;
+        p += count;
+        n -= count;
+    }
+    return true;
+}
+
+static bool cache_write_full(int fd, const void *buf, size_t n) {
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t count = write(fd, p, n);
+        if (count <= 0)
+            return false;
+        p += count;
+        n -= count;
+    }
+    return true;
+}
+
+bool ml_cache_ctx_init(struct ml_cache_ctx **pp, const char *dir,
+                       const struct ml_cache_ctx_init_args *args) {
+    const struct ml_cache_ctx_init_args *p_args = args;
+    if (!p_args)
+        p_args = &ml_cache_ctx_init_args_default;
+
+    if (!dir || !*dir || strlen(dir) + ML_CACHE_KEY_NAME_LENGTH + 64 >= ML_CACHE_PATH_CAPACITY)
+        return false;
+
+    struct ml_cache_ctx *ctx = ml_memory_malloc(sizeof(struct ml_cache_ctx));
+    if (!ctx)
+        goto fail;
+
+    *ctx = (struct ml_cache_ctx) {0};
+    ctx->args = *p_args;
+    strcpy(ctx->dir, dir);
+    if (!cache_make_dir(ctx->dir))
+        goto fail;
+
+    *pp = ctx;
+    return true;
+
+fail:
+    ml_cache_ctx_uninit(&ctx);
+    return false;
+}
+
+void ml_cache_ctx_uninit(struct ml_cache_ctx **pp) {
+    struct ml_cache_ctx *ctx = *pp;
+    if (!ctx)
+        return;
+
+    ml_memory_free(ctx);
+    *pp = NULL;
+}
+
+static void cache_key_init(struct ml_cache_key *key, int version) {
+    key->parts[0] = 0xcbf29ce484222325ULL;
+    key->parts[1] = 0x84222325cbf29ce4ULL;
+    cache_hash_int(key, version);
+}
+
+void ml_cache_key_init(struct ml_cache_key *key, struct ml_compile_ctx *compile, int argc, char **argv) {
+    struct cache_key_ctx ctx = {
+        .key = key,
+        .argc = argc,
+        .argv = argv,
+    };
+    cache_key_init(key, ML_CACHE_KEY_VERSION);
+    ml_compile_accept(compile, &ctx, cache_fn_visit);
+}
+
+void ml_cache_program_key_init(struct ml_cache_key *key, struct ml_compile_ctx *compile, uint32_t salt) {
+    // only the program itself, so that every argument value shares the same key
+    struct cache_key_ctx ctx = {
+        .key = key,
+    };
+    cache_key_init(key, ML_CACHE_PROGRAM_KEY_VERSION);
+    cache_hash_int(key, (int) salt);
+    ml_compile_accept(compile, &ctx, cache_fn_visit);
+}
+
+bool ml_cache_get_path(struct ml_cache_ctx *ctx, const struct ml_cache_key *key,
+                       const char *suffix, ml_cache_path path) {
+    // an artifact is marked as used by its access time, which leaves the modification time to its owner,
+    // while a missing one is about to be made, so room is made for it first
+    if (!cache_make_path(ctx, key, suffix, path))
+        return false;
+
+    const struct timespec times[2] = { { 0, UTIME_NOW }, { 0, UTIME_OMIT } };
+    if (utimensat(AT_FDCWD, path, times, 0) != 0 && ctx->args.max_entries > 0)
+        cache_evict_oldest(ctx, key);
+    return true;
+}
+
+bool ml_cache_load(struct ml_cache_ctx *ctx, const struct ml_cache_key *key,
+                   void *opaque, ml_cache_write_fn fn) {
+    char path[ML_CACHE_PATH_CAPACITY];
+    if (!cache_make_path(ctx, key, ML_CACHE_ENTRY_SUFFIX, path))
+        return false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    // the whole entry is validated before anything is written out
+    bool hit = false;
+    char *buf = NULL;
+    struct stat s;
+    struct cache_entry_header header;
+    if (!cache_read_full(fd, &header, sizeof(header)))
+        goto done;
+    if (memcmp(header.magic, cache_entry_magic, sizeof(cache_entry_magic)) != 0)
+        goto done;
+    if (memcmp(&header.key, key, sizeof(struct ml_cache_key)) != 0)
+        goto done;
+    if (header.count > ctx->args.max_entry_size)
+        goto done;
+    if (fstat(fd, &s) != 0 || s.st_size != sizeof(header) + header.count)
+        goto done;
+
+    if (header.count) {
+        buf = ml_memory_malloc(header.count);
+        if (!buf || !cache_read_full(fd, buf, header.count))
+            goto done;
+        fn(opaque, buf, header.count);
+    }
+
+    utime(path, NULL);
+    hit = true;
+done:
+    if (buf)
+        ml_memory_free(buf);
+    close(fd);
+    return hit;
+}
+
+bool ml_cache_store(struct ml_cache_ctx *ctx, const struct ml_cache_key *key,
+                    const char *buf, int count) {
+    if (count < 0 || count > ctx->args.max_entry_size || ctx->args.max_entries <= 0)
+        return false;
+
+    if (!cache_evict_oldest(ctx, key))
+        return false;
+
+    char path[ML_CACHE_PATH_CAPACITY];
+    char temp_path[ML_CACHE_PATH_CAPACITY];
+    if (!cache_make_path(ctx, key, ML_CACHE_ENTRY_SUFFIX, path) || !ml_cache_make_temp_path(path, temp_path))
+        return false;
+
+    // readers never see a partial entry, because it is renamed only after being fully written
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return false;
+
+    struct cache_entry_header header = {0};
+    memcpy(header.magic, cache_entry_magic, sizeof(cache_entry_magic));
+    header.key = *key;
+    header.count = count;
+    bool written = cache_write_full(fd, &header, sizeof(header)) && cache_write_full(fd, buf, count);
+    written = (close(fd) == 0) && written;
+    if (!written || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+int ml_cache_get_thread_id(void) {
+    return (int) syscall(SYS_gettid);
+}
+
+bool ml_cache_make_temp_path(const char *path, ml_cache_path temp) {
+    int n = snprintf(temp, ML_CACHE_PATH_CAPACITY, "%s.tmp%d", path, ml_cache_get_thread_id());
+    return n > 0 && n < ML_CACHE_PATH_CAPACITY;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct ml_compile_ctx;
+struct ml_cache_ctx;
+
+typedef char ml_cache_path[4096];
+
+struct ml_cache_ctx_init_args {
+    int max_entries;
+    int max_entry_size;
+};
+
+struct ml_cache_key {
+    uint64_t parts[2];
+};
+
+typedef void (*ml_cache_write_fn)(void *opaque, const char *buf, int n);
+
+bool ml_cache_ctx_init(struct ml_cache_ctx **pp, const char *dir,
+                       const struct ml_cache_ctx_init_args *args);
+
+void ml_cache_ctx_uninit(struct ml_cache_ctx **pp);
+
+void ml_cache_key_init(struct ml_cache_key *key, struct ml_compile_ctx *compile, int argc, char **argv);
+
+void ml_cache_program_key_init(struct ml_cache_key *key, struct ml_compile_ctx *compile, uint32_t salt);
+
+bool ml_cache_get_path(struct ml_cache_ctx *ctx, const struct ml_cache_key *key,
+                       const char *suffix, ml_cache_path path);
+
+bool ml_cache_load(struct ml_cache_ctx *ctx, const struct ml_cache_key *key,
+                   void *opaque, ml_cache_write_fn fn);
+
+bool ml_cache_store(struct ml_cache_ctx *ctx, const struct ml_cache_key *key,
+                    const char *buf, int count);
+
+// unlike the process id, it tells apart threads running in the same process
+int ml_cache_get_thread_id(void);
+
+// a file next to the path, which is written by the calling thread alone and renamed into place afterwards
+bool ml_cache_make_temp_path(const char *path, ml_cache_path temp);
@@ -3,55 +3,471 @@
 #include "ml_compile.h"
 #include "ml_memory.h"
 
-#include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
-#define ML_CODEGEN_BUFFER_CAPACITY_WRITE    4096
+#define ML_CODEGEN_BUFFER_CAPACITY_WRITE    65536
 #define ML_CODEGEN_BUFFER_CAPACITY_NUM      64
 #define ML_CODEGEN_SECTION_COMMENT_WIDTH    80
+#define ML_CODEGEN_MEMO_CAPACITY            256
+#define ML_CODEGEN_PARALLEL_MIN_FUNCS       128
+#define ML_CODEGEN_PARALLEL_MAX_THREADS     64
+#define ML_CODEGEN_PROFILE_MAX_DEPTH        4096
+#define ML_CODEGEN_PROFILE_MAX_NODES        4096
+#define ML_CODEGEN_PROFILE_PATH             "runml.profile"
+#define ML_CODEGEN_SERVER_MAX_REQUEST       65536
+
+// expands to a string literal and its length, anything other than a literal fails to compile
+#define ML_CODEGEN_LITERAL(s)               ("" s), ((int) sizeof(s) - 1)
 
 static int cb_codegen_write(void *opaque, char *buffer, int count);
+static int cb_codegen_writev(void *opaque, struct iovec *iov, int count);
 static void cb_codegen_close(void *opaque);
+static int cb_codegen_chunk_write(void *opaque, char *buffer, int count);
+static void cb_codegen_chunk_close(void *opaque);
 
 struct codegen_ctx {
+    struct ml_compile_ctx *compile;
     char *buffer;
     int offset;
     int capacity;
+    uint32_t flags;
     void *opaque;
     const struct ml_codegen_io_fns *fns;
+    char last;
+    bool pending_space;
+    bool split;
+    int batch_width;
+    const char *source_path;
+    const char *output_path;
+    const char *profile_path;
+    long long lines;
+    int scanned;
+    long long flushes;
+    long long written;
+};
+
+struct codegen_chunk {
+    char *data;
+    int count;
+    int capacity;
+    int grows;
+    bool failed;
+};
+
+struct codegen_worker {
+    struct ml_compile_ctx *compile;
+    const struct ml_codegen_args *args;
+    int func_begin;
+    int func_end;
+    struct codegen_chunk chunk;
+    long long flushes;
+    long long written;
+};
+
+struct codegen_outline {
+    struct codegen_ctx head;
+    struct codegen_ctx tail;
+    bool in_functions;
+    bool after_functions;
+};
+
+struct codegen_unit_filter {
+    struct codegen_ctx *ctx;
+    bool in_functions;
+};
+
+struct codegen_mangled_name {
+    const char *name;
+    const char *mangled;
+    bool exported;
 };
 
 static const struct ml_codegen_io_fns ml_codegen_io_fns_file = {
     .write = cb_codegen_write,
+    .writev = cb_codegen_writev,
     .close = cb_codegen_close,
 };
 
+static const struct ml_codegen_io_fns ml_codegen_io_fns_chunk = {
+    .write = cb_codegen_chunk_write,
+    .close = cb_codegen_chunk_close,
+};
+
+// names of user symbols are all lowercase, so upper case names never clash with them
+// "ml_arg" and "ml_memo_arg" are prefixes followed by digits, "ml_memo_raw_" and "ml_u_" are followed by names
+static const struct codegen_mangled_name codegen_mangled_names[] = {
+    {"ml_arg", "A"},
+    {"ml_argc", "C"},
+    {"ml_argv", "V"},
+    {"ml_bits", "T"},
+    {"ml_memo", "M"},
+    {"ml_memo_raw_", "R"},
+    {"ml_u_", "Z"},
+    {"ml_memo_hash", "H"},
+    {"ml_memo_equal", "E"},
+    {"ml_memo_epoch", "MP"},
+    {"ml_memo_check", "MC"},
+    {"ml_memo_arg", "MQ"},
+    {"ml_out_buf", "O"},
+    {"ml_out_len", "L"},
+    {"ml_put_uint", "U"},
+    {"ml_flush", "F", true},
+    {"ml_print", "P", true},
+    {"ml_parse_arg", "G", true},
+    {"ml_a", "AA"},
+    {"ml_b", "BB"},
+    {"ml_buf", "BF"},
+    {"ml_digits", "DG"},
+    {"ml_done", "DN"},
+    {"ml_field", "FL"},
+    {"ml_frac", "FR"},
+    {"ml_half", "HF"},
+    {"ml_hash", "HS"},
+    {"ml_i", "II"},
+    {"ml_int", "IN"},
+    {"ml_mant", "MT"},
+    {"ml_mask", "MK"},
+    {"ml_n", "NN"},
+    {"ml_shift", "SH"},
+    {"ml_slot", "SL"},
+    {"ml_val", "VL"},
+    {"ml_value", "VA"},
+    {"ml_width", "WD"},
+    {"ml_x", "XX"},
+    {"ml_y", "YY"},
+    {"ml_vec", "VC"},
+    {"ml_vec_u", "VU"},
+    {"ml_lanes", "LN"},
+    {"ml_cells", "CL"},
+    {"ml_rec", "RC"},
+    {"ml_rec_len", "RL"},
+    {"ml_rec_cap", "RP"},
+    {"ml_in_buf", "IB"},
+    {"ml_in_pos", "IP"},
+    {"ml_in_len", "IL"},
+    {"ml_batch_print", "BP"},
+    {"ml_batch_load", "BL"},
+    {"ml_batch_read_line", "BR"},
+    {"ml_batch_read_binary", "BN"},
+    {"ml_batch_run", "BU"},
+    {"ml_batch_body", "BD"},
+    {"ml_binary", "BI"},
+    {"ml_body", "BO"},
+    {"ml_end", "EN"},
+    {"ml_k", "KK"},
+    {"ml_l", "LL"},
+    {"ml_p", "PT"},
+    {"ml_row", "RW"},
+    {"ml_size", "SZ"},
+    {"ml_read", "RD"},
+    {"ml_in_ptr", "IQ"},
+    {"ml_in_end", "IE"},
+    {"ml_line", "LI"},
+    {"ml_shard", "SD"},
+    {"ml_shards", "SS"},
+    {"ml_out_shard", "OS"},
+    {"ml_shard_read_line", "SR"},
+    {"ml_shard_read_binary", "SN"},
+    {"ml_shard_worker", "SW"},
+    {"ml_shard_main", "SM"},
+    {"ml_threads", "TH"},
+    {"ml_started", "SA"},
+    {"ml_failed", "FA"},
+    {"ml_count", "CT"},
+    {"ml_data", "DA"},
+    {"ml_fd", "FD"},
+    {"ml_st", "SU"},
+    {"ml_s", "SP"},
+    {"ml_begin", "BG"},
+    {"ml_sink", "SI"},
+    {"ml_out_sink", "OI"},
+    {"ml_out", "OP"},
+    {"ml_main", "MA"},
+    {"ml_ctl", "CO"},
+    {"ml_args", "AR"},
+    {"ml_ctrl", "CR"},
+    {"ml_c", "CM"},
+    {"ml_h", "HD"},
+    {"ml_iov", "IO"},
+    {"ml_msg", "MG"},
+    {"ml_pid", "PI"},
+    {"ml_status", "SX"},
+    {"ml_code", "CE"},
+    {"ml_symbol", "SY"},
+    {"ml_prof", "PF"},
+    {"ml_prof_raw_", "PR"},
+    {"ml_prof_func", "PU"},
+    {"ml_prof_node", "PX"},
+    {"ml_prof_frame", "PG"},
+    {"ml_prof_names", "PN"},
+    {"ml_prof_path", "PH"},
+    {"ml_prof_nodes", "PD"},
+    {"ml_prof_links", "PK"},
+    {"ml_prof_node_count", "PC"},
+    {"ml_prof_frames", "PA"},
+    {"ml_prof_depth", "PE"},
+    {"ml_prof_now", "PW"},
+    {"ml_prof_node_of", "PO"},
+    {"ml_prof_enter", "PY"},
+    {"ml_prof_leave", "PV"},
+    {"ml_prof_begin", "PB"},
+    {"ml_prof_end", "PZ"},
+    {"ml_prof_order", "PQ"},
+    {"ml_prof_write_stack", "PS"},
+    {"ml_func", "FN"},
+    {"ml_parent", "PP"},
+    {"ml_total", "TT"},
+    {"ml_order", "OR"},
+    {"ml_path", "PL"},
+    {"ml_ts", "TS"},
+    {"ml_fp", "FP"},
+    {"ml_f", "FF"},
+};
+
+static const struct ml_codegen_args ml_codegen_args_default = {
+    .buffer_capacity = ML_CODEGEN_BUFFER_CAPACITY_WRITE,
+    .thread_count = 0,
+    .flags = ML_CODEGEN_FLAG_MEMOIZE,
+};
+
 static int cb_codegen_write(void *opaque, char *buffer, int count) {
-    FILE *file = opaque;
-    return fwrite(buffer, 1, count, file);
+    int fd = (int) (intptr_t) opaque;
+    int written = 0;
+    while (written < count) {
+        ssize_t n = write(fd, buffer + written, count - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    return written;
+}
+
+static int cb_codegen_writev(void *opaque, struct iovec *iov, int count) {
+    // partial writes are resumed by consuming the written part of the vector
+    int fd = (int) (intptr_t) opaque;
+    int written = 0;
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n <= 0)
+            break;
+
+        written += n;
+        while (count > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return written;
 }
 
 static void cb_codegen_close(void *opaque) {
-    FILE *file = opaque;
-    if (file)
-        fclose(file);
+    close((int) (intptr_t) opaque);
+}
+
+static int cb_codegen_chunk_write(void *opaque, char *buffer, int count) {
+    struct codegen_chunk *chunk = opaque;
+    if (chunk->failed)
+        return 0;
+
+    if (chunk->count + count > chunk->capacity) {
+        int capacity = chunk->capacity ? chunk->capacity : ML_CODEGEN_BUFFER_CAPACITY_WRITE;
+        while (capacity < chunk->count + count)
+            capacity *= 2;
+
+        char *data = ml_memory_realloc(chunk->data, capacity);
+        if (!data) {
+            chunk->failed = true;
+            return 0;
+        }
+        if (chunk->data)
+            chunk->grows++;
+        chunk->data = data;
+        chunk->capacity = capacity;
+    }
+
+    memcpy(chunk->data + chunk->count, buffer, count);
+    chunk->count += count;
+    return count;
+}
+
+static void cb_codegen_chunk_close(void *opaque) {
+}
+
+static long long resolve_output_lines(struct codegen_ctx *ctx) {
+    // only needed by markers, so lines are counted when one is written or the buffer is flushed
+    for (int i = ctx->scanned; i < ctx->offset; i++)
+        ctx->lines += (ctx->buffer[i] == '\n');
+    ctx->scanned = ctx->offset;
+    return ctx->lines;
 }
 
 static void do_write_flush(struct codegen_ctx *ctx) {
-    if (ctx->offset)
+    if (ctx->output_path)
+        resolve_output_lines(ctx);
+    ctx->scanned = 0;
+    if (ctx->offset) {
         ctx->fns->write(ctx->opaque, ctx->buffer, ctx->offset);
+        ctx->flushes++;
+        ctx->written += ctx->offset;
+    }
     ctx->offset = 0;
 }
 
-static void do_write_char(struct codegen_ctx *ctx, char c) {
+static void do_stats_add_buffer(struct ml_memory_stats *buffers, int count, int capacity, int grows) {
+    if (!capacity)
+        return;
+
+    buffers->count += count;
+    buffers->capacity += capacity;
+    buffers->allocs += 1 + grows;
+    buffers->grows += grows;
+    buffers->bytes += capacity;
+}
+
+static void do_stats_add_chunk(struct ml_memory_stats *buffers, const struct codegen_chunk *chunk) {
+    do_stats_add_buffer(buffers, chunk->count, chunk->capacity, chunk->grows);
+}
+
+static void do_stats_merge(const struct ml_codegen_args *args, const struct ml_memory_stats *buffers,
+                           long long flushes, long long written) {
+    // every buffer of one export is alive at the same time, and exports are accumulated
+    struct ml_codegen_stats *stats = args->stats;
+    if (!stats)
+        return;
+
+    stats->flushes += flushes;
+    stats->bytes += written;
+    stats->buffers.name = "buffers";
+    stats->buffers.count += buffers->count;
+    stats->buffers.capacity += buffers->capacity;
+    stats->buffers.allocs += buffers->allocs;
+    stats->buffers.grows += buffers->grows;
+    stats->buffers.bytes += buffers->bytes;
+    if (buffers->bytes > stats->buffers.peak_bytes)
+        stats->buffers.peak_bytes = buffers->bytes;
+}
+
+static void do_put_char(struct codegen_ctx *ctx, char c) {
     ctx->buffer[ctx->offset++] = c;
     if (ctx->offset == ctx->capacity)
         do_write_flush(ctx);
 }
 
-static void do_write_str(struct codegen_ctx *ctx, const char *s) {
+static bool check_ident_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static bool check_word_char(char c) {
+    return check_ident_char(c) || c == '.' || c == '\'' || c == '"';
+}
+
+static bool check_operator_char(char c) {
+    return c && strchr("+-*/%<>=!&|^~?:", c);
+}
+
+static bool check_profile_enabled(struct codegen_ctx *ctx) {
+    // rows evaluated together and programs run more than once by their host have no single run to report
+    return (ctx->flags & ML_CODEGEN_FLAG_PROFILE)
+           && !(ctx->flags & (ML_CODEGEN_FLAG_BATCH | ML_CODEGEN_FLAG_SHARED | ML_CODEGEN_FLAG_FORK_SERVER));
+}
+
+static bool check_memoize_enabled(struct codegen_ctx *ctx) {
+    // memo tables are keyed by scalars, so rows evaluated together are never memoized
+    return (ctx->flags & ML_CODEGEN_FLAG_MEMOIZE) && !(ctx->flags & ML_CODEGEN_FLAG_BATCH);
+}
+
+static bool check_extern_runtime(struct codegen_ctx *ctx) {
+    // sharded programs keep their output state per thread, and shared objects print to a sink,
+    // neither of which a prebuilt runtime does, while a fork server or a profiler needs the system headers anyway
+    return (ctx->flags & ML_CODEGEN_FLAG_EXTERN_RUNTIME)
+           && !(ctx->flags & (ML_CODEGEN_FLAG_SHARD | ML_CODEGEN_FLAG_SHARED | ML_CODEGEN_FLAG_FORK_SERVER))
+           && !check_profile_enabled(ctx);
+}
+
+static const char *resolve_mangled_name(struct codegen_ctx *ctx, const char *s, int count) {
+    for (int i = 0; i < sizeof(codegen_mangled_names) / sizeof(codegen_mangled_names[0]); i++) {
+        const struct codegen_mangled_name *entry = &codegen_mangled_names[i];
+        if (entry->exported && check_extern_runtime(ctx))
+            continue;
+        if (strncmp(entry->name, s, count) == 0 && !entry->name[count])
+            return entry->mangled;
+    }
+    return NULL;
+}
+
+static void do_write_compact(struct codegen_ctx *ctx, const char *s, int count) {
+    // indents and blank lines are dropped, and a space is only kept if the tokens around it would merge
+    for (int i = 0; i < count; i++) {
+        char c = s[i];
+        if (c == ' ') {
+            ctx->pending_space = true;
+            continue;
+        }
+
+        if (c == '\n') {
+            ctx->pending_space = false;
+            if (ctx->last && ctx->last != '\n')
+                do_put_char(ctx, ctx->last = c);
+            continue;
+        }
+
+        if (ctx->pending_space) {
+            ctx->pending_space = false;
+            if ((check_word_char(ctx->last) && check_word_char(c))
+                || (check_operator_char(ctx->last) && check_operator_char(c)))
+                do_put_char(ctx, ctx->last = ' ');
+        }
+
+        // internal names are shortened, each of them is written in one piece
+        if (c == 'm' && i + 2 < count && s[i + 1] == 'l' && s[i + 2] == '_' && !check_word_char(ctx->last)) {
+            int end = i + 3;
+            while (end < count && check_ident_char(s[end]))
+                end++;
+
+            const char *mangled = resolve_mangled_name(ctx, s + i, end - i);
+            if (mangled) {
+                for (const char *p = mangled; *p; p++)
+                    do_put_char(ctx, ctx->last = *p);
+                i = end - 1;
+                continue;
+            }
+        }
+
+        do_put_char(ctx, ctx->last = c);
+    }
+}
+
+static void do_write_char(struct codegen_ctx *ctx, char c) {
+    if (ctx->flags & ML_CODEGEN_FLAG_COMPACT)
+        do_write_compact(ctx, &c, 1);
+    else
+        do_put_char(ctx, c);
+}
+
+static void do_write_chars(struct codegen_ctx *ctx, const char *s, int count) {
+    if (ctx->flags & ML_CODEGEN_FLAG_COMPACT) {
+        do_write_compact(ctx, s, count);
+        return;
+    }
+
+    // most fragments are short enough to fit in the rest of the buffer
+    if (count < ctx->capacity - ctx->offset) {
+        memcpy(ctx->buffer + ctx->offset, s, count);
+        ctx->offset += count;
+        return;
+    }
+
     int idx = 0;
-    int count = strlen(s);
     while (idx < count) {
         bool flush = false;
         int capacity = ctx->capacity - ctx->offset;
@@ -69,34 +485,135 @@ static void do_write_str(struct codegen_ctx *ctx, const char *s) {
     }
 }
 
+static void do_write_str(struct codegen_ctx *ctx, const char *s) {
+    // only for names from the compile context, literals carry their lengths
+    do_write_chars(ctx, s, strlen(s));
+}
+
+static void do_write_name(struct codegen_ctx *ctx, const char *name) {
+    // symbols of split units have external linkage, so user names are prefixed to never clash with libc
+    if (ctx->split)
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_u_"));
+    do_write_str(ctx, name);
+}
+
 static void do_write_newline(struct codegen_ctx *ctx) {
     do_write_char(ctx, '\n');
 }
 
 static void do_write_indent(struct codegen_ctx *ctx) {
-    do_write_str(ctx, "    ");
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("    "));
 }
 
-static void do_write_line(struct codegen_ctx *ctx, const char *s) {
-    do_write_str(ctx, s);
+static void do_write_line(struct codegen_ctx *ctx, const char *s, int count) {
+    do_write_chars(ctx, s, count);
     do_write_newline(ctx);
 }
 
-static void do_write_line_indent(struct codegen_ctx *ctx, const char *s) {
+static void do_write_line_indent(struct codegen_ctx *ctx, const char *s, int count) {
     do_write_indent(ctx);
-    do_write_line(ctx, s);
+    do_write_line(ctx, s, count);
+}
+
+static void do_write_int(struct codegen_ctx *ctx, int value) {
+    // digits are filled from the end of the buffer
+    char buf[ML_CODEGEN_BUFFER_CAPACITY_NUM];
+    int offset = sizeof(buf);
+    unsigned int rest = (value < 0) ? -(unsigned int) value : (unsigned int) value;
+    do {
+        buf[--offset] = (char) ('0' + rest % 10);
+        rest /= 10;
+    } while (rest);
+
+    if (value < 0)
+        buf[--offset] = '-';
+    do_write_chars(ctx, buf + offset, sizeof(buf) - offset);
+}
+
+static void do_write_quoted(struct codegen_ctx *ctx, const char *s) {
+    // e.g. "\"/tmp/script.ml\"", a path is written as it is even in compact output
+    do_put_char(ctx, '"');
+    for (const char *p = s; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            do_put_char(ctx, '\\');
+        do_put_char(ctx, *p);
+    }
+    do_put_char(ctx, '"');
+    ctx->last = '"';
+    ctx->pending_space = false;
+}
+
+static void do_write_line_marker(struct codegen_ctx *ctx, int line, const char *path) {
+    // e.g. "#line 3 \"/tmp/script.ml\""
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("#line "));
+    do_write_int(ctx, line);
+    do_put_char(ctx, ' ');
+    do_write_quoted(ctx, path);
+    do_put_char(ctx, '\n');
+    ctx->last = '\n';
+    ctx->pending_space = false;
+}
+
+static void do_write_source_marker(struct codegen_ctx *ctx, int line) {
+    if (ctx->source_path && line > 0)
+        do_write_line_marker(ctx, line, ctx->source_path);
+}
+
+static void do_write_output_marker(struct codegen_ctx *ctx) {
+    // the line after the marker is the one after its own line
+    if (ctx->source_path && ctx->output_path)
+        do_write_line_marker(ctx, (int) resolve_output_lines(ctx) + 2, ctx->output_path);
+}
+
+static void do_write_number(struct codegen_ctx *ctx, double value) {
+    // the same text as "%a" of glibc, e.g. "0x1.8p+1" or "0x0.0000000000001p-1022" for subnormals
+    static const char digits[] = "0123456789abcdef";
+    union { double d; uint64_t u; } bits = { value };
+    uint64_t mantissa = bits.u & ((1ULL << 52) - 1);
+    int exponent = (int) ((bits.u >> 52) & 0x7ff);
+
+    int count = 0;
+    char buf[ML_CODEGEN_BUFFER_CAPACITY_NUM];
+    if (bits.u >> 63)
+        buf[count++] = '-';
+
+    if (exponent == 0x7ff) {
+        memcpy(buf + count, mantissa ? "nan" : "inf", 3);
+        do_write_chars(ctx, buf, count + 3);
+        return;
+    }
+
+    buf[count++] = '0';
+    buf[count++] = 'x';
+    buf[count++] = exponent ? '1' : '0';
+    if (mantissa) {
+        buf[count++] = '.';
+        for (int shift = 48; shift >= 0 && mantissa; shift -= 4) {
+            buf[count++] = digits[(mantissa >> shift) & 0xf];
+            mantissa &= (1ULL << shift) - 1;
+        }
+    }
+
+    int power = exponent ? (exponent - 1023) : ((bits.u << 1) ? -1022 : 0);
+    buf[count++] = 'p';
+    buf[count++] = (power < 0) ? '-' : '+';
+    do_write_chars(ctx, buf, count);
+    do_write_int(ctx, (power < 0) ? -power : power);
 }
 
 static void do_write_comment_tag(struct codegen_ctx *ctx, const char *name) {
-    do_write_str(ctx, "// ");
+    if (ctx->flags & ML_CODEGEN_FLAG_COMPACT)
+        return;
+
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("// "));
 
     int count = name ? strlen(name) : 0;
     int spaced = count ? (count + 2) : 0;
     if (spaced + 2 > ML_CODEGEN_SECTION_COMMENT_WIDTH) {
-        do_write_str(ctx, name);
+        do_write_chars(ctx, name, count);
     } else {
         int offset = 0;
-        char buf[ML_CODEGEN_SECTION_COMMENT_WIDTH + 1];
+        char buf[ML_CODEGEN_SECTION_COMMENT_WIDTH];
 
         int left = (ML_CODEGEN_SECTION_COMMENT_WIDTH - spaced) / 2;
         int right = ML_CODEGEN_SECTION_COMMENT_WIDTH - spaced - left;
@@ -119,32 +636,658 @@ static void do_write_comment_tag(struct codegen_ctx *ctx, const char *name) {
             offset += right;
         }
 
-        buf[ML_CODEGEN_SECTION_COMMENT_WIDTH] = 0;
-        do_write_str(ctx, buf);
+        do_write_chars(ctx, buf, ML_CODEGEN_SECTION_COMMENT_WIDTH);
     }
 
     do_write_newline(ctx);
 }
 
-static void do_write_framework(struct codegen_ctx *ctx) {
-    do_write_line(ctx, "#include <stdio.h>");
-    do_write_line(ctx, "#include <stdlib.h>");
-    do_write_line(ctx, "#include <math.h>");
+static void do_write_runtime_storage(struct codegen_ctx *ctx, bool exported) {
+    if (!exported)
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("static "));
+}
+
+static void do_write_thread_storage(struct codegen_ctx *ctx) {
+    if (ctx->flags & ML_CODEGEN_FLAG_SHARD)
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("static _Thread_local "));
+    else
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("static "));
+}
+
+static void do_write_runtime(struct codegen_ctx *ctx, bool exported) {
+    // the same text as printf() with "%.0f" for integral values and "%.6f" for the others,
+    // but formatted by hand into a large buffer, which is written at exit or when it is full
+    // fractions are rounded half to even on the exact binary value, so at most 60 fraction bits are handled here
+    // a worker of a sharded program keeps its output in its shard, which is written after the previous ones
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("char ml_out_buf[65536];"));
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("int ml_out_len = 0;"));
+    do_write_newline(ctx);
+    if (ctx->flags & ML_CODEGEN_FLAG_SHARD) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("typedef struct {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("const char *begin;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("const char *end;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int (*read)(double *);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("void (*body)(void);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("char *data;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long count;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long capacity;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int status;"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("} ml_shard;"));
+        do_write_newline(ctx);
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static _Thread_local ml_shard *ml_out_shard = 0;"));
+        do_write_newline(ctx);
+    }
+    if (ctx->flags & ML_CODEGEN_FLAG_SHARED) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("typedef struct { void (*write)(void *, const char *, int); void *opaque; } ml_sink;"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static const ml_sink *ml_out_sink = 0;"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("const ml_sink *ml_module_sink = 0;"));
+        if (check_memoize_enabled(ctx))
+            do_write_line(ctx, ML_CODEGEN_LITERAL("static unsigned ml_memo_epoch = 1;"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("typedef struct { const char *name; int kind; int count; void *address; } ml_symbol;"));
+        do_write_newline(ctx);
+    }
+    do_write_runtime_storage(ctx, exported);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("void ml_flush(void) {"));
+    if (ctx->flags & ML_CODEGEN_FLAG_SHARD) {
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_out_shard) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_out_shard->count + ml_out_len > ml_out_shard->capacity) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_out_shard->capacity = ml_out_shard->capacity * 2 + ml_out_len;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_out_shard->data = realloc(ml_out_shard->data, ml_out_shard->capacity);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (!ml_out_shard->data)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            abort();"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    memcpy(ml_out_shard->data + ml_out_shard->count, ml_out_buf, ml_out_len);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_out_shard->count += ml_out_len;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_out_len = 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    }
+    if (ctx->flags & ML_CODEGEN_FLAG_SHARED) {
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_out_sink) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_out_sink->write(ml_out_sink->opaque, ml_out_buf, ml_out_len);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_out_len = 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    }
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_done = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (ml_done < ml_out_len) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    long ml_n = (long) write(1, ml_out_buf + ml_done, ml_out_len - ml_done);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_n <= 0)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        break;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_done += (int) ml_n;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_len = 0;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_put_uint(unsigned long long ml_n, int ml_width) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("char ml_buf[24];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_i = 24;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("do {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_buf[--ml_i] = (char) ('0' + ml_n % 10);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_n /= 10;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("} while (ml_n || 24 - ml_i < ml_width);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (ml_i < 24)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_out_buf[ml_out_len++] = ml_buf[ml_i++];"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_runtime_storage(ctx, exported);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("void ml_print(double ml_val) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_bits ml_b = { ml_val };"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_field = (int) ((ml_b.u >> 52) & 0x7ff);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("unsigned long long ml_mant = (ml_b.u & 0xfffffffffffffULL) | (ml_field ? 0x10000000000000ULL : 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_shift = ml_mant ? ((ml_field ? ml_field : 1) - 1075) : 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_out_len + 512 > (int) sizeof(ml_out_buf))"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_flush();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_field == 0x7ff || ml_shift > 10 || ml_shift < -60) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_frac = (ml_field == 0x7ff) ? (ml_mant != 0x10000000000000ULL) : (ml_shift < 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_out_len += snprintf(ml_out_buf + ml_out_len, 512, ml_frac ? \"%.6f\\n\" : \"%.0f\\n\", ml_val);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_b.u >> 63)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_out_buf[ml_out_len++] = '-';"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_shift >= 0) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_put_uint(ml_mant << ml_shift, 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("} else {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    unsigned long long ml_mask = (1ULL << -ml_shift) - 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    unsigned long long ml_int = ml_mant >> -ml_shift;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    unsigned long long ml_frac = ml_mant & ml_mask;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    unsigned long long ml_digits = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_i = 0; ml_i < 6; ml_i++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_frac *= 10;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_digits = ml_digits * 10 + (ml_frac >> -ml_shift);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_frac &= ml_mask;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_frac) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        unsigned long long ml_half = 1ULL << (-ml_shift - 1);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_frac > ml_half || (ml_frac == ml_half && (ml_digits & 1)))"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            ml_digits++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_digits == 1000000) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_digits = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_int++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_put_uint(ml_int, 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_mant & ml_mask) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_out_buf[ml_out_len++] = '.';"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_put_uint(ml_digits, 6);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_buf[ml_out_len++] = '\\n';"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+
+    do_write_runtime_storage(ctx, exported);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("double ml_parse_arg(int ml_i, char **ml_argv, int ml_argc) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return (ml_i + 1 < ml_argc) ? strtod(ml_argv[ml_i + 1], 0) : 0;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_runtime_includes(struct codegen_ctx *ctx) {
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#include <stdio.h>"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#include <stdlib.h>"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#include <unistd.h>"));
+    if (ctx->flags & ML_CODEGEN_FLAG_FORK_SERVER) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <string.h>"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <sys/socket.h>"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <sys/wait.h>"));
+    }
+    if (ctx->flags & ML_CODEGEN_FLAG_SHARD) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <string.h>"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <fcntl.h>"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <pthread.h>"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <sys/mman.h>"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <sys/stat.h>"));
+    }
+    if (check_profile_enabled(ctx))
+        do_write_line(ctx, ML_CODEGEN_LITERAL("#include <time.h>"));
+    do_write_newline(ctx);
+    do_write_newline(ctx);
+}
+
+static void do_write_runtime_prototypes(struct codegen_ctx *ctx) {
+    // the only library functions used by the runtime, which are much cheaper to parse than their headers
+    do_write_line(ctx, ML_CODEGEN_LITERAL("int snprintf(char *, __SIZE_TYPE__, const char *, ...);"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("double strtod(const char *, char **);"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("long write(int, const void *, __SIZE_TYPE__);"));
+}
+
+static void do_write_memo_helpers(struct codegen_ctx *ctx) {
+    if (check_memoize_enabled(ctx)) {
+        // memo keys are compared by bit patterns, so NaNs and signed zeros are told apart
+        // the header is shared by units without memoized functions, so inline keeps them quiet
+        const char *storage = ctx->split ? "static inline " : "static ";
+        do_write_newline(ctx);
+        do_write_str(ctx, storage);
+        do_write_line(ctx, ML_CODEGEN_LITERAL("unsigned long long ml_memo_hash(unsigned long long ml_hash, double ml_val) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_bits ml_b = { ml_val };"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_hash = (ml_hash ^ ml_b.u) * 0x100000001b3ULL;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_hash ^ (ml_hash >> 32);"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+        do_write_newline(ctx);
+        do_write_str(ctx, storage);
+        do_write_line(ctx, ML_CODEGEN_LITERAL("int ml_memo_equal(double ml_a, double ml_b) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_bits ml_x = { ml_a };"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_bits ml_y = { ml_b };"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_x.u == ml_y.u;"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    }
+}
+
+static void do_write_batch_runtime(struct codegen_ctx *ctx) {
+    // rows are evaluated together in the lanes of a vector as wide as the target allows, or one by one
+    // values printed for the rows are kept in order, and printed row by row once all of them are done
+    // they are kept on the heap, which only guarantees the alignment of a double for vectors wider than 16 bytes
+    // a line of comma separated values is one row, and a line longer than the input buffer is rejected,
+    // so the program exits with status 1 once the rows before it are printed
+    // rows of the binary input are doubles in the native byte order, one for each argument up to the largest
+    if (!(ctx->flags & ML_CODEGEN_FLAG_SHARD)) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("void *realloc(void *, __SIZE_TYPE__);"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("void free(void *);"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("void abort(void);"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("long read(int, void *, __SIZE_TYPE__);"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("double strtod(const char *, char **);"));
+        do_write_newline(ctx);
+    }
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#if defined(__GNUC__) && !defined(__TINYC__)"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#if defined(__AVX512F__)"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#define ML_LANES 8"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#elif defined(__AVX__)"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#define ML_LANES 4"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#else"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#define ML_LANES 2"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#endif"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef double ml_vec __attribute__((vector_size(ML_LANES * 8)));"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef ml_vec ml_vec_u __attribute__((aligned(8)));"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#else"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#define ML_LANES 1"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef double ml_vec;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef double ml_vec_u;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#endif"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("#define ML_V(ml_x) ((ml_vec) {0} + (ml_x))"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef union { ml_vec v; double d[ML_LANES]; } ml_lanes;"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_width = 1;"));
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("double *ml_cells = 0;"));
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("ml_vec_u *ml_rec = 0;"));
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("int ml_rec_len = 0;"));
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("int ml_rec_cap = 0;"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_batch_print(ml_vec ml_val) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_rec_len == ml_rec_cap) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_rec_cap = ml_rec_cap ? ml_rec_cap * 2 : 64;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_rec = realloc(ml_rec, sizeof(ml_vec_u) * ml_rec_cap);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (!ml_rec)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        abort();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_rec[ml_rec_len++] = ml_val;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static ml_vec ml_batch_load(int ml_i) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_lanes ml_l;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("for (int ml_k = 0; ml_k < ML_LANES; ml_k++)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_l.d[ml_k] = ml_cells[ml_k * ml_width + ml_i];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_l.v;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    if (!(ctx->flags & ML_CODEGEN_FLAG_SHARD)) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static char ml_in_buf[65537];"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_in_pos = 0;"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_in_len = 0;"));
+        do_write_newline(ctx);
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_batch_read_line(double *ml_row) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (1) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_end = ml_in_pos;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    while (1) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        while (ml_end < ml_in_len && ml_in_buf[ml_end] != '\\n')"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            ml_end++;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_end < ml_in_len)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            break;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_in_pos == 0 && ml_in_len == 65536)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            return -1;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        for (int ml_i = ml_in_pos; ml_i < ml_in_len; ml_i++)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            ml_in_buf[ml_i - ml_in_pos] = ml_in_buf[ml_i];"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_in_len -= ml_in_pos;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_end -= ml_in_pos;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_in_pos = 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        long ml_n = read(0, ml_in_buf + ml_in_len, 65536 - ml_in_len);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_n <= 0)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            break;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_in_len += (int) ml_n;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_in_pos == ml_in_len)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        return 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    char *ml_p = ml_in_buf + ml_in_pos;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_in_buf[ml_end] = 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_in_pos = ml_end + (ml_end < ml_in_len);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (*ml_p == 0 || *ml_p == '\\r')"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        continue;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_i = 0; ml_i < ml_width; ml_i++)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_row[ml_i] = 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_i = 0; ml_i < ml_width && *ml_p; ml_i++) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_row[ml_i] = strtod(ml_p, 0);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        while (*ml_p && *ml_p++ != ',')"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            ;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return 1;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+        do_write_newline(ctx);
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_batch_read_binary(double *ml_row) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long ml_done = 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long ml_size = (long) sizeof(double) * ml_width;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (ml_done < ml_size) {"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    long ml_n = read(0, (char *) ml_row + ml_done, ml_size - ml_done);"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_n <= 0)"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        return 0;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_done += ml_n;"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return 1;"));
+        do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+        do_write_newline(ctx);
+    }
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_batch_run(int (*ml_read)(double *), void (*ml_body)(void)) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_cells = realloc(0, sizeof(double) * ML_LANES * ml_width);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (!ml_cells)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    abort();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_status = 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (ml_status > 0) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_n = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    while (ml_n < ML_LANES && (ml_status = ml_read(ml_cells + ml_n * ml_width)) > 0)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_n++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (!ml_n)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        break;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_i = ml_n * ml_width; ml_i < ML_LANES * ml_width; ml_i++)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_cells[ml_i] = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_rec_len = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_body();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_k = 0; ml_k < ml_n; ml_k++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        for (int ml_i = 0; ml_i < ml_rec_len; ml_i++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            ml_lanes ml_l = { ml_rec[ml_i] };"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            ml_print(ml_l.d[ml_k]);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_flush();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("free(ml_cells);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("free(ml_rec);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_rec = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_rec_cap = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_status < 0;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_shard_runtime(struct codegen_ctx *ctx) {
+    // the mapped input is cut into one range of whole rows for each thread, and the first range is run
+    // by the main thread straight to the output, while the others are written in order once joined
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("const char *ml_in_ptr = 0;"));
+    do_write_thread_storage(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("const char *ml_in_end = 0;"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_shard_read_line(double *ml_row) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("char ml_line[65537];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (ml_in_ptr < ml_in_end) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_n = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    while (ml_in_ptr < ml_in_end && *ml_in_ptr != '\\n') {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_n == 65536)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            return -1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_line[ml_n++] = *ml_in_ptr++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_in_ptr += (ml_in_ptr < ml_in_end);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_line[ml_n] = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    char *ml_p = ml_line;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (*ml_p == 0 || *ml_p == '\\r')"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        continue;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_i = 0; ml_i < ml_width; ml_i++)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_row[ml_i] = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_i = 0; ml_i < ml_width && *ml_p; ml_i++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_row[ml_i] = strtod(ml_p, 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        while (*ml_p && *ml_p++ != ',')"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            ;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return 0;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_shard_read_binary(double *ml_row) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long ml_size = (long) sizeof(double) * ml_width;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_in_end - ml_in_ptr < ml_size)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("memcpy(ml_row, ml_in_ptr, ml_size);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_in_ptr += ml_size;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return 1;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void *ml_shard_worker(void *ml_p) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_shard *ml_s = ml_p;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_shard = ml_s->data ? ml_s : 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_in_ptr = ml_s->begin;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_in_end = ml_s->end;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_s->status = ml_batch_run(ml_s->read, ml_s->body);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_shard = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return 0;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_shard_main(int ml_argc, char **ml_argv, void (*ml_body)(void)) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("struct stat ml_st;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_fd = (ml_argc > 3) ? open(ml_argv[2], O_RDONLY) : -1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_fd < 0 || fstat(ml_fd, &ml_st) != 0)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long ml_size = (long) ml_st.st_size;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("const char *ml_data = ml_size ? mmap(0, ml_size, PROT_READ, MAP_PRIVATE, ml_fd, 0) : \"\";"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("close(ml_fd);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_data == MAP_FAILED)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_binary = (ml_argv[1][0] == 'b');"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long ml_row = ml_binary ? (long) sizeof(double) * ml_width : 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long ml_count = atol(ml_argv[3]);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_count > ml_size / ml_row)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_count = ml_size / ml_row;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_count > 64)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_count = 64;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_count < 1)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_count = 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_shard ml_shards[64];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("long ml_begin = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("for (long ml_i = 0; ml_i < ml_count; ml_i++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    long ml_end = (ml_i + 1 < ml_count) ? ml_size / ml_row * (ml_i + 1) / ml_count * ml_row : ml_size;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_end < ml_begin)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_end = ml_begin;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    while (!ml_binary && ml_end > 0 && ml_end < ml_size && ml_data[ml_end - 1] != '\\n')"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_end++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_shards[ml_i] = (ml_shard) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_data + ml_begin, ml_data + ml_end, ml_binary ? ml_shard_read_binary : ml_shard_read_line, ml_body, 0, 0, 0,"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    };"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_begin = ml_end;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("pthread_t ml_threads[64];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_started[64] = {0};"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("for (long ml_i = 1; ml_i < ml_count; ml_i++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_shards[ml_i].capacity = 65536;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_shards[ml_i].data = realloc(0, ml_shards[ml_i].capacity);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (!ml_shards[ml_i].data)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        abort();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_started[ml_i] = (pthread_create(&ml_threads[ml_i], 0, ml_shard_worker, &ml_shards[ml_i]) == 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_shard_worker(&ml_shards[0]);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_failed = ml_shards[0].status;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("for (long ml_i = 1; ml_i < ml_count; ml_i++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_started[ml_i])"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        pthread_join(ml_threads[ml_i], 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    else if (!ml_failed)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_shard_worker(&ml_shards[ml_i]);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (long ml_done = 0; !ml_failed && ml_done < ml_shards[ml_i].count;) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        long ml_n = (long) write(1, ml_shards[ml_i].data + ml_done, ml_shards[ml_i].count - ml_done);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_n <= 0)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            break;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_done += ml_n;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_failed = ml_failed || ml_shards[ml_i].status;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    free(ml_shards[ml_i].data);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_failed;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_profile_name(void *opaque,
+                                  enum ml_compile_visit_event event,
+                                  const union ml_compile_visit_data *data) {
+    // e.g. ", \"func\""
+    struct codegen_ctx *ctx = opaque;
+    if (event == ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START) {
+        do_write_chars(ctx, ML_CODEGEN_LITERAL(", \""));
+        do_write_str(ctx, data->func.name);
+        do_write_char(ctx, '"');
+    }
+}
+
+static void do_write_profile_runtime(struct codegen_ctx *ctx) {
+    // every call is counted and timed by the wrapper of its function, and the time of its callees is taken
+    // from its own, while a recursive call only adds to the total of the outermost one
+    // call paths are kept as a tree for the collapsed stacks, and calls deeper than the stack or off a full tree
+    // are timed as part of their callers, with main() as the root of both
+    if (!check_profile_enabled(ctx))
+        return;
+
+    int count = ml_compile_get_func_count(ctx->compile) + 1;
+    do_write_newline(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("#define ML_PROF_DEPTH "));
+    do_write_int(ctx, ML_CODEGEN_PROFILE_MAX_DEPTH);
+    do_write_newline(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("#define ML_PROF_NODES "));
+    do_write_int(ctx, ML_CODEGEN_PROFILE_MAX_NODES);
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef struct { unsigned long long calls, self, total; int active, depth; } ml_prof_func;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef struct { int parent, func; unsigned long long self; } ml_prof_node;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef struct { int node; unsigned long long start, child; } ml_prof_frame;"));
+    do_write_newline(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static const char *const ml_prof_names[] = { \"main\""));
+    ml_compile_accept(ctx->compile, ctx, do_write_profile_name);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(" };"));
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static const char ml_prof_path[] = "));
+    do_write_quoted(ctx, ctx->profile_path ? ctx->profile_path : ML_CODEGEN_PROFILE_PATH);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static ml_prof_func ml_prof["));
+    do_write_int(ctx, count);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("];"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static ml_prof_node ml_prof_nodes[ML_PROF_NODES];"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_prof_links[ML_PROF_NODES * 2];"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_prof_node_count = 1;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static ml_prof_frame ml_prof_frames[ML_PROF_DEPTH];"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_prof_depth = 0;"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static unsigned long long ml_prof_now(void) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("struct timespec ml_ts;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("clock_gettime(CLOCK_MONOTONIC, &ml_ts);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return (unsigned long long) ml_ts.tv_sec * 1000000000ULL + (unsigned long long) ml_ts.tv_nsec;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
     do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_prof_node_of(int ml_parent, int ml_func) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("unsigned ml_h = ((unsigned) ml_parent * 31 + (unsigned) ml_func) % (ML_PROF_NODES * 2);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (ml_prof_links[ml_h]) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_n = ml_prof_links[ml_h] - 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_prof_nodes[ml_n].parent == ml_parent && ml_prof_nodes[ml_n].func == ml_func)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        return ml_n;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_h = (ml_h + 1) % (ML_PROF_NODES * 2);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_prof_node_count == ML_PROF_NODES)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return ml_parent;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_nodes[ml_prof_node_count] = (ml_prof_node) { ml_parent, ml_func, 0 };"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_links[ml_h] = ++ml_prof_node_count;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_prof_node_count - 1;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
     do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_prof_enter(int ml_func) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof[ml_func].calls++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof[ml_func].active++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_prof_depth > ml_prof[ml_func].depth)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_prof[ml_func].depth = ml_prof_depth;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_prof_depth < ML_PROF_DEPTH) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_prof_frame *ml_f = &ml_prof_frames[ml_prof_depth];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_f->node = ml_prof_node_of(ml_prof_frames[ml_prof_depth - 1].node, ml_func);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_f->child = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_f->start = ml_prof_now();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_depth++;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_prof_leave(int ml_func) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof[ml_func].active--;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (--ml_prof_depth >= ML_PROF_DEPTH)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_frame *ml_f = &ml_prof_frames[ml_prof_depth];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("unsigned long long ml_total = ml_prof_now() - ml_f->start;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof[ml_func].self += ml_total - ml_f->child;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_nodes[ml_f->node].self += ml_total - ml_f->child;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (!ml_prof[ml_func].active)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_prof[ml_func].total += ml_total;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_frames[ml_prof_depth - 1].child += ml_total;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_prof_begin(void) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof[0].calls = 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_depth = 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_frames[0].start = ml_prof_now();"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_prof_order(const void *ml_a, const void *ml_b) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_x = *(const int *) ml_a;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_y = *(const int *) ml_b;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_prof[ml_x].self != ml_prof[ml_y].self)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    return (ml_prof[ml_x].self < ml_prof[ml_y].self) ? 1 : -1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_x - ml_y;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_prof_write_stack(FILE *ml_fp, int ml_n) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_n) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_prof_write_stack(ml_fp, ml_prof_nodes[ml_n].parent);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    fputc(';', ml_fp);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("fputs(ml_prof_names[ml_prof_nodes[ml_n].func], ml_fp);"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+    // functions are listed by their self time, and stacks are the ones of flamegraph.pl, e.g. "main;fib;fib 1200"
+    do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_prof_end(void) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof[0].total = ml_prof_now() - ml_prof_frames[0].start;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof[0].self = ml_prof[0].total - ml_prof_frames[0].child;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_nodes[0].self = ml_prof[0].self;"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("int ml_order["));
+    do_write_int(ctx, count);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("for (int ml_i = 0; ml_i < (int) (sizeof(ml_order) / sizeof(int)); ml_i++)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_order[ml_i] = ml_i;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("qsort(ml_order, sizeof(ml_order) / sizeof(int), sizeof(int), ml_prof_order);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("FILE *ml_fp = fopen(ml_prof_path, \"w\");"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_fp) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    fputs(\"function\\tcalls\\tself_ns\\ttotal_ns\\tmax_depth\\n\", ml_fp);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_i = 0; ml_i < (int) (sizeof(ml_order) / sizeof(int)); ml_i++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_prof_func *ml_f = &ml_prof[ml_order[ml_i]];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_f->calls)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            fprintf(ml_fp, \"%s\\t%llu\\t%llu\\t%llu\\t%d\\n\", ml_prof_names[ml_order[ml_i]],"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("                    ml_f->calls, ml_f->self, ml_f->total, ml_f->depth);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    fclose(ml_fp);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("char ml_path[4096];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("snprintf(ml_path, sizeof(ml_path), \"%s.folded\", ml_prof_path);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_fp = fopen(ml_path, \"w\");"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_fp) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    for (int ml_n = 0; ml_n < ml_prof_node_count; ml_n++) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (!ml_prof_nodes[ml_n].self)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            continue;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_prof_write_stack(ml_fp, ml_n);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        fputc(' ', ml_fp);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        fprintf(ml_fp, \"%llu\\n\", ml_prof_nodes[ml_n].self);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    fclose(ml_fp);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_runtime_declarations(struct codegen_ctx *ctx) {
+    do_write_line(ctx, ML_CODEGEN_LITERAL("void ml_flush(void);"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("void ml_print(double ml_val);"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("double ml_parse_arg(int ml_i, char **ml_argv, int ml_argc);"));
+}
+
+static void do_write_framework(struct codegen_ctx *ctx) {
+    // a prebuilt runtime only needs its declarations, so no system header is parsed
+    bool extern_runtime = check_extern_runtime(ctx);
+    if (!extern_runtime) {
+        if ((ctx->flags & ML_CODEGEN_FLAG_COMPACT) && !(ctx->flags & (ML_CODEGEN_FLAG_SHARD | ML_CODEGEN_FLAG_FORK_SERVER))
+            && !check_profile_enabled(ctx))
+            do_write_runtime_prototypes(ctx);
+        else
+            do_write_runtime_includes(ctx);
+    }
 
     do_write_comment_tag(ctx, "framework");
-    do_write_line(ctx, "static void ml_print(double ml_val) {");
-    do_write_line_indent(ctx, "double ml_int = 0;");
-    do_write_line_indent(ctx, "double ml_frac = modf(ml_val, &ml_int);");
-    do_write_line_indent(ctx, "const char *ml_fmt = (ml_frac == 0) ? \"%.0f\\n\" : \"%.6f\\n\";");
-    do_write_line_indent(ctx, "printf(ml_fmt, ml_val);");
-    do_write_line(ctx, "}");
+    do_write_line(ctx, ML_CODEGEN_LITERAL("typedef union { double d; unsigned long long u; } ml_bits;"));
     do_write_newline(ctx);
+    if (extern_runtime)
+        do_write_runtime_declarations(ctx);
+    else
+        do_write_runtime(ctx, false);
 
-    do_write_line(ctx, "static double ml_parse_arg(int ml_i, char **ml_argv, int ml_argc) {");
-    do_write_line_indent(ctx, "return (ml_i + 1 < ml_argc) ? strtod(ml_argv[ml_i + 1], NULL) : 0;");
-    do_write_line(ctx, "}");
+    if (ctx->flags & ML_CODEGEN_FLAG_BATCH) {
+        do_write_newline(ctx);
+        do_write_batch_runtime(ctx);
+        if (ctx->flags & ML_CODEGEN_FLAG_SHARD) {
+            do_write_newline(ctx);
+            do_write_shard_runtime(ctx);
+        }
+    }
+
+    do_write_memo_helpers(ctx);
+    do_write_profile_runtime(ctx);
     do_write_comment_tag(ctx, NULL);
     do_write_newline(ctx);
     do_write_newline(ctx);
@@ -153,25 +1296,25 @@ static void do_write_framework(struct codegen_ctx *ctx) {
 static void do_write_token(struct codegen_ctx *ctx, enum ml_token_type token) {
     switch (token) {
         case ML_TOKEN_TYPE_RETURN:
-            do_write_str(ctx, "return ");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("return "));
             break;
         case ML_TOKEN_TYPE_ASSIGNMENT:
-            do_write_str(ctx, " = ");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(" = "));
             break;
         case ML_TOKEN_TYPE_PLUS:
-            do_write_str(ctx, " + ");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(" + "));
             break;
         case ML_TOKEN_TYPE_MINUS:
-            do_write_str(ctx, " - ");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(" - "));
             break;
         case ML_TOKEN_TYPE_MULTIPLY:
-            do_write_str(ctx, " * ");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(" * "));
             break;
         case ML_TOKEN_TYPE_DIVIDE:
-            do_write_str(ctx, " / ");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(" / "));
             break;
         case ML_TOKEN_TYPE_COMMA:
-            do_write_str(ctx, ", ");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(", "));
             break;
         case ML_TOKEN_TYPE_PARENTHESIS_L:
             do_write_char(ctx, '(');
@@ -184,10 +1327,381 @@ static void do_write_token(struct codegen_ctx *ctx, enum ml_token_type token) {
     }
 }
 
+static bool check_memoized(struct codegen_ctx *ctx, const union ml_compile_visit_data *data) {
+    return check_memoize_enabled(ctx) && data->func.pure;
+}
+
+static void do_write_value_type(struct codegen_ctx *ctx) {
+    if (ctx->flags & ML_CODEGEN_FLAG_BATCH)
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_vec "));
+    else
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("double "));
+}
+
+static void do_write_value_init(struct codegen_ctx *ctx) {
+    // static vectors start from zeros without an initializer
+    if (ctx->flags & ML_CODEGEN_FLAG_BATCH)
+        do_write_char(ctx, ';');
+    else
+        do_write_chars(ctx, ML_CODEGEN_LITERAL(" = 0;"));
+}
+
+static void do_write_func_head(struct codegen_ctx *ctx, const char *prefix,
+                               const union ml_compile_visit_data *data) {
+    // e.g. "double func(double a, double b)"
+    // only memoized bodies stay private to split units, because they are called by their wrappers
+    if (!ctx->split || *prefix)
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("static "));
+    do_write_value_type(ctx);
+    do_write_str(ctx, prefix);
+    do_write_name(ctx, data->func.name);
+    do_write_char(ctx, '(');
+    for (int i = 0; i < data->func.count; i++) {
+        if (i)
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(", "));
+        do_write_value_type(ctx);
+        do_write_name(ctx, data->func.params[i]);
+    }
+    do_write_char(ctx, ')');
+}
+
+static void do_write_func_signature(struct codegen_ctx *ctx, const char *prefix,
+                                    const union ml_compile_visit_data *data) {
+    do_write_func_head(ctx, prefix, data);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL(" {"));
+    do_write_newline(ctx);
+}
+
+static void do_write_func_call(struct codegen_ctx *ctx, const char *prefix,
+                               const union ml_compile_visit_data *data) {
+    // e.g. "ml_memo_raw_func(a, b)"
+    do_write_str(ctx, prefix);
+    do_write_name(ctx, data->func.name);
+    do_write_char(ctx, '(');
+    for (int i = 0; i < data->func.count; i++) {
+        if (i)
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(", "));
+        do_write_name(ctx, data->func.params[i]);
+    }
+    do_write_char(ctx, ')');
+}
+
+static void do_write_memo_key(struct codegen_ctx *ctx, int idx) {
+    // e.g. "ml_memo[ml_slot].keys[1]"
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_memo[ml_slot].keys["));
+    do_write_int(ctx, idx);
+    do_write_char(ctx, ']');
+}
+
+static void do_write_memo_wrapper(struct codegen_ctx *ctx, const char *prefix,
+                                  const union ml_compile_visit_data *data) {
+    // results of pure functions only depend on arguments, so they are cached in a direct-mapped table
+    // a function without parameters still needs one key slot to keep the declaration valid
+    // a shared object has its arguments written by the host, so an entry only holds in the epoch it was stored in
+    int count = data->func.count;
+    bool epoch = (ctx->flags & ML_CODEGEN_FLAG_SHARED);
+    do_write_func_signature(ctx, prefix, data);
+
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static struct { unsigned used; double keys["));
+    do_write_int(ctx, count ? count : 1);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("]; double value; } ml_memo["));
+    do_write_int(ctx, ML_CODEGEN_MEMO_CAPACITY);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("];"));
+
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("unsigned long long ml_hash = 0xcbf29ce484222325ULL;"));
+    for (int i = 0; i < count; i++) {
+        do_write_indent(ctx);
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_hash = ml_memo_hash(ml_hash, "));
+        do_write_name(ctx, data->func.params[i]);
+        do_write_line(ctx, ML_CODEGEN_LITERAL(");"));
+    }
+
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("int ml_slot = (int) (ml_hash % "));
+    do_write_int(ctx, ML_CODEGEN_MEMO_CAPACITY);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(");"));
+
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("if (ml_memo[ml_slot].used"));
+    if (epoch)
+        do_write_chars(ctx, ML_CODEGEN_LITERAL(" == ml_memo_epoch"));
+    for (int i = 0; i < count; i++) {
+        do_write_chars(ctx, ML_CODEGEN_LITERAL(" && ml_memo_equal("));
+        do_write_memo_key(ctx, i);
+        do_write_chars(ctx, ML_CODEGEN_LITERAL(", "));
+        do_write_name(ctx, data->func.params[i]);
+        do_write_char(ctx, ')');
+    }
+    do_write_line(ctx, ML_CODEGEN_LITERAL(")"));
+    do_write_indent(ctx);
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_memo[ml_slot].value;"));
+
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("double ml_value = "));
+    do_write_func_call(ctx, "ml_memo_raw_", data);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+    if (epoch)
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_memo[ml_slot].used = ml_memo_epoch;"));
+    else
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_memo[ml_slot].used = 1;"));
+    for (int i = 0; i < count; i++) {
+        do_write_indent(ctx);
+        do_write_memo_key(ctx, i);
+        do_write_chars(ctx, ML_CODEGEN_LITERAL(" = "));
+        do_write_name(ctx, data->func.params[i]);
+        do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+    }
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_memo[ml_slot].value = ml_value;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_value;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_profile_wrapper(struct codegen_ctx *ctx, const union ml_compile_visit_data *data) {
+    // e.g. "ml_prof_enter(1); double ml_value = ml_prof_raw_func(a, b); ml_prof_leave(1);"
+    // the wrapped function is the memo wrapper of a memoized one, so cache hits are counted as calls
+    int idx = data->func.index + 1;
+    do_write_func_signature(ctx, "", data);
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_prof_enter("));
+    do_write_int(ctx, idx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(");"));
+    do_write_indent(ctx);
+    do_write_value_type(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_value = "));
+    do_write_func_call(ctx, "ml_prof_raw_", data);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_prof_leave("));
+    do_write_int(ctx, idx);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(");"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_value;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_global_reset(void *opaque,
+                                  enum ml_compile_visit_event event,
+                                  const union ml_compile_visit_data *data) {
+    // e.g. "var = ML_V(0);" or "var = 0;"
+    struct codegen_ctx *ctx = opaque;
+    if (event == ML_COMPILE_VISIT_EVENT_GLOBAL_VISIT_VAR) {
+        do_write_indent(ctx);
+        do_write_name(ctx, data->name);
+        if (ctx->flags & ML_CODEGEN_FLAG_BATCH)
+            do_write_line(ctx, ML_CODEGEN_LITERAL(" = ML_V(0);"));
+        else
+            do_write_line(ctx, ML_CODEGEN_LITERAL(" = 0;"));
+    }
+}
+
+static void do_write_symbol_wrapper(void *opaque,
+                                    enum ml_compile_visit_event event,
+                                    const union ml_compile_visit_data *data) {
+    // e.g. "double ml_call_func(const double *ml_a, int ml_n) { return func(ml_a[0], ml_a[1]); }"
+    // the count is checked by the host when the function is looked up, and anything printed is flushed at once
+    // to the sink of the host, since a call is made outside of ml_entry()
+    struct codegen_ctx *ctx = opaque;
+    if (event != ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START)
+        return;
+
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static double ml_call_"));
+    do_write_name(ctx, data->func.name);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("(const double *ml_a, int ml_n) {"));
+    if (check_memoize_enabled(ctx))
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_memo_check();"));
+    if (!data->func.pure)
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_sink = ml_module_sink;"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("double ml_value = "));
+    do_write_name(ctx, data->func.name);
+    do_write_char(ctx, '(');
+    for (int i = 0; i < data->func.count; i++) {
+        if (i)
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(", "));
+        do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_a["));
+        do_write_int(ctx, i);
+        do_write_char(ctx, ']');
+    }
+    do_write_line(ctx, ML_CODEGEN_LITERAL(");"));
+    if (!data->func.pure) {
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("if (ml_out_len)"));
+        do_write_indent(ctx);
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_flush();"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_sink = 0;"));
+    }
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_value;"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_newline(ctx);
+}
+
+static void do_write_symbol_entry(void *opaque,
+                                  enum ml_compile_visit_event event,
+                                  const union ml_compile_visit_data *data) {
+    // e.g. "{ "func", 0, 2, (void *) ml_call_func },", kinds are the ones of ml_codegen_symbol_kind
+    struct codegen_ctx *ctx = opaque;
+    switch (event) {
+        case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START:
+            do_write_indent(ctx);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("{ \""));
+            do_write_name(ctx, data->func.name);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("\", 0, "));
+            do_write_int(ctx, data->func.count);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(", (void *) ml_call_"));
+            do_write_name(ctx, data->func.name);
+            do_write_line(ctx, ML_CODEGEN_LITERAL(" },"));
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_GLOBAL_VISIT_VAR:
+            do_write_indent(ctx);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("{ \""));
+            do_write_name(ctx, data->name);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("\", 1, 0, &"));
+            do_write_name(ctx, data->name);
+            do_write_line(ctx, ML_CODEGEN_LITERAL(" },"));
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_ARG_VISIT_INDEX:
+            do_write_indent(ctx);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("{ \"arg"));
+            do_write_int(ctx, data->index);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("\", 2, 0, &ml_arg"));
+            do_write_int(ctx, data->index);
+            do_write_line(ctx, ML_CODEGEN_LITERAL(" },"));
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void do_write_memo_arg_check(void *opaque,
+                                    enum ml_compile_visit_event event,
+                                    const union ml_compile_visit_data *data) {
+    // e.g. "if (!ml_memo_equal(ml_memo_arg2, ml_arg2)) { ml_memo_arg2 = ml_arg2; ml_memo_epoch++; }"
+    struct codegen_ctx *ctx = opaque;
+    if (event != ML_COMPILE_VISIT_EVENT_ARG_VISIT_INDEX)
+        return;
+
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static double ml_memo_arg"));
+    do_write_int(ctx, data->index);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(" = 0;"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("if (!ml_memo_equal(ml_memo_arg"));
+    do_write_int(ctx, data->index);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL(", ml_arg"));
+    do_write_int(ctx, data->index);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(")) {"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("    ml_memo_arg"));
+    do_write_int(ctx, data->index);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL(" = ml_arg"));
+    do_write_int(ctx, data->index);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_memo_epoch++;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_symbols(struct codegen_ctx *ctx) {
+    // a host looks the table up by name, like the entry
+    // pure functions read arguments, which the host may write between calls, so memo entries stored before are dropped
+    if (check_memoize_enabled(ctx)) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_memo_check(void) {"));
+        ml_compile_accept(ctx->compile, ctx, do_write_memo_arg_check);
+        do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+        do_write_newline(ctx);
+    }
+    ml_compile_accept(ctx->compile, ctx, do_write_symbol_wrapper);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("const ml_symbol ml_symbols[] = {"));
+    ml_compile_accept(ctx->compile, ctx, do_write_symbol_entry);
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("{ 0, 0, 0, 0 },"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("};"));
+}
+
+static void do_write_batch_main(struct codegen_ctx *ctx) {
+    // the first parameter tells the binary input from the text one
+    int width = ctx->batch_width ? ctx->batch_width : 1;
+    do_write_line(ctx, ML_CODEGEN_LITERAL("int main(int ml_argc, char **ml_argv) {"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_width = "));
+    do_write_int(ctx, width);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+    if (ctx->flags & ML_CODEGEN_FLAG_SHARD) {
+        // followed by the path of the rows and the number of threads
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_shard_main(ml_argc, ml_argv, ml_batch_body);"));
+    } else {
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_binary = (ml_argc > 1 && ml_argv[1][0] == 'b');"));
+        do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ml_batch_run(ml_binary ? ml_batch_read_binary : ml_batch_read_line, ml_batch_body);"));
+    }
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
+static void do_write_fork_server(struct codegen_ctx *ctx) {
+    // the program is started once, and runs in a forked child for every request on the control socket
+    // a request is the arguments separated by NULs, with the descriptor of the output attached
+    // the exit status of the child is the reply, and the server exits once the socket is closed
+    // every argument takes at least its NUL, so a request never has more arguments than bytes
+    do_write_line(ctx, ML_CODEGEN_LITERAL("int main(int ml_argc, char **ml_argv) {"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static char ml_buf["));
+    do_write_int(ctx, ML_CODEGEN_SERVER_MAX_REQUEST + 1);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("];"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("static char *ml_args["));
+    do_write_int(ctx, ML_CODEGEN_SERVER_MAX_REQUEST + 1);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("];"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("int ml_ctl = (ml_argc > 1) ? atoi(ml_argv[1]) : 3;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("while (1) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_fd = -1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    union { char ml_c[CMSG_SPACE(sizeof(int))]; struct cmsghdr ml_h; } ml_ctrl;"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("    struct iovec ml_iov = { ml_buf, "));
+    do_write_int(ctx, ML_CODEGEN_SERVER_MAX_REQUEST);
+    do_write_line(ctx, ML_CODEGEN_LITERAL(" };"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    struct msghdr ml_msg;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    memset(&ml_msg, 0, sizeof(ml_msg));"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_msg.msg_iov = &ml_iov;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_msg.msg_iovlen = 1;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_msg.msg_control = &ml_ctrl;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_msg.msg_controllen = sizeof(ml_ctrl);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    long ml_n = (long) recvmsg(ml_ctl, &ml_msg, 0);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_n <= 0)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        return 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    struct cmsghdr *ml_h = CMSG_FIRSTHDR(&ml_msg);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_h && ml_h->cmsg_level == SOL_SOCKET && ml_h->cmsg_type == SCM_RIGHTS)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        memcpy(&ml_fd, CMSG_DATA(ml_h), sizeof(int));"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_count = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_buf[ml_n] = 0;"));
+    do_write_indent(ctx);
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("    for (long ml_i = 0; ml_i < ml_n && ml_count < "));
+    do_write_int(ctx, ML_CODEGEN_SERVER_MAX_REQUEST);
+    do_write_line(ctx, ML_CODEGEN_LITERAL("; ml_i += (long) strlen(ml_buf + ml_i) + 1)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_args[ml_count++] = ml_buf + ml_i;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    ml_args[ml_count] = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    pid_t ml_pid = fork();"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_pid == 0) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        close(ml_ctl);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        if (ml_fd >= 0 && ml_fd != 1) {"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            dup2(ml_fd, 1);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("            close(ml_fd);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        _exit(ml_main(ml_count, ml_args));"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    }"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_fd >= 0)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        close(ml_fd);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_status = 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    int ml_code = 255;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (ml_pid > 0 && waitpid(ml_pid, &ml_status, 0) == ml_pid)"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        ml_code = WIFEXITED(ml_status) ? WEXITSTATUS(ml_status) : 128 + WTERMSIG(ml_status);"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("    if (send(ml_ctl, &ml_code, sizeof(ml_code), MSG_NOSIGNAL) != sizeof(ml_code))"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("        return 0;"));
+    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("}"));
+    do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+}
+
 static void do_write_compile_data(void *opaque,
                                   enum ml_compile_visit_event event,
                                   const union ml_compile_visit_data *data) {
-    char buf[ML_CODEGEN_BUFFER_CAPACITY_NUM];
     struct codegen_ctx *ctx = opaque;
     switch (event) {
         case ML_COMPILE_VISIT_EVENT_ARG_SECTION_START:
@@ -196,11 +1710,12 @@ static void do_write_compile_data(void *opaque,
 
         case ML_COMPILE_VISIT_EVENT_ARG_VISIT_INDEX:
             // e.g. "double ml_arg4 = 0;"
-            snprintf(buf, sizeof(buf), "%d", data->index);
-            do_write_str(ctx, "static double ");
-            do_write_str(ctx, "ml_arg");
-            do_write_str(ctx, buf);
-            do_write_str(ctx, " = 0;");
+            if (!ctx->split)
+                do_write_thread_storage(ctx);
+            do_write_value_type(ctx);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_arg"));
+            do_write_int(ctx, data->index);
+            do_write_value_init(ctx);
             do_write_newline(ctx);
             break;
 
@@ -210,9 +1725,11 @@ static void do_write_compile_data(void *opaque,
 
         case ML_COMPILE_VISIT_EVENT_GLOBAL_VISIT_VAR:
             // e.g. "double var = 0;"
-            do_write_str(ctx, "static double ");
-            do_write_str(ctx, data->name);
-            do_write_str(ctx, " = 0;");
+            if (!ctx->split)
+                do_write_thread_storage(ctx);
+            do_write_value_type(ctx);
+            do_write_name(ctx, data->name);
+            do_write_value_init(ctx);
             do_write_newline(ctx);
             break;
 
@@ -229,50 +1746,111 @@ static void do_write_compile_data(void *opaque,
             break;
 
         case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START:
-            // e.g. "double func(double a, double b) {"
-            do_write_str(ctx, "static double ");
-            do_write_str(ctx, data->func.name);
-            do_write_char(ctx, '(');
-            for (int i = 0; i < data->func.count; i++) {
-                if (i)
-                    do_write_str(ctx, ", ");
-                do_write_str(ctx, "double ");
-                do_write_str(ctx, data->func.params[i]);
+            // the original body of a memoized or profiled function is renamed and called by the wrapper
+            // a recursive body calls the outermost wrapper, so it is declared first
+            do_write_source_marker(ctx, data->func.line);
+            if (check_memoized(ctx, data) || check_profile_enabled(ctx)) {
+                do_write_func_head(ctx, "", data);
+                do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+                do_write_func_signature(ctx, check_memoized(ctx, data) ? "ml_memo_raw_" : "ml_prof_raw_", data);
+            } else {
+                do_write_func_signature(ctx, "", data);
             }
-            do_write_str(ctx, ") {");
-            do_write_newline(ctx);
             break;
 
         case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_END:
-            if (!data->func.ret)
-                do_write_line_indent(ctx, "return 0;");
-            do_write_line(ctx, "}");
+            do_write_output_marker(ctx);
+            if (!data->func.ret && (ctx->flags & ML_CODEGEN_FLAG_BATCH))
+                do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return ML_V(0);"));
+            else if (!data->func.ret)
+                do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return 0;"));
+            do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+            if (check_memoized(ctx, data)) {
+                do_write_newline(ctx);
+                do_write_memo_wrapper(ctx, check_profile_enabled(ctx) ? "ml_prof_raw_" : "", data);
+            }
+            if (check_profile_enabled(ctx)) {
+                do_write_newline(ctx);
+                do_write_profile_wrapper(ctx, data);
+            }
             if (!data->func.last)
                 do_write_newline(ctx);
             break;
 
         case ML_COMPILE_VISIT_EVENT_MAIN_FUNC_SECTION_START:
-            do_write_line(ctx, "int main(int ml_argc, char **ml_argv) {");
+            if (ctx->flags & ML_CODEGEN_FLAG_BATCH) {
+                // every batch of rows starts from zeroed globals, like a separate run
+                do_write_line(ctx, ML_CODEGEN_LITERAL("static void ml_batch_body(void) {"));
+                ctx->batch_width = 0;
+                ml_compile_accept(ctx->compile, ctx, do_write_global_reset);
+            } else if (ctx->flags & ML_CODEGEN_FLAG_SHARED) {
+                // a loaded object may be called again, and every call starts from zeroed globals
+                do_write_line(ctx, ML_CODEGEN_LITERAL("int ml_entry(int ml_argc, char **ml_argv, const ml_sink *ml_out) {"));
+                do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_sink = ml_out;"));
+                if (check_memoize_enabled(ctx))
+                    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_memo_epoch++;"));
+                ml_compile_accept(ctx->compile, ctx, do_write_global_reset);
+            } else if (ctx->flags & ML_CODEGEN_FLAG_FORK_SERVER) {
+                do_write_line(ctx, ML_CODEGEN_LITERAL("static int ml_main(int ml_argc, char **ml_argv) {"));
+            } else {
+                do_write_line(ctx, ML_CODEGEN_LITERAL("int main(int ml_argc, char **ml_argv) {"));
+                if (check_profile_enabled(ctx))
+                    do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_begin();"));
+            }
             break;
 
         case ML_COMPILE_VISIT_EVENT_MAIN_FUNC_VISIT_ARG:
+            if (ctx->flags & ML_CODEGEN_FLAG_BATCH) {
+                // e.g. "ml_arg4 = ml_batch_load(4);"
+                if (data->index >= ctx->batch_width)
+                    ctx->batch_width = data->index + 1;
+                do_write_indent(ctx);
+                do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_arg"));
+                do_write_int(ctx, data->index);
+                do_write_chars(ctx, ML_CODEGEN_LITERAL(" = ml_batch_load("));
+                do_write_int(ctx, data->index);
+                do_write_chars(ctx, ML_CODEGEN_LITERAL(");"));
+                do_write_newline(ctx);
+                break;
+            }
+
             // e.g. "ml_arg4 = ml_parse_arg(4, ml_argv, ml_argc);"
-            snprintf(buf, sizeof(buf), "%d", data->index);
             do_write_indent(ctx);
-            do_write_str(ctx, "ml_arg");
-            do_write_str(ctx, buf);
-            do_write_str(ctx, " = ml_parse_arg(");
-            do_write_str(ctx, buf);
-            do_write_str(ctx, ", ml_argv, ml_argc);");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_arg"));
+            do_write_int(ctx, data->index);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(" = ml_parse_arg("));
+            do_write_int(ctx, data->index);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(", ml_argv, ml_argc);"));
             do_write_newline(ctx);
             break;
 
         case ML_COMPILE_VISIT_EVENT_MAIN_FUNC_SECTION_END:
-            do_write_line_indent(ctx, "return EXIT_SUCCESS;");
-            do_write_line(ctx, "}");
+            do_write_output_marker(ctx);
+            if (ctx->flags & ML_CODEGEN_FLAG_BATCH) {
+                do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+                do_write_newline(ctx);
+                do_write_batch_main(ctx);
+                break;
+            }
+            do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_flush();"));
+            if (ctx->flags & ML_CODEGEN_FLAG_SHARED)
+                do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_out_sink = 0;"));
+            if (check_profile_enabled(ctx))
+                do_write_line_indent(ctx, ML_CODEGEN_LITERAL("ml_prof_end();"));
+            do_write_line_indent(ctx, ML_CODEGEN_LITERAL("return 0;"));
+            do_write_line(ctx, ML_CODEGEN_LITERAL("}"));
+            if (ctx->flags & ML_CODEGEN_FLAG_FORK_SERVER) {
+                do_write_newline(ctx);
+                do_write_fork_server(ctx);
+            }
+            if (ctx->flags & ML_CODEGEN_FLAG_SHARED) {
+                do_write_newline(ctx);
+                do_write_symbols(ctx);
+            }
             break;
 
         case ML_COMPILE_VISIT_EVENT_STATEMENT_START:
+            do_write_source_marker(ctx, data->location.line);
             do_write_indent(ctx);
             break;
 
@@ -282,27 +1860,35 @@ static void do_write_compile_data(void *opaque,
             break;
 
         case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_PRINT_START:
-            do_write_str(ctx, "ml_print(");
+            if (ctx->flags & ML_CODEGEN_FLAG_BATCH)
+                do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_batch_print("));
+            else
+                do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_print("));
             break;
 
         case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_PRINT_END:
-            do_write_str(ctx, ")");
+            do_write_chars(ctx, ML_CODEGEN_LITERAL(")"));
             break;
 
         case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_ARG:
             // e.g. "ml_arg4"
-            snprintf(buf, sizeof(buf), "%d", data->index);
-            do_write_str(ctx, "ml_arg");
-            do_write_str(ctx, buf);
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("ml_arg"));
+            do_write_int(ctx, data->index);
             break;
 
         case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_NUMBER:
-            snprintf(buf, sizeof(buf), "%a", data->number);
-            do_write_str(ctx, buf);
+            // e.g. "ML_V(0x1.8p+1)", every operand is a vector, so no expression is left as a scalar
+            if (ctx->flags & ML_CODEGEN_FLAG_BATCH) {
+                do_write_chars(ctx, ML_CODEGEN_LITERAL("ML_V("));
+                do_write_number(ctx, data->number);
+                do_write_char(ctx, ')');
+            } else {
+                do_write_number(ctx, data->number);
+            }
             break;
 
         case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_SYMBOL:
-            do_write_str(ctx, data->name);
+            do_write_name(ctx, data->name);
             break;
 
         case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_TOKEN:
@@ -311,35 +1897,421 @@ static void do_write_compile_data(void *opaque,
     }
 }
 
-bool ml_codegen_export_file(struct ml_compile_ctx *compile, const char *path) {
-    FILE *file = fopen(path, "wb");
-    if (!file)
+static void do_write_header_data(void *opaque,
+                                 enum ml_compile_visit_event event,
+                                 const union ml_compile_visit_data *data) {
+    // every symbol shared between split units, e.g. "extern double var;" or "double func(double a);"
+    struct codegen_ctx *ctx = opaque;
+    switch (event) {
+        case ML_COMPILE_VISIT_EVENT_ARG_VISIT_INDEX:
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("extern double ml_arg"));
+            do_write_int(ctx, data->index);
+            do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_GLOBAL_VISIT_VAR:
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("extern double "));
+            do_write_name(ctx, data->name);
+            do_write_line(ctx, ML_CODEGEN_LITERAL(";"));
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START:
+            do_write_chars(ctx, ML_CODEGEN_LITERAL("double "));
+            do_write_name(ctx, data->func.name);
+            do_write_char(ctx, '(');
+            for (int i = 0; i < data->func.count; i++) {
+                if (i)
+                    do_write_chars(ctx, ML_CODEGEN_LITERAL(", "));
+                do_write_chars(ctx, ML_CODEGEN_LITERAL("double "));
+                do_write_name(ctx, data->func.params[i]);
+            }
+            do_write_line(ctx, ML_CODEGEN_LITERAL(");"));
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void do_write_main_unit_data(void *opaque,
+                                    enum ml_compile_visit_event event,
+                                    const union ml_compile_visit_data *data) {
+    // functions are written by their own units
+    struct codegen_unit_filter *filter = opaque;
+    switch (event) {
+        case ML_COMPILE_VISIT_EVENT_SUB_FUNC_SECTION_START:
+            filter->in_functions = true;
+            return;
+
+        case ML_COMPILE_VISIT_EVENT_SUB_FUNC_SECTION_END:
+            filter->in_functions = false;
+            return;
+
+        default:
+            if (!filter->in_functions)
+                do_write_compile_data(filter->ctx, event, data);
+            break;
+    }
+}
+
+static void do_write_unit_include(struct codegen_ctx *ctx, const char *header_name) {
+    // the name is written as it is, even in compact mode
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("#include \""));
+    do_write_flush(ctx);
+    ctx->fns->write(ctx->opaque, (char*) header_name, strlen(header_name));
+    ctx->last = 0;
+    do_write_chars(ctx, ML_CODEGEN_LITERAL("\""));
+    do_write_newline(ctx);
+}
+
+static int resolve_func_unit_count(struct ml_compile_ctx *compile, const struct ml_codegen_args *args) {
+    int count = args->unit_count;
+    if (count <= 0)
+        count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > ML_CODEGEN_PARALLEL_MAX_THREADS)
+        count = ML_CODEGEN_PARALLEL_MAX_THREADS;
+
+    int func_count = ml_compile_get_func_count(compile);
+    if (count > func_count)
+        count = func_count;
+    return (count > 0) ? count : 0;
+}
+
+static void do_write_unit(struct codegen_ctx *ctx, struct ml_compile_ctx *compile, int unit,
+                          const char *header_name, const struct ml_codegen_args *args) {
+    if (unit == ML_CODEGEN_UNIT_HEADER) {
+        do_write_line(ctx, ML_CODEGEN_LITERAL("typedef union { double d; unsigned long long u; } ml_bits;"));
+        do_write_runtime_declarations(ctx);
+        do_write_memo_helpers(ctx);
+        do_write_newline(ctx);
+        ml_compile_accept(compile, ctx, do_write_header_data);
+    } else if (unit == ML_CODEGEN_UNIT_MAIN) {
+        // the runtime is defined here, and shared by the declarations in the header
+        bool extern_runtime = check_extern_runtime(ctx);
+        if (!extern_runtime) {
+            if (ctx->flags & ML_CODEGEN_FLAG_COMPACT)
+                do_write_runtime_prototypes(ctx);
+            else
+                do_write_runtime_includes(ctx);
+        }
+        do_write_unit_include(ctx, header_name);
+        do_write_newline(ctx);
+        if (!extern_runtime) {
+            do_write_runtime(ctx, true);
+            do_write_newline(ctx);
+        }
+
+        struct codegen_unit_filter filter = {
+            .ctx = ctx,
+        };
+        ml_compile_accept(compile, &filter, do_write_main_unit_data);
+    } else {
+        // each unit takes a contiguous range of functions
+        int func_count = ml_compile_get_func_count(compile);
+        int unit_count = resolve_func_unit_count(compile, args);
+        int idx = unit - ML_CODEGEN_UNIT_FUNCTIONS;
+        int begin = (int) ((long long) func_count * idx / unit_count);
+        int end = (int) ((long long) func_count * (idx + 1) / unit_count);
+        do_write_unit_include(ctx, header_name);
+        do_write_newline(ctx);
+        for (int i = begin; i < end; i++)
+            ml_compile_accept_func(compile, i, ctx, do_write_compile_data);
+    }
+}
+
+static void do_write_outline(void *opaque,
+                             enum ml_compile_visit_event event,
+                             const union ml_compile_visit_data *data) {
+    // function bodies are written by workers, the rest is split into what comes before and after them
+    struct codegen_outline *outline = opaque;
+    if (event == ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START)
+        outline->in_functions = true;
+
+    if (outline->in_functions) {
+        if (event != ML_COMPILE_VISIT_EVENT_SUB_FUNC_SECTION_END)
+            return;
+
+        outline->in_functions = false;
+        outline->after_functions = true;
+    }
+
+    do_write_compile_data(outline->after_functions ? &outline->tail : &outline->head, event, data);
+}
+
+static void *do_write_worker(void *opaque) {
+    struct codegen_worker *worker = opaque;
+    char buffer[ML_CODEGEN_BUFFER_CAPACITY_WRITE];
+    struct codegen_ctx ctx = {
+        .buffer = buffer,
+        .offset = 0,
+        .capacity = sizeof(buffer),
+        .flags = worker->args->flags,
+        .opaque = &worker->chunk,
+        .fns = &ml_codegen_io_fns_chunk,
+    };
+
+    for (int i = worker->func_begin; i < worker->func_end; i++)
+        ml_compile_accept_func(worker->compile, i, &ctx, do_write_compile_data);
+    do_write_flush(&ctx);
+    worker->flushes = ctx.flushes;
+    worker->written = ctx.written;
+    return NULL;
+}
+
+static int resolve_worker_count(struct ml_compile_ctx *compile, const struct ml_codegen_args *args) {
+    // markers need the lines written before them, which are only known when writing serially
+    if (!(args->flags & ML_CODEGEN_FLAG_PARALLEL) || args->source_path)
+        return 0;
+
+    int count = args->thread_count;
+    if (count <= 0)
+        count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    // too few functions for each thread are not worth the overhead
+    int limit = ml_compile_get_func_count(compile) / ML_CODEGEN_PARALLEL_MIN_FUNCS;
+    if (count > limit)
+        count = limit;
+    if (count > ML_CODEGEN_PARALLEL_MAX_THREADS)
+        count = ML_CODEGEN_PARALLEL_MAX_THREADS;
+    return (count >= 2) ? count : 0;
+}
+
+static bool do_export_parallel(struct ml_compile_ctx *compile, void *opaque,
+                               const struct ml_codegen_io_fns *fns,
+                               const struct ml_codegen_args *args,
+                               int worker_count) {
+    char head_buffer[ML_CODEGEN_BUFFER_CAPACITY_WRITE];
+    char tail_buffer[ML_CODEGEN_BUFFER_CAPACITY_WRITE];
+    struct codegen_chunk head_chunk = {0};
+    struct codegen_chunk tail_chunk = {0};
+    struct codegen_outline outline = {
+        .head = {
+            .compile = compile,
+            .buffer = head_buffer,
+            .capacity = sizeof(head_buffer),
+            .flags = args->flags,
+            .profile_path = args->profile_path,
+            .opaque = &head_chunk,
+            .fns = &ml_codegen_io_fns_chunk,
+        },
+        .tail = {
+            .compile = compile,
+            .buffer = tail_buffer,
+            .capacity = sizeof(tail_buffer),
+            .flags = args->flags,
+            .opaque = &tail_chunk,
+            .fns = &ml_codegen_io_fns_chunk,
+        },
+    };
+
+    // each worker takes a contiguous range of functions, so concatenating in order keeps the serial output
+    int func_count = ml_compile_get_func_count(compile);
+    struct codegen_worker workers[ML_CODEGEN_PARALLEL_MAX_THREADS] = {0};
+    pthread_t threads[ML_CODEGEN_PARALLEL_MAX_THREADS];
+    bool started[ML_CODEGEN_PARALLEL_MAX_THREADS] = {0};
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].compile = compile;
+        workers[i].args = args;
+        workers[i].func_begin = (int) ((long long) func_count * i / worker_count);
+        workers[i].func_end = (int) ((long long) func_count * (i + 1) / worker_count);
+        started[i] = (pthread_create(&threads[i], NULL, do_write_worker, &workers[i]) == 0);
+    }
+
+    do_write_framework(&outline.head);
+    ml_compile_accept(compile, &outline, do_write_outline);
+    do_write_flush(&outline.head);
+    do_write_flush(&outline.tail);
+
+    bool succeed = !head_chunk.failed && !tail_chunk.failed;
+    for (int i = 0; i < worker_count; i++) {
+        // a worker failed to start is simply run on this thread
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            do_write_worker(&workers[i]);
+        succeed &= !workers[i].chunk.failed;
+    }
+
+    if (succeed) {
+        int iov_count = 0;
+        struct iovec iov[ML_CODEGEN_PARALLEL_MAX_THREADS + 2];
+        iov[iov_count++] = (struct iovec) { head_chunk.data, head_chunk.count };
+        for (int i = 0; i < worker_count; i++)
+            iov[iov_count++] = (struct iovec) { workers[i].chunk.data, workers[i].chunk.count };
+        iov[iov_count++] = (struct iovec) { tail_chunk.data, tail_chunk.count };
+
+        if (fns->writev) {
+            fns->writev(opaque, iov, iov_count);
+        } else {
+            for (int i = 0; i < iov_count; i++)
+                if (iov[i].iov_len)
+                    fns->write(opaque, iov[i].iov_base, iov[i].iov_len);
+        }
+
+        struct ml_memory_stats buffers = {0};
+        long long flushes = outline.head.flushes + outline.tail.flushes;
+        long long written = outline.head.written + outline.tail.written;
+        do_stats_add_chunk(&buffers, &head_chunk);
+        do_stats_add_chunk(&buffers, &tail_chunk);
+        for (int i = 0; i < worker_count; i++) {
+            do_stats_add_chunk(&buffers, &workers[i].chunk);
+            flushes += workers[i].flushes;
+            written += workers[i].written;
+        }
+        do_stats_merge(args, &buffers, flushes, written);
+    }
+
+    if (head_chunk.data)
+        ml_memory_free(head_chunk.data);
+    if (tail_chunk.data)
+        ml_memory_free(tail_chunk.data);
+    for (int i = 0; i < worker_count; i++)
+        if (workers[i].chunk.data)
+            ml_memory_free(workers[i].chunk.data);
+    return succeed;
+}
+
+bool ml_codegen_export_file(struct ml_compile_ctx *compile, const char *path,
+                            const struct ml_codegen_args *args) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    ml_codegen_export_fns(compile, (void*) (intptr_t) fd, &ml_codegen_io_fns_file, args);
+    return true;
+}
+
+bool ml_codegen_export_runtime(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    char buffer[ML_CODEGEN_BUFFER_CAPACITY_WRITE];
+    struct codegen_ctx ctx = {
+        .buffer = buffer,
+        .offset = 0,
+        .capacity = sizeof(buffer),
+        .flags = 0,
+        .opaque = (void*) (intptr_t) fd,
+        .fns = &ml_codegen_io_fns_file,
+    };
+
+    do_write_runtime_includes(&ctx);
+    do_write_line(&ctx, ML_CODEGEN_LITERAL("typedef union { double d; unsigned long long u; } ml_bits;"));
+    do_write_newline(&ctx);
+    do_write_runtime(&ctx, true);
+    do_write_flush(&ctx);
+    ctx.fns->close(ctx.opaque);
+    return true;
+}
+
+int ml_codegen_get_unit_count(struct ml_compile_ctx *compile, const struct ml_codegen_args *args) {
+    const struct ml_codegen_args *p_args = args ? args : &ml_codegen_args_default;
+    return ML_CODEGEN_UNIT_FUNCTIONS + resolve_func_unit_count(compile, p_args);
+}
+
+bool ml_codegen_export_unit_file(struct ml_compile_ctx *compile, int unit, const char *header_name,
+                                 const char *path, const struct ml_codegen_args *args) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    ml_codegen_export_unit_fns(compile, unit, header_name, (void*) (intptr_t) fd, &ml_codegen_io_fns_file, args);
+    return true;
+}
+
+void ml_codegen_export_unit_fns(struct ml_compile_ctx *compile, int unit, const char *header_name,
+                                void *opaque, const struct ml_codegen_io_fns *fns,
+                                const struct ml_codegen_args *args) {
+    const struct ml_codegen_args *p_args = args ? args : &ml_codegen_args_default;
+    // rows are only evaluated together, and calls only profiled, in a single translation file
+    char buffer[ML_CODEGEN_BUFFER_CAPACITY_WRITE];
+    struct codegen_ctx ctx = {
+        .compile = compile,
+        .buffer = buffer,
+        .offset = 0,
+        .capacity = sizeof(buffer),
+        .flags = p_args->flags & ~(ML_CODEGEN_FLAG_BATCH | ML_CODEGEN_FLAG_SHARD | ML_CODEGEN_FLAG_SHARED
+                                  | ML_CODEGEN_FLAG_FORK_SERVER | ML_CODEGEN_FLAG_PROFILE),
+        .opaque = opaque,
+        .fns = fns,
+        .split = true,
+    };
+
+    if (unit >= 0 && unit < ml_codegen_get_unit_count(compile, p_args))
+        do_write_unit(&ctx, compile, unit, header_name, p_args);
+    do_write_flush(&ctx);
+    do_stats_merge(p_args, &(struct ml_memory_stats) {0}, ctx.flushes, ctx.written);
+    fns->close(opaque);
+}
+
+bool ml_codegen_export_buffer(struct ml_compile_ctx *compile, char **buffer, int *count,
+                              const struct ml_codegen_args *args) {
+    struct codegen_chunk chunk = {0};
+    ml_codegen_export_fns(compile, &chunk, &ml_codegen_io_fns_chunk, args);
+
+    // the returned buffer is accounted separately, the export itself has been merged
+    if (args && args->stats) {
+        struct ml_memory_stats buffers = {0};
+        do_stats_add_chunk(&buffers, &chunk);
+        do_stats_merge(args, &buffers, 0, 0);
+    }
+
+    if (chunk.failed || !chunk.data) {
+        if (chunk.data)
+            ml_memory_free(chunk.data);
         return false;
+    }
 
-    ml_codegen_export_fns(compile, 0, file, &ml_codegen_io_fns_file);
+    *buffer = chunk.data;
+    *count = chunk.count;
     return true;
 }
 
-void ml_codegen_export_fns(struct ml_compile_ctx *compile, int capacity,
-                           void *opaque, const struct ml_codegen_io_fns *fns) {
+void ml_codegen_export_fns(struct ml_compile_ctx *compile, void *opaque,
+                           const struct ml_codegen_io_fns *fns,
+                           const struct ml_codegen_args *args) {
+    const struct ml_codegen_args *p_args = args;
+    if (!p_args)
+        p_args = &ml_codegen_args_default;
+
+    // nothing is written before every part is formatted, so a failure can still fall back to serial
+    int worker_count = resolve_worker_count(compile, p_args);
+    if (worker_count && do_export_parallel(compile, opaque, fns, p_args, worker_count)) {
+        fns->close(opaque);
+        return;
+    }
+
+    int capacity = p_args->buffer_capacity;
     int buffer_size = (capacity > 0) ? capacity : ML_CODEGEN_BUFFER_CAPACITY_WRITE;
     void *buffer_data = ml_memory_malloc(buffer_size);
-    if (!buffer_data)
+    if (!buffer_data) {
+        fns->close(opaque);
         return;
+    }
 
     struct codegen_ctx ctx = {
+        .compile = compile,
         .buffer = buffer_data,
         .offset = 0,
         .capacity = buffer_size,
+        .flags = p_args->flags,
         .opaque = opaque,
         .fns = fns,
+        .source_path = p_args->source_path,
+        .output_path = p_args->output_path,
+        .profile_path = p_args->profile_path,
     };
 
+    // the translation may be written somewhere else first, so even the runtime is marked
+    do_write_output_marker(&ctx);
     do_write_framework(&ctx);
     ml_compile_accept(compile, &ctx, do_write_compile_data);
     do_write_flush(&ctx);
 
+    struct ml_memory_stats buffers = {0};
+    do_stats_add_buffer(&buffers, ctx.written < buffer_size ? ctx.written : buffer_size, buffer_size, 0);
+    do_stats_merge(p_args, &buffers, ctx.flushes, ctx.written);
     ml_memory_free(buffer_data);
     ctx.fns->close(ctx.opaque);
 }
-
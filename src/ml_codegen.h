@@ -1,15 +1,100 @@
 #pragma once
 
+#include "ml_memory.h"
+
+#include <stdint.h>
 #include <stdbool.h>
 
+struct iovec;
 struct ml_compile_ctx;
 
+enum ml_codegen_flag {
+    ML_CODEGEN_FLAG_MEMOIZE = 1,
+    ML_CODEGEN_FLAG_PARALLEL = 1 << 1,
+    ML_CODEGEN_FLAG_EXTERN_RUNTIME = 1 << 2,
+    ML_CODEGEN_FLAG_COMPACT = 1 << 3,
+    ML_CODEGEN_FLAG_BATCH = 1 << 4,
+    ML_CODEGEN_FLAG_SHARD = 1 << 5,
+    ML_CODEGEN_FLAG_SHARED = 1 << 6,
+    ML_CODEGEN_FLAG_FORK_SERVER = 1 << 7,
+    ML_CODEGEN_FLAG_PROFILE = 1 << 8,
+};
+
+enum ml_codegen_unit {
+    ML_CODEGEN_UNIT_HEADER,
+    ML_CODEGEN_UNIT_MAIN,
+    ML_CODEGEN_UNIT_FUNCTIONS,
+};
+
+// buffers are the heap memory used for staging and reordering the output
+struct ml_codegen_stats {
+    long long flushes;
+    long long bytes;
+    struct ml_memory_stats buffers;
+};
+
+// taken by ml_entry() of a shared object, which prints here instead of its standard output
+struct ml_codegen_sink {
+    void (*write)(void *opaque, const char *buf, int n);
+    void *opaque;
+};
+
+typedef int (*ml_codegen_entry_fn)(int argc, char **argv, const struct ml_codegen_sink *sink);
+
+enum ml_codegen_symbol_kind {
+    ML_CODEGEN_SYMBOL_FUNC,
+    ML_CODEGEN_SYMBOL_GLOBAL,
+    ML_CODEGEN_SYMBOL_ARG,
+};
+
+// an entry of ml_symbols[] of a shared object, which ends with a null name
+// a function is called through a wrapper taking its arguments as an array, and a variable is its address
+struct ml_codegen_symbol {
+    const char *name;
+    int kind;
+    int param_count;
+    void *address;
+};
+
+typedef double (*ml_codegen_func_fn)(const double *args, int n);
+
+struct ml_codegen_args {
+    int buffer_capacity;
+    int thread_count;
+    uint32_t flags;
+    int unit_count;
+    struct ml_codegen_stats *stats;
+    // statements of a single translation are marked with "#line" directives pointing to the ml file,
+    // and the code following them points back to the translation itself, if it is kept at the output path
+    const char *source_path;
+    const char *output_path;
+    // a profiled program writes its report here at exit, and its call stacks to the same path with ".folded"
+    const char *profile_path;
+};
+
 struct ml_codegen_io_fns {
     int (*write)(void *opaque, char *buffer, int count);
+    int (*writev)(void *opaque, struct iovec *iov, int count);
     void (*close)(void *opaque);
 };
 
-bool ml_codegen_export_file(struct ml_compile_ctx *compile, const char *path);
+bool ml_codegen_export_file(struct ml_compile_ctx *compile, const char *path,
+                            const struct ml_codegen_args *args);
+
+bool ml_codegen_export_runtime(const char *path);
+
+bool ml_codegen_export_buffer(struct ml_compile_ctx *compile, char **buffer, int *count,
+                              const struct ml_codegen_args *args);
+
+int ml_codegen_get_unit_count(struct ml_compile_ctx *compile, const struct ml_codegen_args *args);
+
+bool ml_codegen_export_unit_file(struct ml_compile_ctx *compile, int unit, const char *header_name,
+                                 const char *path, const struct ml_codegen_args *args);
+
+void ml_codegen_export_unit_fns(struct ml_compile_ctx *compile, int unit, const char *header_name,
+                                void *opaque, const struct ml_codegen_io_fns *fns,
+                                const struct ml_codegen_args *args);
 
-void ml_codegen_export_fns(struct ml_compile_ctx *compile, int capacity,
-                           void *opaque, const struct ml_codegen_io_fns *fns);
+void ml_codegen_export_fns(struct ml_compile_ctx *compile, void *opaque,
+                           const struct ml_codegen_io_fns *fns,
+                           const struct ml_codegen_args *args);
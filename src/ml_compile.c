@@ -1,68 +1,12 @@
 #include "ml_compile.h"
 #include "ml_memory.h"
 #include "ml_token.h"
+#include "ml_list.h"
+#include "ml_allocator.h"
 
 #include <stdint.h>
 #include <string.h>
 
-#define ML_LIST_DECLARE_BASE(type, name)                                    \
-    struct ml_list_##name {                                                 \
-        type *base;                                                         \
-        int count;                                                          \
-        int capacity;                                                       \
-    };                                                                      \
-                                                                            \
-    static bool list_init_##name(struct ml_list_##name *p, int capacity) {  \
-        void *mem = ml_memory_malloc(capacity * sizeof(type));              \
-        if (!mem)                                                           \
-            return false;                                                   \
-        *p = (struct ml_list_##name) {mem, 0, capacity};                    \
-        return true;                                                        \
-    }                                                                       \
-                                                                            \
-    static void list_uninit_##name(struct ml_list_##name *p) {              \
-        if (!p)                                                             \
-            return;                                                         \
-        ml_memory_free(p->base);                                            \
-        *p = (struct ml_list_##name) {0};                                   \
-    }                                                                       \
-
-#define ML_LIST_DECLARE_GROW(type, name)                                    \
-    static bool list_grow_##name(struct ml_list_##name *p, int n) {         \
-        int req_capacity = p->count + n;                                    \
-        if (req_capacity > p->capacity) {                                   \
-            int new_capacity = p->capacity;                                 \
-            while (new_capacity >= req_capacity)                            \
-                new_capacity <<= 1;                                         \
-            size_t new_size = new_capacity * sizeof(type);                  \
-            void *new_base = ml_memory_realloc(p->base, new_size);          \
-            if (!new_base)                                                  \
-                return false;                                               \
-            p->base = new_base;                                             \
-            p->capacity = new_capacity;                                     \
-        }                                                                   \
-        return true;                                                        \
-    }                                                                       \
-
-#define ML_LIST_DECLARE_APPEND(type, name)                                  \
-    static bool list_append_##name(struct ml_list_##name *p,                \
-                                   const type *v) {                         \
-        if (!list_grow_##name(p, 1))                                        \
-            return false;                                                   \
-        p->base[p->count] = *v;                                             \
-        p->count++;                                                         \
-        return true;                                                        \
-    }                                                                       \
-
-#define ML_LIST_DECLARE_FILL(type, name)                                    \
-    static bool list_fill_##name(struct ml_list_##name *p,                  \
-                                 const type *v, int n) {                    \
-        if (!list_grow_##name(p, n))                                        \
-            return false;                                                   \
-        memcpy(p->base + p->count, v, sizeof(type) * n);                    \
-        p->count += n;                                                      \
-        return true;                                                        \
-    }                                                                       \
 
 enum symbol_usage {
     SYMBOL_USAGE_NONE,
@@ -79,6 +23,7 @@ enum symbol_resolve_hint {
 
 struct symbol_entry {
     int offset;
+    int func_index;
     enum symbol_usage usage;
 };
 
@@ -90,6 +35,7 @@ enum token_entry_type {
     TOKEN_ENTRY_TYPE_TERMINATOR,
 };
 
+// the position in ml source where the token starts
 struct token_entry {
     enum token_entry_type type;
     union {
@@ -97,10 +43,14 @@ struct token_entry {
         int offset;
         enum ml_token_type type;
     } data;
+    int line;
+    int column;
 };
 
 struct func_entry {
     bool has_return;
+    bool is_pure;
+    int line;
     int name_offset;
     int param_begin;
     int param_end;
@@ -114,25 +64,31 @@ struct func_entry {
 ML_LIST_DECLARE_BASE(int, int);
 ML_LIST_DECLARE_GROW(int, int);
 ML_LIST_DECLARE_APPEND(int, int);
+ML_LIST_DECLARE_STATS(int, int);
 
 ML_LIST_DECLARE_BASE(double, double);
 ML_LIST_DECLARE_GROW(double, double);
 ML_LIST_DECLARE_APPEND(double, double);
+ML_LIST_DECLARE_STATS(double, double);
 
 ML_LIST_DECLARE_BASE(char, str);
 ML_LIST_DECLARE_GROW(char, str);
 ML_LIST_DECLARE_FILL(char, str);
+ML_LIST_DECLARE_STATS(char, str);
 
 ML_LIST_DECLARE_BASE(struct func_entry, func);
 ML_LIST_DECLARE_GROW(struct func_entry, func);
 ML_LIST_DECLARE_APPEND(struct func_entry, func);
+ML_LIST_DECLARE_STATS(struct func_entry, func);
 
 ML_LIST_DECLARE_BASE(struct symbol_entry, sym);
 ML_LIST_DECLARE_GROW(struct symbol_entry, sym);
+ML_LIST_DECLARE_STATS(struct symbol_entry, sym);
 
 ML_LIST_DECLARE_BASE(struct token_entry, token);
 ML_LIST_DECLARE_GROW(struct token_entry, token);
 ML_LIST_DECLARE_APPEND(struct token_entry, token);
+ML_LIST_DECLARE_STATS(struct token_entry, token);
 
 
 struct feed_state {
@@ -140,6 +96,8 @@ struct feed_state {
     enum ml_compile_result error;
     enum ml_token_type type;
     struct ml_token_data data;
+    int symbol_line;
+    int symbol_column;
 };
 
 enum compile_flag {
@@ -162,6 +120,7 @@ enum parse_expr_flag {
 
 struct ml_compile_ctx {
     uint32_t compile_flags;
+    const struct ml_allocator *allocator;
 
     // pack all symbol into a continuous block of memory
     // the symbol entries saving offsets are sorted by lexicographic order
@@ -176,6 +135,10 @@ struct ml_compile_ctx {
     struct ml_list_func func_list;
     struct ml_list_int param_offsets;
 
+    // names of all parameters in the order of offsets, resolved once the feeding is done
+    // visits only read them, so they never allocate and may run concurrently
+    const char **param_names;
+
     struct ml_list_token tokens_main;
     struct ml_list_token tokens_sub;
 
@@ -185,6 +148,7 @@ struct ml_compile_ctx {
 static const struct ml_compile_ctx_init_args ml_compile_ctx_init_args_default = {
     .list_default_capacity = 64,
     .symbol_chars_capacity = 4096,
+    .allocator = NULL,
 };
 
 static bool fail_on_error(struct feed_state *state, enum ml_compile_result error) {
@@ -238,6 +202,10 @@ pass:
 
 static bool symbol_ensure(struct ml_compile_ctx *ctx, struct feed_state *state,
                           enum symbol_usage usage, struct symbol_entry **entry) {
+    // a symbol token is appended after the next token is read, so its position is kept here
+    state->symbol_line = state->data.line;
+    state->symbol_column = state->data.column;
+
     int search_idx = symbol_find(ctx, state->data.buf);
     if (search_idx >= 0) {
         *entry = &ctx->symbol_entries.base[search_idx];
@@ -261,6 +229,7 @@ static bool symbol_ensure(struct ml_compile_ctx *ctx, struct feed_state *state,
     }
     ctx->symbol_entries.base[insert_idx] = (struct symbol_entry) {
         .offset = offset,
+        .func_index = -1,
         .usage = SYMBOL_USAGE_NONE,
     };
     ctx->symbol_entries.count++;
@@ -311,26 +280,28 @@ bool ml_compile_ctx_init(struct ml_compile_ctx **pp,
     if (!p_args)
         p_args = &ml_compile_ctx_init_args_default;
 
-    struct ml_compile_ctx *ctx = ml_memory_malloc(sizeof(struct ml_compile_ctx));
+    const struct ml_allocator *allocator = p_args->allocator;
+    struct ml_compile_ctx *ctx = ml_allocator_alloc(allocator, sizeof(struct ml_compile_ctx));
     if (!ctx)
         goto fail;
 
     *ctx = (struct ml_compile_ctx) {0};
-    if (!list_init_str(&ctx->symbol_chars, p_args->symbol_chars_capacity))
+    ctx->allocator = allocator;
+    if (!list_init_str(&ctx->symbol_chars, p_args->symbol_chars_capacity, allocator))
         goto fail;
-    if (!list_init_sym(&ctx->symbol_entries, p_args->list_default_capacity))
+    if (!list_init_sym(&ctx->symbol_entries, p_args->list_default_capacity, allocator))
         goto fail;
-    if (!list_init_double(&ctx->num_list, p_args->list_default_capacity))
+    if (!list_init_double(&ctx->num_list, p_args->list_default_capacity, allocator))
         goto fail;
-    if (!list_init_func(&ctx->func_list, p_args->list_default_capacity))
+    if (!list_init_func(&ctx->func_list, p_args->list_default_capacity, allocator))
         goto fail;
-    if (!list_init_int(&ctx->param_offsets, p_args->list_default_capacity))
+    if (!list_init_int(&ctx->param_offsets, p_args->list_default_capacity, allocator))
         goto fail;
-    if (!list_init_token(&ctx->tokens_main, p_args->list_default_capacity))
+    if (!list_init_token(&ctx->tokens_main, p_args->list_default_capacity, allocator))
         goto fail;
-    if (!list_init_token(&ctx->tokens_sub, p_args->list_default_capacity))
+    if (!list_init_token(&ctx->tokens_sub, p_args->list_default_capacity, allocator))
         goto fail;
-    if (!list_init_int(&ctx->arg_indexes, p_args->list_default_capacity))
+    if (!list_init_int(&ctx->arg_indexes, p_args->list_default_capacity, allocator))
         goto fail;
 
     *pp = ctx;
@@ -354,7 +325,9 @@ void ml_compile_ctx_uninit(struct ml_compile_ctx **pp) {
     list_uninit_token(&ctx->tokens_main);
     list_uninit_token(&ctx->tokens_sub);
     list_uninit_int(&ctx->arg_indexes);
-    ml_memory_free(ctx);
+    if (ctx->param_names)
+        ml_allocator_free(ctx->allocator, ctx->param_names);
+    ml_allocator_free(ctx->allocator, ctx);
     *pp = NULL;
 }
 
@@ -451,6 +424,8 @@ static bool parse_function(struct ml_compile_ctx *ctx, struct feed_state *state)
     if (!do_check_line_start(CHECK_LINE_TYPE_FUNCTION, ctx, state))
         return false;
 
+    int line = state->data.line;
+
     // function name
     if (!feed_expect_space_and_next(state, ML_TOKEN_TYPE_NAME))
         return false;
@@ -496,6 +471,8 @@ static bool parse_function(struct ml_compile_ctx *ctx, struct feed_state *state)
 
     const struct func_entry entry = {
         .has_return = false,
+        .is_pure = false,
+        .line = line,
         .name_offset = name_offset,
         .param_begin = param_begin,
         .param_end = param_end,
@@ -505,6 +482,10 @@ static bool parse_function(struct ml_compile_ctx *ctx, struct feed_state *state)
     if (!list_append_func(&ctx->func_list, &entry))
         return fail_on_no_memory(state);
 
+    // the name entry may have been moved by parameter insertions
+    const char *name = ctx->symbol_chars.base + name_offset;
+    ctx->symbol_entries.base[symbol_find(ctx, name)].func_index = ctx->func_list.count - 1;
+
     if (!do_check_line_end(CHECK_LINE_TYPE_FUNCTION, ctx, state))
         return false;
 
@@ -562,6 +543,8 @@ static bool parse_do_append_symbol_token(struct ml_compile_ctx *ctx,
     const struct token_entry token = {
         .type = TOKEN_ENTRY_TYPE_SYMBOL,
         .data = { .offset = (*symbol)->offset },
+        .line = state->symbol_line,
+        .column = state->symbol_column,
     };
     if (!list_append_token(resolve_token_list(ctx), &token))
         return fail_on_no_memory(state);
@@ -599,6 +582,8 @@ static bool parse_expression(struct ml_compile_ctx *ctx, struct feed_state *stat
                 token = (struct token_entry) {
                     .type = TOKEN_ENTRY_TYPE_ARGUMENT,
                     .data = { .index = state->data.value.index },
+                    .line = state->data.line,
+                    .column = state->data.column,
                 };
                 break;
 
@@ -610,6 +595,8 @@ static bool parse_expression(struct ml_compile_ctx *ctx, struct feed_state *stat
                 token = (struct token_entry) {
                     .type = TOKEN_ENTRY_TYPE_NUMBER,
                     .data = { .offset = ctx->num_list.count - 1 },
+                    .line = state->data.line,
+                    .column = state->data.column,
                 };
                 break;
 
@@ -651,6 +638,8 @@ static bool parse_expression(struct ml_compile_ctx *ctx, struct feed_state *stat
                 token = (struct token_entry) {
                     .type = TOKEN_ENTRY_TYPE_PLAIN,
                     .data = { .type = state->type },
+                    .line = state->data.line,
+                    .column = state->data.column,
                 };
                 break;
         }
@@ -681,7 +670,11 @@ static bool parse_expression(struct ml_compile_ctx *ctx, struct feed_state *stat
     if (!parse_do_append_symbol_token(ctx, state, &check_func, &symbol, NULL, SYMBOL_RESOLVE_HINT_VAR))
         return false;
 
-    const struct token_entry end = { .type = TOKEN_ENTRY_TYPE_TERMINATOR };
+    const struct token_entry end = {
+        .type = TOKEN_ENTRY_TYPE_TERMINATOR,
+        .line = state->data.line,
+        .column = state->data.column,
+    };
     if (!list_append_token(tokens, &end))
         return fail_on_no_memory(state);
 
@@ -696,6 +689,8 @@ static bool parse_assignment(struct ml_compile_ctx *ctx,
     const struct token_entry operand = {
         .type = TOKEN_ENTRY_TYPE_SYMBOL,
         .data = { .offset = operand_offset },
+        .line = state->symbol_line,
+        .column = state->symbol_column,
     };
     if (!list_append_token(tokens, &operand))
         return fail_on_no_memory(state);
@@ -704,6 +699,8 @@ static bool parse_assignment(struct ml_compile_ctx *ctx,
     const struct token_entry assignment = {
         .type = TOKEN_ENTRY_TYPE_PLAIN,
         .data = { .type = ML_TOKEN_TYPE_ASSIGNMENT },
+        .line = state->data.line,
+        .column = state->data.column,
     };
     if (!list_append_token(tokens, &assignment))
         return fail_on_no_memory(state);
@@ -724,6 +721,8 @@ static bool parse_instruction(struct ml_compile_ctx *ctx,
     const struct token_entry token = {
         .type = TOKEN_ENTRY_TYPE_PLAIN,
         .data = { .type = state->type },
+        .line = state->data.line,
+        .column = state->data.column,
     };
     struct ml_list_token *tokens = resolve_token_list(ctx);
     if (!list_append_token(tokens, &token))
@@ -738,12 +737,88 @@ static bool parse_instruction(struct ml_compile_ctx *ctx,
     return true;
 }
 
+static struct func_entry *resolve_called_function(struct ml_compile_ctx *ctx,
+                                                  struct token_entry *token) {
+    int idx = symbol_find(ctx, ctx->symbol_chars.base + token->data.offset);
+    struct symbol_entry *symbol = &ctx->symbol_entries.base[idx];
+    if (symbol->usage != SYMBOL_USAGE_FUNC_NAME || symbol->func_index < 0)
+        return NULL;
+    return &ctx->func_list.base[symbol->func_index];
+}
+
+static bool check_function_pure(struct ml_compile_ctx *ctx, struct func_entry *func, bool deep) {
+    for (int i = func->token_begin; i < func->token_end; i++) {
+        struct token_entry *token = &ctx->tokens_sub.base[i];
+        if (token->type == TOKEN_ENTRY_TYPE_PLAIN) {
+            // printing is an observable side effect
+            if (token->data.type == ML_TOKEN_TYPE_PRINT)
+                return false;
+        } else if (token->type == TOKEN_ENTRY_TYPE_SYMBOL) {
+            int idx = symbol_find(ctx, ctx->symbol_chars.base + token->data.offset);
+            enum symbol_usage usage = ctx->symbol_entries.base[idx].usage;
+
+            // not only assigning but also reading globals makes the result depend on hidden state
+            if (usage == SYMBOL_USAGE_GLOBAL_VAR)
+                return false;
+
+            if (usage == SYMBOL_USAGE_FUNC_NAME) {
+                struct func_entry *callee = resolve_called_function(ctx, token);
+                if (!callee || (deep && !callee->is_pure))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void do_analyze_functions(struct ml_compile_ctx *ctx) {
+    // find functions without direct side effects first
+    for (int i = 0; i < ctx->func_list.count; i++) {
+        struct func_entry *func = &ctx->func_list.base[i];
+        func->is_pure = check_function_pure(ctx, func, false);
+    }
+
+    // then propagate impurity through callers until nothing changes
+    // callees are usually defined before callers, so it takes very few rounds
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < ctx->func_list.count; i++) {
+            struct func_entry *func = &ctx->func_list.base[i];
+            if (func->is_pure && !check_function_pure(ctx, func, true)) {
+                func->is_pure = false;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool do_resolve_param_names(struct ml_compile_ctx *ctx) {
+    // symbol chars never move again after feeding, so pointers into them stay valid
+    int count = ctx->param_offsets.count;
+    if (ctx->param_names)
+        ml_allocator_free(ctx->allocator, ctx->param_names);
+    ctx->param_names = NULL;
+    if (count <= 0)
+        return true;
+
+    ctx->param_names = ml_allocator_alloc(ctx->allocator, sizeof(const char*) * count);
+    if (!ctx->param_names)
+        return false;
+
+    for (int i = 0; i < count; i++)
+        ctx->param_names[i] = ctx->symbol_chars.base + ctx->param_offsets.base[i];
+    return true;
+}
+
 enum ml_compile_result ml_compile_feed(struct ml_compile_ctx *ctx, struct ml_token_ctx *token) {
     struct feed_state state = {
         .ctx = token,
         .error = ML_COMPILE_RESULT_SUCCEED,
         .type = ML_TOKEN_TYPE_EOF,
         .data = {0},
+        .symbol_line = 0,
+        .symbol_column = 0,
     };
 
     bool is_comment_line = false;
@@ -827,6 +902,10 @@ enum ml_compile_result ml_compile_feed(struct ml_compile_ctx *ctx, struct ml_tok
             return ML_COMPILE_RESULT_ERROR_SYNTAX_ERROR;
         }
     }
+
+    do_analyze_functions(ctx);
+    if (!do_resolve_param_names(ctx))
+        return ML_COMPILE_RESULT_ERROR_OUT_OF_MEMORY;
     return ML_COMPILE_RESULT_SUCCEED;
 }
 
@@ -836,12 +915,15 @@ static void do_accept_statements(struct ml_compile_ctx *ctx,
     bool is_print = false;
     bool is_started = false;
     for (int i = begin; i < end; i++) {
+        struct token_entry *token = &tokens->base[i];
         if (!is_started) {
+            // a statement starts where its first token does
             is_started = true;
-            fn(opaque, ML_COMPILE_VISIT_EVENT_STATEMENT_START, NULL);
+            fn(opaque, ML_COMPILE_VISIT_EVENT_STATEMENT_START, &(union ml_compile_visit_data) {
+                .location = { .line = token->line, .column = token->column },
+            });
         }
 
-        struct token_entry *token = &tokens->base[i];
         switch (token->type) {
             case TOKEN_ENTRY_TYPE_PLAIN:
                 if (token->data.type == ML_TOKEN_TYPE_PRINT) {
@@ -908,54 +990,41 @@ static void do_accept_globals(struct ml_compile_ctx *ctx,
         fn(opaque, ML_COMPILE_VISIT_EVENT_GLOBAL_SECTION_END, NULL);
 }
 
+static void do_accept_function(struct ml_compile_ctx *ctx, int idx,
+                               void *opaque, ml_compile_visit_fn fn) {
+    // parameters of a function are a slice of the names resolved after feeding
+    struct func_entry *func = &ctx->func_list.base[idx];
+    int count = func->param_end - func->param_begin;
+    const char **params = count ? ctx->param_names + func->param_begin : NULL;
+    const char *name = ctx->symbol_chars.base + func->name_offset;
+
+    const union ml_compile_visit_data data = {
+        .func = {
+            .ret = func->has_return,
+            .pure = func->is_pure,
+            .last = (idx + 1 == ctx->func_list.count),
+            .name = name,
+            .params = params,
+            .count = count,
+            .index = idx,
+            .line = func->line,
+        }
+    };
+
+    fn(opaque, ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START, &data);
+    do_accept_statements(ctx, opaque, fn, &ctx->tokens_sub, func->token_begin, func->token_end);
+    fn(opaque, ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_END, &data);
+}
+
 static void do_accept_functions(struct ml_compile_ctx *ctx,
                                 void *opaque, ml_compile_visit_fn fn) {
     if (ctx->func_list.count <= 0)
         return;
 
-    size_t capacity = 0;
-    void *buffer = NULL;
-
     fn(opaque, ML_COMPILE_VISIT_EVENT_SUB_FUNC_SECTION_START, NULL);
-    for (int i = 0; i < ctx->func_list.count; i++) {
-        // need an array to hold string pointers of parameters
-        struct func_entry *func = &ctx->func_list.base[i];
-        int count = func->param_end - func->param_begin;
-        size_t request = sizeof(const char*) * count;
-        if (capacity < request) {
-            void *p = ml_memory_realloc(buffer, request);
-            if (!p)
-                continue;
-
-            buffer = p;
-            capacity = request;
-        }
-
-        const char **params = buffer;
-        const char *name = ctx->symbol_chars.base + func->name_offset;
-        for (int j = 0; j < count; j++) {
-            int offset = ctx->param_offsets.base[func->param_begin + j];
-            params[j] = ctx->symbol_chars.base + offset;
-        }
-
-        const union ml_compile_visit_data data = {
-            .func = {
-                .ret = func->has_return,
-                .last = (i + 1 == ctx->func_list.count),
-                .name = name,
-                .params = params,
-                .count = count,
-            }
-        };
-
-        fn(opaque, ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START, &data);
-        do_accept_statements(ctx, opaque, fn, &ctx->tokens_sub, func->token_begin, func->token_end);
-        fn(opaque, ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_END, &data);
-    }
+    for (int i = 0; i < ctx->func_list.count; i++)
+        do_accept_function(ctx, i, opaque, fn);
     fn(opaque, ML_COMPILE_VISIT_EVENT_SUB_FUNC_SECTION_END, NULL);
-
-    if (buffer)
-        ml_memory_free(buffer);
 }
 
 void ml_compile_accept(struct ml_compile_ctx *ctx, void *opaque, ml_compile_visit_fn fn) {
@@ -982,3 +1051,33 @@ void ml_compile_accept(struct ml_compile_ctx *ctx, void *opaque, ml_compile_visi
     fn(opaque, ML_COMPILE_VISIT_EVENT_MAIN_FUNC_SECTION_END, NULL);
 }
 
+
+int ml_compile_get_func_count(struct ml_compile_ctx *ctx) {
+    return ctx->func_list.count;
+}
+
+void ml_compile_accept_func(struct ml_compile_ctx *ctx, int idx, void *opaque, ml_compile_visit_fn fn) {
+    // only reads the compile context, so different functions can be visited concurrently
+    if (!fn || idx < 0 || idx >= ctx->func_list.count)
+        return;
+
+    do_accept_function(ctx, idx, opaque, fn);
+}
+
+int ml_compile_get_memory_stats(struct ml_compile_ctx *ctx, struct ml_memory_stats *stats, int capacity) {
+    // the same order as the fields, a smaller capacity only fills the leading ones
+    struct ml_memory_stats all[8];
+    list_stats_str(&ctx->symbol_chars, "symbol_chars", &all[0]);
+    list_stats_sym(&ctx->symbol_entries, "symbol_entries", &all[1]);
+    list_stats_double(&ctx->num_list, "num_list", &all[2]);
+    list_stats_func(&ctx->func_list, "func_list", &all[3]);
+    list_stats_int(&ctx->param_offsets, "param_offsets", &all[4]);
+    list_stats_token(&ctx->tokens_main, "tokens_main", &all[5]);
+    list_stats_token(&ctx->tokens_sub, "tokens_sub", &all[6]);
+    list_stats_int(&ctx->arg_indexes, "arg_indexes", &all[7]);
+
+    int count = sizeof(all) / sizeof(all[0]);
+    for (int i = 0; stats && i < count && i < capacity; i++)
+        stats[i] = all[i];
+    return count;
+}
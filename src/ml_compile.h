@@ -4,10 +4,14 @@
 
 struct ml_token_ctx;
 struct ml_compile_ctx;
+struct ml_memory_stats;
+struct ml_allocator;
 
+// the allocator is used from feeding until the context is released, so it must outlive the context
 struct ml_compile_ctx_init_args {
     int list_default_capacity;
     int symbol_chars_capacity;
+    const struct ml_allocator *allocator;
 };
 
 enum ml_compile_result {
@@ -31,10 +35,17 @@ union ml_compile_visit_data {
     struct {
         bool ret;
         bool last;
+        bool pure;
         const char *name;
         const char **params;
         int count;
+        int index;
+        int line;
     } func;
+    struct {
+        int line;
+        int column;
+    } location;
 };
 
 enum ml_compile_visit_event {
@@ -75,3 +86,9 @@ void ml_compile_ctx_uninit(struct ml_compile_ctx **pp);
 enum ml_compile_result ml_compile_feed(struct ml_compile_ctx *ctx, struct ml_token_ctx *token);
 
 void ml_compile_accept(struct ml_compile_ctx *ctx, void *opaque, ml_compile_visit_fn fn);
+
+int ml_compile_get_func_count(struct ml_compile_ctx *ctx);
+
+void ml_compile_accept_func(struct ml_compile_ctx *ctx, int idx, void *opaque, ml_compile_visit_fn fn);
+
+int ml_compile_get_memory_stats(struct ml_compile_ctx *ctx, struct ml_memory_stats *stats, int capacity);
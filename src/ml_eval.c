@@ -0,0 +1,931 @@
+#include "ml_eval.h"
+#include "ml_token.h"
+#include "ml_compile.h"
+#include "ml_memory.h"
+#include "ml_list.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ML_EVAL_BUFFER_CAPACITY_NUM     512
+#define ML_EVAL_MEMO_CAPACITY           4096
+#define ML_EVAL_MEMO_MAX_PARAMS         8
+
+enum eval_op {
+    EVAL_OP_NUMBER,
+    EVAL_OP_GLOBAL,
+    EVAL_OP_LOCAL,
+    EVAL_OP_CALL,
+    EVAL_OP_NEGATE,
+    EVAL_OP_ADD,
+    EVAL_OP_SUBTRACT,
+    EVAL_OP_MULTIPLY,
+    EVAL_OP_DIVIDE,
+};
+
+enum eval_stmt_type {
+    EVAL_STMT_TYPE_EXPRESSION,
+    EVAL_STMT_TYPE_PRINT,
+    EVAL_STMT_TYPE_RETURN,
+    EVAL_STMT_TYPE_ASSIGN_GLOBAL,
+    EVAL_STMT_TYPE_ASSIGN_LOCAL,
+};
+
+struct eval_code {
+    enum eval_op op;
+    union {
+        int index;
+        double number;
+    } data;
+};
+
+struct eval_stmt {
+    enum eval_stmt_type type;
+    int target;
+    int code_begin;
+    int code_end;
+};
+
+struct eval_func {
+    int name_offset;
+    int param_count;
+    int stmt_begin;
+    int stmt_end;
+
+    // side effects are collected transitively, as callees are always defined before callers
+    bool effect;
+    bool reads;
+};
+
+struct eval_token {
+    enum ml_compile_visit_event event;
+    union ml_compile_visit_data data;
+};
+
+struct eval_memo_entry {
+    int func;
+    double value;
+    double keys[ML_EVAL_MEMO_MAX_PARAMS];
+};
+
+struct eval_parser {
+    const struct eval_token *tokens;
+    int idx;
+    int count;
+    int effect_calls;
+    int sensitive_reads;
+};
+
+ML_LIST_DECLARE_BASE(int, eval_int);
+ML_LIST_DECLARE_GROW(int, eval_int);
+
+ML_LIST_DECLARE_BASE(char, eval_str);
+ML_LIST_DECLARE_GROW(char, eval_str);
+ML_LIST_DECLARE_FILL(char, eval_str);
+
+ML_LIST_DECLARE_BASE(double, eval_value);
+ML_LIST_DECLARE_GROW(double, eval_value);
+ML_LIST_DECLARE_APPEND(double, eval_value);
+
+ML_LIST_DECLARE_BASE(struct eval_code, eval_code);
+ML_LIST_DECLARE_GROW(struct eval_code, eval_code);
+ML_LIST_DECLARE_APPEND(struct eval_code, eval_code);
+
+ML_LIST_DECLARE_BASE(struct eval_stmt, eval_stmt);
+ML_LIST_DECLARE_GROW(struct eval_stmt, eval_stmt);
+ML_LIST_DECLARE_APPEND(struct eval_stmt, eval_stmt);
+
+ML_LIST_DECLARE_BASE(struct eval_func, eval_func);
+ML_LIST_DECLARE_GROW(struct eval_func, eval_func);
+ML_LIST_DECLARE_APPEND(struct eval_func, eval_func);
+
+ML_LIST_DECLARE_BASE(struct eval_token, eval_token);
+ML_LIST_DECLARE_GROW(struct eval_token, eval_token);
+ML_LIST_DECLARE_APPEND(struct eval_token, eval_token);
+
+struct ml_eval_ctx {
+    struct ml_eval_ctx_init_args args;
+    enum ml_eval_result load_result;
+
+    // names are copied, so the compile context can be released after loading
+    // global and function entries are sorted by names for searching
+    struct ml_list_eval_str names;
+    struct ml_list_eval_int global_names;
+    struct ml_list_eval_int func_order;
+    struct ml_list_eval_func funcs;
+    struct ml_list_eval_stmt stmts;
+    struct ml_list_eval_code codes;
+    int main_index;
+
+    // the statement being loaded and the parameters of its function
+    struct ml_list_eval_token tokens;
+    const char **params;
+    int param_count;
+
+    // running states
+    int steps;
+    int depth;
+    struct ml_list_eval_value globals;
+    struct ml_list_eval_value stack;
+    struct ml_list_eval_str output;
+    struct eval_memo_entry *memo;
+};
+
+static const struct ml_eval_ctx_init_args ml_eval_ctx_init_args_default = {
+    .max_steps = 1 << 24,
+    .max_depth = 1024,
+    .max_output = 1 << 20,
+    .flags = ML_EVAL_FLAG_MEMOIZE,
+};
+
+// names that are either C keywords or declared by headers of the generated code
+// programs using them fail to compile, so they are left to the C compiler to report
+static const char *const eval_reserved_names[] = {
+    "abort", "abs", "acos", "acosh", "acospi", "alignas", "alignof", "alloca", "asin",
+    "asinh", "asinpi", "asm", "asprintf", "atan", "atanh", "atanpi", "atexit", "atof",
+    "atoi", "atol", "atoll", "auto", "bool", "break", "bsearch", "calloc", "canonicalize",
+    "case", "cbrt", "ceil", "char", "clearenv", "clearerr", "compoundn", "const",
+    "constexpr", "continue", "copysign", "cos", "cosh", "cospi", "ctermid", "cuserid",
+    "default", "div", "do", "double", "dprintf", "drem", "ecvt", "else", "enum", "erf",
+    "erfc", "exit", "exp", "expm", "extern", "fabs", "fadd", "false", "fclose",
+    "fcloseall", "fcvt", "fdim", "fdiv", "fdopen", "feof", "ferror", "fflush", "fgetc",
+    "fgetpos", "fgets", "fileno", "finite", "float", "flockfile", "floor", "fma", "fmax",
+    "fmaximum", "fmaximummag", "fmaxmag", "fmemopen", "fmin", "fminimum", "fminimummag",
+    "fminmag", "fmod", "fmul", "fopen", "fopencookie", "for", "fpclassify", "fprintf",
+    "fputc", "fputs", "fread", "free", "freopen", "frexp", "fromfp", "fscanf", "fseek",
+    "fseeko", "fsetpos", "fsub", "ftell", "ftello", "ftrylockfile", "funlockfile",
+    "fwrite", "gamma", "gcvt", "getc", "getchar", "getdelim", "getenv", "getline",
+    "getloadavg", "getpayload", "gets", "getsubopt", "getw", "goto", "grantpt", "hypot",
+    "if", "ilogb", "initstate", "inline", "int", "iscanonical", "isfinite", "isgreater",
+    "isgreaterequal", "isinf", "isless", "islessequal", "islessgreater", "isnan",
+    "isnormal", "issignaling", "issubnormal", "isunordered", "iszero", "jn", "labs",
+    "ldexp", "ldiv", "lgamma", "llabs", "lldiv", "llogb", "llrint", "llround", "log",
+    "logb", "long", "lrint", "lround", "main", "malloc", "mblen", "mbstowcs", "mbtowc",
+    "mkdtemp", "mkstemp", "mkstemps", "mktemp", "modf", "nan", "nearbyint", "nextafter",
+    "nextdown", "nexttoward", "nextup", "nullptr", "pclose", "perror", "popen", "pow",
+    "pown", "powr", "printf", "ptsname", "putc", "putchar", "putenv", "puts", "putw",
+    "qecvt", "qfcvt", "qgcvt", "qsort", "rand", "random", "realloc", "reallocarray",
+    "realpath", "register", "remainder", "remove", "remquo", "rename", "renameat",
+    "restrict", "return", "rewind", "rint", "rootn", "round", "roundeven", "rpmatch",
+    "rsqrt", "scalb", "scalbln", "scalbn", "scanf", "setbuf", "setbuffer", "setenv",
+    "setlinebuf", "setpayload", "setpayloadsig", "setstate", "setvbuf", "short", "signbit",
+    "signed", "signgam", "significand", "sin", "sincos", "sinh", "sinpi", "sizeof",
+    "snprintf", "sprintf", "sqrt", "srand", "srandom", "sscanf", "static", "stderr",
+    "stdin", "stdout", "strtod", "strtof", "strtol", "strtold", "strtoll", "strtoul",
+    "strtoull", "struct", "switch", "system", "tan", "tanh", "tanpi", "tempnam", "tgamma",
+    "tmpfile", "tmpnam", "totalorder", "totalordermag", "true", "trunc", "typedef",
+    "typeof", "ufromfp", "ungetc", "union", "unlockpt", "unsetenv", "unsigned", "valloc",
+    "vasprintf", "vdprintf", "vfprintf", "vfscanf", "void", "volatile", "vprintf",
+    "vscanf", "vsnprintf", "vsprintf", "vsscanf", "wcstombs", "wctomb", "while", "yn"
+};
+
+bool ml_eval_ctx_init(struct ml_eval_ctx **pp, const struct ml_eval_ctx_init_args *args) {
+    const struct ml_eval_ctx_init_args *p_args = args;
+    if (!p_args)
+        p_args = &ml_eval_ctx_init_args_default;
+
+    int capacity = 64;
+    struct ml_eval_ctx *ctx = ml_memory_malloc(sizeof(struct ml_eval_ctx));
+    if (!ctx)
+        goto fail;
+
+    *ctx = (struct ml_eval_ctx) {0};
+    ctx->args = *p_args;
+    ctx->main_index = -1;
+    if (!list_init_eval_str(&ctx->names, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_int(&ctx->global_names, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_int(&ctx->func_order, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_func(&ctx->funcs, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_stmt(&ctx->stmts, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_code(&ctx->codes, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_token(&ctx->tokens, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_value(&ctx->globals, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_value(&ctx->stack, capacity, NULL))
+        goto fail;
+    if (!list_init_eval_str(&ctx->output, capacity, NULL))
+        goto fail;
+
+    *pp = ctx;
+    return true;
+
+fail:
+    ml_eval_ctx_uninit(&ctx);
+    return false;
+}
+
+void ml_eval_ctx_uninit(struct ml_eval_ctx **pp) {
+    struct ml_eval_ctx *ctx = pp ? *pp : NULL;
+    if (!ctx)
+        return;
+
+    list_uninit_eval_str(&ctx->names);
+    list_uninit_eval_int(&ctx->global_names);
+    list_uninit_eval_int(&ctx->func_order);
+    list_uninit_eval_func(&ctx->funcs);
+    list_uninit_eval_stmt(&ctx->stmts);
+    list_uninit_eval_code(&ctx->codes);
+    list_uninit_eval_token(&ctx->tokens);
+    list_uninit_eval_value(&ctx->globals);
+    list_uninit_eval_value(&ctx->stack);
+    list_uninit_eval_str(&ctx->output);
+    if (ctx->memo)
+        ml_memory_free(ctx->memo);
+    ml_memory_free(ctx);
+    *pp = NULL;
+}
+
+static bool load_fail_on_result(struct ml_eval_ctx *ctx, enum ml_eval_result result) {
+    ctx->load_result = result;
+    return false;
+}
+
+static bool load_fail_on_no_memory(struct ml_eval_ctx *ctx) {
+    return load_fail_on_result(ctx, ML_EVAL_RESULT_OUT_OF_MEMORY);
+}
+
+static bool load_fail_on_unsupported(struct ml_eval_ctx *ctx) {
+    return load_fail_on_result(ctx, ML_EVAL_RESULT_UNSUPPORTED);
+}
+
+static int compare_reserved_name(const void *key, const void *item) {
+    return strcmp(key, *(const char *const *) item);
+}
+
+static bool check_reserved_name(const char *name) {
+    size_t count = sizeof(eval_reserved_names) / sizeof(eval_reserved_names[0]);
+    size_t size = sizeof(eval_reserved_names[0]);
+    if (bsearch(name, eval_reserved_names, count, size, compare_reserved_name))
+        return true;
+
+    // math functions also have float and long double variants, e.g. "sinf" and "sinl"
+    char stem[ML_EVAL_BUFFER_CAPACITY_NUM];
+    size_t len = strlen(name);
+    if (len < 2 || len >= sizeof(stem) || (name[len - 1] != 'f' && name[len - 1] != 'l'))
+        return false;
+
+    memcpy(stem, name, len - 1);
+    stem[len - 1] = 0;
+    return bsearch(stem, eval_reserved_names, count, size, compare_reserved_name) != NULL;
+}
+
+static const char *resolve_name(struct ml_eval_ctx *ctx, int offset) {
+    return ctx->names.base + offset;
+}
+
+static int search_global(struct ml_eval_ctx *ctx, const char *name) {
+    int low = 0;
+    int high = ctx->global_names.count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(name, resolve_name(ctx, ctx->global_names.base[mid]));
+        if (cmp < 0)
+            high = mid - 1;
+        else if (cmp > 0)
+            low = mid + 1;
+        else
+            return mid;
+    }
+    return -(low + 1);
+}
+
+static int search_function(struct ml_eval_ctx *ctx, const char *name) {
+    int low = 0;
+    int high = ctx->func_order.count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        struct eval_func *func = &ctx->funcs.base[ctx->func_order.base[mid]];
+        int cmp = strcmp(name, resolve_name(ctx, func->name_offset));
+        if (cmp < 0)
+            high = mid - 1;
+        else if (cmp > 0)
+            low = mid + 1;
+        else
+            return mid;
+    }
+    return -(low + 1);
+}
+
+static bool load_name(struct ml_eval_ctx *ctx, const char *name, int *offset) {
+    *offset = ctx->names.count;
+    return list_fill_eval_str(&ctx->names, name, strlen(name) + 1) || load_fail_on_no_memory(ctx);
+}
+
+static bool load_insert_sorted(struct ml_eval_ctx *ctx, struct ml_list_eval_int *list,
+                               int search_idx, int value) {
+    if (!list_grow_eval_int(list, 1))
+        return load_fail_on_no_memory(ctx);
+
+    int insert_idx = -search_idx - 1;
+    int move_count = list->count - insert_idx;
+    if (move_count) {
+        int *insert_addr = list->base + insert_idx;
+        memmove(insert_addr + 1, insert_addr, sizeof(int) * move_count);
+    }
+    list->base[insert_idx] = value;
+    list->count++;
+    return true;
+}
+
+static bool load_global(struct ml_eval_ctx *ctx, const char *name) {
+    int search_idx = search_global(ctx, name);
+    if (search_idx >= 0 || check_reserved_name(name))
+        return load_fail_on_unsupported(ctx);
+
+    int offset = 0;
+    return load_name(ctx, name, &offset)
+        && load_insert_sorted(ctx, &ctx->global_names, search_idx, offset);
+}
+
+static bool load_function_start(struct ml_eval_ctx *ctx, const union ml_compile_visit_data *data) {
+    // a function is visible in its own body, and redefinitions fail in C
+    int search_idx = search_function(ctx, data->func.name);
+    if (search_idx >= 0 || check_reserved_name(data->func.name))
+        return load_fail_on_unsupported(ctx);
+
+    for (int i = 0; i < data->func.count; i++) {
+        if (check_reserved_name(data->func.params[i]))
+            return load_fail_on_unsupported(ctx);
+    }
+
+    struct eval_func func = {
+        .param_count = data->func.count,
+        .stmt_begin = ctx->stmts.count,
+        .stmt_end = ctx->stmts.count,
+    };
+    if (!load_name(ctx, data->func.name, &func.name_offset))
+        return false;
+    if (!list_append_eval_func(&ctx->funcs, &func))
+        return load_fail_on_no_memory(ctx);
+    if (!load_insert_sorted(ctx, &ctx->func_order, search_idx, ctx->funcs.count - 1))
+        return false;
+
+    // parameter names are only valid during the function visit
+    ctx->params = data->func.params;
+    ctx->param_count = data->func.count;
+    return true;
+}
+
+static bool load_main_start(struct ml_eval_ctx *ctx) {
+    const struct eval_func func = {
+        .name_offset = -1,
+        .param_count = 0,
+        .stmt_begin = ctx->stmts.count,
+        .stmt_end = ctx->stmts.count,
+    };
+    if (!list_append_eval_func(&ctx->funcs, &func))
+        return load_fail_on_no_memory(ctx);
+
+    ctx->main_index = ctx->funcs.count - 1;
+    ctx->params = NULL;
+    ctx->param_count = 0;
+    return true;
+}
+
+static void load_function_end(struct ml_eval_ctx *ctx) {
+    ctx->funcs.base[ctx->funcs.count - 1].stmt_end = ctx->stmts.count;
+    ctx->params = NULL;
+    ctx->param_count = 0;
+}
+
+static int resolve_param(struct ml_eval_ctx *ctx, const char *name) {
+    for (int i = 0; i < ctx->param_count; i++) {
+        if (strcmp(ctx->params[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static bool load_check_token(struct eval_parser *p, enum ml_token_type type) {
+    if (p->idx >= p->count)
+        return false;
+
+    const struct eval_token *token = &p->tokens[p->idx];
+    return token->event == ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_TOKEN && token->data.token == type;
+}
+
+static bool load_append_code(struct ml_eval_ctx *ctx, const struct eval_code *code) {
+    return list_append_eval_code(&ctx->codes, code) || load_fail_on_no_memory(ctx);
+}
+
+static bool load_append_op(struct ml_eval_ctx *ctx, enum eval_op op) {
+    return load_append_code(ctx, &(struct eval_code) { .op = op });
+}
+
+static bool load_expression(struct ml_eval_ctx *ctx, struct eval_parser *p);
+
+static bool load_call(struct ml_eval_ctx *ctx, struct eval_parser *p, const char *name) {
+    int search_idx = search_function(ctx, name);
+    if (search_idx < 0)
+        return load_fail_on_unsupported(ctx);
+
+    // skip the left parenthesis
+    p->idx++;
+
+    int count = 0;
+    if (!load_check_token(p, ML_TOKEN_TYPE_PARENTHESIS_R)) {
+        while (true) {
+            if (!load_expression(ctx, p))
+                return false;
+
+            count++;
+            if (!load_check_token(p, ML_TOKEN_TYPE_COMMA))
+                break;
+            p->idx++;
+        }
+    }
+
+    if (!load_check_token(p, ML_TOKEN_TYPE_PARENTHESIS_R))
+        return load_fail_on_unsupported(ctx);
+    p->idx++;
+
+    // mismatched calls either fail to compile or silently drop values in C
+    int index = ctx->func_order.base[search_idx];
+    struct eval_func *func = &ctx->funcs.base[index];
+    if (count != func->param_count)
+        return load_fail_on_unsupported(ctx);
+
+    if (func->effect)
+        p->effect_calls++;
+    else if (func->reads)
+        p->sensitive_reads++;
+
+    return load_append_code(ctx, &(struct eval_code) {
+        .op = EVAL_OP_CALL,
+        .data = { .index = index },
+    });
+}
+
+static bool load_variable(struct ml_eval_ctx *ctx, struct eval_parser *p, const char *name) {
+    int param = resolve_param(ctx, name);
+    if (param >= 0) {
+        return load_append_code(ctx, &(struct eval_code) {
+            .op = EVAL_OP_LOCAL,
+            .data = { .index = param },
+        });
+    }
+
+    // function names or parameters of other functions are not variables here
+    int global = search_global(ctx, name);
+    if (global < 0)
+        return load_fail_on_unsupported(ctx);
+
+    p->sensitive_reads++;
+    return load_append_code(ctx, &(struct eval_code) {
+        .op = EVAL_OP_GLOBAL,
+        .data = { .index = global },
+    });
+}
+
+static bool load_primary(struct ml_eval_ctx *ctx, struct eval_parser *p) {
+    if (p->idx >= p->count)
+        return load_fail_on_unsupported(ctx);
+
+    const struct eval_token *token = &p->tokens[p->idx++];
+    switch (token->event) {
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_NUMBER:
+            return load_append_code(ctx, &(struct eval_code) {
+                .op = EVAL_OP_NUMBER,
+                .data = { .number = token->data.number },
+            });
+
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_SYMBOL:
+            if (load_check_token(p, ML_TOKEN_TYPE_PARENTHESIS_L))
+                return load_call(ctx, p, token->data.name);
+            return load_variable(ctx, p, token->data.name);
+
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_TOKEN:
+            if (token->data.token != ML_TOKEN_TYPE_PARENTHESIS_L)
+                return load_fail_on_unsupported(ctx);
+            if (!load_expression(ctx, p))
+                return false;
+            if (!load_check_token(p, ML_TOKEN_TYPE_PARENTHESIS_R))
+                return load_fail_on_unsupported(ctx);
+            p->idx++;
+            return true;
+
+        default:
+            return load_fail_on_unsupported(ctx);
+    }
+}
+
+static bool load_unary(struct ml_eval_ctx *ctx, struct eval_parser *p) {
+    // operators are kept as they are in the generated code, so unary ones follow C rules
+    if (load_check_token(p, ML_TOKEN_TYPE_PLUS)) {
+        p->idx++;
+        return load_unary(ctx, p);
+    } else if (load_check_token(p, ML_TOKEN_TYPE_MINUS)) {
+        p->idx++;
+        return load_unary(ctx, p) && load_append_op(ctx, EVAL_OP_NEGATE);
+    }
+    return load_primary(ctx, p);
+}
+
+static bool load_term(struct ml_eval_ctx *ctx, struct eval_parser *p) {
+    if (!load_unary(ctx, p))
+        return false;
+
+    while (true) {
+        enum eval_op op;
+        if (load_check_token(p, ML_TOKEN_TYPE_MULTIPLY))
+            op = EVAL_OP_MULTIPLY;
+        else if (load_check_token(p, ML_TOKEN_TYPE_DIVIDE))
+            op = EVAL_OP_DIVIDE;
+        else
+            return true;
+
+        p->idx++;
+        if (!load_unary(ctx, p) || !load_append_op(ctx, op))
+            return false;
+    }
+}
+
+static bool load_expression(struct ml_eval_ctx *ctx, struct eval_parser *p) {
+    if (!load_term(ctx, p))
+        return false;
+
+    while (true) {
+        enum eval_op op;
+        if (load_check_token(p, ML_TOKEN_TYPE_PLUS))
+            op = EVAL_OP_ADD;
+        else if (load_check_token(p, ML_TOKEN_TYPE_MINUS))
+            op = EVAL_OP_SUBTRACT;
+        else
+            return true;
+
+        p->idx++;
+        if (!load_term(ctx, p) || !load_append_op(ctx, op))
+            return false;
+    }
+}
+
+static bool load_statement(struct ml_eval_ctx *ctx) {
+    struct eval_parser p = {
+        .tokens = ctx->tokens.base,
+        .idx = 0,
+        .count = ctx->tokens.count,
+        .effect_calls = 0,
+        .sensitive_reads = 0,
+    };
+
+    struct eval_stmt stmt = {
+        .type = EVAL_STMT_TYPE_EXPRESSION,
+        .target = -1,
+        .code_begin = ctx->codes.count,
+    };
+    if (p.count && p.tokens[0].event == ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_PRINT_START) {
+        p.idx++;
+        stmt.type = EVAL_STMT_TYPE_PRINT;
+    } else if (load_check_token(&p, ML_TOKEN_TYPE_RETURN)) {
+        p.idx++;
+        stmt.type = EVAL_STMT_TYPE_RETURN;
+    } else if (p.count > 1 && p.tokens[0].event == ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_SYMBOL) {
+        p.idx++;
+        if (load_check_token(&p, ML_TOKEN_TYPE_ASSIGNMENT)) {
+            const char *name = p.tokens[0].data.name;
+            stmt.target = resolve_param(ctx, name);
+            stmt.type = EVAL_STMT_TYPE_ASSIGN_LOCAL;
+            if (stmt.target < 0) {
+                stmt.target = search_global(ctx, name);
+                stmt.type = EVAL_STMT_TYPE_ASSIGN_GLOBAL;
+            }
+            if (stmt.target < 0)
+                return load_fail_on_unsupported(ctx);
+            p.idx++;
+        } else {
+            p.idx = 0;
+        }
+    }
+
+    // commas outside of calls are comma operators in C, which are not worth supporting
+    if (!load_expression(ctx, &p))
+        return false;
+    if (p.idx != p.count)
+        return load_fail_on_unsupported(ctx);
+    stmt.code_end = ctx->codes.count;
+
+    // the evaluation order of operands is unspecified in C
+    // so a side effect is only allowed when nothing else in the statement can observe it
+    if (p.effect_calls && p.effect_calls + p.sensitive_reads > 1)
+        return load_fail_on_unsupported(ctx);
+
+    struct eval_func *func = &ctx->funcs.base[ctx->funcs.count - 1];
+    if (stmt.type == EVAL_STMT_TYPE_PRINT || stmt.type == EVAL_STMT_TYPE_ASSIGN_GLOBAL || p.effect_calls)
+        func->effect = true;
+    if (p.sensitive_reads)
+        func->reads = true;
+
+    if (!list_append_eval_stmt(&ctx->stmts, &stmt))
+        return load_fail_on_no_memory(ctx);
+    return true;
+}
+
+static void do_load_compile_data(void *opaque,
+                                 enum ml_compile_visit_event event,
+                                 const union ml_compile_visit_data *data) {
+    struct ml_eval_ctx *ctx = opaque;
+    if (ctx->load_result != ML_EVAL_RESULT_SUCCEED)
+        return;
+
+    const struct eval_token token = {
+        .event = event,
+        .data = data ? *data : (union ml_compile_visit_data) {0},
+    };
+    switch (event) {
+        case ML_COMPILE_VISIT_EVENT_ARG_SECTION_START:
+            // the output depends on command line arguments
+            load_fail_on_unsupported(ctx);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_GLOBAL_VISIT_VAR:
+            load_global(ctx, data->name);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START:
+            load_function_start(ctx, data);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_MAIN_FUNC_SECTION_START:
+            load_main_start(ctx);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_END:
+        case ML_COMPILE_VISIT_EVENT_MAIN_FUNC_SECTION_END:
+            load_function_end(ctx);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_START:
+            ctx->tokens.count = 0;
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_PRINT_START:
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_ARG:
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_NUMBER:
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_SYMBOL:
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_VISIT_TOKEN:
+            if (!list_append_eval_token(&ctx->tokens, &token))
+                load_fail_on_no_memory(ctx);
+            break;
+
+        case ML_COMPILE_VISIT_EVENT_STATEMENT_END:
+            load_statement(ctx);
+            break;
+
+        default:
+            break;
+    }
+}
+
+enum ml_eval_result ml_eval_load(struct ml_eval_ctx *ctx, struct ml_compile_ctx *compile) {
+    ctx->load_result = ML_EVAL_RESULT_SUCCEED;
+    ml_compile_accept(compile, ctx, do_load_compile_data);
+    if (ctx->load_result == ML_EVAL_RESULT_SUCCEED && ctx->main_index < 0)
+        ctx->load_result = ML_EVAL_RESULT_UNSUPPORTED;
+    return ctx->load_result;
+}
+
+static bool check_integral(double value) {
+    // the same as checking the fractional part from modf(), but libm is not required
+    if (isnan(value))
+        return false;
+    if (isinf(value))
+        return true;
+
+    double magnitude = (value < 0) ? -value : value;
+    return magnitude >= 4503599627370496.0 || value == (double) (long long) value;
+}
+
+static enum ml_eval_result run_print(struct ml_eval_ctx *ctx, double value) {
+    // the sign of NaN may be different when the C compiler folds constants
+    if (isnan(value))
+        return ML_EVAL_RESULT_UNSUPPORTED;
+
+    char buf[ML_EVAL_BUFFER_CAPACITY_NUM];
+    const char *fmt = check_integral(value) ? "%.0f\n" : "%.6f\n";
+    int n = snprintf(buf, sizeof(buf), fmt, value);
+    if (n < 0 || n >= sizeof(buf))
+        return ML_EVAL_RESULT_UNSUPPORTED;
+
+    if (ctx->output.count + n > ctx->args.max_output)
+        return ML_EVAL_RESULT_LIMIT_EXCEEDED;
+
+    if (!list_fill_eval_str(&ctx->output, buf, n))
+        return ML_EVAL_RESULT_OUT_OF_MEMORY;
+    return ML_EVAL_RESULT_SUCCEED;
+}
+
+static enum ml_eval_result run_function(struct ml_eval_ctx *ctx, int index, int frame, double *ret);
+
+static struct eval_memo_entry *run_find_memo(struct ml_eval_ctx *ctx, int index,
+                                             int frame, bool *found) {
+    *found = false;
+    struct eval_func *func = &ctx->funcs.base[index];
+    if (!(ctx->args.flags & ML_EVAL_FLAG_MEMOIZE) || func->effect || func->reads)
+        return NULL;
+    if (func->param_count > ML_EVAL_MEMO_MAX_PARAMS)
+        return NULL;
+
+    if (!ctx->memo) {
+        ctx->memo = ml_memory_malloc(sizeof(struct eval_memo_entry) * ML_EVAL_MEMO_CAPACITY);
+        if (!ctx->memo)
+            return NULL;
+        for (int i = 0; i < ML_EVAL_MEMO_CAPACITY; i++)
+            ctx->memo[i].func = -1;
+    }
+
+    // keys are compared by bit patterns, the same as the generated code
+    const double *args = ctx->stack.base + frame;
+    unsigned long long hash = 0xcbf29ce484222325ULL ^ (unsigned) index;
+    for (int i = 0; i < func->param_count; i++) {
+        unsigned long long bits = 0;
+        memcpy(&bits, &args[i], sizeof(bits));
+        hash = (hash ^ bits) * 0x100000001b3ULL;
+        hash ^= hash >> 32;
+    }
+
+    struct eval_memo_entry *entry = &ctx->memo[hash % ML_EVAL_MEMO_CAPACITY];
+    *found = (entry->func == index)
+        && memcmp(entry->keys, args, sizeof(double) * func->param_count) == 0;
+    return entry;
+}
+
+static enum ml_eval_result run_call(struct ml_eval_ctx *ctx, int index, int frame, double *ret) {
+    bool found = false;
+    struct eval_memo_entry *entry = run_find_memo(ctx, index, frame, &found);
+    if (found) {
+        *ret = entry->value;
+        return ML_EVAL_RESULT_SUCCEED;
+    }
+
+    // parameters may be assigned in the body, so keep the original keys
+    double keys[ML_EVAL_MEMO_MAX_PARAMS];
+    int count = ctx->funcs.base[index].param_count;
+    if (entry)
+        memcpy(keys, ctx->stack.base + frame, sizeof(double) * count);
+
+    // recursion never ends without conditional statements
+    if (ctx->depth >= ctx->args.max_depth)
+        return ML_EVAL_RESULT_LIMIT_EXCEEDED;
+
+    ctx->depth++;
+    enum ml_eval_result result = run_function(ctx, index, frame, ret);
+    ctx->depth--;
+
+    if (result == ML_EVAL_RESULT_SUCCEED && entry) {
+        entry->func = index;
+        entry->value = *ret;
+        memcpy(entry->keys, keys, sizeof(double) * count);
+    }
+    return result;
+}
+
+static void run_apply_operator(struct ml_eval_ctx *ctx, enum eval_op op) {
+    double *top = ctx->stack.base + ctx->stack.count - 1;
+    if (op == EVAL_OP_NEGATE) {
+        *top = -*top;
+        return;
+    }
+
+    double rhs = *top;
+    double *lhs = top - 1;
+    switch (op) {
+        case EVAL_OP_ADD:
+            *lhs = *lhs + rhs;
+            break;
+        case EVAL_OP_SUBTRACT:
+            *lhs = *lhs - rhs;
+            break;
+        case EVAL_OP_MULTIPLY:
+            *lhs = *lhs * rhs;
+            break;
+        case EVAL_OP_DIVIDE:
+            *lhs = *lhs / rhs;
+            break;
+        default:
+            break;
+    }
+    ctx->stack.count--;
+}
+
+static enum ml_eval_result run_code(struct ml_eval_ctx *ctx, int begin, int end,
+                                   int frame, double *value) {
+    int base = ctx->stack.count;
+    for (int i = begin; i < end; i++) {
+        if (++ctx->steps > ctx->args.max_steps)
+            return ML_EVAL_RESULT_LIMIT_EXCEEDED;
+
+        double pushed = 0;
+        struct eval_code *code = &ctx->codes.base[i];
+        switch (code->op) {
+            case EVAL_OP_NUMBER:
+                pushed = code->data.number;
+                break;
+
+            case EVAL_OP_GLOBAL:
+                pushed = ctx->globals.base[code->data.index];
+                break;
+
+            case EVAL_OP_LOCAL:
+                pushed = ctx->stack.base[frame + code->data.index];
+                break;
+
+            case EVAL_OP_CALL: {
+                // arguments on the top of the stack become the frame of the callee
+                int args = ctx->stack.count - ctx->funcs.base[code->data.index].param_count;
+                enum ml_eval_result result = run_call(ctx, code->data.index, args, &pushed);
+                if (result != ML_EVAL_RESULT_SUCCEED)
+                    return result;
+                ctx->stack.count = args;
+                break;
+            }
+
+            default:
+                run_apply_operator(ctx, code->op);
+                continue;
+        }
+
+        // the stack may be reallocated, so no pointers to values are kept across pushes
+        if (!list_append_eval_value(&ctx->stack, &pushed))
+            return ML_EVAL_RESULT_OUT_OF_MEMORY;
+    }
+
+    *value = ctx->stack.base[base];
+    ctx->stack.count = base;
+    return ML_EVAL_RESULT_SUCCEED;
+}
+
+static enum ml_eval_result run_function(struct ml_eval_ctx *ctx, int index, int frame, double *ret) {
+    // functions without return statements return 0
+    *ret = 0;
+
+    struct eval_func *func = &ctx->funcs.base[index];
+    for (int i = func->stmt_begin; i < func->stmt_end; i++) {
+        double value = 0;
+        struct eval_stmt *stmt = &ctx->stmts.base[i];
+        enum ml_eval_result result = run_code(ctx, stmt->code_begin, stmt->code_end, frame, &value);
+        if (result != ML_EVAL_RESULT_SUCCEED)
+            return result;
+
+        switch (stmt->type) {
+            case EVAL_STMT_TYPE_EXPRESSION:
+                break;
+
+            case EVAL_STMT_TYPE_PRINT:
+                result = run_print(ctx, value);
+                if (result != ML_EVAL_RESULT_SUCCEED)
+                    return result;
+                break;
+
+            case EVAL_STMT_TYPE_RETURN:
+                *ret = value;
+                return ML_EVAL_RESULT_SUCCEED;
+
+            case EVAL_STMT_TYPE_ASSIGN_GLOBAL:
+                ctx->globals.base[stmt->target] = value;
+                break;
+
+            case EVAL_STMT_TYPE_ASSIGN_LOCAL:
+                ctx->stack.base[frame + stmt->target] = value;
+                break;
+        }
+    }
+    return ML_EVAL_RESULT_SUCCEED;
+}
+
+enum ml_eval_result ml_eval_run(struct ml_eval_ctx *ctx) {
+    if (ctx->load_result != ML_EVAL_RESULT_SUCCEED)
+        return ctx->load_result;
+
+    ctx->steps = 0;
+    ctx->depth = 0;
+    ctx->stack.count = 0;
+    ctx->output.count = 0;
+    ctx->globals.count = 0;
+    for (int i = 0; i < ctx->global_names.count; i++) {
+        const double zero = 0;
+        if (!list_append_eval_value(&ctx->globals, &zero))
+            return ML_EVAL_RESULT_OUT_OF_MEMORY;
+    }
+
+    if (ctx->memo) {
+        for (int i = 0; i < ML_EVAL_MEMO_CAPACITY; i++)
+            ctx->memo[i].func = -1;
+    }
+
+    double ret = 0;
+    return run_function(ctx, ctx->main_index, 0, &ret);
+}
+
+const char *ml_eval_get_output(struct ml_eval_ctx *ctx, int *count) {
+    *count = ctx->output.count;
+    return ctx->output.base;
+}
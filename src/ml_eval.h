@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct ml_compile_ctx;
+struct ml_eval_ctx;
+
+enum ml_eval_flag {
+    ML_EVAL_FLAG_MEMOIZE = 1,
+};
+
+struct ml_eval_ctx_init_args {
+    int max_steps;
+    int max_depth;
+    int max_output;
+    uint32_t flags;
+};
+
+enum ml_eval_result {
+    ML_EVAL_RESULT_SUCCEED,
+    ML_EVAL_RESULT_UNSUPPORTED,
+    ML_EVAL_RESULT_LIMIT_EXCEEDED,
+    ML_EVAL_RESULT_OUT_OF_MEMORY,
+};
+
+bool ml_eval_ctx_init(struct ml_eval_ctx **pp, const struct ml_eval_ctx_init_args *args);
+
+void ml_eval_ctx_uninit(struct ml_eval_ctx **pp);
+
+enum ml_eval_result ml_eval_load(struct ml_eval_ctx *ctx, struct ml_compile_ctx *compile);
+
+enum ml_eval_result ml_eval_run(struct ml_eval_ctx *ctx);
+
+const char *ml_eval_get_output(struct ml_eval_ctx *ctx, int *count);
@@ -1,21 +1,194 @@
+#define _GNU_SOURCE
+
 #include "ml_exec.h"
 #include "ml_token.h"
 #include "ml_compile.h"
 #include "ml_codegen.h"
+#include "ml_eval.h"
+#include "ml_cache.h"
+#include "ml_trace.h"
+#include "ml_memory.h"
 
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stddef.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#ifdef ML_EXEC_WITH_LIBTCC
+#include <libtcc.h>
+#endif
+
+#define ML_EXEC_CACHE_DIR_CAPACITY      1024
+#define ML_EXEC_CACHE_MAX_ENTRIES       256
+#define ML_EXEC_CACHE_MAX_OUTPUT        (1 << 20)
+#define ML_EXEC_RUNTIME_NAME            "librunml_runtime.a"
+#define ML_EXEC_TIER_LOCK_TIMEOUT       300
+#define ML_EXEC_DRIVER_FLAGS_CAPACITY   256
+#define ML_EXEC_DRIVER_MAX_ARGS         32
+#define ML_EXEC_DRIVER_PROBE_NAME       "/compilers.probe"
+#define ML_EXEC_DRIVER_CONFIG_NAME      "/runml/config"
+#define ML_EXEC_TIER_STATUS_CAPACITY    256
+#define ML_EXEC_SPLIT_MIN_FUNCS         1024
+#define ML_EXEC_SPLIT_MAX_JOBS          32
+#define ML_EXEC_SPLIT_MAX_UNITS         (ML_EXEC_SPLIT_MAX_JOBS + 1)
+#define ML_EXEC_JOBS_CAPACITY           ML_EXEC_SPLIT_MAX_JOBS
+#define ML_EXEC_PIPE_CAPACITY           (1 << 20)
+#define ML_EXEC_FORWARD_BUFFER_SIZE     (1 << 16)
+#define ML_EXEC_LIMIT_POLL_INTERVAL_MS  10
+#define ML_EXEC_SPAN_MAX_ARGS           4
+#define ML_EXEC_BATCH_MAX_THREADS       64
+
+#define ML_EXEC_TIER_SUFFIX_SRC         ".c"
+#define ML_EXEC_TIER_SUFFIX_BASELINE    ".o0"
+#define ML_EXEC_TIER_SUFFIX_OPTIMIZED   ".o2"
+#define ML_EXEC_TIER_SUFFIX_STATUS      ".tier"
+#define ML_EXEC_TIER_SUFFIX_LOCK        ".lock"
+#define ML_EXEC_SHARED_SUFFIX           ".so"
+#define ML_EXEC_SHARED_ENTRY_NAME       "ml_entry"
+#define ML_EXEC_SHARED_SYMBOLS_NAME     "ml_symbols"
+#define ML_EXEC_SHARED_SINK_NAME        "ml_module_sink"
+#define ML_EXEC_GUARD_STACK_SIZE        (1 << 16)
+#define ML_EXEC_DEBUG_SUFFIX_SRC        ".dbg.c"
+#define ML_EXEC_DEBUG_SUFFIX_EXEC       ".dbg"
+#define ML_EXEC_SERVER_CONTROL_FD       3
+#define ML_EXEC_SERVER_CONTROL_ARG      "3"
+#define ML_EXEC_SERVER_MAX_REQUEST      (1 << 16)
+#define ML_EXEC_SERVER_MAX_ARGS         (1 << 16)
 
 enum exec_run_flag {
     EXEC_RUN_FLAG_GRAB_STDOUT = 1,
     EXEC_RUN_FLAG_SUPPRESS_STDERR = 1 << 1,
     EXEC_RUN_FLAG_SEARCH_BIN_PATH = 1 << 2,
+    EXEC_RUN_FLAG_BATCH_INPUT = 1 << 3,
+};
+
+enum exec_build_profile {
+    EXEC_BUILD_PROFILE_CONFIGURED = -1,
+    EXEC_BUILD_PROFILE_FAST_COMPILE,
+    EXEC_BUILD_PROFILE_OPTIMIZED,
+    EXEC_BUILD_PROFILE_DEBUG,
+    EXEC_BUILD_PROFILE_BATCH,
+    EXEC_BUILD_PROFILE_COUNT,
+};
+
+struct exec_build_profile_info {
+    const char *name;
+    const char *env_name;
+};
+
+struct exec_compiler {
+    const char *name;
+    bool optimizing;
+    const char *flags[EXEC_BUILD_PROFILE_COUNT];
+};
+
+struct exec_driver {
+    enum exec_build_profile profile;
+    ml_exec_path compiler;
+    bool has_flags[EXEC_BUILD_PROFILE_COUNT];
+    char flags[EXEC_BUILD_PROFILE_COUNT][ML_EXEC_DRIVER_FLAGS_CAPACITY];
+    ml_cache_path probe_path;
+};
+
+struct exec_option {
+    const char *name;
+    uint32_t flag;
+};
+
+struct exec_limit_option {
+    const char *name;
+    size_t offset;
+};
+
+struct exec_tier_paths {
+    ml_cache_path src;
+    ml_cache_path baseline;
+    ml_cache_path optimized;
+    ml_cache_path status;
+    ml_cache_path lock;
+};
+
+struct exec_span {
+    const char *name;
+    long long start;
+    struct ml_trace_arg args[ML_EXEC_SPAN_MAX_ARGS];
+    int count;
+};
+
+struct exec_jobs {
+    int epoll_fd;
+    int count;
+    pid_t pids[ML_EXEC_JOBS_CAPACITY];
+    int pidfds[ML_EXEC_JOBS_CAPACITY];
+    struct exec_span spans[ML_EXEC_JOBS_CAPACITY];
+};
+
+struct exec_capture {
+    const struct ml_exec_run_fns *fns;
+    void *opaque;
+    char *buffer;
+    int count;
+    int capacity;
+    bool overflow;
+};
+
+static const struct exec_option exec_options[] = {
+    { "--no-memoize", ML_EXEC_FLAG_NO_MEMOIZE },
+    { "--cache", ML_EXEC_FLAG_CACHE },
+    { "--tiered", ML_EXEC_FLAG_TIERED },
+    { "--tier-status", ML_EXEC_FLAG_TIER_STATUS },
+    { "--split", ML_EXEC_FLAG_SPLIT },
+    { "--stats", ML_EXEC_FLAG_STATS },
+    { "--shared", ML_EXEC_FLAG_SHARED },
+    { "--fork-server", ML_EXEC_FLAG_FORK_SERVER },
+    { "--debug-info", ML_EXEC_FLAG_DEBUG_INFO },
+    { "--profile", ML_EXEC_FLAG_PROFILE },
+    { "--no-compact", ML_EXEC_FLAG_NO_COMPACT },
+};
+
+static const struct exec_limit_option exec_limit_options[] = {
+    { "--cpu-limit=", offsetof(struct ml_exec_limits, cpu_seconds) },
+    { "--wall-limit=", offsetof(struct ml_exec_limits, wall_ms) },
+    { "--memory-limit=", offsetof(struct ml_exec_limits, memory_mb) },
+};
+
+static const struct exec_build_profile_info exec_build_profiles[EXEC_BUILD_PROFILE_COUNT] = {
+    [EXEC_BUILD_PROFILE_FAST_COMPILE] = { "fast-compile", "RUNML_CFLAGS_FAST_COMPILE" },
+    [EXEC_BUILD_PROFILE_OPTIMIZED] = { "optimized", "RUNML_CFLAGS_OPTIMIZED" },
+    [EXEC_BUILD_PROFILE_DEBUG] = { "debug", "RUNML_CFLAGS_DEBUG" },
+    [EXEC_BUILD_PROFILE_BATCH] = { "batch", "RUNML_CFLAGS_BATCH" },
+};
+
+// candidates in the order of preference when there is no probe record
+// contractions are disabled wherever supported, so that every profile prints exactly the same numbers
+// batches are built for the host cpu, so that their vectors get as many lanes as its registers hold
+static const struct exec_compiler exec_compilers[] = {
+    { "tcc", false, { "", "", "-g", "" } },
+    { "clang", true, { "-O0 -ffp-contract=off", "-O2 -ffp-contract=off", "-O0 -g -ffp-contract=off",
+                       "-O2 -march=native -ffp-contract=off" } },
+    { "gcc", true, { "-O0 -ffp-contract=off", "-O2 -ffp-contract=off", "-O0 -g -ffp-contract=off",
+                     "-O2 -march=native -ffp-contract=off" } },
+    { "cc", true, { "-O0 -ffp-contract=off", "-O2 -ffp-contract=off", "-O0 -g -ffp-contract=off",
+                    "-O2 -march=native -ffp-contract=off" } },
 };
 
 static void exec_fn_write_stdout(void *opaque, const char *buf, int n) {
@@ -29,9 +202,15 @@ static void exec_fn_printf_stderr(void *opaque, const char *fmt, ...) {
     va_end(args);
 }
 
+static int exec_fn_get_stdout_fd(void *opaque) {
+    // anything buffered must come out before the program writes
+    fflush(stdout);
+    return STDOUT_FILENO;
+}
+
 static bool exec_fn_make_temp_path(void *opaque, ml_exec_path path, const char *suffix) {
     char buf[50];
-    int n = snprintf(buf, sizeof(buf), "ml_tmp_%d_%s", getpid(), suffix);
+    int n = snprintf(buf, sizeof(buf), "ml_tmp_%d_%d_%s", (int) getpid(), ml_cache_get_thread_id(), suffix);
     if (n + 1 > sizeof(buf) || n + 1 > sizeof(ml_exec_path))
         return false;
 
@@ -43,6 +222,69 @@ static const struct ml_exec_run_fns ml_exec_run_fns_default = {
     .write_stdout = exec_fn_write_stdout,
     .printf_stderr = exec_fn_printf_stderr,
     .make_temp_path = exec_fn_make_temp_path,
+    .get_stdout_fd = exec_fn_get_stdout_fd,
+};
+
+static void do_capture_append(struct exec_capture *capture, const char *buf, int n) {
+    // a copy is kept until the output is too large to cache
+    if (capture->overflow)
+        return;
+
+    if (capture->count + n > ML_EXEC_CACHE_MAX_OUTPUT) {
+        capture->overflow = true;
+        return;
+    }
+
+    if (capture->count + n > capture->capacity) {
+        int capacity = capture->capacity ? capture->capacity : 1024;
+        while (capacity < capture->count + n)
+            capacity *= 2;
+
+        char *buffer = ml_memory_realloc(capture->buffer, capacity);
+        if (!buffer) {
+            capture->overflow = true;
+            return;
+        }
+        capture->buffer = buffer;
+        capture->capacity = capacity;
+    }
+
+    memcpy(capture->buffer + capture->count, buf, n);
+    capture->count += n;
+}
+
+static void exec_capture_fn_write_stdout(void *opaque, const char *buf, int n) {
+    struct exec_capture *capture = opaque;
+    capture->fns->write_stdout(capture->opaque, buf, n);
+    do_capture_append(capture, buf, n);
+}
+
+static void exec_capture_fn_printf_stderr(void *opaque, const char *fmt, ...) {
+    char buf[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    struct exec_capture *capture = opaque;
+    capture->fns->printf_stderr(capture->opaque, "%s", buf);
+}
+
+static bool exec_capture_fn_make_temp_path(void *opaque, ml_exec_path path, const char *suffix) {
+    struct exec_capture *capture = opaque;
+    return capture->fns->make_temp_path(capture->opaque, path, suffix);
+}
+
+static int exec_capture_fn_get_stdout_fd(void *opaque) {
+    struct exec_capture *capture = opaque;
+    return capture->fns->get_stdout_fd ? capture->fns->get_stdout_fd(capture->opaque) : -1;
+}
+
+static const struct ml_exec_run_fns ml_exec_run_fns_capture = {
+    .write_stdout = exec_capture_fn_write_stdout,
+    .printf_stderr = exec_capture_fn_printf_stderr,
+    .make_temp_path = exec_capture_fn_make_temp_path,
+    .get_stdout_fd = exec_capture_fn_get_stdout_fd,
 };
 
 static bool is_readable_file(struct ml_exec_ctx *ctx, const char *path) {
@@ -50,6 +292,180 @@ static bool is_readable_file(struct ml_exec_ctx *ctx, const char *path) {
     return (stat(path, &s) == 0) && S_ISREG(s.st_mode) && (access(path, R_OK) == 0);
 }
 
+static long long resolve_file_size(const char *path) {
+    struct stat s = {0};
+    return (stat(path, &s) == 0) ? (long long) s.st_size : 0;
+}
+
+static void do_span_begin(struct ml_exec_ctx *ctx, struct exec_span *span, const char *name) {
+    span->name = name;
+    span->start = ctx->trace ? ml_trace_now() : 0;
+    span->count = 0;
+}
+
+static void do_span_arg(struct exec_span *span, const char *name, long long value) {
+    if (span->count < ML_EXEC_SPAN_MAX_ARGS)
+        span->args[span->count++] = (struct ml_trace_arg) { name, value };
+}
+
+static void do_span_end(struct ml_exec_ctx *ctx, struct exec_span *span, int tid) {
+    ml_trace_span(ctx->trace, span->name, tid, span->start, span->args, span->count);
+}
+
+static void exec_count_symbols(void *opaque, enum ml_compile_visit_event event,
+                               const union ml_compile_visit_data *data) {
+    int *count = opaque;
+    if (event == ML_COMPILE_VISIT_EVENT_ARG_VISIT_INDEX || event == ML_COMPILE_VISIT_EVENT_GLOBAL_VISIT_VAR)
+        (*count)++;
+}
+
+static void do_span_symbol_args(struct ml_exec_ctx *ctx, struct exec_span *span, struct ml_compile_ctx *compile) {
+    // functions, and variables including arguments
+    if (!ctx->trace)
+        return;
+
+    int variables = 0;
+    ml_compile_accept(compile, &variables, exec_count_symbols);
+    do_span_arg(span, "functions", ml_compile_get_func_count(compile));
+    do_span_arg(span, "variables", variables);
+}
+
+static void do_stats_print_memory(struct ml_exec_ctx *ctx, const char *scope,
+                                  const struct ml_memory_stats *stats, int count) {
+    for (int i = 0; i < count; i++) {
+        ctx->fns->printf_stderr(ctx->opaque,
+                                "stats memory %s.%s count=%d capacity=%d allocs=%lld grows=%lld bytes=%lld peak=%lld\n",
+                                scope, stats[i].name, stats[i].count, stats[i].capacity,
+                                stats[i].allocs, stats[i].grows, stats[i].bytes, stats[i].peak_bytes);
+    }
+}
+
+static void do_stats_print_load(struct ml_exec_ctx *ctx, struct ml_token_ctx *token,
+                                struct ml_compile_ctx *compile) {
+    if (!(ctx->flags & ML_EXEC_FLAG_STATS))
+        return;
+
+    struct ml_token_stats stats;
+    ml_token_get_stats(token, &stats);
+    ctx->fns->printf_stderr(ctx->opaque, "stats token bytes=%lld refills=%lld tokens=%lld\n",
+                            stats.bytes, stats.refills, stats.tokens);
+
+    // only seen types are listed, the end of input is not a token
+    for (int i = 0; i < ML_TOKEN_TYPE_COUNT; i++) {
+        if (stats.types[i] && i != ML_TOKEN_TYPE_EOF)
+            ctx->fns->printf_stderr(ctx->opaque, "stats token.type %s=%lld\n",
+                                    ml_token_get_type_name(i), stats.types[i]);
+    }
+
+    struct ml_memory_stats memory[16];
+    int count = ml_token_get_memory_stats(token, memory, sizeof(memory) / sizeof(memory[0]));
+    do_stats_print_memory(ctx, "token", memory, count);
+    count = ml_compile_get_memory_stats(compile, memory, sizeof(memory) / sizeof(memory[0]));
+    do_stats_print_memory(ctx, "compile", memory, count);
+}
+
+static void do_stats_print_codegen(struct ml_exec_ctx *ctx, const struct ml_codegen_args *args) {
+    if (!args->stats)
+        return;
+
+    ctx->fns->printf_stderr(ctx->opaque, "stats codegen flushes=%lld bytes=%lld\n",
+                            args->stats->flushes, args->stats->bytes);
+    if (args->stats->buffers.allocs)
+        do_stats_print_memory(ctx, "codegen", &args->stats->buffers, 1);
+}
+
+static bool do_exec_resolve_cache_dir(struct ml_exec_ctx *ctx, char *dir) {
+    const char *path = ctx->cache_dir;
+    const char *suffix = "";
+    if (!path)
+        path = getenv("RUNML_CACHE_DIR");
+    if (!path && (path = getenv("XDG_CACHE_HOME")))
+        suffix = "/runml";
+    if (!path && (path = getenv("HOME")))
+        suffix = "/.cache/runml";
+    if (!path || !*path)
+        return false;
+
+    int n = snprintf(dir, ML_EXEC_CACHE_DIR_CAPACITY, "%s%s", path, suffix);
+    return n > 0 && n < ML_EXEC_CACHE_DIR_CAPACITY;
+}
+
+static int do_parse_options(struct ml_exec_ctx *ctx, int argc, char *argv[]) {
+    // options are placed before the input file, and the rest are passed to the program
+    int idx = 1;
+    while (idx < argc && strncmp(argv[idx], "--", 2) == 0) {
+        bool found = false;
+        for (int i = 0; i < sizeof(exec_options) / sizeof(exec_options[0]); i++) {
+            if (strcmp(argv[idx], exec_options[i].name) == 0) {
+                found = true;
+                ctx->flags |= exec_options[i].flag;
+                break;
+            }
+        }
+
+        if (!found && strncmp(argv[idx], "--trace=", 8) == 0) {
+            found = true;
+            ctx->trace_path = argv[idx] + 8;
+        }
+
+        // the report of a profiled program, which is "runml.profile" in the working directory otherwise
+        if (!found && strncmp(argv[idx], "--profile=", 10) == 0) {
+            found = true;
+            ctx->flags |= ML_EXEC_FLAG_PROFILE;
+            ctx->profile_path = argv[idx] + 10;
+        }
+
+        // rows of arguments are either comma separated text or native doubles
+        if (!found && strncmp(argv[idx], "--batch=", 8) == 0) {
+            found = true;
+            ctx->batch_path = argv[idx] + 8;
+            ctx->batch_binary = false;
+        }
+        if (!found && strncmp(argv[idx], "--batch-binary=", 15) == 0) {
+            found = true;
+            ctx->batch_path = argv[idx] + 15;
+            ctx->batch_binary = true;
+        }
+
+        // rows are shared by this many threads, and one means no sharding
+        if (!found && strncmp(argv[idx], "--batch-threads=", 16) == 0) {
+            char *end = NULL;
+            long value = strtol(argv[idx] + 16, &end, 10);
+            if (end == argv[idx] + 16 || *end || value <= 0 || value > ML_EXEC_BATCH_MAX_THREADS) {
+                ctx->fns->printf_stderr(ctx->opaque, "invalid option value %s\n", argv[idx]);
+                return -1;
+            }
+
+            found = true;
+            ctx->batch_threads = (int) value;
+        }
+
+        // limits take a positive value, e.g. "--wall-limit=500"
+        for (int i = 0; !found && i < sizeof(exec_limit_options) / sizeof(exec_limit_options[0]); i++) {
+            const char *name = exec_limit_options[i].name;
+            int count = strlen(name);
+            if (strncmp(argv[idx], name, count) == 0) {
+                char *end = NULL;
+                long value = strtol(argv[idx] + count, &end, 10);
+                if (end == argv[idx] + count || *end || value <= 0 || value > INT_MAX) {
+                    ctx->fns->printf_stderr(ctx->opaque, "invalid option value %s\n", argv[idx]);
+                    return -1;
+                }
+
+                found = true;
+                *(int*) ((char*) &ctx->limits + exec_limit_options[i].offset) = (int) value;
+            }
+        }
+
+        if (!found) {
+            ctx->fns->printf_stderr(ctx->opaque, "unknown option %s\n", argv[idx]);
+            return -1;
+        }
+        idx++;
+    }
+    return idx - 1;
+}
+
 static const char *resolve_compile_result_msg(enum ml_compile_result result) {
     switch (result) {
         case ML_COMPILE_RESULT_SUCCEED:
@@ -76,165 +492,2365 @@ static const char *resolve_compile_result_msg(enum ml_compile_result result) {
     return "unknown error";
 }
 
-static bool do_exec_translate_file(struct ml_exec_ctx *ctx, const char *in, const char *src) {
+static bool do_exec_load_file(struct ml_exec_ctx *ctx, const char *in,
+                              struct ml_compile_ctx **compile) {
     bool succeed = false;
     struct ml_token_ctx *token = NULL;
-    struct ml_compile_ctx *compile = NULL;
+    struct exec_span span;
 
-    if (!ml_token_ctx_init_file(&token, in)) {
+    do_span_begin(ctx, &span, "load");
+    bool loaded = ml_token_ctx_init_file(&token, in);
+    do_span_arg(&span, "bytes", resolve_file_size(in));
+    do_span_end(ctx, &span, 0);
+    if (!loaded) {
         ctx->fns->printf_stderr(ctx->opaque, "failed to init ml token context\n");
         goto done;
     }
 
-    if (!ml_compile_ctx_init(&compile, NULL)) {
+    if (!ml_compile_ctx_init(compile, NULL)) {
         ctx->fns->printf_stderr(ctx->opaque, "failed to init ml compile context\n");
         goto done;
     }
 
-    enum ml_compile_result result = ml_compile_feed(compile, token);
+    // tokenizing is driven by the compiler, so both are in the same span
+    do_span_begin(ctx, &span, "compile");
+    enum ml_compile_result result = ml_compile_feed(*compile, token);
+    struct ml_token_stats stats;
+    ml_token_get_stats(token, &stats);
+    do_span_arg(&span, "bytes", stats.bytes);
+    do_span_arg(&span, "tokens", stats.tokens);
+    if (result == ML_COMPILE_RESULT_SUCCEED)
+        do_span_symbol_args(ctx, &span, *compile);
+    do_span_end(ctx, &span, 0);
+    do_stats_print_load(ctx, token, *compile);
     if (result != ML_COMPILE_RESULT_SUCCEED) {
         ctx->fns->printf_stderr(ctx->opaque, "! %s\n", resolve_compile_result_msg(result));
         goto done;
     }
 
-    if (!ml_codegen_export_file(compile, src)) {
-        ctx->fns->printf_stderr(ctx->opaque, "failed to write ml translation file\n");
-        goto done;
-    }
-
     succeed = true;
 done:
     ml_token_ctx_uninit(&token);
-    ml_compile_ctx_uninit(&compile);
     return succeed;
 }
 
-static bool do_run_subprocess(struct ml_exec_ctx *ctx, uint32_t flags,
-                              const char *bin, char **argv,
-                              const char *error_msg) {
-    int fds[2];
-    if ((flags & EXEC_RUN_FLAG_GRAB_STDOUT)) {
-        if (pipe(fds) != 0) {
-            ctx->fns->printf_stderr(ctx->opaque, "failed to create pipe\n");
+static bool do_exec_evaluate(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile) {
+    // a program without arguments prints the same thing every time, so try to evaluate it in place
+    // anything unsupported or too expensive falls back to the compiled executable
+    struct ml_eval_ctx *eval = NULL;
+    const struct ml_eval_ctx_init_args args = {
+        .max_steps = 1 << 24,
+        .max_depth = 1024,
+        .max_output = 1 << 20,
+        .flags = (ctx->flags & ML_EXEC_FLAG_NO_MEMOIZE) ? 0 : ML_EVAL_FLAG_MEMOIZE,
+    };
+    if (!ml_eval_ctx_init(&eval, &args))
+        return false;
+
+    bool evaluated = false;
+    int count = 0;
+    struct exec_span span;
+    do_span_begin(ctx, &span, "evaluate");
+    if (ml_eval_load(eval, compile) == ML_EVAL_RESULT_SUCCEED
+        && ml_eval_run(eval) == ML_EVAL_RESULT_SUCCEED) {
+        const char *output = ml_eval_get_output(eval, &count);
+        if (count)
+            ctx->fns->write_stdout(ctx->opaque, output, count);
+        evaluated = true;
+    }
+    do_span_arg(&span, "evaluated", evaluated);
+    do_span_arg(&span, "bytes", count);
+    do_span_end(ctx, &span, 0);
+
+    ml_eval_ctx_uninit(&eval);
+    return evaluated;
+}
+
+static bool do_exec_resolve_runtime(struct ml_exec_ctx *ctx, ml_exec_path path) {
+    // the prebuilt runtime is installed next to the running executable unless it is given explicitly
+    const char *given = ctx->runtime_path ? ctx->runtime_path : getenv("RUNML_RUNTIME");
+    if (given) {
+        if (strlen(given) + 1 > sizeof(ml_exec_path))
             return false;
-        }
+        strcpy(path, given);
+    } else {
+        ml_exec_path self;
+        ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        if (n <= 0)
+            return false;
+
+        self[n] = 0;
+        char *slash = strrchr(self, '/');
+        if (!slash || (slash - self) + sizeof(ML_EXEC_RUNTIME_NAME) + 1 > sizeof(ml_exec_path))
+            return false;
+
+        slash[1] = 0;
+        strcpy(path, self);
+        strcat(path, ML_EXEC_RUNTIME_NAME);
     }
+    return is_readable_file(ctx, path);
+}
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        ctx->fns->printf_stderr(ctx->opaque, "failed to fork subprocess\n");
-        return false;
-    } else if (pid == 0) {
-        if (flags & EXEC_RUN_FLAG_GRAB_STDOUT) {
-            // close read pipe and redirect stdout to the write pipe
-            bool created = (dup2(fds[1], STDOUT_FILENO) != - 1);
-            close(fds[0]);
-            close(fds[1]);
-            if (!created)
-                goto fail;
-        }
+static int resolve_batch_thread_count(struct ml_exec_ctx *ctx) {
+    if (ctx->batch_threads > 0)
+        return ctx->batch_threads;
 
-        if (flags & EXEC_RUN_FLAG_SUPPRESS_STDERR)
-            close(STDERR_FILENO);
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1)
+        return 1;
+    return (count > ML_EXEC_BATCH_MAX_THREADS) ? ML_EXEC_BATCH_MAX_THREADS : (int) count;
+}
 
-        if (flags & EXEC_RUN_FLAG_SEARCH_BIN_PATH)
-            execvp(bin, argv);
-        else
-            execv(bin, argv);
+static bool check_batch_sharded(struct ml_exec_ctx *ctx) {
+    // a sharded program maps the rows by itself, instead of reading them from its standard input
+    return ctx->batch_path && resolve_batch_thread_count(ctx) > 1;
+}
 
-fail:
-        exit(EXIT_FAILURE);
+static bool check_single_build(struct ml_exec_ctx *ctx) {
+    // debug and profiled builds are meant to be looked into, so they are never replaced by anything faster to start
+    return (ctx->flags & (ML_EXEC_FLAG_DEBUG_INFO | ML_EXEC_FLAG_PROFILE)) && !ctx->batch_path;
+}
+
+static bool check_shared_selected(struct ml_exec_ctx *ctx) {
+    // a call in this process can neither be limited nor read rows from its standard input
+    return (ctx->flags & ML_EXEC_FLAG_SHARED) && !ctx->batch_path && !check_single_build(ctx)
+           && ctx->limits.cpu_seconds <= 0 && ctx->limits.wall_ms <= 0 && ctx->limits.memory_mb <= 0;
+}
+
+static bool check_fork_server_selected(struct ml_exec_ctx *ctx) {
+    // children are forked by the server, so limits could only be applied to the server itself
+    return (ctx->flags & ML_EXEC_FLAG_FORK_SERVER) && !ctx->batch_path && !check_shared_selected(ctx)
+           && !check_single_build(ctx) && ctx->limits.cpu_seconds <= 0 && ctx->limits.wall_ms <= 0 && ctx->limits.memory_mb <= 0;
+}
+
+static bool check_compact_enabled(struct ml_exec_ctx *ctx) {
+    // a compact translation is quicker to compile, but a kept source is meant to be read
+    return !(ctx->flags & (ML_EXEC_FLAG_NO_COMPACT | ML_EXEC_FLAG_DEBUG_INFO));
+}
+
+static struct ml_codegen_args resolve_codegen_args(struct ml_exec_ctx *ctx, bool extern_runtime,
+                                                   struct ml_codegen_stats *stats) {
+    *stats = (struct ml_codegen_stats) {0};
+    return (struct ml_codegen_args) {
+        .buffer_capacity = 0,
+        .thread_count = 0,
+        .flags = ML_CODEGEN_FLAG_PARALLEL
+                 | (check_compact_enabled(ctx) ? ML_CODEGEN_FLAG_COMPACT : 0)
+                 | (extern_runtime ? ML_CODEGEN_FLAG_EXTERN_RUNTIME : 0)
+                 | (ctx->batch_path ? ML_CODEGEN_FLAG_BATCH : 0)
+                 | (check_batch_sharded(ctx) ? ML_CODEGEN_FLAG_SHARD : 0)
+                 | (check_shared_selected(ctx) ? ML_CODEGEN_FLAG_SHARED : 0)
+                 | (check_fork_server_selected(ctx) ? ML_CODEGEN_FLAG_FORK_SERVER : 0)
+                 | ((ctx->flags & ML_EXEC_FLAG_PROFILE) ? ML_CODEGEN_FLAG_PROFILE : 0)
+                 | ((ctx->flags & ML_EXEC_FLAG_NO_MEMOIZE) ? 0 : ML_CODEGEN_FLAG_MEMOIZE),
+        .stats = (ctx->flags & ML_EXEC_FLAG_STATS) ? stats : NULL,
+        .profile_path = ctx->profile_path,
+    };
+}
+
+static bool do_exec_translate_file(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                                   const char *src, bool extern_runtime,
+                                   const char *source_path, const char *output_path) {
+    struct ml_codegen_stats stats;
+    struct ml_codegen_args codegen_args = resolve_codegen_args(ctx, extern_runtime, &stats);
+    codegen_args.source_path = source_path;
+    codegen_args.output_path = output_path;
+    struct exec_span span;
+    do_span_begin(ctx, &span, "codegen");
+    bool exported = ml_codegen_export_file(compile, src, &codegen_args);
+    do_span_arg(&span, "bytes", resolve_file_size(src));
+    do_span_symbol_args(ctx, &span, compile);
+    do_span_end(ctx, &span, 0);
+    do_stats_print_codegen(ctx, &codegen_args);
+    if (!exported) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to write ml translation file\n");
         return false;
-    } else {
-        if (flags & EXEC_RUN_FLAG_GRAB_STDOUT) {
-            close(fds[1]);
-
-            char buffer[1024];
-            while (true) {
-                int count = read(fds[0], buffer, sizeof(buffer));
-                if (count <= 0)
-                    break;
-                ctx->fns->write_stdout(ctx->opaque, buffer, count);
-            }
-            close(fds[0]);
-        }
+    }
+    return true;
+}
+
+static bool check_resource_limited(struct ml_exec_ctx *ctx) {
+    return ctx->limits.cpu_seconds > 0 || ctx->limits.memory_mb > 0;
+}
 
-        int status = 0;
-        if (waitpid(pid, &status, 0) != pid) {
-            ctx->fns->printf_stderr(ctx->opaque, "failed to wait subprocess\n");
+static bool do_set_limits(const struct ml_exec_limits *limits) {
+    // the soft cpu limit sends SIGXCPU, and the hard one follows a second later
+    if (limits->cpu_seconds > 0) {
+        struct rlimit limit = {
+            .rlim_cur = limits->cpu_seconds,
+            .rlim_max = limits->cpu_seconds + 1,
+        };
+        if (setrlimit(RLIMIT_CPU, &limit) != 0)
             return false;
-        }
+    }
 
-        if (status != 0) {
-            ctx->fns->printf_stderr(ctx->opaque, error_msg);
+    if (limits->memory_mb > 0) {
+        rlim_t size = (rlim_t) limits->memory_mb << 20;
+        struct rlimit limit = {
+            .rlim_cur = size,
+            .rlim_max = size,
+        };
+        if (setrlimit(RLIMIT_AS, &limit) != 0)
             return false;
-        }
+    }
+    return true;
+}
 
-        return true;
+static const struct timespec *resolve_deadline(struct ml_exec_ctx *ctx, struct timespec *deadline) {
+    // every subprocess has its own wall clock limit, which starts before it is spawned
+    if (ctx->limits.wall_ms <= 0)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ctx->limits.wall_ms / 1000;
+    deadline->tv_nsec += (ctx->limits.wall_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
     }
+    return deadline;
 }
 
-static bool do_exec_compile_file(struct ml_exec_ctx *ctx, char *src, char *exec) {
-    char *args[] = {"cc", "-o", exec, src, NULL};
-    uint32_t flags = EXEC_RUN_FLAG_SEARCH_BIN_PATH | EXEC_RUN_FLAG_SUPPRESS_STDERR;
-    return do_run_subprocess(ctx, flags, "cc", args,
-                             "failed to compile ml translation file");
+static int resolve_remaining_ms(const struct timespec *deadline) {
+    if (!deadline)
+        return -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ms = (deadline->tv_sec - now.tv_sec) * 1000LL + (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+    return (ms <= 0) ? 0 : (ms > INT_MAX) ? INT_MAX : (int) ms;
 }
 
-static bool do_exec_run_exec_file(struct ml_exec_ctx *ctx, char *exec, char **argv) {
-    return do_run_subprocess(ctx, EXEC_RUN_FLAG_GRAB_STDOUT, exec, argv,
-                             "failed to run translated executable file");
+static bool do_poll_readable(int fd, const struct timespec *deadline) {
+    // false means the deadline is reached first
+    if (!deadline)
+        return true;
+
+    struct pollfd p = {
+        .fd = fd,
+        .events = POLLIN,
+    };
+    int n = 0;
+    do {
+        n = poll(&p, 1, resolve_remaining_ms(deadline));
+    } while (n < 0 && errno == EINTR);
+    return n != 0;
 }
 
-int ml_exec_run_main(struct ml_exec_ctx *ctx, int argc, char *argv[]) {
-    int ret = EXIT_FAILURE;
-    bool src_written = false;
-    bool exec_written = false;
+static pid_t do_fork_limited(struct ml_exec_ctx *ctx, uint32_t flags,
+                             const char *bin, char **argv, int stdout_fd) {
+    // spawning has no attribute for resource limits, so the child sets them on itself before exec
+    // the child only makes async-signal-safe calls, and tells a failure by a close-on-exec pipe
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to spawn subprocess\n");
+        return -1;
+    }
 
-    if (!ctx->fns)
-        ctx->fns = &ml_exec_run_fns_default;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        bool prepared = true;
+        if (stdout_fd >= 0 && stdout_fd != STDOUT_FILENO)
+            prepared = (dup2(stdout_fd, STDOUT_FILENO) == STDOUT_FILENO);
+        if (flags & EXEC_RUN_FLAG_SUPPRESS_STDERR)
+            close(STDERR_FILENO);
+        if (flags & EXEC_RUN_FLAG_BATCH_INPUT) {
+            int fd = open(ctx->batch_path, O_RDONLY);
+            prepared = prepared && (fd >= 0) && (dup2(fd, STDIN_FILENO) == STDIN_FILENO);
+            if (fd > STDIN_FILENO)
+                close(fd);
+        }
 
-    if (argc < 2) {
-        ctx->fns->printf_stderr(ctx->opaque, "no input file\n");
-        goto fail;
+        char stage = 's';
+        if (prepared) {
+            stage = 'l';
+            if (do_set_limits(&ctx->limits)) {
+                stage = 'e';
+                if (flags & EXEC_RUN_FLAG_SEARCH_BIN_PATH)
+                    execvp(bin, argv);
+                else
+                    execv(bin, argv);
+            }
+        }
+        ssize_t written = write(fds[1], &stage, 1);
+        _exit(written == 1 ? 127 : 126);
     }
 
-    const char *input_path = argv[1];
-    if (!is_readable_file(ctx, input_path)) {
-        ctx->fns->printf_stderr(ctx->opaque, "not a readable file\n");
-        goto fail;
+    close(fds[1]);
+    char stage = 0;
+    ssize_t n = 0;
+    if (pid != -1) {
+        do {
+            n = read(fds[0], &stage, 1);
+        } while (n < 0 && errno == EINTR);
     }
+    close(fds[0]);
 
-    ml_exec_path src_path;
-    if (!ctx->fns->make_temp_path(ctx->opaque, src_path, "src.c")) {
-        ctx->fns->printf_stderr(ctx->opaque, "failed to generate translation file name\n");
-        goto fail;
+    // a missing binary is reported by the caller, like a failed subprocess
+    if (pid != -1 && n == 1) {
+        waitpid(pid, NULL, 0);
+        if (stage == 'l')
+            ctx->fns->printf_stderr(ctx->opaque, "failed to limit subprocess\n");
+        pid = -1;
     }
+    return pid;
+}
 
-    ml_exec_path exec_path;
-    if (!ctx->fns->make_temp_path(ctx->opaque, exec_path, "exec")) {
-        ctx->fns->printf_stderr(ctx->opaque, "failed to generate executable file name\n");
-        goto fail;
+static pid_t do_start_subprocess(struct ml_exec_ctx *ctx, uint32_t flags,
+                                 const char *bin, char **argv, int stdout_fd, int *read_fd) {
+    // the child is spawned without copying the page tables of a possibly large host process
+    // descriptors of the parent are close-on-exec, so that concurrent children do not hold each other's pipes
+    int fds[2];
+    if ((flags & EXEC_RUN_FLAG_GRAB_STDOUT)) {
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            ctx->fns->printf_stderr(ctx->opaque, "failed to create pipe\n");
+            return -1;
+        }
+
+        // fewer and larger transfers, it is only a hint
+        fcntl(fds[1], F_SETPIPE_SZ, ML_EXEC_PIPE_CAPACITY);
+        stdout_fd = fds[1];
     }
 
-    if (!do_exec_translate_file(ctx, input_path, src_path))
-        goto fail;
-    src_written = true;
+    pid_t pid = -1;
+    posix_spawn_file_actions_t actions;
+    if (check_resource_limited(ctx)) {
+        pid = do_fork_limited(ctx, flags, bin, argv, stdout_fd);
+        goto done;
+    }
 
-    if (!do_exec_compile_file(ctx, src_path, exec_path))
-        goto fail;
-    exec_written = true;
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to spawn subprocess\n");
+        goto done;
+    }
 
-    // the first parameter is ml source file path
-    // the following parameters should be passed to run the compiled executable
-    if (!do_exec_run_exec_file(ctx, exec_path, argv + 1))
-        goto fail;
+    bool prepared = true;
+    if (stdout_fd >= 0 && stdout_fd != STDOUT_FILENO)
+        prepared = (posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO) == 0);
+    if (flags & EXEC_RUN_FLAG_SUPPRESS_STDERR)
+        prepared = prepared && (posix_spawn_file_actions_addclose(&actions, STDERR_FILENO) == 0);
+    if (flags & EXEC_RUN_FLAG_BATCH_INPUT)
+        prepared = prepared && (posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, ctx->batch_path, O_RDONLY, 0) == 0);
 
-    ret = EXIT_SUCCESS;
-fail:
-    if (src_written)
-        unlink(src_path);
-    if (exec_written)
-        unlink(exec_path);
-    return ret;
+    // a missing binary is reported by the caller, like a failed subprocess
+    int err = -1;
+    if (prepared) {
+        err = (flags & EXEC_RUN_FLAG_SEARCH_BIN_PATH)
+              ? posix_spawnp(&pid, bin, &actions, NULL, argv, environ)
+              : posix_spawn(&pid, bin, &actions, NULL, argv, environ);
+    }
+    if (err != 0)
+        pid = -1;
+    posix_spawn_file_actions_destroy(&actions);
+
+done:
+    if (flags & EXEC_RUN_FLAG_GRAB_STDOUT) {
+        close(fds[1]);
+        if (pid == -1)
+            close(fds[0]);
+        else
+            *read_fd = fds[0];
+    }
+    return pid;
+}
+
+static void do_forward_output(struct ml_exec_ctx *ctx, int fd, const struct timespec *deadline) {
+    // the pipe is kept open on timeout, so the subprocess is stopped by the limit instead of SIGPIPE
+    char buffer[ML_EXEC_FORWARD_BUFFER_SIZE];
+    while (do_poll_readable(fd, deadline)) {
+        int count = read(fd, buffer, sizeof(buffer));
+        if (count <= 0)
+            break;
+        ctx->fns->write_stdout(ctx->opaque, buffer, count);
+    }
+}
+
+static bool do_write_fully(int fd, const char *buf, int count) {
+    while (count > 0) {
+        ssize_t n = write(fd, buf, count);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        count -= n;
+    }
+    return true;
+}
+
+static void exec_fn_write_fd(void *opaque, const char *buf, int n) {
+    // replayed output goes where the program itself would have written
+    do_write_fully(*(int*) opaque, buf, n);
+}
+
+static bool do_splice_output(struct exec_capture *capture, int fd, int dst, const struct timespec *deadline) {
+    // the pipe is duplicated for the cached copy, then moved to the destination without passing user space
+    // a destination that refuses splice, e.g. an append-only file, falls back to plain writes
+    char buffer[ML_EXEC_FORWARD_BUFFER_SIZE];
+    int copy[2];
+    if (pipe2(copy, O_CLOEXEC) != 0)
+        return false;
+    fcntl(copy[1], F_SETPIPE_SZ, ML_EXEC_PIPE_CAPACITY);
+
+    bool succeed = true;
+    bool spliced = true;
+    while (succeed && do_poll_readable(fd, deadline)) {
+        ssize_t count = tee(fd, copy[1], ML_EXEC_PIPE_CAPACITY, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0) {
+            succeed = (count == 0);
+            break;
+        }
+
+        for (ssize_t left = count; succeed && left > 0;) {
+            ssize_t n = -1;
+            if (spliced) {
+                n = splice(fd, NULL, dst, NULL, left, SPLICE_F_MOVE);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && errno == EINVAL)
+                    spliced = false;
+                else if (n <= 0)
+                    succeed = false;
+            }
+            if (!spliced) {
+                n = read(fd, buffer, (left < sizeof(buffer)) ? left : sizeof(buffer));
+                succeed = (n > 0) && do_write_fully(dst, buffer, n);
+            }
+            left -= succeed ? n : 0;
+        }
+
+        for (ssize_t left = count; succeed && left > 0;) {
+            ssize_t n = read(copy[0], buffer, (left < sizeof(buffer)) ? left : sizeof(buffer));
+            if (n <= 0) {
+                succeed = false;
+                break;
+            }
+            do_capture_append(capture, buffer, n);
+            left -= n;
+        }
+    }
+
+    close(copy[0]);
+    close(copy[1]);
+    return succeed;
+}
+
+static bool do_wait_deadline(pid_t pid, const struct timespec *deadline) {
+    // the subprocess is killed unless it exits in time
+    bool exited = false;
+    int fd = -1;
+#ifdef SYS_pidfd_open
+    fd = (int) syscall(SYS_pidfd_open, pid, 0);
+#endif
+    if (fd >= 0) {
+        exited = do_poll_readable(fd, deadline);
+        close(fd);
+    } else {
+        while (true) {
+            siginfo_t info = {0};
+            if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid == pid) {
+                exited = true;
+                break;
+            }
+
+            int remaining = resolve_remaining_ms(deadline);
+            if (remaining == 0)
+                break;
+            usleep(((remaining < ML_EXEC_LIMIT_POLL_INTERVAL_MS) ? remaining : ML_EXEC_LIMIT_POLL_INTERVAL_MS) * 1000);
+        }
+    }
+
+    if (!exited)
+        kill(pid, SIGKILL);
+    return exited;
+}
+
+static bool do_wait_subprocess(struct ml_exec_ctx *ctx, pid_t pid, const struct timespec *deadline,
+                               const char *error_msg) {
+    bool killed = deadline && !do_wait_deadline(pid, deadline);
+
+    int status = 0;
+    struct rusage usage = {0};
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to wait subprocess\n");
+        return false;
+    }
+
+    if (status != 0) {
+        // the hard cpu limit ends with SIGKILL if SIGXCPU is not fatal, while other kills are told by the cpu time
+        int sig = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+        long long cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000LL
+                           + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+        bool cpu_killed = !killed && sig == SIGKILL && cpu_ms >= ctx->limits.cpu_seconds * 1000LL;
+        bool cpu_exceeded = (ctx->limits.cpu_seconds > 0) && (sig == SIGXCPU || cpu_killed);
+        if (killed) {
+            ctx->timed_out = true;
+            ctx->fns->printf_stderr(ctx->opaque, "subprocess exceeded the wall clock limit of %d ms\n",
+                                    ctx->limits.wall_ms);
+        } else if (cpu_exceeded) {
+            ctx->timed_out = true;
+            ctx->fns->printf_stderr(ctx->opaque, "subprocess exceeded the cpu time limit of %d s\n",
+                                    ctx->limits.cpu_seconds);
+        } else if (sig) {
+            ctx->fns->printf_stderr(ctx->opaque, "subprocess terminated by signal %d\n", sig);
+        }
+
+        if (error_msg)
+            ctx->fns->printf_stderr(ctx->opaque, error_msg);
+        return false;
+    }
+
+    return true;
+}
+
+static bool do_run_subprocess(struct ml_exec_ctx *ctx, uint32_t flags,
+                              const char *bin, char **argv,
+                              struct exec_span *span, const char *error_msg) {
+    int fd = -1;
+    struct timespec deadline;
+    const struct timespec *p_deadline = resolve_deadline(ctx, &deadline);
+    pid_t pid = do_start_subprocess(ctx, flags, bin, argv, -1, &fd);
+    if (pid == -1) {
+        if (error_msg)
+            ctx->fns->printf_stderr(ctx->opaque, error_msg);
+        return false;
+    }
+
+    if (flags & EXEC_RUN_FLAG_GRAB_STDOUT)
+        do_forward_output(ctx, fd, p_deadline);
+
+    bool succeed = do_wait_subprocess(ctx, pid, p_deadline, error_msg);
+    if (flags & EXEC_RUN_FLAG_GRAB_STDOUT)
+        close(fd);
+    if (span)
+        do_span_end(ctx, span, pid);
+    return succeed;
+}
+
+static void do_jobs_init(struct exec_jobs *jobs) {
+    jobs->count = 0;
+    jobs->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+static void do_jobs_uninit(struct exec_jobs *jobs) {
+    for (int i = 0; i < jobs->count; i++)
+        if (jobs->pidfds[i] >= 0)
+            close(jobs->pidfds[i]);
+    if (jobs->epoll_fd >= 0)
+        close(jobs->epoll_fd);
+}
+
+static void do_jobs_add(struct exec_jobs *jobs, pid_t pid, const struct exec_span *span) {
+    // without pidfd support, the job is only waited in the order it is added
+    int fd = -1;
+#ifdef SYS_pidfd_open
+    if (jobs->epoll_fd >= 0)
+        fd = (int) syscall(SYS_pidfd_open, pid, 0);
+#endif
+    if (fd >= 0) {
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.fd = fd,
+        };
+        if (epoll_ctl(jobs->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    jobs->pids[jobs->count] = pid;
+    jobs->pidfds[jobs->count] = fd;
+    jobs->spans[jobs->count] = *span;
+    jobs->count++;
+}
+
+static int resolve_jobs_exited_index(struct exec_jobs *jobs, const struct timespec *deadline) {
+    // a pidfd becomes readable once its process exits
+    for (int i = 0; i < jobs->count; i++)
+        if (jobs->pidfds[i] < 0)
+            return 0;
+
+    struct epoll_event event;
+    int n = 0;
+    do {
+        n = epoll_wait(jobs->epoll_fd, &event, 1, resolve_remaining_ms(deadline));
+    } while (n < 0 && errno == EINTR);
+
+    for (int i = 0; n > 0 && i < jobs->count; i++)
+        if (jobs->pidfds[i] == event.data.fd)
+            return i;
+    return 0;
+}
+
+static bool do_jobs_wait_any(struct ml_exec_ctx *ctx, struct exec_jobs *jobs,
+                             const struct timespec *deadline, const char *error_msg) {
+    // on timeout the first job is taken, and it is killed by the deadline check
+    int idx = resolve_jobs_exited_index(jobs, deadline);
+    pid_t pid = jobs->pids[idx];
+    struct exec_span span = jobs->spans[idx];
+    if (jobs->pidfds[idx] >= 0)
+        close(jobs->pidfds[idx]);
+
+    jobs->count--;
+    jobs->pids[idx] = jobs->pids[jobs->count];
+    jobs->pidfds[idx] = jobs->pidfds[jobs->count];
+    jobs->spans[idx] = jobs->spans[jobs->count];
+    bool succeed = do_wait_subprocess(ctx, pid, deadline, error_msg);
+    do_span_end(ctx, &span, pid);
+    return succeed;
+}
+
+static long resolve_elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+static const struct exec_compiler *resolve_known_compiler(const char *compiler) {
+    // a path or an unknown name takes the generic flags of "cc"
+    const char *slash = strrchr(compiler, '/');
+    const char *name = slash ? (slash + 1) : compiler;
+    int count = sizeof(exec_compilers) / sizeof(exec_compilers[0]);
+    for (int i = 0; i < count; i++)
+        if (strcmp(exec_compilers[i].name, name) == 0)
+            return &exec_compilers[i];
+    return &exec_compilers[count - 1];
+}
+
+static bool check_bin_available(const char *name) {
+    // the same lookup as execvp()
+    if (strchr(name, '/'))
+        return access(name, X_OK) == 0;
+
+    const char *path = getenv("PATH");
+    while (path && *path) {
+        const char *end = strchr(path, ':');
+        int count = end ? (int) (end - path) : (int) strlen(path);
+        char buf[ML_EXEC_CACHE_DIR_CAPACITY];
+        int n = snprintf(buf, sizeof(buf), "%.*s/%s", count, path, name);
+        if (n > 0 && n < sizeof(buf) && access(buf, X_OK) == 0)
+            return true;
+        path = end ? (end + 1) : NULL;
+    }
+    return false;
+}
+
+static bool do_copy_string(char *dst, int capacity, const char *src, int count) {
+    if (count + 1 > capacity)
+        return false;
+    memcpy(dst, src, count);
+    dst[count] = 0;
+    return true;
+}
+
+static void do_driver_set(struct exec_driver *driver, const char *key, int key_count,
+                          const char *value, int value_count) {
+    if (key_count == 8 && strncmp(key, "compiler", 8) == 0) {
+        do_copy_string(driver->compiler, sizeof(driver->compiler), value, value_count);
+        return;
+    }
+
+    for (int i = 0; i < EXEC_BUILD_PROFILE_COUNT; i++) {
+        const char *name = exec_build_profiles[i].name;
+        int count = strlen(name);
+        if (key_count == 7 && strncmp(key, "profile", 7) == 0
+            && value_count == count && strncmp(value, name, count) == 0) {
+            driver->profile = i;
+            return;
+        }
+
+        if (key_count == count + 6 && strncmp(key, "flags.", 6) == 0 && strncmp(key + 6, name, count) == 0) {
+            driver->has_flags[i] = do_copy_string(driver->flags[i], sizeof(driver->flags[i]), value, value_count);
+            return;
+        }
+    }
+}
+
+static bool do_driver_resolve_config_path(struct ml_exec_ctx *ctx, ml_cache_path path) {
+    const char *given = ctx->config_path ? ctx->config_path : getenv("RUNML_CONFIG");
+    const char *suffix = "";
+    if (!given && (given = getenv("XDG_CONFIG_HOME")))
+        suffix = ML_EXEC_DRIVER_CONFIG_NAME;
+    if (!given && (given = getenv("HOME")))
+        suffix = "/.config" ML_EXEC_DRIVER_CONFIG_NAME;
+    if (!given || !*given)
+        return false;
+
+    int n = snprintf(path, sizeof(ml_cache_path), "%s%s", given, suffix);
+    return n > 0 && n < sizeof(ml_cache_path);
+}
+
+static void do_driver_load_config(struct ml_exec_ctx *ctx, struct exec_driver *driver) {
+    // each line is "key = value", and lines starting with "#" are comments
+    ml_cache_path path;
+    if (!do_driver_resolve_config_path(ctx, path))
+        return;
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return;
+
+    char line[ML_EXEC_DRIVER_FLAGS_CAPACITY * 2];
+    while (fgets(line, sizeof(line), f)) {
+        char *equal = strchr(line, '=');
+        if (line[0] == '#' || !equal)
+            continue;
+
+        char *key = line;
+        char *key_end = equal;
+        char *value = equal + 1;
+        char *value_end = value + strlen(value);
+        while (key < key_end && (*key == ' ' || *key == '\t'))
+            key++;
+        while (key_end > key && (key_end[-1] == ' ' || key_end[-1] == '\t'))
+            key_end--;
+        while (*value == ' ' || *value == '\t')
+            value++;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t' || value_end[-1] == '\n'))
+            value_end--;
+        do_driver_set(driver, key, key_end - key, value, value_end - value);
+    }
+    fclose(f);
+}
+
+static void do_driver_load_env(struct exec_driver *driver) {
+    const char *value = getenv("RUNML_CC");
+    if (value)
+        do_driver_set(driver, "compiler", 8, value, strlen(value));
+
+    value = getenv("RUNML_BUILD_PROFILE");
+    if (value)
+        do_driver_set(driver, "profile", 7, value, strlen(value));
+
+    for (int i = 0; i < EXEC_BUILD_PROFILE_COUNT; i++) {
+        value = getenv(exec_build_profiles[i].env_name);
+        if (value)
+            driver->has_flags[i] = do_copy_string(driver->flags[i], sizeof(driver->flags[i]), value, strlen(value));
+    }
+}
+
+static void do_driver_init(struct ml_exec_ctx *ctx, struct exec_driver *driver) {
+    // environment variables take precedence over the config file
+    *driver = (struct exec_driver) {0};
+    do_driver_load_config(ctx, driver);
+    do_driver_load_env(driver);
+
+    char dir[ML_EXEC_CACHE_DIR_CAPACITY];
+    int n = do_exec_resolve_cache_dir(ctx, dir)
+            ? snprintf(driver->probe_path, sizeof(driver->probe_path), "%s%s", dir, ML_EXEC_DRIVER_PROBE_NAME)
+            : 0;
+    if (n <= 0 || n >= sizeof(driver->probe_path))
+        driver->probe_path[0] = 0;
+}
+
+static bool check_profile_supported(const struct exec_compiler *compiler, enum exec_build_profile profile) {
+    return (profile != EXEC_BUILD_PROFILE_OPTIMIZED && profile != EXEC_BUILD_PROFILE_BATCH) || compiler->optimizing;
+}
+
+static bool do_driver_load_probe(struct exec_driver *driver, enum exec_build_profile profile,
+                                 ml_exec_path compiler, bool *recorded) {
+    // the fastest recorded compiler which can build the profile
+    *recorded = false;
+    FILE *f = driver->probe_path[0] ? fopen(driver->probe_path, "r") : NULL;
+    if (!f)
+        return false;
+
+    long best = -1;
+    long elapsed = 0;
+    char name[64];
+    while (fscanf(f, "%63s %ld", name, &elapsed) == 2) {
+        const struct exec_compiler *known = resolve_known_compiler(name);
+        *recorded = true;
+        if (strcmp(known->name, name) != 0 || !check_profile_supported(known, profile))
+            continue;
+
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+            strcpy(compiler, name);
+        }
+    }
+    fclose(f);
+    return best >= 0;
+}
+
+static void do_driver_pick_static(enum exec_build_profile profile, ml_exec_path compiler) {
+    int count = sizeof(exec_compilers) / sizeof(exec_compilers[0]);
+    for (int i = 0; i < count; i++) {
+        if (check_profile_supported(&exec_compilers[i], profile) && check_bin_available(exec_compilers[i].name)) {
+            strcpy(compiler, exec_compilers[i].name);
+            return;
+        }
+    }
+    strcpy(compiler, exec_compilers[count - 1].name);
+}
+
+static int do_driver_make_args(struct exec_driver *driver, enum exec_build_profile profile,
+                               char *compiler, char *flags, char **args) {
+    // flags are split by blanks, quoting is not supported
+    const char *profile_flags = driver->has_flags[profile]
+                                ? driver->flags[profile]
+                                : resolve_known_compiler(compiler)->flags[profile];
+    if (!do_copy_string(flags, ML_EXEC_DRIVER_FLAGS_CAPACITY, profile_flags, strlen(profile_flags)))
+        return -1;
+
+    int count = 0;
+    char *saved = NULL;
+    args[count++] = compiler;
+    for (char *p = strtok_r(flags, " \t", &saved); p && count <= ML_EXEC_DRIVER_MAX_ARGS; p = strtok_r(NULL, " \t", &saved))
+        args[count++] = p;
+    return count;
+}
+
+static bool do_driver_run(struct ml_exec_ctx *ctx, struct exec_driver *driver,
+                          enum exec_build_profile profile, char *compiler,
+                          char *src, char *exec, char *runtime, const char *error_msg) {
+    char flags[ML_EXEC_DRIVER_FLAGS_CAPACITY];
+    char *args[ML_EXEC_DRIVER_MAX_ARGS + 7];
+    int count = do_driver_make_args(driver, profile, compiler, flags, args);
+    if (count < 0)
+        return false;
+
+    // sharded batches start their own threads, whatever flags are configured
+    if (check_batch_sharded(ctx))
+        args[count++] = "-pthread";
+    args[count++] = "-o";
+    args[count++] = exec;
+    args[count++] = src;
+    args[count++] = runtime;
+    args[count] = NULL;
+
+    struct exec_span span;
+    do_span_begin(ctx, &span, "cc");
+    do_span_arg(&span, "bytes", resolve_file_size(src));
+    uint32_t flags_run = EXEC_RUN_FLAG_SEARCH_BIN_PATH | EXEC_RUN_FLAG_SUPPRESS_STDERR;
+    return do_run_subprocess(ctx, flags_run, compiler, args, &span, error_msg);
+}
+
+static void do_driver_store_probe(struct ml_exec_ctx *ctx, struct exec_driver *driver,
+                                  const char *record, int count) {
+    // the cache directory is created on demand, and the record is renamed into place
+    char dir[ML_EXEC_CACHE_DIR_CAPACITY];
+    struct ml_cache_ctx *cache = NULL;
+    if (!do_exec_resolve_cache_dir(ctx, dir) || !ml_cache_ctx_init(&cache, dir, NULL))
+        return;
+    ml_cache_ctx_uninit(&cache);
+
+    ml_cache_path temp_path;
+    if (!ml_cache_make_temp_path(driver->probe_path, temp_path))
+        return;
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return;
+
+    bool written = (write(fd, record, count) == count);
+    written = (close(fd) == 0) && written;
+    if (!written || rename(temp_path, driver->probe_path) != 0)
+        unlink(temp_path);
+}
+
+static bool do_driver_probe(struct ml_exec_ctx *ctx, struct exec_driver *driver,
+                            char *src, char *exec, char *runtime) {
+    // every available compiler builds the real program once, then the fastest result is kept
+    enum { COUNT = sizeof(exec_compilers) / sizeof(exec_compilers[0]) };
+    ml_cache_path paths[COUNT];
+    bool built[COUNT] = {0};
+    char record[COUNT * 96];
+    int record_count = 0;
+    int best = -1;
+    long best_elapsed = 0;
+    for (int i = 0; i < COUNT; i++) {
+        char *name = (char*) exec_compilers[i].name;
+        int n = snprintf(paths[i], sizeof(paths[i]), "%s.%s", exec, name);
+        if (n <= 0 || n >= sizeof(paths[i]) || !check_bin_available(name))
+            continue;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        built[i] = do_driver_run(ctx, driver, EXEC_BUILD_PROFILE_FAST_COMPILE, name, src, paths[i], runtime, NULL);
+        if (!built[i])
+            continue;
+
+        long elapsed = resolve_elapsed_ms(&start);
+        record_count += snprintf(record + record_count, sizeof(record) - record_count, "%s %ld\n", name, elapsed);
+        if (best < 0 || elapsed < best_elapsed) {
+            best = i;
+            best_elapsed = elapsed;
+        }
+    }
+
+    if (record_count)
+        do_driver_store_probe(ctx, driver, record, record_count);
+
+    bool succeed = (best >= 0) && rename(paths[best], exec) == 0;
+    for (int i = 0; i < COUNT; i++)
+        if (built[i] && i != best)
+            unlink(paths[i]);
+
+    if (!succeed)
+        ctx->fns->printf_stderr(ctx->opaque, "failed to compile ml translation file\n");
+    return succeed;
+}
+
+static bool do_driver_resolve_compiler(struct exec_driver *driver, enum exec_build_profile profile,
+                                       ml_exec_path compiler) {
+    // false means the compiler should be measured by the caller instead
+    bool recorded = false;
+    if (driver->compiler[0]) {
+        strcpy(compiler, driver->compiler);
+    } else if (!do_driver_load_probe(driver, profile, compiler, &recorded)) {
+        if (!recorded && driver->probe_path[0] && profile == EXEC_BUILD_PROFILE_FAST_COMPILE)
+            return false;
+        do_driver_pick_static(profile, compiler);
+    }
+    return true;
+}
+
+static bool do_exec_compile_file(struct ml_exec_ctx *ctx, enum exec_build_profile profile,
+                                 char *src, char *exec, char *runtime) {
+    // the compiler is measured once by building the first program, unless it is configured
+    struct exec_driver driver;
+    do_driver_init(ctx, &driver);
+    if (profile == EXEC_BUILD_PROFILE_CONFIGURED)
+        profile = driver.profile;
+
+    ml_exec_path compiler;
+    if (!do_driver_resolve_compiler(&driver, profile, compiler))
+        return do_driver_probe(ctx, &driver, src, exec, runtime);
+
+    return do_driver_run(ctx, &driver, profile, compiler, src, exec, runtime,
+                         "failed to compile ml translation file\n");
+}
+
+static bool do_exec_run_exec_file(struct ml_exec_ctx *ctx, char *exec, char **argv) {
+    // the program writes straight to the destination of the host when there is one
+    // output kept for the cache still reaches it by splice, and only the cached copy is read
+    const char *error_msg = "failed to run translated executable file\n";
+    struct exec_span span;
+    int argc = 0;
+    while (argv[argc])
+        argc++;
+    do_span_begin(ctx, &span, "exec");
+    do_span_arg(&span, "args", argc ? argc - 1 : 0);
+
+    // rows of a batch are read from the standard input of the program
+    uint32_t input = (ctx->batch_path && !check_batch_sharded(ctx)) ? EXEC_RUN_FLAG_BATCH_INPUT : 0;
+    int dst = ctx->fns->get_stdout_fd ? ctx->fns->get_stdout_fd(ctx->opaque) : -1;
+    if (dst < 0)
+        return do_run_subprocess(ctx, EXEC_RUN_FLAG_GRAB_STDOUT | input, exec, argv, &span, error_msg);
+
+    bool intercepted = (ctx->fns == &ml_exec_run_fns_capture);
+    int fd = -1;
+    struct timespec deadline;
+    const struct timespec *p_deadline = resolve_deadline(ctx, &deadline);
+    pid_t pid = do_start_subprocess(ctx, (intercepted ? EXEC_RUN_FLAG_GRAB_STDOUT : 0) | input, exec, argv, dst, &fd);
+    if (pid == -1) {
+        ctx->fns->printf_stderr(ctx->opaque, error_msg);
+        return false;
+    }
+
+    // a broken destination stops the subprocess as if it wrote there directly
+    bool forwarded = true;
+    if (intercepted) {
+        forwarded = do_splice_output(ctx->opaque, fd, dst, p_deadline);
+        if (!forwarded) {
+            ((struct exec_capture*) ctx->opaque)->overflow = true;
+            close(fd);
+        }
+    }
+
+    bool succeed = do_wait_subprocess(ctx, pid, p_deadline, error_msg) && forwarded;
+    if (intercepted && forwarded)
+        close(fd);
+    do_span_end(ctx, &span, pid);
+    return succeed;
+}
+
+#ifdef ML_EXEC_WITH_LIBTCC
+// libtcc keeps global state, so only one program is compiled at a time
+static pthread_mutex_t exec_libtcc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool check_libtcc_selected(struct ml_exec_ctx *ctx) {
+    // the same choice as a build of the configured profile, but only once tcc is known to be there
+    struct exec_driver driver;
+    do_driver_init(ctx, &driver);
+
+    bool recorded = false;
+    ml_exec_path compiler;
+    if (driver.compiler[0])
+        strcpy(compiler, driver.compiler);
+    else if (!do_driver_load_probe(&driver, driver.profile, compiler, &recorded))
+        return false;
+    return strcmp(resolve_known_compiler(compiler)->name, "tcc") == 0;
+}
+
+static bool do_exec_run_libtcc(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                               char *argv[]) {
+    // the program is compiled into memory and its entry is called in this process
+    // like a shared object, it prints to the sink of this run rather than to fd 1 of the whole process
+    bool succeed = false;
+    char *source = NULL;
+    int count = 0;
+    TCCState *state = NULL;
+    bool locked = false;
+
+    struct ml_codegen_stats stats;
+    struct ml_codegen_args codegen_args = resolve_codegen_args(ctx, false, &stats);
+    codegen_args.flags |= ML_CODEGEN_FLAG_SHARED;
+    struct exec_span span;
+    do_span_begin(ctx, &span, "codegen");
+    if (!ml_codegen_export_buffer(compile, &source, &count, &codegen_args)) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to write ml translation file\n");
+        goto done;
+    }
+    do_span_arg(&span, "bytes", count);
+    do_span_symbol_args(ctx, &span, compile);
+    do_span_end(ctx, &span, 0);
+    do_stats_print_codegen(ctx, &codegen_args);
+
+    char *text = ml_memory_realloc(source, count + 1);
+    if (!text)
+        goto done;
+    source = text;
+    source[count] = 0;
+
+    pthread_mutex_lock(&exec_libtcc_mutex);
+    locked = true;
+    state = tcc_new();
+    if (!state)
+        goto done;
+
+    tcc_set_output_type(state, TCC_OUTPUT_MEMORY);
+    do_span_begin(ctx, &span, "cc");
+    do_span_arg(&span, "bytes", count);
+    // older releases take the destination of the relocated code, which newer ones always allocate
+#ifdef TCC_RELOCATE_AUTO
+    bool relocated = (tcc_compile_string(state, source) == 0) && (tcc_relocate(state, TCC_RELOCATE_AUTO) >= 0);
+#else
+    bool relocated = (tcc_compile_string(state, source) == 0) && (tcc_relocate(state) >= 0);
+#endif
+    ml_codegen_entry_fn entry = relocated ? (ml_codegen_entry_fn) tcc_get_symbol(state, ML_EXEC_SHARED_ENTRY_NAME) : NULL;
+    if (!entry) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to compile ml translation file\n");
+        goto done;
+    }
+    do_span_end(ctx, &span, 0);
+
+    // the first parameter is ml source file path, which is argv[0] of the program
+    int argc = 0;
+    while (argv[argc + 1])
+        argc++;
+
+    const struct ml_codegen_sink sink = {
+        .write = ctx->fns->write_stdout,
+        .opaque = ctx->opaque,
+    };
+    do_span_begin(ctx, &span, "exec");
+    do_span_arg(&span, "args", argc ? argc - 1 : 0);
+    succeed = (entry(argc, argv + 1, &sink) == 0);
+    do_span_end(ctx, &span, 0);
+    if (!succeed)
+        ctx->fns->printf_stderr(ctx->opaque, "failed to run translated executable file\n");
+
+done:
+    if (state)
+        tcc_delete(state);
+    if (locked)
+        pthread_mutex_unlock(&exec_libtcc_mutex);
+    if (source)
+        ml_memory_free(source);
+    return succeed;
+}
+#endif
+
+static bool check_split_selected(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile) {
+    // splitting only pays off when units are compiled in parallel
+    if (ctx->flags & ML_EXEC_FLAG_SPLIT)
+        return true;
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1
+           && ml_compile_get_func_count(compile) >= ML_EXEC_SPLIT_MIN_FUNCS;
+}
+
+static int resolve_split_job_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1)
+        return 1;
+    return (count > ML_EXEC_SPLIT_MAX_JOBS) ? ML_EXEC_SPLIT_MAX_JOBS : (int) count;
+}
+
+static bool do_split_compile_units(struct ml_exec_ctx *ctx, struct exec_driver *driver, char *compiler,
+                                   ml_exec_path *srcs, ml_exec_path *objs, int count, int jobs,
+                                   int *started) {
+    // at most one job per processor, and whichever job exits first makes room for the next
+    struct exec_jobs running;
+    uint32_t flags_run = EXEC_RUN_FLAG_SEARCH_BIN_PATH | EXEC_RUN_FLAG_SUPPRESS_STDERR;
+    bool succeed = true;
+    struct timespec deadline;
+    const struct timespec *p_deadline = resolve_deadline(ctx, &deadline);
+    *started = 0;
+    do_jobs_init(&running);
+    while (running.count || (succeed && *started < count)) {
+        if (succeed && *started < count && running.count < jobs) {
+            char flags[ML_EXEC_DRIVER_FLAGS_CAPACITY];
+            char *args[ML_EXEC_DRIVER_MAX_ARGS + 6];
+            int n = do_driver_make_args(driver, driver->profile, compiler, flags, args);
+            if (n < 0) {
+                succeed = false;
+                continue;
+            }
+
+            args[n++] = "-c";
+            args[n++] = srcs[*started];
+            args[n++] = "-o";
+            args[n++] = objs[*started];
+            args[n] = NULL;
+
+            struct exec_span span;
+            do_span_begin(ctx, &span, "cc");
+            do_span_arg(&span, "bytes", resolve_file_size(srcs[*started]));
+            pid_t pid = do_start_subprocess(ctx, flags_run, compiler, args, -1, NULL);
+            if (pid == -1) {
+                succeed = false;
+                continue;
+            }
+            do_jobs_add(&running, pid, &span);
+            (*started)++;
+        } else {
+            succeed = do_jobs_wait_any(ctx, &running, p_deadline, NULL) && succeed;
+        }
+    }
+    do_jobs_uninit(&running);
+    return succeed;
+}
+
+static bool do_split_link(struct ml_exec_ctx *ctx, struct exec_driver *driver, char *compiler,
+                          ml_exec_path *objs, int count, char *exec, char *runtime) {
+    char flags[ML_EXEC_DRIVER_FLAGS_CAPACITY];
+    char *args[ML_EXEC_DRIVER_MAX_ARGS + ML_EXEC_SPLIT_MAX_UNITS + 6];
+    int n = do_driver_make_args(driver, driver->profile, compiler, flags, args);
+    if (n < 0)
+        return false;
+
+    args[n++] = "-o";
+    args[n++] = exec;
+    for (int i = 0; i < count; i++)
+        args[n++] = objs[i];
+    args[n++] = runtime;
+    args[n] = NULL;
+
+    struct exec_span span;
+    do_span_begin(ctx, &span, "link");
+    do_span_arg(&span, "objects", count);
+    uint32_t flags_run = EXEC_RUN_FLAG_SEARCH_BIN_PATH | EXEC_RUN_FLAG_SUPPRESS_STDERR;
+    return do_run_subprocess(ctx, flags_run, compiler, args, &span, NULL);
+}
+
+static bool do_exec_run_split(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                              char *argv[]) {
+    // the header is shared, and every other unit is compiled by its own compiler process
+    bool succeed = false;
+    bool header_written = false;
+    bool exec_written = false;
+    int src_count = 0;
+    int obj_count = 0;
+
+    ml_exec_path runtime_path;
+    bool has_runtime = do_exec_resolve_runtime(ctx, runtime_path);
+    int job_count = resolve_split_job_count();
+    struct ml_codegen_stats stats;
+    struct ml_codegen_args codegen_args = resolve_codegen_args(ctx, has_runtime, &stats);
+    codegen_args.unit_count = job_count;
+    int unit_count = ml_codegen_get_unit_count(compile, &codegen_args);
+
+    ml_exec_path header_path;
+    ml_exec_path exec_path;
+    ml_exec_path src_paths[ML_EXEC_SPLIT_MAX_UNITS];
+    ml_exec_path obj_paths[ML_EXEC_SPLIT_MAX_UNITS];
+    if (!ctx->fns->make_temp_path(ctx->opaque, header_path, "hdr.h")
+        || !ctx->fns->make_temp_path(ctx->opaque, exec_path, "exec")) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to generate translation file name\n");
+        goto done;
+    }
+
+    // units are placed next to the header, so it is included by its base name
+    struct exec_span span;
+    long long bytes = 0;
+    do_span_begin(ctx, &span, "codegen");
+    const char *header_name = strrchr(header_path, '/');
+    header_name = header_name ? header_name + 1 : header_path;
+    if (!ml_codegen_export_unit_file(compile, ML_CODEGEN_UNIT_HEADER, header_name, header_path, &codegen_args)) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to write ml translation file\n");
+        goto done;
+    }
+    header_written = true;
+
+    for (int i = ML_CODEGEN_UNIT_MAIN; i < unit_count; i++) {
+        char src_suffix[16];
+        char obj_suffix[16];
+        snprintf(src_suffix, sizeof(src_suffix), "u%d.c", i);
+        snprintf(obj_suffix, sizeof(obj_suffix), "u%d.o", i);
+        if (!ctx->fns->make_temp_path(ctx->opaque, src_paths[src_count], src_suffix)
+            || !ctx->fns->make_temp_path(ctx->opaque, obj_paths[src_count], obj_suffix)) {
+            ctx->fns->printf_stderr(ctx->opaque, "failed to generate translation file name\n");
+            goto done;
+        }
+
+        if (!ml_codegen_export_unit_file(compile, i, header_name, src_paths[src_count], &codegen_args)) {
+            ctx->fns->printf_stderr(ctx->opaque, "failed to write ml translation file\n");
+            goto done;
+        }
+        bytes += resolve_file_size(src_paths[src_count]);
+        src_count++;
+    }
+    do_span_arg(&span, "bytes", bytes + resolve_file_size(header_path));
+    do_span_arg(&span, "units", unit_count);
+    do_span_symbol_args(ctx, &span, compile);
+    do_span_end(ctx, &span, 0);
+    do_stats_print_codegen(ctx, &codegen_args);
+
+    // compilers are never measured here, because unit builds are not comparable to whole builds
+    struct exec_driver driver;
+    ml_exec_path compiler;
+    do_driver_init(ctx, &driver);
+    if (!do_driver_resolve_compiler(&driver, driver.profile, compiler))
+        do_driver_pick_static(driver.profile, compiler);
+
+    bool compiled = do_split_compile_units(ctx, &driver, compiler, src_paths, obj_paths,
+                                           src_count, job_count, &obj_count);
+    if (!compiled || !do_split_link(ctx, &driver, compiler, obj_paths, obj_count, exec_path,
+                                    has_runtime ? runtime_path : NULL)) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to compile ml translation file\n");
+        goto done;
+    }
+    exec_written = true;
+
+    if (!do_exec_run_exec_file(ctx, exec_path, argv + 1))
+        goto done;
+
+    succeed = true;
+done:
+    if (header_written)
+        unlink(header_path);
+    for (int i = 0; i < src_count; i++)
+        unlink(src_paths[i]);
+    for (int i = 0; i < obj_count; i++)
+        unlink(obj_paths[i]);
+    if (exec_written)
+        unlink(exec_path);
+    return succeed;
+}
+
+static bool do_debug_resolve_paths(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                                   ml_cache_path src, ml_cache_path exec) {
+    // only the last debug build of a program is kept, next to the source it is built from
+    char dir[ML_EXEC_CACHE_DIR_CAPACITY];
+    struct ml_cache_ctx *cache = NULL;
+    if (!do_exec_resolve_cache_dir(ctx, dir) || !ml_cache_ctx_init(&cache, dir, NULL))
+        return false;
+
+    struct ml_cache_key key;
+    ml_cache_program_key_init(&key, compile, (ctx->flags & ML_EXEC_FLAG_NO_MEMOIZE));
+    bool resolved = ml_cache_get_path(cache, &key, ML_EXEC_DEBUG_SUFFIX_SRC, src)
+                    && ml_cache_get_path(cache, &key, ML_EXEC_DEBUG_SUFFIX_EXEC, exec);
+    ml_cache_ctx_uninit(&cache);
+    return resolved;
+}
+
+static bool do_exec_run_compiled(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                                 char *argv[]) {
+    // a batch is always one executable optimized for this cpu, which runs long enough to pay for the build
+    // a debug build is one executable too, whose lines point back to the ml file, and so is a profiled one
+    bool batch = (ctx->batch_path != NULL);
+    bool debug = (ctx->flags & ML_EXEC_FLAG_DEBUG_INFO);
+#ifdef ML_EXEC_WITH_LIBTCC
+    if (!batch && !check_single_build(ctx) && check_libtcc_selected(ctx))
+        return do_exec_run_libtcc(ctx, compile, argv);
+#endif
+
+    if (!batch && !check_single_build(ctx) && check_split_selected(ctx, compile))
+        return do_exec_run_split(ctx, compile, argv);
+
+    bool succeed = false;
+    bool src_written = false;
+    bool exec_written = false;
+
+    ml_exec_path src_path;
+    if (!ctx->fns->make_temp_path(ctx->opaque, src_path, "src.c")) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to generate translation file name\n");
+        goto done;
+    }
+
+    ml_exec_path exec_path;
+    if (!ctx->fns->make_temp_path(ctx->opaque, exec_path, "exec")) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to generate executable file name\n");
+        goto done;
+    }
+
+    // the output state of a sharded program is kept by each thread, so its runtime is always embedded
+    ml_exec_path runtime_path;
+    bool sharded = check_batch_sharded(ctx);
+    bool has_runtime = !sharded && do_exec_resolve_runtime(ctx, runtime_path);
+
+    // a debug translation is written as if it were kept already, so the code around statements points there
+    char source_path[PATH_MAX];
+    ml_cache_path kept_src_path;
+    ml_cache_path kept_exec_path;
+    bool keep = debug && realpath(argv[1], source_path)
+                && do_debug_resolve_paths(ctx, compile, kept_src_path, kept_exec_path);
+    if (!do_exec_translate_file(ctx, compile, src_path, has_runtime,
+                                keep ? source_path : NULL, keep ? kept_src_path : NULL))
+        goto done;
+    src_written = true;
+
+    enum exec_build_profile profile = debug ? EXEC_BUILD_PROFILE_DEBUG
+                                      : batch ? EXEC_BUILD_PROFILE_BATCH
+                                      : EXEC_BUILD_PROFILE_CONFIGURED;
+    if (!do_exec_compile_file(ctx, profile, src_path, exec_path, has_runtime ? runtime_path : NULL))
+        goto done;
+    exec_written = true;
+
+    // profilers and debuggers read the executable after the run, so it runs from where it is kept
+    char *run_path = exec_path;
+    if (keep && rename(exec_path, kept_exec_path) == 0) {
+        exec_written = false;
+        run_path = kept_exec_path;
+        if (rename(src_path, kept_src_path) == 0)
+            src_written = false;
+    }
+
+    // the first parameter is ml source file path
+    // the following parameters should be passed to run the compiled executable
+    // a batch program only takes the format of its rows, and the arguments come from them
+    // a sharded one also takes the path of the rows and the number of threads
+    char batch_format[] = "c";
+    char batch_threads[16];
+    char *batch_argv[] = { argv[1], batch_format, NULL, NULL, NULL };
+    if (ctx->batch_binary)
+        batch_format[0] = 'b';
+    if (sharded) {
+        snprintf(batch_threads, sizeof(batch_threads), "%d", resolve_batch_thread_count(ctx));
+        batch_argv[2] = (char*) ctx->batch_path;
+        batch_argv[3] = batch_threads;
+    }
+    if (!do_exec_run_exec_file(ctx, run_path, batch ? batch_argv : argv + 1))
+        goto done;
+
+    succeed = true;
+done:
+    if (src_written)
+        unlink(src_path);
+    if (exec_written)
+        unlink(exec_path);
+    return succeed;
+}
+
+static bool is_executable_file(const char *path) {
+    struct stat s = {0};
+    return (stat(path, &s) == 0) && S_ISREG(s.st_mode) && (access(path, X_OK) == 0);
+}
+
+static bool do_tier_make_paths(struct ml_cache_ctx *cache, struct ml_compile_ctx *compile,
+                               uint32_t flags, struct exec_tier_paths *paths) {
+    // executables are shared by all argument values, but not by different codegen flags
+    struct ml_cache_key key;
+    ml_cache_program_key_init(&key, compile, (flags & ML_EXEC_FLAG_NO_MEMOIZE));
+    return ml_cache_get_path(cache, &key, ML_EXEC_TIER_SUFFIX_SRC, paths->src)
+           && ml_cache_get_path(cache, &key, ML_EXEC_TIER_SUFFIX_BASELINE, paths->baseline)
+           && ml_cache_get_path(cache, &key, ML_EXEC_TIER_SUFFIX_OPTIMIZED, paths->optimized)
+           && ml_cache_get_path(cache, &key, ML_EXEC_TIER_SUFFIX_STATUS, paths->status)
+           && ml_cache_get_path(cache, &key, ML_EXEC_TIER_SUFFIX_LOCK, paths->lock);
+}
+
+static void do_tier_append_status(const char *path, const char *tier, long elapsed) {
+    // each line is written at once, so lines from concurrent jobs are never interleaved
+    char line[ML_EXEC_TIER_STATUS_CAPACITY];
+    int n = (elapsed < 0)
+            ? snprintf(line, sizeof(line), "%s failed\n", tier)
+            : snprintf(line, sizeof(line), "%s compile %ld ms\n", tier, elapsed);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd < 0)
+        return;
+    if (write(fd, line, n) != n)
+        unlink(path);
+    close(fd);
+}
+
+static bool do_tier_compile(struct ml_exec_ctx *ctx, enum exec_build_profile profile, const char *tier,
+                            char *src, char *exec, const char *status) {
+    // the executable is renamed into place, so a concurrent run never sees a partial one
+    ml_exec_path runtime_path;
+    ml_cache_path temp_path;
+    bool has_runtime = do_exec_resolve_runtime(ctx, runtime_path);
+    if (!ml_cache_make_temp_path(exec, temp_path))
+        return false;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool compiled = do_exec_compile_file(ctx, profile, src, temp_path, has_runtime ? runtime_path : NULL)
+                    && rename(temp_path, exec) == 0;
+    do_tier_append_status(status, tier, compiled ? resolve_elapsed_ms(&start) : -1);
+    if (!compiled)
+        unlink(temp_path);
+    return compiled;
+}
+
+static bool do_tier_acquire_lock(const char *path) {
+    // a lock left by a killed job is taken over after a while
+    for (int i = 0; i < 2; i++) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            close(fd);
+            return true;
+        }
+
+        struct stat s;
+        if (stat(path, &s) != 0 || time(NULL) - s.st_mtime < ML_EXEC_TIER_LOCK_TIMEOUT)
+            return false;
+        unlink(path);
+    }
+    return false;
+}
+
+// e.g. "sh -c <script> sh <temp> <exec> <status> <lock> cc -O2 -o <temp> <src>"
+// the build runs in a background subshell, so it is adopted by init once the shell exits
+static const char exec_tier_job_script[] =
+    "(t=$1 e=$2 s=$3 l=$4; shift 4; b=$(date +%s%N)"
+    "; if nice -n 10 \"$@\" && mv -f \"$t\" \"$e\"; then"
+    " n=$(date +%s%N); case $b$n in *[!0-9]*) b=0 n=0;; esac"
+    "; echo \"O2 compile $(((n - b) / 1000000)) ms\" >> \"$s\""
+    "; else rm -f \"$t\"; echo \"O2 failed\" >> \"$s\"; fi; rm -f \"$l\") &";
+
+static void do_tier_start_optimizer(struct ml_exec_ctx *ctx, struct exec_tier_paths *paths) {
+    // the job is spawned rather than forked, since a copy of a threaded host may inherit locks nobody releases
+    // runs of other scripts should not be slowed down by a job nobody waits for, hence the lower priority
+    if (!do_tier_acquire_lock(paths->lock))
+        return;
+
+    struct exec_driver driver;
+    ml_exec_path compiler;
+    do_driver_init(ctx, &driver);
+    if (!do_driver_resolve_compiler(&driver, EXEC_BUILD_PROFILE_OPTIMIZED, compiler))
+        do_driver_pick_static(EXEC_BUILD_PROFILE_OPTIMIZED, compiler);
+
+    ml_exec_path runtime_path;
+    ml_cache_path temp_path;
+    char flags[ML_EXEC_DRIVER_FLAGS_CAPACITY];
+    char *args[ML_EXEC_DRIVER_MAX_ARGS + 16];
+    bool has_runtime = do_exec_resolve_runtime(ctx, runtime_path);
+    int n = 0;
+    args[n++] = "sh";
+    args[n++] = "-c";
+    args[n++] = (char*) exec_tier_job_script;
+    args[n++] = "sh";
+    args[n++] = temp_path;
+    args[n++] = paths->optimized;
+    args[n++] = paths->status;
+    args[n++] = paths->lock;
+    int count = do_driver_make_args(&driver, EXEC_BUILD_PROFILE_OPTIMIZED, compiler, flags, args + n);
+    if (count < 0 || !ml_cache_make_temp_path(paths->optimized, temp_path)) {
+        unlink(paths->lock);
+        return;
+    }
+    n += count;
+    args[n++] = "-o";
+    args[n++] = temp_path;
+    args[n++] = paths->src;
+    args[n++] = has_runtime ? runtime_path : NULL;
+    args[n] = NULL;
+
+    pid_t pid = -1;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    bool prepared = (posix_spawnattr_init(&attr) == 0);
+    if (prepared && posix_spawn_file_actions_init(&actions) != 0) {
+        posix_spawnattr_destroy(&attr);
+        prepared = false;
+    }
+    if (prepared) {
+#ifdef POSIX_SPAWN_SETSID
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+#endif
+        bool redirected = (posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0) == 0)
+                          && (posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0) == 0)
+                          && (posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0) == 0);
+        if (!redirected || posix_spawn(&pid, "/bin/sh", &actions, &attr, args, environ) != 0)
+            pid = -1;
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+    }
+
+    if (pid == -1)
+        unlink(paths->lock);
+    else
+        waitpid(pid, NULL, 0);
+}
+
+static bool do_tier_translate(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                              struct exec_tier_paths *paths) {
+    ml_exec_path runtime_path;
+    ml_cache_path temp_path;
+    bool has_runtime = do_exec_resolve_runtime(ctx, runtime_path);
+    if (!ml_cache_make_temp_path(paths->src, temp_path))
+        return false;
+
+    if (!do_exec_translate_file(ctx, compile, temp_path, has_runtime, NULL, NULL) || rename(temp_path, paths->src) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+static bool do_exec_run_tiered(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                               char *argv[]) {
+    // the first run waits for a quick baseline build, and an optimized one replaces it in the background
+    char dir[ML_EXEC_CACHE_DIR_CAPACITY];
+    struct ml_cache_ctx *cache = NULL;
+    struct exec_tier_paths paths;
+    if (!do_exec_resolve_cache_dir(ctx, dir) || !ml_cache_ctx_init(&cache, dir, NULL))
+        return do_exec_run_compiled(ctx, compile, argv);
+
+    bool succeed = false;
+    if (!do_tier_make_paths(cache, compile, ctx->flags, &paths)) {
+        succeed = do_exec_run_compiled(ctx, compile, argv);
+        goto done;
+    }
+
+    if (is_executable_file(paths.optimized)) {
+        succeed = do_exec_run_exec_file(ctx, paths.optimized, argv + 1);
+        goto done;
+    }
+
+    if (!is_executable_file(paths.baseline)) {
+        if (!do_tier_translate(ctx, compile, &paths)
+            || !do_tier_compile(ctx, EXEC_BUILD_PROFILE_FAST_COMPILE, "O0",
+                                paths.src, paths.baseline, paths.status))
+            goto done;
+    }
+
+    succeed = do_exec_run_exec_file(ctx, paths.baseline, argv + 1);
+    if (succeed)
+        do_tier_start_optimizer(ctx, &paths);
+
+done:
+    ml_cache_ctx_uninit(&cache);
+    return succeed;
+}
+
+static bool do_exec_print_tier_status(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile) {
+    char dir[ML_EXEC_CACHE_DIR_CAPACITY];
+    struct ml_cache_ctx *cache = NULL;
+    struct exec_tier_paths paths;
+    if (!do_exec_resolve_cache_dir(ctx, dir) || !ml_cache_ctx_init(&cache, dir, NULL)
+        || !do_tier_make_paths(cache, compile, ctx->flags, &paths)) {
+        ml_cache_ctx_uninit(&cache);
+        ctx->fns->printf_stderr(ctx->opaque, "failed to open executable cache\n");
+        return false;
+    }
+
+    const char *tier = "none";
+    if (is_executable_file(paths.optimized))
+        tier = "O2";
+    else if (is_executable_file(paths.baseline))
+        tier = (access(paths.lock, F_OK) == 0) ? "O0 optimizing" : "O0";
+
+    char buf[ML_EXEC_TIER_STATUS_CAPACITY];
+    int n = snprintf(buf, sizeof(buf), "tier %s\n", tier);
+    ctx->fns->write_stdout(ctx->opaque, buf, n);
+
+    // timings of every build are kept in the order they finished
+    int fd = open(paths.status, O_RDONLY);
+    if (fd >= 0) {
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            ctx->fns->write_stdout(ctx->opaque, buf, n);
+        close(fd);
+    }
+
+    ml_cache_ctx_uninit(&cache);
+    return true;
+}
+
+// objects loaded from the same path share their statics, so only one of them is called at a time
+static pthread_mutex_t exec_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool do_shared_compile(struct ml_exec_ctx *ctx, char *src, char *lib) {
+    // compilers are never measured here, because position independent builds are not comparable
+    struct exec_driver driver;
+    ml_exec_path compiler;
+    do_driver_init(ctx, &driver);
+    if (!do_driver_resolve_compiler(&driver, driver.profile, compiler))
+        do_driver_pick_static(driver.profile, compiler);
+
+    char flags[ML_EXEC_DRIVER_FLAGS_CAPACITY];
+    char *args[ML_EXEC_DRIVER_MAX_ARGS + 8];
+    int n = do_driver_make_args(&driver, driver.profile, compiler, flags, args);
+    if (n < 0)
+        return false;
+
+    args[n++] = "-shared";
+    args[n++] = "-fPIC";
+    args[n++] = "-o";
+    args[n++] = lib;
+    args[n++] = src;
+    args[n] = NULL;
+
+    struct exec_span span;
+    do_span_begin(ctx, &span, "cc");
+    do_span_arg(&span, "bytes", resolve_file_size(src));
+    uint32_t flags_run = EXEC_RUN_FLAG_SEARCH_BIN_PATH | EXEC_RUN_FLAG_SUPPRESS_STDERR;
+    return do_run_subprocess(ctx, flags_run, compiler, args, &span, "failed to compile ml translation file\n");
+}
+
+static void *do_shared_open(const char *lib) {
+    // a name without a slash would be searched in the library paths instead
+    if (strchr(lib, '/'))
+        return dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+
+    ml_exec_path path;
+    int n = snprintf(path, sizeof(path), "./%s", lib);
+    return (n > 0 && n < sizeof(path)) ? dlopen(path, RTLD_NOW | RTLD_LOCAL) : NULL;
+}
+
+struct exec_guard {
+    sigjmp_buf jump;
+    stack_t old_stack;
+    void *stack;
+};
+
+// faults of the program are caught on an alternate stack, so that a stack overflow can be handled too
+static const int exec_guard_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+static struct sigaction exec_guard_old_actions[sizeof(exec_guard_signals) / sizeof(exec_guard_signals[0])];
+static pthread_mutex_t exec_guard_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int exec_guard_count = 0;
+static _Thread_local struct exec_guard *exec_guard_current = NULL;
+
+static void exec_guard_on_signal(int sig, siginfo_t *info, void *context) {
+    // only a fault of the guarded call jumps back, and any other one gets the disposition it had before
+    struct exec_guard *guard = exec_guard_current;
+    if (guard) {
+        exec_guard_current = NULL;
+        siglongjmp(guard->jump, sig);
+    }
+
+    int idx = 0;
+    while (exec_guard_signals[idx] != sig)
+        idx++;
+    const struct sigaction *old = &exec_guard_old_actions[idx];
+    if (old->sa_flags & SA_SIGINFO) {
+        old->sa_sigaction(sig, info, context);
+    } else if (old->sa_handler == SIG_DFL) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    } else if (old->sa_handler != SIG_IGN) {
+        old->sa_handler(sig);
+    }
+}
+
+static bool do_guard_enter(struct exec_guard *guard) {
+    // handlers are shared by the process, so they are installed by the first guarded call and kept until the last one
+    guard->stack = ml_memory_malloc(ML_EXEC_GUARD_STACK_SIZE);
+    if (!guard->stack)
+        return false;
+
+    const stack_t stack = {
+        .ss_sp = guard->stack,
+        .ss_size = ML_EXEC_GUARD_STACK_SIZE,
+    };
+    if (sigaltstack(&stack, &guard->old_stack) != 0) {
+        ml_memory_free(guard->stack);
+        return false;
+    }
+
+    bool installed = true;
+    pthread_mutex_lock(&exec_guard_mutex);
+    if (exec_guard_count == 0) {
+        struct sigaction action = {
+            .sa_sigaction = exec_guard_on_signal,
+            .sa_flags = SA_SIGINFO | SA_ONSTACK,
+        };
+        sigemptyset(&action.sa_mask);
+        int count = 0;
+        while (installed && count < sizeof(exec_guard_signals) / sizeof(exec_guard_signals[0])) {
+            installed = (sigaction(exec_guard_signals[count], &action, &exec_guard_old_actions[count]) == 0);
+            count += installed;
+        }
+        while (!installed && count > 0) {
+            count--;
+            sigaction(exec_guard_signals[count], &exec_guard_old_actions[count], NULL);
+        }
+    }
+    exec_guard_count += installed;
+    pthread_mutex_unlock(&exec_guard_mutex);
+
+    if (!installed) {
+        sigaltstack(&guard->old_stack, NULL);
+        ml_memory_free(guard->stack);
+    }
+    return installed;
+}
+
+static void do_guard_leave(struct exec_guard *guard) {
+    exec_guard_current = NULL;
+    pthread_mutex_lock(&exec_guard_mutex);
+    if (--exec_guard_count == 0) {
+        for (int i = 0; i < sizeof(exec_guard_signals) / sizeof(exec_guard_signals[0]); i++)
+            sigaction(exec_guard_signals[i], &exec_guard_old_actions[i], NULL);
+    }
+    pthread_mutex_unlock(&exec_guard_mutex);
+
+    sigaltstack(&guard->old_stack, NULL);
+    ml_memory_free(guard->stack);
+}
+
+static bool do_shared_call(struct ml_exec_ctx *ctx, const char *lib, char **argv, bool *guarded) {
+    // everything the program prints goes through the host instead of fd 1
+    // a crash of the program is reported like one of a subprocess, but what it did to the heap of the host
+    // before it is caught cannot be undone, and neither are the memo tables it leaves behind
+    // without the guard the call does not happen, so the caller can run the program in a subprocess instead
+    bool succeed = false;
+    int argc = 0;
+    while (argv[argc])
+        argc++;
+
+    struct exec_span span;
+    pthread_mutex_lock(&exec_shared_mutex);
+    do_span_begin(ctx, &span, "dlopen");
+    void *handle = do_shared_open(lib);
+    ml_codegen_entry_fn entry = handle ? (ml_codegen_entry_fn) dlsym(handle, ML_EXEC_SHARED_ENTRY_NAME) : NULL;
+    do_span_end(ctx, &span, 0);
+    if (!entry) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to load translated shared object\n");
+        goto done;
+    }
+
+    struct exec_guard guard;
+    *guarded = do_guard_enter(&guard);
+    if (!*guarded)
+        goto done;
+
+    const struct ml_codegen_sink sink = {
+        .write = ctx->fns->write_stdout,
+        .opaque = ctx->opaque,
+    };
+    do_span_begin(ctx, &span, "exec");
+    do_span_arg(&span, "args", argc ? argc - 1 : 0);
+    int sig = sigsetjmp(guard.jump, 1);
+    if (sig == 0) {
+        exec_guard_current = &guard;
+        succeed = (entry(argc, argv, &sink) == 0);
+    }
+    do_guard_leave(&guard);
+    do_span_end(ctx, &span, 0);
+    if (sig)
+        ctx->fns->printf_stderr(ctx->opaque, "translated program terminated by signal %d\n", sig);
+    if (!succeed)
+        ctx->fns->printf_stderr(ctx->opaque, "failed to run translated executable file\n");
+
+done:
+    if (handle)
+        dlclose(handle);
+    pthread_mutex_unlock(&exec_shared_mutex);
+    return succeed;
+}
+
+static bool do_shared_build(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                            ml_cache_path lib_path, bool *temporary) {
+    // the object is kept in the cache directory for all argument values, so a warm run is only a call
+    // without the cache it is built into a temporary file, which is removed by the caller
+    bool succeed = false;
+    bool src_written = false;
+    char dir[ML_EXEC_CACHE_DIR_CAPACITY];
+    struct ml_cache_ctx *cache = NULL;
+    struct ml_cache_key key;
+    ml_cache_path temp_path;
+    *temporary = false;
+    bool cached = do_exec_resolve_cache_dir(ctx, dir) && ml_cache_ctx_init(&cache, dir, NULL);
+    if (cached) {
+        ml_cache_program_key_init(&key, compile, (ctx->flags & ML_EXEC_FLAG_NO_MEMOIZE));
+        cached = ml_cache_get_path(cache, &key, ML_EXEC_SHARED_SUFFIX, lib_path)
+                 && ml_cache_make_temp_path(lib_path, temp_path);
+    }
+
+    if (cached && is_readable_file(ctx, lib_path)) {
+        succeed = true;
+        goto done;
+    }
+
+    ml_exec_path src_path;
+    if (!ctx->fns->make_temp_path(ctx->opaque, src_path, "src.c")
+        || (!cached && !ctx->fns->make_temp_path(ctx->opaque, temp_path, "lib.so"))) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to generate translation file name\n");
+        goto done;
+    }
+
+    if (!do_exec_translate_file(ctx, compile, src_path, false, NULL, NULL))
+        goto done;
+    src_written = true;
+
+    // a cached object is renamed into place, so a concurrent run never loads a partial one
+    if (!do_shared_compile(ctx, src_path, temp_path))
+        goto done;
+    if (!cached || rename(temp_path, lib_path) != 0) {
+        strcpy(lib_path, temp_path);
+        *temporary = true;
+    }
+
+    succeed = true;
+done:
+    if (src_written)
+        unlink(src_path);
+    ml_cache_ctx_uninit(&cache);
+    return succeed;
+}
+
+static bool do_exec_run_shared(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                               char *argv[]) {
+    bool temporary = false;
+    ml_cache_path lib_path;
+    if (!do_shared_build(ctx, compile, lib_path, &temporary))
+        return false;
+
+    bool guarded = true;
+    bool succeed = do_shared_call(ctx, lib_path, argv + 1, &guarded);
+    if (temporary)
+        unlink(lib_path);
+    if (guarded)
+        return succeed;
+
+    // the same program is built as an executable, since a shared object cannot be run by itself
+    ctx->flags &= ~ML_EXEC_FLAG_SHARED;
+    succeed = do_exec_run_compiled(ctx, compile, argv);
+    ctx->flags |= ML_EXEC_FLAG_SHARED;
+    return succeed;
+}
+
+struct ml_exec_server {
+    struct ml_cache_key key;
+    pid_t pid;
+    int fd;
+};
+
+static int resolve_server_request(char **argv, char *request) {
+    // the arguments are sent in one message, each one ending with a NUL
+    // the server splits a request into a fixed array, so arguments it could not hold are refused too
+    int count = 0;
+    for (int i = 0; argv[i]; i++) {
+        int n = strlen(argv[i]) + 1;
+        if (count + n > ML_EXEC_SERVER_MAX_REQUEST || i >= ML_EXEC_SERVER_MAX_ARGS)
+            return -1;
+        memcpy(request + count, argv[i], n);
+        count += n;
+    }
+    return count;
+}
+
+static pid_t do_server_spawn(struct ml_exec_ctx *ctx, char *exec, int *control_fd) {
+    // the server finds its end of the socket at a fixed descriptor, named by its only argument
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to create socket\n");
+        return -1;
+    }
+
+    // duplicating a descriptor onto itself would keep it close-on-exec
+    if (fds[1] == ML_EXEC_SERVER_CONTROL_FD) {
+        int fd = fcntl(fds[1], F_DUPFD_CLOEXEC, ML_EXEC_SERVER_CONTROL_FD + 1);
+        close(fds[1]);
+        fds[1] = fd;
+    }
+
+    pid_t pid = -1;
+    char control[] = ML_EXEC_SERVER_CONTROL_ARG;
+    char *argv[] = { exec, control, NULL };
+    posix_spawn_file_actions_t actions;
+    if (fds[1] >= 0 && posix_spawn_file_actions_init(&actions) == 0) {
+        if (posix_spawn_file_actions_adddup2(&actions, fds[1], ML_EXEC_SERVER_CONTROL_FD) != 0
+            || posix_spawn(&pid, exec, &actions, NULL, argv, environ) != 0)
+            pid = -1;
+        posix_spawn_file_actions_destroy(&actions);
+    }
+
+    if (fds[1] >= 0)
+        close(fds[1]);
+    if (pid == -1) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to spawn subprocess\n");
+        close(fds[0]);
+        return -1;
+    }
+    *control_fd = fds[0];
+    return pid;
+}
+
+static bool do_server_start(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                            const struct ml_cache_key *key) {
+    // the executable is only needed until the server runs it
+    bool succeed = false;
+    bool src_written = false;
+    bool exec_written = false;
+
+    ml_exec_path src_path;
+    if (!ctx->fns->make_temp_path(ctx->opaque, src_path, "src.c")) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to generate translation file name\n");
+        goto done;
+    }
+
+    ml_exec_path exec_path;
+    if (!ctx->fns->make_temp_path(ctx->opaque, exec_path, "exec")) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to generate executable file name\n");
+        goto done;
+    }
+
+    if (!do_exec_translate_file(ctx, compile, src_path, false, NULL, NULL))
+        goto done;
+    src_written = true;
+
+    if (!do_exec_compile_file(ctx, EXEC_BUILD_PROFILE_CONFIGURED, src_path, exec_path, NULL))
+        goto done;
+    exec_written = true;
+
+    int fd = -1;
+    pid_t pid = do_server_spawn(ctx, exec_path, &fd);
+    if (pid == -1)
+        goto done;
+
+    ctx->server = ml_memory_malloc(sizeof(struct ml_exec_server));
+    if (!ctx->server) {
+        close(fd);
+        waitpid(pid, NULL, 0);
+        goto done;
+    }
+    ctx->server->key = *key;
+    ctx->server->pid = pid;
+    ctx->server->fd = fd;
+
+    succeed = true;
+done:
+    if (src_written)
+        unlink(src_path);
+    if (exec_written)
+        unlink(exec_path);
+    return succeed;
+}
+
+static bool do_server_send(struct ml_exec_server *server, const char *request, int count, int fd) {
+    // the descriptor of the output goes along with the arguments
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {
+        .iov_base = (void*) request,
+        .iov_len = count,
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *header = CMSG_FIRSTHDR(&msg);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+    ssize_t n = 0;
+    do {
+        n = sendmsg(server->fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == count;
+}
+
+static int do_server_receive_status(struct ml_exec_server *server) {
+    int status = -1;
+    ssize_t n = 0;
+    do {
+        n = recv(server->fd, &status, sizeof(status), 0);
+    } while (n < 0 && errno == EINTR);
+    return (n == sizeof(status)) ? status : -1;
+}
+
+static bool do_server_request(struct ml_exec_ctx *ctx, const char *request, int count, int *status) {
+    // false means the request never reached the server, while a failed run is told by the status
+    // the program writes straight to the destination of the host, unless its output is kept
+    int dst = ctx->fns->get_stdout_fd ? ctx->fns->get_stdout_fd(ctx->opaque) : -1;
+    bool intercepted = (ctx->fns == &ml_exec_run_fns_capture);
+    if (dst >= 0 && !intercepted) {
+        if (!do_server_send(ctx->server, request, count, dst))
+            return false;
+        *status = do_server_receive_status(ctx->server);
+        return true;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        *status = -1;
+        return true;
+    }
+
+    // the pipe is closed before waiting, so a child stuck on a broken destination is stopped by SIGPIPE
+    bool sent = do_server_send(ctx->server, request, count, fds[1]);
+    close(fds[1]);
+    if (sent && dst < 0)
+        do_forward_output(ctx, fds[0], NULL);
+    if (sent && dst >= 0 && !do_splice_output(ctx->opaque, fds[0], dst, NULL))
+        ((struct exec_capture*) ctx->opaque)->overflow = true;
+    close(fds[0]);
+    if (sent)
+        *status = do_server_receive_status(ctx->server);
+    return sent;
+}
+
+static bool do_exec_run_forked(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                               const char *request, int count, int argc) {
+    // a server of another program is replaced, and a dead one is started again once
+    struct ml_cache_key key;
+    ml_cache_program_key_init(&key, compile, (ctx->flags & ML_EXEC_FLAG_NO_MEMOIZE));
+    if (ctx->server && memcmp(&ctx->server->key, &key, sizeof(key)) != 0)
+        ml_exec_stop_server(ctx);
+
+    int status = -1;
+    struct exec_span span;
+    for (int i = 0; i < 2; i++) {
+        if (!ctx->server && !do_server_start(ctx, compile, &key))
+            return false;
+
+        do_span_begin(ctx, &span, "exec");
+        do_span_arg(&span, "args", argc ? argc - 1 : 0);
+        bool sent = do_server_request(ctx, request, count, &status);
+        do_span_end(ctx, &span, ctx->server->pid);
+        if (sent)
+            break;
+        ml_exec_stop_server(ctx);
+    }
+
+    if (status < 0)
+        ml_exec_stop_server(ctx);
+    if (status != 0) {
+        ctx->fns->printf_stderr(ctx->opaque, "failed to run translated executable file\n");
+        return false;
+    }
+    return true;
+}
+
+static bool do_exec_run_served(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                               char *argv[]) {
+    // the first parameter is ml source file path, which is the name of the program in the child
+    // arguments too large for one message are passed to a normal executable instead
+    char request[ML_EXEC_SERVER_MAX_REQUEST];
+    int count = resolve_server_request(argv + 1, request);
+    if (count > 0) {
+        int argc = 0;
+        while (argv[argc + 1])
+            argc++;
+        return do_exec_run_forked(ctx, compile, request, count, argc);
+    }
+
+    ctx->flags &= ~ML_EXEC_FLAG_FORK_SERVER;
+    bool succeed = (ctx->flags & ML_EXEC_FLAG_TIERED)
+                   ? do_exec_run_tiered(ctx, compile, argv)
+                   : do_exec_run_compiled(ctx, compile, argv);
+    ctx->flags |= ML_EXEC_FLAG_FORK_SERVER;
+    return succeed;
+}
+
+static bool do_exec_run_program(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                                char *argv[]) {
+    if (check_single_build(ctx))
+        return do_exec_run_compiled(ctx, compile, argv);
+
+    if (do_exec_evaluate(ctx, compile))
+        return true;
+
+    if (check_shared_selected(ctx))
+        return do_exec_run_shared(ctx, compile, argv);
+
+    if (check_fork_server_selected(ctx))
+        return do_exec_run_served(ctx, compile, argv);
+
+    return (ctx->flags & ML_EXEC_FLAG_TIERED)
+           ? do_exec_run_tiered(ctx, compile, argv)
+           : do_exec_run_compiled(ctx, compile, argv);
+}
+
+static bool do_exec_run_cached(struct ml_exec_ctx *ctx, struct ml_compile_ctx *compile,
+                               int argc, char *argv[]) {
+    // the output only depends on the program and the argument values it refers to
+    // any problem of the cache itself falls back to a normal run
+    char dir[ML_EXEC_CACHE_DIR_CAPACITY];
+    struct ml_cache_ctx *cache = NULL;
+    const struct ml_cache_ctx_init_args cache_args = {
+        .max_entries = ML_EXEC_CACHE_MAX_ENTRIES,
+        .max_entry_size = ML_EXEC_CACHE_MAX_OUTPUT,
+    };
+    if (!do_exec_resolve_cache_dir(ctx, dir) || !ml_cache_ctx_init(&cache, dir, &cache_args))
+        return do_exec_run_program(ctx, compile, argv);
+
+    // the first parameter is ml source file path, which is not part of the key
+    struct ml_cache_key key;
+    ml_cache_key_init(&key, compile, argc - 1, argv + 1);
+
+    bool succeed = true;
+    int dst = ctx->fns->get_stdout_fd ? ctx->fns->get_stdout_fd(ctx->opaque) : -1;
+    bool loaded = (dst >= 0)
+                  ? ml_cache_load(cache, &key, &dst, exec_fn_write_fd)
+                  : ml_cache_load(cache, &key, ctx->opaque, ctx->fns->write_stdout);
+    if (!loaded) {
+        struct exec_capture capture = {
+            .fns = ctx->fns,
+            .opaque = ctx->opaque,
+        };
+        ctx->fns = &ml_exec_run_fns_capture;
+        ctx->opaque = &capture;
+        succeed = do_exec_run_program(ctx, compile, argv);
+        ctx->fns = capture.fns;
+        ctx->opaque = capture.opaque;
+
+        // failures may come from the environment, e.g. a missing compiler, so they are never stored
+        if (succeed && !capture.overflow)
+            ml_cache_store(cache, &key, capture.buffer, capture.count);
+
+        if (capture.buffer)
+            ml_memory_free(capture.buffer);
+    }
+
+    ml_cache_ctx_uninit(&cache);
+    return succeed;
+}
+
+int ml_exec_run_main(struct ml_exec_ctx *ctx, int argc, char *argv[]) {
+    int ret = EXIT_FAILURE;
+    struct ml_compile_ctx *compile = NULL;
+
+    if (!ctx->fns)
+        ctx->fns = &ml_exec_run_fns_default;
+    ctx->timed_out = false;
+    ctx->trace = NULL;
+
+    int option_count = do_parse_options(ctx, argc, argv);
+    if (option_count < 0)
+        goto fail;
+    argc -= option_count;
+    argv += option_count;
+
+    // a trace that cannot be written never stops the run
+    struct exec_span span;
+    const char *trace_path = ctx->trace_path ? ctx->trace_path : getenv("RUNML_TRACE");
+    if (trace_path && *trace_path && !ml_trace_ctx_init(&ctx->trace, trace_path))
+        ctx->fns->printf_stderr(ctx->opaque, "failed to open trace file %s\n", trace_path);
+    do_span_begin(ctx, &span, "runml");
+
+    if (argc < 2) {
+        ctx->fns->printf_stderr(ctx->opaque, "no input file\n");
+        goto fail;
+    }
+
+    const char *input_path = argv[1];
+    if (!is_readable_file(ctx, input_path)) {
+        ctx->fns->printf_stderr(ctx->opaque, "not a readable file\n");
+        goto fail;
+    }
+
+    if (!do_exec_load_file(ctx, input_path, &compile))
+        goto fail;
+
+    if (ctx->batch_path && !is_readable_file(ctx, ctx->batch_path)) {
+        ctx->fns->printf_stderr(ctx->opaque, "not a readable batch file\n");
+        goto fail;
+    }
+
+    // the output of a batch depends on its rows, so it is neither evaluated in place nor cached
+    bool succeed = false;
+    if (ctx->batch_path)
+        succeed = do_exec_run_compiled(ctx, compile, argv);
+    else if (ctx->flags & ML_EXEC_FLAG_TIER_STATUS)
+        succeed = do_exec_print_tier_status(ctx, compile);
+    else if ((ctx->flags & ML_EXEC_FLAG_CACHE) && !check_single_build(ctx))
+        succeed = do_exec_run_cached(ctx, compile, argc, argv);
+    else
+        succeed = do_exec_run_program(ctx, compile, argv);
+    if (!succeed)
+        goto fail;
+
+    ret = EXIT_SUCCESS;
+fail:
+    if (ctx->timed_out)
+        ret = ML_EXEC_EXIT_STATUS_TIMEOUT;
+    if (ctx->trace) {
+        do_span_arg(&span, "status", ret);
+        do_span_end(ctx, &span, 0);
+        ml_trace_ctx_uninit(&ctx->trace);
+    }
+    ml_compile_ctx_uninit(&compile);
+    return ret;
+}
+
+void ml_exec_stop_server(struct ml_exec_ctx *ctx) {
+    // closing the socket ends the loop of the server
+    if (!ctx->server)
+        return;
+
+    close(ctx->server->fd);
+    waitpid(ctx->server->pid, NULL, 0);
+    ml_memory_free(ctx->server);
+    ctx->server = NULL;
+}
+
+struct ml_exec_module {
+    const struct ml_exec_run_fns *fns;
+    void *opaque;
+    void *handle;
+    ml_codegen_entry_fn entry;
+    const struct ml_codegen_symbol *symbols;
+    struct ml_codegen_sink sink;
+};
+
+static bool do_module_copy_object(const char *src, const char *dst) {
+    // objects are told apart by their files, so every module maps its own copy to have its own globals
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    int out = (in >= 0) ? open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0700) : -1;
+    bool succeed = (out >= 0);
+    char buffer[ML_EXEC_FORWARD_BUFFER_SIZE];
+    while (succeed) {
+        ssize_t n = read(in, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            succeed = (n == 0);
+            break;
+        }
+        succeed = do_write_fully(out, buffer, n);
+    }
+
+    if (in >= 0)
+        close(in);
+    if (out >= 0)
+        close(out);
+    return succeed;
+}
+
+static const struct ml_codegen_symbol *resolve_module_symbol(struct ml_exec_module *module,
+                                                             enum ml_codegen_symbol_kind kind, const char *name) {
+    for (const struct ml_codegen_symbol *symbol = module->symbols; symbol->name; symbol++) {
+        if (symbol->kind == kind && strcmp(symbol->name, name) == 0)
+            return symbol;
+    }
+    return NULL;
+}
+
+bool ml_exec_module_load(struct ml_exec_ctx *ctx, const char *path, struct ml_exec_module **pp) {
+    // the object is the one of a shared run, but a module is neither limited nor fed with rows
+    // files are removed once the object is mapped
+    struct ml_exec_ctx build = {
+        .fns = ctx->fns ? ctx->fns : &ml_exec_run_fns_default,
+        .opaque = ctx->opaque,
+        .flags = (ctx->flags & (ML_EXEC_FLAG_NO_MEMOIZE | ML_EXEC_FLAG_STATS | ML_EXEC_FLAG_NO_COMPACT))
+                 | ML_EXEC_FLAG_SHARED,
+        .cache_dir = ctx->cache_dir,
+        .config_path = ctx->config_path,
+    };
+
+    bool succeed = false;
+    bool temporary = false;
+    bool copied = false;
+    struct ml_compile_ctx *compile = NULL;
+    struct ml_exec_module *module = NULL;
+    ml_cache_path lib_path;
+    ml_exec_path copy_path;
+    if (!is_readable_file(&build, path)) {
+        build.fns->printf_stderr(build.opaque, "not a readable file\n");
+        goto done;
+    }
+
+    if (!do_exec_load_file(&build, path, &compile) || !do_shared_build(&build, compile, lib_path, &temporary))
+        goto done;
+
+    if (!temporary) {
+        if (!build.fns->make_temp_path(build.opaque, copy_path, "lib.so")) {
+            build.fns->printf_stderr(build.opaque, "failed to generate shared object file name\n");
+            goto done;
+        }
+        copied = true;
+        if (!do_module_copy_object(lib_path, copy_path)) {
+            build.fns->printf_stderr(build.opaque, "failed to copy translated shared object\n");
+            goto done;
+        }
+    }
+
+    module = ml_memory_malloc(sizeof(struct ml_exec_module));
+    if (!module)
+        goto done;
+
+    // functions called directly print through the sink kept by the object, which points into the module
+    void *handle = do_shared_open(copied ? copy_path : lib_path);
+    const struct ml_codegen_sink **sink = handle ? dlsym(handle, ML_EXEC_SHARED_SINK_NAME) : NULL;
+    *module = (struct ml_exec_module) {
+        .fns = build.fns,
+        .opaque = build.opaque,
+        .handle = handle,
+        .entry = handle ? (ml_codegen_entry_fn) dlsym(handle, ML_EXEC_SHARED_ENTRY_NAME) : NULL,
+        .symbols = handle ? dlsym(handle, ML_EXEC_SHARED_SYMBOLS_NAME) : NULL,
+        .sink = {
+            .write = build.fns->write_stdout,
+            .opaque = build.opaque,
+        },
+    };
+    if (!module->entry || !module->symbols || !sink) {
+        build.fns->printf_stderr(build.opaque, "failed to load translated shared object\n");
+        goto done;
+    }
+    *sink = &module->sink;
+
+    *pp = module;
+    module = NULL;
+    succeed = true;
+done:
+    if (module && module->handle)
+        dlclose(module->handle);
+    if (module)
+        ml_memory_free(module);
+    if (copied)
+        unlink(copy_path);
+    if (temporary)
+        unlink(lib_path);
+    ml_compile_ctx_uninit(&compile);
+    return succeed;
+}
+
+void ml_exec_module_unload(struct ml_exec_module **pp) {
+    if (!*pp)
+        return;
+
+    dlclose((*pp)->handle);
+    ml_memory_free(*pp);
+    *pp = NULL;
+}
+
+bool ml_exec_module_run(struct ml_exec_module *module, int argc, char *argv[]) {
+    if (module->entry(argc, argv, &module->sink) != 0) {
+        module->fns->printf_stderr(module->opaque, "failed to run translated executable file\n");
+        return false;
+    }
+    return true;
+}
+
+ml_exec_func ml_exec_module_find_func(struct ml_exec_module *module, const char *name, int param_count) {
+    // the wrapper reads as many arguments as the function has, so any other count is refused here
+    const struct ml_codegen_symbol *symbol = resolve_module_symbol(module, ML_CODEGEN_SYMBOL_FUNC, name);
+    return (symbol && symbol->param_count == param_count) ? (ml_exec_func) symbol->address : NULL;
+}
+
+double *ml_exec_module_find_global(struct ml_exec_module *module, const char *name) {
+    const struct ml_codegen_symbol *symbol = resolve_module_symbol(module, ML_CODEGEN_SYMBOL_GLOBAL, name);
+    return symbol ? symbol->address : NULL;
+}
+
+double *ml_exec_module_find_arg(struct ml_exec_module *module, int index) {
+    // only arguments referred to by the program exist
+    char name[16];
+    snprintf(name, sizeof(name), "arg%d", index);
+    const struct ml_codegen_symbol *symbol = resolve_module_symbol(module, ML_CODEGEN_SYMBOL_ARG, name);
+    return symbol ? symbol->address : NULL;
 }
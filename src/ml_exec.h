@@ -1,18 +1,83 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdbool.h>
 
+struct ml_trace_ctx;
+struct ml_exec_server;
+struct ml_exec_module;
+
+typedef double (*ml_exec_func)(const double *args, int n);
+
 typedef char ml_exec_path[256];
 
+enum ml_exec_flag {
+    ML_EXEC_FLAG_NO_MEMOIZE = 1,
+    ML_EXEC_FLAG_CACHE = 1 << 1,
+    ML_EXEC_FLAG_TIERED = 1 << 2,
+    ML_EXEC_FLAG_TIER_STATUS = 1 << 3,
+    ML_EXEC_FLAG_SPLIT = 1 << 4,
+    ML_EXEC_FLAG_STATS = 1 << 5,
+    ML_EXEC_FLAG_SHARED = 1 << 6,
+    ML_EXEC_FLAG_FORK_SERVER = 1 << 7,
+    ML_EXEC_FLAG_DEBUG_INFO = 1 << 8,
+    ML_EXEC_FLAG_PROFILE = 1 << 9,
+    ML_EXEC_FLAG_NO_COMPACT = 1 << 10,
+};
+
+enum ml_exec_exit_status {
+    ML_EXEC_EXIT_STATUS_TIMEOUT = 124,
+};
+
+struct ml_exec_limits {
+    int cpu_seconds;
+    int wall_ms;
+    int memory_mb;
+};
+
 struct ml_exec_run_fns {
     void (*write_stdout)(void *opaque, const char *buf, int n);
     void (*printf_stderr)(void *opaque, const char *fmt, ...);
     bool (*make_temp_path)(void *opaque, ml_exec_path path, const char *suffix);
+    int (*get_stdout_fd)(void *opaque);
 };
 
 struct ml_exec_ctx {
     const struct ml_exec_run_fns *fns;
     void *opaque;
+    uint32_t flags;
+    const char *cache_dir;
+    const char *runtime_path;
+    const char *config_path;
+    struct ml_exec_limits limits;
+    bool timed_out;
+    const char *trace_path;
+    struct ml_trace_ctx *trace;
+    const char *profile_path;
+    const char *batch_path;
+    bool batch_binary;
+    int batch_threads;
+    struct ml_exec_server *server;
 };
 
+// a context is used by one thread at a time, while different contexts may run concurrently
 int ml_exec_run_main(struct ml_exec_ctx *ctx, int argc, char *argv[]);
+
+// a fork server outlives the run which starts it, and serves the following runs of the same program
+void ml_exec_stop_server(struct ml_exec_ctx *ctx);
+
+// a module is a program loaded into this process, with its own globals, whose functions are called directly
+// the functions of the context are kept by the module, and a module is used by one thread at a time
+bool ml_exec_module_load(struct ml_exec_ctx *ctx, const char *path, struct ml_exec_module **pp);
+
+void ml_exec_module_unload(struct ml_exec_module **pp);
+
+// the statements of the program run from zeroed globals, and print through the context
+bool ml_exec_module_run(struct ml_exec_module *module, int argc, char *argv[]);
+
+// null if there is no such function, or if it takes another number of parameters
+ml_exec_func ml_exec_module_find_func(struct ml_exec_module *module, const char *name, int param_count);
+
+double *ml_exec_module_find_global(struct ml_exec_module *module, const char *name);
+
+double *ml_exec_module_find_arg(struct ml_exec_module *module, int index);
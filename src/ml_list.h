@@ -0,0 +1,84 @@
+#pragma once
+
+#include "ml_memory.h"
+#include "ml_allocator.h"
+
+#include <string.h>
+#include <stdbool.h>
+
+#define ML_LIST_DECLARE_BASE(type, name)                                    \
+    struct ml_list_##name {                                                 \
+        type *base;                                                         \
+        int count;                                                          \
+        int capacity;                                                       \
+        int grows;                                                          \
+        const struct ml_allocator *allocator;                               \
+    };                                                                      \
+                                                                            \
+    static bool list_init_##name(struct ml_list_##name *p, int capacity,    \
+                                 const struct ml_allocator *allocator) {    \
+        void *mem = ml_allocator_alloc(allocator, capacity * sizeof(type)); \
+        if (!mem)                                                           \
+            return false;                                                   \
+        *p = (struct ml_list_##name) {mem, 0, capacity, 0, allocator};      \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    static void list_uninit_##name(struct ml_list_##name *p) {              \
+        if (!p)                                                             \
+            return;                                                         \
+        ml_allocator_free(p->allocator, p->base);                           \
+        *p = (struct ml_list_##name) {0};                                   \
+    }                                                                       \
+
+#define ML_LIST_DECLARE_GROW(type, name)                                    \
+    static bool list_grow_##name(struct ml_list_##name *p, int n) {         \
+        int req_capacity = p->count + n;                                    \
+        if (req_capacity > p->capacity) {                                   \
+            int new_capacity = p->capacity;                                 \
+            while (new_capacity < req_capacity)                             \
+                new_capacity <<= 1;                                         \
+            size_t new_size = new_capacity * sizeof(type);                  \
+            void *new_base = ml_allocator_realloc(p->allocator, p->base,    \
+                                                  new_size);                \
+            if (!new_base)                                                  \
+                return false;                                               \
+            p->base = new_base;                                             \
+            p->capacity = new_capacity;                                     \
+            p->grows++;                                                     \
+        }                                                                   \
+        return true;                                                        \
+    }                                                                       \
+
+#define ML_LIST_DECLARE_APPEND(type, name)                                  \
+    static bool list_append_##name(struct ml_list_##name *p,                \
+                                   const type *v) {                         \
+        if (!list_grow_##name(p, 1))                                        \
+            return false;                                                   \
+        p->base[p->count] = *v;                                             \
+        p->count++;                                                         \
+        return true;                                                        \
+    }                                                                       \
+
+#define ML_LIST_DECLARE_FILL(type, name)                                    \
+    static bool list_fill_##name(struct ml_list_##name *p,                  \
+                                 const type *v, int n) {                    \
+        if (!list_grow_##name(p, n))                                        \
+            return false;                                                   \
+        memcpy(p->base + p->count, v, sizeof(type) * n);                    \
+        p->count += n;                                                      \
+        return true;                                                        \
+    }                                                                       \
+
+#define ML_LIST_DECLARE_STATS(type, name)                                   \
+    static void list_stats_##name(const struct ml_list_##name *p,           \
+                                  const char *tag,                          \
+                                  struct ml_memory_stats *stats) {          \
+        /* lists never shrink, so the current size is also the peak */     \
+        long long bytes = (long long) p->capacity * sizeof(type);           \
+        long long allocs = p->base ? 1 + p->grows : 0;                      \
+        *stats = (struct ml_memory_stats) {                                 \
+            tag, p->count, p->capacity, allocs, p->grows, bytes, bytes,     \
+        };                                                                  \
+    }                                                                       \
+
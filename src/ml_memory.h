@@ -2,6 +2,17 @@
 
 #include <stddef.h>
 
+// counts and capacities are in elements, bytes are what is reserved for them
+struct ml_memory_stats {
+    const char *name;
+    int count;
+    int capacity;
+    long long allocs;
+    long long grows;
+    long long bytes;
+    long long peak_bytes;
+};
+
 void *ml_memory_malloc(size_t size);
 
 void *ml_memory_realloc(void *ptr, size_t size);
@@ -1,5 +1,6 @@
 #include "ml_token.h"
 #include "ml_memory.h"
+#include "ml_allocator.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -37,6 +38,7 @@ enum token_flag {
 struct ml_token_ctx {
     const struct ml_token_io_fns *io_fns;
     void *io_opaque;
+    const struct ml_allocator *allocator;
 
     char *read_buffer;
     int read_idx;
@@ -47,6 +49,20 @@ struct ml_token_ctx {
     int token_idx;
     int token_capacity;
     uint32_t token_flags;
+
+    // where the current line and the pending token start
+    int line;
+    long long line_offset;
+    int token_line;
+    int token_column;
+
+    // counters are narrower than the public stats to keep the context small
+    long long read_bytes;
+    int read_refills;
+    int read_peak;
+    int token_peak;
+    int token_grows;
+    int type_counts[ML_TOKEN_TYPE_COUNT];
 };
 
 static const struct ml_token_io_fns ml_token_io_fns_file = {
@@ -57,6 +73,7 @@ static const struct ml_token_io_fns ml_token_io_fns_file = {
 static const struct ml_token_ctx_init_args ml_token_ctx_init_args_default = {
     .read_capacity = 1024,
     .token_capacity = 64,
+    .allocator = NULL,
 };
 
 bool ml_token_ctx_init_file(struct ml_token_ctx **pp, const char *path) {
@@ -75,21 +92,23 @@ bool ml_token_ctx_init_fns(struct ml_token_ctx **pp, void *opaque,
     char *token_buffer = NULL;
     struct ml_token_ctx *ctx = NULL;
 
-    ctx = ml_memory_malloc(sizeof(struct ml_token_ctx));
+    const struct ml_allocator *allocator = p_args->allocator;
+    ctx = ml_allocator_alloc(allocator, sizeof(struct ml_token_ctx));
     if (!ctx)
         goto fail;
 
-    read_buffer = ml_memory_malloc(p_args->read_capacity);
+    read_buffer = ml_allocator_alloc(allocator, p_args->read_capacity);
     if (!read_buffer)
         goto fail;
 
-    token_buffer = ml_memory_malloc(p_args->token_capacity);
+    token_buffer = ml_allocator_alloc(allocator, p_args->token_capacity);
     if (!token_buffer)
         goto fail;
 
     *ctx = (struct ml_token_ctx) {
         .io_fns = fns,
         .io_opaque = opaque,
+        .allocator = allocator,
         .read_buffer = read_buffer,
         .read_idx = 0,
         .read_count = 0,
@@ -98,6 +117,16 @@ bool ml_token_ctx_init_fns(struct ml_token_ctx **pp, void *opaque,
         .token_idx = 0,
         .token_capacity = p_args->token_capacity,
         .token_flags = 0,
+        .line = 1,
+        .line_offset = 0,
+        .token_line = 0,
+        .token_column = 0,
+        .read_bytes = 0,
+        .read_refills = 0,
+        .read_peak = 0,
+        .token_peak = 0,
+        .token_grows = 0,
+        .type_counts = {0},
     };
     *pp = ctx;
     return true;
@@ -106,11 +135,11 @@ fail:
     if (opaque)
         fns->close(opaque);
     if (read_buffer)
-        ml_memory_free(read_buffer);
+        ml_allocator_free(p_args->allocator, read_buffer);
     if (token_buffer)
-        ml_memory_free(token_buffer);
+        ml_allocator_free(p_args->allocator, token_buffer);
     if (ctx)
-        ml_memory_free(ctx);
+        ml_allocator_free(p_args->allocator, ctx);
     return false;
 }
 
@@ -122,10 +151,10 @@ void ml_token_ctx_uninit(struct ml_token_ctx **pp) {
     if (ctx->io_opaque)
         ctx->io_fns->close(ctx->io_opaque);
     if (ctx->read_buffer)
-        ml_memory_free(ctx->read_buffer);
+        ml_allocator_free(ctx->allocator, ctx->read_buffer);
     if (ctx->token_buffer)
-        ml_memory_free(ctx->token_buffer);
-    ml_memory_free(ctx);
+        ml_allocator_free(ctx->allocator, ctx->token_buffer);
+    ml_allocator_free(ctx->allocator, ctx);
     *pp = NULL;
 }
 
@@ -144,9 +173,18 @@ static void clear_token(struct ml_token_ctx *ctx) {
     ctx->token_flags &= ~TOKEN_FLAG_TRAIT_MASK;
 }
 
+static long long get_read_offset(struct ml_token_ctx *ctx) {
+    return ctx->read_bytes - ctx->read_count + ctx->read_idx;
+}
+
 static enum ml_token_type raise_error(struct ml_token_ctx *ctx, struct ml_token_data *data) {
-    if (data)
-        *data = (struct ml_token_data) {0};
+    // an unexpected character is reported where it is
+    if (data) {
+        *data = (struct ml_token_data) {
+            .line = ctx->line,
+            .column = (int) (get_read_offset(ctx) - ctx->line_offset) + 1,
+        };
+    }
     clear_token(ctx);
     ctx->read_idx++;
     ctx->token_flags |= TOKEN_FLAG_SKIP_LINE;
@@ -212,6 +250,8 @@ static enum ml_token_type finish_token(struct ml_token_ctx *ctx,
 
     // the token is zero-terminated string now
     ctx->token_buffer[ctx->token_idx] = 0;
+    if (ctx->token_idx + 1 > ctx->token_peak)
+        ctx->token_peak = ctx->token_idx + 1;
 
     enum ml_token_type found = hint ? *hint : ML_TOKEN_TYPE_ERROR;
     if (ctx->token_flags & TOKEN_FLAG_INTERNAL_ERROR) {
@@ -230,12 +270,29 @@ static enum ml_token_type finish_token(struct ml_token_ctx *ctx,
         found = resolve_name_token(ctx);
     }
 
-    if (found == ML_TOKEN_TYPE_ERROR)
-        return raise_error(ctx, data);
+    // a malformed token is reported from its start
+    if (found == ML_TOKEN_TYPE_ERROR) {
+        int line = ctx->token_line;
+        int column = ctx->token_column;
+        found = raise_error(ctx, data);
+        if (data) {
+            data->line = line;
+            data->column = column;
+        }
+        return found;
+    }
 
     if (data) {
         data->buf = ctx->token_buffer;
         data->len = ctx->token_idx;
+        data->line = ctx->token_line;
+        data->column = ctx->token_column;
+    }
+
+    // the next line starts right after its terminator
+    if (found == ML_TOKEN_TYPE_LINE_TERMINATOR) {
+        ctx->line++;
+        ctx->line_offset = get_read_offset(ctx);
     }
 
     clear_token(ctx);
@@ -247,15 +304,20 @@ static void expand_token(struct ml_token_ctx *ctx) {
     bool grow = true;
     if (ctx->token_idx + 2 >= ctx->token_capacity) {
         int new_capacity = ctx->token_capacity << 1;
-        char *new_buffer = ml_memory_realloc(ctx->token_buffer, new_capacity);
+        char *new_buffer = ml_allocator_realloc(ctx->allocator, ctx->token_buffer, new_capacity);
         if (new_buffer) {
             ctx->token_buffer = new_buffer;
             ctx->token_capacity = new_capacity;
+            ctx->token_grows++;
         } else {
             grow = false;
             ctx->token_flags |= TOKEN_FLAG_INTERNAL_ERROR;
         }
     }
+    if (!ctx->token_idx) {
+        ctx->token_line = ctx->line;
+        ctx->token_column = (int) (get_read_offset(ctx) - ctx->line_offset) + 1;
+    }
     if (grow) {
         ctx->token_buffer[ctx->token_idx] = ctx->read_buffer[ctx->read_idx];
         ctx->token_idx++;
@@ -278,7 +340,7 @@ static enum ml_token_type flush_token(struct ml_token_ctx *ctx,
     return finish_token(ctx, data, &type);
 }
 
-enum ml_token_type ml_token_iterate(struct ml_token_ctx *ctx, struct ml_token_data *data) {
+static enum ml_token_type do_token_iterate(struct ml_token_ctx *ctx, struct ml_token_data *data) {
     while (true) {
         // fill read buffer if it is empty
         if (ctx->read_idx >= ctx->read_count) {
@@ -292,8 +354,13 @@ enum ml_token_type ml_token_iterate(struct ml_token_ctx *ctx, struct ml_token_da
 
             // block reading if it is the last chunk of data
             int n = ctx->io_fns->read(ctx->io_opaque, ctx->read_buffer, ctx->read_capacity);
+            ctx->read_refills++;
             if (n <= 0)
                 ctx->token_flags |= TOKEN_FLAG_STOP_READING;
+            else
+                ctx->read_bytes += n;
+            if (n > ctx->read_peak)
+                ctx->read_peak = n;
 
             ctx->read_idx = 0;
             ctx->read_count = n;
@@ -420,3 +487,78 @@ enum ml_token_type ml_token_iterate(struct ml_token_ctx *ctx, struct ml_token_da
         }
     }
 }
+
+enum ml_token_type ml_token_iterate(struct ml_token_ctx *ctx, struct ml_token_data *data) {
+    enum ml_token_type type = do_token_iterate(ctx, data);
+    ctx->type_counts[type]++;
+    return type;
+}
+
+void ml_token_get_stats(struct ml_token_ctx *ctx, struct ml_token_stats *stats) {
+    // the end of input is not a token, though it is counted by its type
+    *stats = (struct ml_token_stats) {
+        .bytes = ctx->read_bytes,
+        .tokens = 0,
+        .refills = ctx->read_refills,
+    };
+    for (int i = 0; i < ML_TOKEN_TYPE_COUNT; i++) {
+        stats->types[i] = ctx->type_counts[i];
+        if (i != ML_TOKEN_TYPE_EOF)
+            stats->tokens += ctx->type_counts[i];
+    }
+}
+
+int ml_token_get_memory_stats(struct ml_token_ctx *ctx, struct ml_memory_stats *stats, int capacity) {
+    // counts are the largest refill and the longest token with its terminator
+    struct ml_memory_stats all[] = {
+        {
+            .name = "read_buffer",
+            .count = ctx->read_peak,
+            .capacity = ctx->read_capacity,
+            .allocs = 1,
+            .grows = 0,
+            .bytes = ctx->read_capacity,
+            .peak_bytes = ctx->read_capacity,
+        },
+        {
+            .name = "token_buffer",
+            .count = ctx->token_peak,
+            .capacity = ctx->token_capacity,
+            .allocs = 1 + ctx->token_grows,
+            .grows = ctx->token_grows,
+            .bytes = ctx->token_capacity,
+            .peak_bytes = ctx->token_capacity,
+        },
+    };
+
+    int count = sizeof(all) / sizeof(all[0]);
+    for (int i = 0; stats && i < count && i < capacity; i++)
+        stats[i] = all[i];
+    return count;
+}
+
+const char *ml_token_get_type_name(enum ml_token_type type) {
+    static const char *const names[ML_TOKEN_TYPE_COUNT] = {
+        [ML_TOKEN_TYPE_EOF] = "eof",
+        [ML_TOKEN_TYPE_ERROR] = "error",
+        [ML_TOKEN_TYPE_NUMBER] = "number",
+        [ML_TOKEN_TYPE_NAME] = "name",
+        [ML_TOKEN_TYPE_PRINT] = "print",
+        [ML_TOKEN_TYPE_RETURN] = "return",
+        [ML_TOKEN_TYPE_FUNCTION] = "function",
+        [ML_TOKEN_TYPE_ARGUMENT] = "argument",
+        [ML_TOKEN_TYPE_ASSIGNMENT] = "assignment",
+        [ML_TOKEN_TYPE_COMMENT] = "comment",
+        [ML_TOKEN_TYPE_SPACE] = "space",
+        [ML_TOKEN_TYPE_TAB] = "tab",
+        [ML_TOKEN_TYPE_PLUS] = "plus",
+        [ML_TOKEN_TYPE_MINUS] = "minus",
+        [ML_TOKEN_TYPE_MULTIPLY] = "multiply",
+        [ML_TOKEN_TYPE_DIVIDE] = "divide",
+        [ML_TOKEN_TYPE_COMMA] = "comma",
+        [ML_TOKEN_TYPE_PARENTHESIS_L] = "parenthesis_l",
+        [ML_TOKEN_TYPE_PARENTHESIS_R] = "parenthesis_r",
+        [ML_TOKEN_TYPE_LINE_TERMINATOR] = "line_terminator",
+    };
+    return (type >= 0 && type < ML_TOKEN_TYPE_COUNT) ? names[type] : "unknown";
+}
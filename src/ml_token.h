@@ -3,10 +3,14 @@
 #include <stdbool.h>
 
 struct ml_token_ctx;
+struct ml_memory_stats;
+struct ml_allocator;
 
+// the allocator must outlive the context
 struct ml_token_ctx_init_args {
     int read_capacity;
     int token_capacity;
+    const struct ml_allocator *allocator;
 };
 
 struct ml_token_io_fns {
@@ -14,6 +18,7 @@ struct ml_token_io_fns {
     void (*close)(void *opaque);
 };
 
+// lines and columns count from one, and a column counts bytes
 struct ml_token_data {
     const char *buf;
     int len;
@@ -21,6 +26,8 @@ struct ml_token_data {
         int index;
         double number;
     } value;
+    int line;
+    int column;
 };
 
 enum ml_token_type {
@@ -46,6 +53,15 @@ enum ml_token_type {
     ML_TOKEN_TYPE_LINE_TERMINATOR,
 };
 
+#define ML_TOKEN_TYPE_COUNT     (ML_TOKEN_TYPE_LINE_TERMINATOR + 1)
+
+struct ml_token_stats {
+    long long bytes;
+    long long tokens;
+    long long refills;
+    long long types[ML_TOKEN_TYPE_COUNT];
+};
+
 bool ml_token_ctx_init_file(struct ml_token_ctx **pp, const char *path);
 
 bool ml_token_ctx_init_fns(struct ml_token_ctx **pp, void *opaque,
@@ -55,3 +71,9 @@ bool ml_token_ctx_init_fns(struct ml_token_ctx **pp, void *opaque,
 void ml_token_ctx_uninit(struct ml_token_ctx **pp);
 
 enum ml_token_type ml_token_iterate(struct ml_token_ctx *ctx, struct ml_token_data *data);
+
+void ml_token_get_stats(struct ml_token_ctx *ctx, struct ml_token_stats *stats);
+
+int ml_token_get_memory_stats(struct ml_token_ctx *ctx, struct ml_memory_stats *stats, int capacity);
+
+const char *ml_token_get_type_name(enum ml_token_type type);
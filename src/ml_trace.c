@@ -0,0 +1,75 @@
+#include "ml_trace.h"
+#include "ml_memory.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ML_TRACE_CATEGORY               "runml"
+
+struct ml_trace_ctx {
+    FILE *file;
+    int pid;
+    int count;
+};
+
+bool ml_trace_ctx_init(struct ml_trace_ctx **pp, const char *path) {
+    // events are written in the json array format, which a viewer accepts even without the closing bracket
+    struct ml_trace_ctx *ctx = ml_memory_malloc(sizeof(struct ml_trace_ctx));
+    if (!ctx)
+        return false;
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        ml_memory_free(ctx);
+        return false;
+    }
+
+    fputs("[\n", file);
+    *ctx = (struct ml_trace_ctx) {
+        .file = file,
+        .pid = (int) getpid(),
+        .count = 0,
+    };
+    *pp = ctx;
+    return true;
+}
+
+void ml_trace_ctx_uninit(struct ml_trace_ctx **pp) {
+    struct ml_trace_ctx *ctx = pp ? *pp : NULL;
+    if (!ctx)
+        return;
+
+    fputs("\n]\n", ctx->file);
+    fclose(ctx->file);
+    ml_memory_free(ctx);
+    *pp = NULL;
+}
+
+long long ml_trace_now(void) {
+    // microseconds, as the unit of trace timestamps
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+void ml_trace_span(struct ml_trace_ctx *ctx, const char *name, int tid, long long start,
+                   const struct ml_trace_arg *args, int count) {
+    // e.g. {"name":"cc","cat":"runml","ph":"X","ts":1,"dur":2,"pid":3,"tid":4,"args":{"bytes":5}}
+    // names are literals of the caller, so nothing needs to be escaped
+    // subprocesses are given their own tracks, because they may overlap each other
+    if (!ctx)
+        return;
+
+    long long end = ml_trace_now();
+    fprintf(ctx->file, "%s{\"name\":\"%s\",\"cat\":\"" ML_TRACE_CATEGORY "\",\"ph\":\"X\","
+                       "\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{",
+            ctx->count ? ",\n" : "", name, start, end - start, ctx->pid, tid ? tid : ctx->pid);
+    for (int i = 0; i < count; i++)
+        fprintf(ctx->file, "%s\"%s\":%lld", i ? "," : "", args[i].name, args[i].value);
+    fputs("}}", ctx->file);
+
+    // a forked process never writes what is buffered before it
+    fflush(ctx->file);
+    ctx->count++;
+}
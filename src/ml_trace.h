@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct ml_trace_ctx;
+
+struct ml_trace_arg {
+    const char *name;
+    long long value;
+};
+
+bool ml_trace_ctx_init(struct ml_trace_ctx **pp, const char *path);
+
+void ml_trace_ctx_uninit(struct ml_trace_ctx **pp);
+
+long long ml_trace_now(void);
+
+void ml_trace_span(struct ml_trace_ctx *ctx, const char *name, int tid, long long start,
+                   const struct ml_trace_arg *args, int count);
@@ -5,6 +5,7 @@ extern "C" {
 #include "base.h"
 
 #include <cstring>
+#include <mutex>
 #include <memory>
 #include <vector>
 #include <algorithm>
@@ -27,6 +28,9 @@ private:
     size_t allocate_size;
     std::unordered_map<void*, std::shared_ptr<std::vector<uint8_t>>> memory_map;
 
+    // codegen workers allocate from multiple threads
+    std::recursive_mutex mutex;
+
 private:
     bool check(size_t old_size, size_t new_size) {
         switch (limit_mode) {
@@ -51,11 +55,13 @@ private:
 
 public:
     void limit(LimitMode mode, size_t value) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
         limit_mode = mode;
         limit_value = value;
     }
 
     bool reset() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
         bool no_leak = memory_map.empty();
         memory_map.clear();
         invoke_count = 0;
@@ -64,6 +70,7 @@ public:
     }
 
     void *alloc(size_t size) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
         if (!check(0, size))
             return nullptr;
 
@@ -73,6 +80,7 @@ public:
     }
 
     void *realloc(void *ptr, size_t size) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
         auto it = memory_map.find(ptr);
         if (it == memory_map.end())
             return alloc(size);
@@ -91,6 +99,7 @@ public:
     }
 
     void free(void *ptr) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
         auto it = memory_map.find(ptr);
         if (it == memory_map.end()) {
             CPPUNIT_ASSERT(false);
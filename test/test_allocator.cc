@@ -0,0 +1,167 @@
+extern "C" {
+#include "ml_allocator.h"
+#include "ml_compile.h"
+}
+
+#include "base.h"
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace runml {
+
+class TestAllocator : public BaseTextFixture {
+
+    CPPUNIT_TEST_SUITE(TestAllocator);
+    CPPUNIT_TEST(testFixedWithoutHeap);
+    CPPUNIT_TEST(testFixedExhausted);
+    CPPUNIT_TEST(testBumpResize);
+    CPPUNIT_TEST(testArena);
+    CPPUNIT_TEST(testPool);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    std::vector<std::string> line_storage;
+
+private:
+    static void countParams(void *opaque, ml_compile_visit_event event, const ml_compile_visit_data *data) {
+        if (event == ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START && data->func.count && std::strcmp(data->func.params[0], "a") == 0)
+            *static_cast<int*>(opaque) = data->func.count;
+    }
+
+    bool compileWith(const ml_allocator *allocator, int functions) {
+        line_storage.clear();
+        for (int i = 0; i < functions; i++) {
+            std::string name = "f" + std::string(1 + i / 26, 'a' + i % 26);
+            line_storage.push_back("function " + name + " x y");
+            line_storage.push_back("\treturn x * y + " + std::to_string(i));
+        }
+
+        // parameters are visited without allocating, however many there are
+        std::string wide = "function wide";
+        for (char c = 'a'; c <= 't'; c++)
+            wide += std::string(" ") + c;
+        line_storage.push_back(wide);
+        line_storage.push_back("\treturn a + t");
+        line_storage.push_back("print fa(1, arg0)");
+
+        std::vector<RawString> lines;
+        for (const auto &line : line_storage)
+            lines.emplace_back(line.c_str());
+
+        // small capacities make both contexts grow through the allocator
+        Tokenizer t(std::move(lines), {4, 2, allocator});
+        ml_compile_ctx *compile = nullptr;
+        const ml_compile_ctx_init_args args {2, 8, allocator};
+        if (!t.cast() || !ml_compile_ctx_init(&compile, &args))
+            return false;
+
+        int params = 0;
+        bool succeed = ml_compile_feed(compile, t.cast()) == ML_COMPILE_RESULT_SUCCEED
+            && ml_compile_get_func_count(compile) == functions + 1;
+        if (succeed)
+            ml_compile_accept(compile, &params, countParams);
+        succeed = succeed && params == 20;
+        ml_compile_ctx_uninit(&compile);
+        return succeed;
+    }
+
+public:
+    void testFixedWithoutHeap() {
+        // any allocation from the default heap fails from now on
+        setMaxAllocCount(0);
+
+        std::vector<char> memory(1 << 20);
+        ml_allocator allocator;
+        CPPUNIT_ASSERT(ml_fixed_init(&allocator, memory.data() + 1, memory.size() - 1));
+        CPPUNIT_ASSERT(compileWith(&allocator, 100));
+        CPPUNIT_ASSERT(!compileWith(nullptr, 100));
+    }
+
+    void testFixedExhausted() {
+        setMaxAllocCount(0);
+
+        char memory[512];
+        ml_allocator allocator;
+        CPPUNIT_ASSERT(!ml_fixed_init(&allocator, memory, 8));
+        CPPUNIT_ASSERT(ml_fixed_init(&allocator, memory, sizeof(memory)));
+        CPPUNIT_ASSERT(!compileWith(&allocator, 100));
+        CPPUNIT_ASSERT(!ml_allocator_alloc(&allocator, ~(size_t) 0));
+    }
+
+    void testBumpResize() {
+        char memory[4096];
+        ml_allocator allocator;
+        CPPUNIT_ASSERT(ml_fixed_init(&allocator, memory, sizeof(memory)));
+
+        // the last block grows in place, others are moved with their content
+        auto p = static_cast<char*>(ml_allocator_alloc(&allocator, 10));
+        std::strcpy(p, "runml");
+        CPPUNIT_ASSERT_EQUAL(static_cast<void*>(p), ml_allocator_realloc(&allocator, p, 100));
+        auto q = ml_allocator_alloc(&allocator, 4);
+        auto r = static_cast<char*>(ml_allocator_realloc(&allocator, p, 200));
+        CPPUNIT_ASSERT(r && r != p);
+        CPPUNIT_ASSERT_EQUAL(std::string("runml"), std::string(r));
+
+        // freeing the last block gives its space back
+        ml_allocator_free(&allocator, r);
+        CPPUNIT_ASSERT_EQUAL(static_cast<void*>(r), ml_allocator_alloc(&allocator, 300));
+        CPPUNIT_ASSERT(q);
+    }
+
+    void testArena() {
+        ml_arena *arena = nullptr;
+        CPPUNIT_ASSERT(ml_arena_init(&arena, nullptr, 256));
+
+        ml_allocator allocator;
+        ml_arena_get_allocator(arena, &allocator);
+        CPPUNIT_ASSERT(compileWith(&allocator, 100));
+
+        // blocks larger than a chunk get a chunk of their own
+        CPPUNIT_ASSERT(ml_allocator_alloc(&allocator, 4096));
+
+        // only the newest chunk survives a reset, and it is reused from its start
+        ml_arena_reset(arena);
+        void *p = ml_allocator_alloc(&allocator, 16);
+        ml_arena_reset(arena);
+        CPPUNIT_ASSERT_EQUAL(p, ml_allocator_alloc(&allocator, 32));
+        CPPUNIT_ASSERT(compileWith(&allocator, 100));
+
+        // everything goes back to the parent at once
+        ml_arena_uninit(&arena);
+        CPPUNIT_ASSERT(!arena);
+    }
+
+    void testPool() {
+        ml_allocator allocator;
+        ml_pool_get_allocator(&allocator);
+        CPPUNIT_ASSERT(compileWith(&allocator, 100));
+
+        // blocks of the same class are reused by the thread freeing them
+        void *p = ml_allocator_alloc(&allocator, 24);
+        ml_allocator_free(&allocator, p);
+        CPPUNIT_ASSERT_EQUAL(p, ml_allocator_alloc(&allocator, 20));
+        CPPUNIT_ASSERT_EQUAL(p, ml_allocator_realloc(&allocator, p, 32));
+
+        void *large = ml_allocator_realloc(&allocator, p, 100000);
+        CPPUNIT_ASSERT(large);
+        ml_allocator_free(&allocator, large);
+
+        void *other = nullptr;
+        std::thread worker([&allocator, &other]() {
+            other = ml_allocator_alloc(&allocator, 24);
+            ml_allocator_free(&allocator, other);
+            ml_pool_trim();
+        });
+        worker.join();
+        CPPUNIT_ASSERT(other && other != p);
+
+        ml_pool_trim();
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TestAllocator);
+
+}
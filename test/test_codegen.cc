@@ -0,0 +1,435 @@
+extern "C" {
+#include "ml_memory.h"
+#include "ml_compile.h"
+#include "ml_codegen.h"
+}
+
+#include "base.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+namespace runml {
+
+class Exporter {
+private:
+    std::string output;
+    int writev_count = 0;
+    bool closed = false;
+
+private:
+    static int doWrite(void *opaque, char *buffer, int count) {
+        auto e = reinterpret_cast<Exporter*>(opaque);
+        e->output.append(buffer, count);
+        return count;
+    }
+
+    static int doWritev(void *opaque, struct iovec *iov, int count) {
+        auto e = reinterpret_cast<Exporter*>(opaque);
+        e->writev_count++;
+        for (int i = 0; i < count; i++)
+            doWrite(opaque, static_cast<char*>(iov[i].iov_base), iov[i].iov_len);
+        return 0;
+    }
+
+    static void doClose(void *opaque) {
+        reinterpret_cast<Exporter*>(opaque)->closed = true;
+    }
+
+public:
+    void run(ml_compile_ctx *compile, const ml_codegen_args &args, bool vectored) {
+        const ml_codegen_io_fns fns {
+            doWrite,
+            vectored ? doWritev : nullptr,
+            doClose,
+        };
+        ml_codegen_export_fns(compile, this, &fns, &args);
+        CPPUNIT_ASSERT(closed);
+    }
+
+    void runUnit(ml_compile_ctx *compile, int unit, const char *header_name, const ml_codegen_args &args) {
+        const ml_codegen_io_fns fns {
+            doWrite,
+            nullptr,
+            doClose,
+        };
+        ml_codegen_export_unit_fns(compile, unit, header_name, this, &fns, &args);
+        CPPUNIT_ASSERT(closed);
+    }
+
+    const std::string& getOutput() const { return output; }
+    int getWritevCount() const { return writev_count; }
+};
+
+class TestCodegen : public BaseTextFixture {
+
+    CPPUNIT_TEST_SUITE(TestCodegen);
+    CPPUNIT_TEST(testParallelOutput);
+    CPPUNIT_TEST(testParallelThreshold);
+    CPPUNIT_TEST(testNumberFormat);
+    CPPUNIT_TEST(testExternRuntime);
+    CPPUNIT_TEST(testCompactOutput);
+    CPPUNIT_TEST(testSplitUnits);
+    CPPUNIT_TEST(testStats);
+    CPPUNIT_TEST(testBatchOutput);
+    CPPUNIT_TEST(testShardOutput);
+    CPPUNIT_TEST(testSharedOutput);
+    CPPUNIT_TEST(testForkServerOutput);
+    CPPUNIT_TEST(testLineMarkers);
+    CPPUNIT_TEST(testProfileOutput);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    ml_compile_ctx *compile = nullptr;
+    std::vector<std::string> line_storage;
+
+private:
+    void compileLines(const std::vector<std::string> &source) {
+        std::vector<RawString> lines;
+        for (const auto &line : source)
+            lines.emplace_back(line.c_str());
+
+        Tokenizer t(std::move(lines));
+        CPPUNIT_ASSERT(ml_compile_ctx_init(&compile, nullptr));
+        CPPUNIT_ASSERT_EQUAL(ML_COMPILE_RESULT_SUCCEED, ml_compile_feed(compile, t.cast()));
+    }
+
+    std::string exportBuffer(const ml_codegen_args &args) {
+        char *buffer = nullptr;
+        int count = 0;
+        CPPUNIT_ASSERT(ml_codegen_export_buffer(compile, &buffer, &count, &args));
+        std::string output(buffer, count);
+        ml_memory_free(buffer);
+        return output;
+    }
+
+    void compileFunctions(int count) {
+        // functions call their previous ones, and every other one is impure
+        auto makeName = [](int i) {
+            std::string name = "f" + std::to_string(i);
+            for (auto &c : name)
+                c = std::isdigit(c) ? ('a' + c - '0') : c;
+            return name;
+        };
+
+        line_storage.clear();
+        for (int i = 0; i < count; i++) {
+            line_storage.push_back("function " + makeName(i) + " x y");
+            if (i % 2)
+                line_storage.push_back("\tprint x");
+            line_storage.push_back(i ? ("\treturn " + makeName(i - 1) + "(x, y) * 0.5") : "\treturn x / 3");
+        }
+        line_storage.push_back("print 1");
+        compileLines(line_storage);
+    }
+
+public:
+    virtual void tearDown() override {
+        ml_compile_ctx_uninit(&compile);
+        BaseTextFixture::tearDown();
+    }
+
+    void testParallelOutput() {
+        compileFunctions(1000);
+
+        Exporter serial;
+        serial.run(compile, {4096, 0, ML_CODEGEN_FLAG_MEMOIZE}, true);
+        CPPUNIT_ASSERT_EQUAL(0, serial.getWritevCount());
+
+        // the whole output is written at once
+        Exporter parallel;
+        parallel.run(compile, {4096, 4, ML_CODEGEN_FLAG_MEMOIZE | ML_CODEGEN_FLAG_PARALLEL}, true);
+        CPPUNIT_ASSERT_EQUAL(1, parallel.getWritevCount());
+        CPPUNIT_ASSERT(serial.getOutput() == parallel.getOutput());
+
+        Exporter fallback;
+        fallback.run(compile, {4096, 3, ML_CODEGEN_FLAG_MEMOIZE | ML_CODEGEN_FLAG_PARALLEL}, false);
+        CPPUNIT_ASSERT(serial.getOutput() == fallback.getOutput());
+
+        CPPUNIT_ASSERT(serial.getOutput() == exportBuffer({16, 2, ML_CODEGEN_FLAG_MEMOIZE | ML_CODEGEN_FLAG_PARALLEL}));
+    }
+
+    void testParallelThreshold() {
+        compileFunctions(10);
+
+        Exporter serial;
+        serial.run(compile, {4096, 0, 0}, true);
+
+        Exporter parallel;
+        parallel.run(compile, {4096, 4, ML_CODEGEN_FLAG_PARALLEL}, true);
+        CPPUNIT_ASSERT_EQUAL(0, parallel.getWritevCount());
+        CPPUNIT_ASSERT(serial.getOutput() == parallel.getOutput());
+    }
+
+    void testNumberFormat() {
+        // numbers are formatted by hand, and should be the same as "%a"
+        const std::vector<std::string> numbers {
+            "0", "1", "2", "0.1", "3.75", "1024.5", "0.3333333333333333", "4503599627370495.5",
+            "123456789012345678901234567890",
+            "0." + std::string(300, '0') + "1",
+            "1" + std::string(300, '0'),
+        };
+
+        std::vector<std::string> lines;
+        for (const auto &number : numbers)
+            lines.push_back("print " + number);
+        lines.push_back("print arg0 + arg1234567");
+        compileLines(lines);
+
+        auto output = exportBuffer({4096, 0, 0});
+        for (const auto &number : numbers) {
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "ml_print(%a);", std::strtod(number.c_str(), nullptr));
+            CPPUNIT_ASSERT(output.find(buf) != std::string::npos);
+        }
+        CPPUNIT_ASSERT(output.find("ml_print(ml_arg0 + ml_arg1234567);") != std::string::npos);
+        CPPUNIT_ASSERT(output.find("ml_arg1234567 = ml_parse_arg(1234567, ml_argv, ml_argc);") != std::string::npos);
+    }
+
+    void testExternRuntime() {
+        compileLines({"x <- arg0", "print x"});
+
+        auto embedded = exportBuffer({4096, 0, 0});
+        CPPUNIT_ASSERT(embedded.find("#include") != std::string::npos);
+        CPPUNIT_ASSERT(embedded.find("void ml_print(double ml_val) {") != std::string::npos);
+
+        // only declarations are left, and the definitions come from the prebuilt library
+        auto external = exportBuffer({4096, 0, ML_CODEGEN_FLAG_EXTERN_RUNTIME});
+        CPPUNIT_ASSERT(external.find("#include") == std::string::npos);
+        CPPUNIT_ASSERT(external.find("void ml_print(double ml_val);") != std::string::npos);
+        CPPUNIT_ASSERT(external.find("void ml_flush(void);") != std::string::npos);
+        CPPUNIT_ASSERT(external.find("ml_print(x);") != std::string::npos);
+    }
+
+    void testCompactOutput() {
+        compileFunctions(1000);
+
+        // no header, comment, indent or internal long name is left
+        const uint32_t flags = ML_CODEGEN_FLAG_MEMOIZE | ML_CODEGEN_FLAG_COMPACT;
+        auto compact = exportBuffer({4096, 0, flags});
+        CPPUNIT_ASSERT(compact.find("#include") == std::string::npos);
+        CPPUNIT_ASSERT(compact.find("//") == std::string::npos);
+        CPPUNIT_ASSERT(compact.find("\n ") == std::string::npos);
+        CPPUNIT_ASSERT(compact.find("\n\n") == std::string::npos);
+        CPPUNIT_ASSERT(compact.find("ml_") == std::string::npos);
+        CPPUNIT_ASSERT(compact.find("static double Rfa(double x,double y){") != std::string::npos);
+        CPPUNIT_ASSERT(compact.size() < exportBuffer({4096, 0, ML_CODEGEN_FLAG_MEMOIZE}).size());
+
+        Exporter parallel;
+        parallel.run(compile, {4096, 4, flags | ML_CODEGEN_FLAG_PARALLEL}, true);
+        CPPUNIT_ASSERT(compact == parallel.getOutput());
+
+        // names defined by the prebuilt runtime are kept
+        auto external = exportBuffer({4096, 0, flags | ML_CODEGEN_FLAG_EXTERN_RUNTIME});
+        CPPUNIT_ASSERT(external.find("void ml_print(double VL);") != std::string::npos);
+        CPPUNIT_ASSERT(external.find("ml_print(x);") != std::string::npos);
+    }
+
+    void testSplitUnits() {
+        compileLines({
+            "x <- arg0",
+            "function f a",
+            "\treturn a + x",
+            "function g a",
+            "\treturn f(a) * 2",
+            "function h a",
+            "\tprint g(a)",
+            "h(1)",
+        });
+
+        const ml_codegen_args args {4096, 0, ML_CODEGEN_FLAG_MEMOIZE, 2};
+        CPPUNIT_ASSERT_EQUAL(4, ml_codegen_get_unit_count(compile, &args));
+        auto exportUnit = [this](int unit, const char *header_name, const ml_codegen_args &args) {
+            Exporter e;
+            e.runUnit(compile, unit, header_name, args);
+            return e.getOutput();
+        };
+
+        // shared symbols are declared once, and user names cannot clash with the runtime
+        auto header = exportUnit(ML_CODEGEN_UNIT_HEADER, "units.h", args);
+        CPPUNIT_ASSERT(header.find("#include") == std::string::npos);
+        CPPUNIT_ASSERT(header.find("extern double ml_arg0;") != std::string::npos);
+        CPPUNIT_ASSERT(header.find("extern double ml_u_x;") != std::string::npos);
+        CPPUNIT_ASSERT(header.find("double ml_u_f(double ml_u_a);") != std::string::npos);
+        CPPUNIT_ASSERT(header.find("static inline int ml_memo_equal(") != std::string::npos);
+
+        auto main = exportUnit(ML_CODEGEN_UNIT_MAIN, "units.h", args);
+        CPPUNIT_ASSERT(main.find("#include \"units.h\"") != std::string::npos);
+        CPPUNIT_ASSERT(main.find("void ml_print(double ml_val) {") != std::string::npos);
+        CPPUNIT_ASSERT(main.find("double ml_u_x = 0;") != std::string::npos);
+        CPPUNIT_ASSERT(main.find("int main(") != std::string::npos);
+        CPPUNIT_ASSERT(main.find("double ml_u_f(") == std::string::npos);
+
+        // functions are dealt out in contiguous ranges
+        auto first = exportUnit(ML_CODEGEN_UNIT_FUNCTIONS, "units.h", args);
+        auto second = exportUnit(ML_CODEGEN_UNIT_FUNCTIONS + 1, "units.h", args);
+        CPPUNIT_ASSERT(first.find("#include \"units.h\"") == 0);
+        CPPUNIT_ASSERT(first.find("double ml_u_f(double ml_u_a) {") != std::string::npos);
+        CPPUNIT_ASSERT(first.find("ml_u_g(double") == std::string::npos);
+        CPPUNIT_ASSERT(second.find("double ml_u_g(double ml_u_a) {") != std::string::npos);
+        CPPUNIT_ASSERT(second.find("double ml_u_h(double ml_u_a) {") != std::string::npos);
+        CPPUNIT_ASSERT(second.find("static double ml_u_f(") == std::string::npos);
+        CPPUNIT_ASSERT(exportUnit(ML_CODEGEN_UNIT_FUNCTIONS + 2, "units.h", args).empty());
+
+        // the header name is kept as it is in compact output
+        const ml_codegen_args compact {4096, 0, ML_CODEGEN_FLAG_COMPACT, 2};
+        auto compact_main = exportUnit(ML_CODEGEN_UNIT_MAIN, "ml_dir/ml units.h", compact);
+        CPPUNIT_ASSERT(compact_main.find("#include \"ml_dir/ml units.h\"") != std::string::npos);
+        CPPUNIT_ASSERT(compact_main.find("double Zx=0;") != std::string::npos);
+    }
+
+    void testStats() {
+        compileFunctions(1000);
+
+        // the staging buffer is flushed whenever it is full
+        ml_codegen_stats stats = {0};
+        Exporter serial;
+        serial.run(compile, {256, 0, 0, 0, &stats}, false);
+        long long size = serial.getOutput().size();
+        CPPUNIT_ASSERT_EQUAL(size, stats.bytes);
+        CPPUNIT_ASSERT_EQUAL((size + 255) / 256, stats.flushes);
+        CPPUNIT_ASSERT_EQUAL(1LL, stats.buffers.allocs);
+        CPPUNIT_ASSERT_EQUAL(256LL, stats.buffers.peak_bytes);
+
+        // chunks of each worker are alive until they are all written, and exports are accumulated
+        Exporter parallel;
+        parallel.run(compile, {0, 4, ML_CODEGEN_FLAG_PARALLEL, 0, &stats}, true);
+        CPPUNIT_ASSERT_EQUAL(serial.getOutput(), parallel.getOutput());
+        CPPUNIT_ASSERT_EQUAL(size * 2, stats.bytes);
+        CPPUNIT_ASSERT(stats.buffers.allocs >= 1 + 4 + 1);
+        CPPUNIT_ASSERT(stats.buffers.peak_bytes >= size);
+        CPPUNIT_ASSERT_EQUAL(stats.buffers.peak_bytes, stats.buffers.bytes - 256);
+    }
+
+    void testBatchOutput() {
+        compileFunctions(1000);
+
+        // every value is a vector of rows, and memoization is left out
+        const uint32_t flags = ML_CODEGEN_FLAG_MEMOIZE | ML_CODEGEN_FLAG_COMPACT | ML_CODEGEN_FLAG_BATCH;
+        auto batch = exportBuffer({4096, 0, flags});
+        CPPUNIT_ASSERT(batch.find("ml_") == std::string::npos);
+        CPPUNIT_ASSERT(batch.find("static VC fa(VC x,VC y){") != std::string::npos);
+        CPPUNIT_ASSERT(batch.find("Rfa") == std::string::npos);
+        CPPUNIT_ASSERT(batch.find("int main(int C,char**V){") != std::string::npos);
+
+        Exporter parallel;
+        parallel.run(compile, {4096, 4, flags | ML_CODEGEN_FLAG_PARALLEL}, true);
+        CPPUNIT_ASSERT(batch == parallel.getOutput());
+    }
+
+    void testShardOutput() {
+        compileLines({"v <- arg0 + arg1", "print v"});
+
+        // arguments and globals belong to the thread evaluating the rows, and the runtime is never left out
+        const uint32_t flags = ML_CODEGEN_FLAG_BATCH | ML_CODEGEN_FLAG_SHARD | ML_CODEGEN_FLAG_EXTERN_RUNTIME;
+        auto shard = exportBuffer({4096, 0, flags});
+        CPPUNIT_ASSERT(shard.find("static _Thread_local ml_vec ml_arg1;") != std::string::npos);
+        CPPUNIT_ASSERT(shard.find("static _Thread_local ml_vec v;") != std::string::npos);
+        CPPUNIT_ASSERT(shard.find("static double ml_arg") == std::string::npos);
+        CPPUNIT_ASSERT(shard.find("static double v") == std::string::npos);
+        CPPUNIT_ASSERT(shard.find("static void ml_flush(void) {") != std::string::npos);
+        CPPUNIT_ASSERT(shard.find("return ml_shard_main(ml_argc, ml_argv, ml_batch_body);") != std::string::npos);
+
+        auto compact = exportBuffer({4096, 0, flags | ML_CODEGEN_FLAG_COMPACT});
+        CPPUNIT_ASSERT(compact.find("ml_") == std::string::npos);
+    }
+
+    void testSharedOutput() {
+        compileLines({"v <- v + arg0", "print v"});
+
+        // the sink, the entry and the symbol table are looked up by name, so they are the only identifiers left unmangled
+        const uint32_t flags = ML_CODEGEN_FLAG_COMPACT | ML_CODEGEN_FLAG_SHARED | ML_CODEGEN_FLAG_EXTERN_RUNTIME;
+        auto shared = exportBuffer({4096, 0, flags});
+        auto sink = shared.find("const SI*ml_module_sink=0;\n");
+        auto entry = shared.find("int ml_entry(int C,char**V,const SI*OP){\nOI=OP;\nv=0;\n");
+        auto symbols = shared.find("const SY ml_symbols[]={\n{\"arg0\",2,0,&A0},\n{\"v\",1,0,&v},\n{0,0,0,0},\n};\n");
+        CPPUNIT_ASSERT(entry != std::string::npos);
+        CPPUNIT_ASSERT(symbols != std::string::npos);
+        CPPUNIT_ASSERT(sink != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(sink + 9, shared.find("ml_"));
+        CPPUNIT_ASSERT_EQUAL(entry + 4, shared.find("ml_", sink + 10));
+        CPPUNIT_ASSERT_EQUAL(symbols + 9, shared.rfind("ml_"));
+        CPPUNIT_ASSERT(shared.find("main") == std::string::npos);
+    }
+
+    void testForkServerOutput() {
+        compileLines({"v <- v + arg0", "print v"});
+
+        // the program becomes a function, which is called by the child of every request
+        const uint32_t flags = ML_CODEGEN_FLAG_COMPACT | ML_CODEGEN_FLAG_FORK_SERVER | ML_CODEGEN_FLAG_EXTERN_RUNTIME;
+        auto server = exportBuffer({4096, 0, flags});
+        CPPUNIT_ASSERT(server.find("#include<sys/socket.h>") != std::string::npos);
+        CPPUNIT_ASSERT(server.find("static int MA(int C,char**V){\n") != std::string::npos);
+        CPPUNIT_ASSERT(server.find("_exit(MA(") != std::string::npos);
+        CPPUNIT_ASSERT(server.find("ml_") == std::string::npos);
+    }
+
+    void testLineMarkers() {
+        compileLines({"# twice", "function twice x", "\treturn x * 2", "", "print twice(arg0)"});
+
+        // nothing is marked without a path, which is never shortened or squeezed
+        ml_codegen_args args {4096, 0, ML_CODEGEN_FLAG_COMPACT};
+        CPPUNIT_ASSERT(exportBuffer(args).find("#line") == std::string::npos);
+        args.source_path = "/tmp/ml_print  \"a\".ml";
+        auto marked = exportBuffer(args);
+        const std::string path = " \"/tmp/ml_print  \\\"a\\\".ml\"\n";
+        CPPUNIT_ASSERT(marked.find("\n#line 2" + path) != std::string::npos);
+        CPPUNIT_ASSERT(marked.find("\n#line 3" + path + "return") != std::string::npos);
+        CPPUNIT_ASSERT(marked.find("\n#line 5" + path + "P(") != std::string::npos);
+        CPPUNIT_ASSERT(marked.find("#line 4") == std::string::npos);
+
+        // the rest points back to the translation, at its own lines
+        args.output_path = "/tmp/out.c";
+        auto kept = exportBuffer(args);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), kept.find("#line 2 \"/tmp/out.c\"\n"));
+        int count = 0;
+        int line = 0;
+        std::istringstream lines(kept);
+        for (std::string text; std::getline(lines, text); ) {
+            line++;
+            if (text.compare(0, 6, "#line ") == 0 && text.find("\"/tmp/out.c\"") != std::string::npos) {
+                CPPUNIT_ASSERT_EQUAL(line + 1, std::atoi(text.c_str() + 6));
+                count++;
+            }
+        }
+        CPPUNIT_ASSERT_EQUAL(3, count);
+    }
+
+    void testProfileOutput() {
+        compileLines({"function sq x", "\treturn x * x", "print sq(arg0)"});
+
+        // the profiled wrapper takes the name of the function, and calls its memo wrapper
+        ml_codegen_args args {4096, 0, ML_CODEGEN_FLAG_MEMOIZE | ML_CODEGEN_FLAG_PROFILE};
+        auto profiled = exportBuffer(args);
+        CPPUNIT_ASSERT(profiled.find("static const char *const ml_prof_names[] = { \"main\", \"sq\" };\n") != std::string::npos);
+        CPPUNIT_ASSERT(profiled.find("static const char ml_prof_path[] = \"runml.profile\";\n") != std::string::npos);
+        CPPUNIT_ASSERT(profiled.find("static double ml_prof_raw_sq(double x) {\n") != std::string::npos);
+        CPPUNIT_ASSERT(profiled.find("double ml_value = ml_memo_raw_sq(x);\n") != std::string::npos);
+        CPPUNIT_ASSERT(profiled.find("static double sq(double x) {\n"
+                                     "    ml_prof_enter(1);\n"
+                                     "    double ml_value = ml_prof_raw_sq(x);\n"
+                                     "    ml_prof_leave(1);\n") != std::string::npos);
+        CPPUNIT_ASSERT(profiled.find("ml_prof_begin();") < profiled.find("ml_prof_end();"));
+
+        // the report path is quoted, and the profiler needs the system headers even with a prebuilt runtime
+        args.flags |= ML_CODEGEN_FLAG_COMPACT | ML_CODEGEN_FLAG_EXTERN_RUNTIME;
+        args.profile_path = "/tmp/a \"b\".profile";
+        auto compact = exportBuffer(args);
+        CPPUNIT_ASSERT(compact.find("#include<time.h>") != std::string::npos);
+        CPPUNIT_ASSERT(compact.find("PH[]=\"/tmp/a \\\"b\\\".profile\";") != std::string::npos);
+        CPPUNIT_ASSERT(compact.find("ml_") == std::string::npos);
+
+        // rows evaluated together are never profiled
+        auto batch = exportBuffer({4096, 0, ML_CODEGEN_FLAG_BATCH | ML_CODEGEN_FLAG_PROFILE});
+        CPPUNIT_ASSERT(batch.find("ml_prof") == std::string::npos);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TestCodegen);
+
+}
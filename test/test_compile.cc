@@ -1,5 +1,6 @@
 extern "C" {
 #include "ml_compile.h"
+#include "ml_memory.h"
 }
 
 #include "base.h"
@@ -15,6 +16,7 @@ class Compiler {
 public:
     struct Function {
         bool ret;
+        bool pure = false;
         RawString name;
         const std::vector<RawString> params;
 
@@ -58,6 +60,7 @@ private:
                 break;
             case ML_COMPILE_VISIT_EVENT_SUB_FUNC_VISIT_START:
                 c->functions.emplace_back(data->func.ret, data->func.name, makeParams(data));
+                c->functions.back().pure = data->func.pure;
                 break;
             default:
                 break;
@@ -66,8 +69,11 @@ private:
 
 public:
     Compiler() { ml_compile_ctx_init(&ctx, nullptr); }
+    Compiler(const ml_compile_ctx_init_args &args) { ml_compile_ctx_init(&ctx, &args); }
     ~Compiler() { ml_compile_ctx_uninit(&ctx); }
 
+    ml_compile_ctx *cast() const { return ctx; }
+
     const std::vector<int>& getGlobalArgIndexes() { return args; }
     const std::vector<RawString>& getGlobalVariables() { return globals; }
     const std::vector<Function>& getFunctions() { return functions; }
@@ -91,6 +97,7 @@ class TestCompileCollect : public BaseTextFixture {
     CPPUNIT_TEST_SUITE(TestCompileCollect);
     CPPUNIT_TEST(testGloabVariables);
     CPPUNIT_TEST(testGlobalArgIndexes);
+    CPPUNIT_TEST(testMemoryStats);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -153,6 +160,34 @@ public:
             0, 1, 2, 3, 47,
         }));
     }
+
+    void testMemoryStats() {
+        Compiler c({2, 8});
+        CPPUNIT_ASSERT_EQUAL(ML_COMPILE_RESULT_SUCCEED, c.feedLines({
+            "abc <- 1",
+            "helen <- abc + 2",
+            "fish <- helen * 3",
+            "print fish + arg0",
+        }));
+
+        // a smaller capacity only takes the leading entries
+        ml_memory_stats stats[16];
+        int count = ml_compile_get_memory_stats(c.cast(), nullptr, 0);
+        CPPUNIT_ASSERT_EQUAL(count, ml_compile_get_memory_stats(c.cast(), stats, 1));
+        CPPUNIT_ASSERT_EQUAL(std::string("symbol_chars"), std::string(stats[0].name));
+        CPPUNIT_ASSERT_EQUAL(16, stats[0].capacity);
+        CPPUNIT_ASSERT_EQUAL(1LL, stats[0].grows);
+
+        CPPUNIT_ASSERT(count <= 16);
+        ml_compile_get_memory_stats(c.cast(), stats, count);
+        for (int i = 0; i < count; i++) {
+            CPPUNIT_ASSERT(stats[i].name);
+            CPPUNIT_ASSERT(stats[i].count <= stats[i].capacity);
+            CPPUNIT_ASSERT_EQUAL(stats[i].grows + 1, stats[i].allocs);
+            CPPUNIT_ASSERT(stats[i].bytes >= stats[i].capacity);
+            CPPUNIT_ASSERT_EQUAL(stats[i].bytes, stats[i].peak_bytes);
+        }
+    }
 };
 
 
@@ -167,6 +202,7 @@ class TestCompileFunction : public BaseTextFixture {
     CPPUNIT_TEST(testEmptyBody);
     CPPUNIT_TEST(testRedundantTab);
     CPPUNIT_TEST(testNameCollision);
+    CPPUNIT_TEST(testPureFunction);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -388,6 +424,33 @@ public:
             "print x(1, y, var)",
         }));
     }
+
+    void testPureFunction() {
+        Compiler c;
+        CPPUNIT_ASSERT_EQUAL(ML_COMPILE_RESULT_SUCCEED, c.feedLines({
+            "function add a b",
+            "\t a <- a + b + arg0",
+            "\t return a",
+            "function twice a",
+            "\t return add(a, a)",
+            "function show a",
+            "\t print a",
+            "function calls a",
+            "\t return twice(a) + show(a)",
+            "function reads a",
+            "\t return a + var",
+            "function writes a",
+            "\t var <- a",
+            "function loop a",
+            "\t return loop(a)",
+            "var <- 1",
+        }));
+
+        const std::vector<bool> expected {true, true, false, false, false, false, true};
+        CPPUNIT_ASSERT(c.getFunctions().size() == expected.size());
+        for (int i = 0, n = expected.size(); i < n; i++)
+            CPPUNIT_ASSERT_EQUAL(bool(expected[i]), c.getFunctions()[i].pure);
+    }
 };
 
 
@@ -0,0 +1,189 @@
+extern "C" {
+#include "ml_compile.h"
+#include "ml_eval.h"
+}
+
+#include "base.h"
+
+#include <string>
+#include <vector>
+
+namespace runml {
+
+class Evaluator {
+private:
+    ml_eval_ctx *ctx = nullptr;
+
+public:
+    Evaluator(const ml_eval_ctx_init_args *args = nullptr) { ml_eval_ctx_init(&ctx, args); }
+    ~Evaluator() { ml_eval_ctx_uninit(&ctx); }
+
+    enum ml_eval_result run(std::vector<RawString>&& lines) {
+        ml_compile_ctx *compile = nullptr;
+        CPPUNIT_ASSERT(ml_compile_ctx_init(&compile, nullptr));
+
+        Tokenizer t(std::move(lines));
+        auto result = ML_EVAL_RESULT_UNSUPPORTED;
+        if (ml_compile_feed(compile, t.cast()) == ML_COMPILE_RESULT_SUCCEED)
+            result = ml_eval_load(ctx, compile);
+
+        // nothing refers to the compile context after loading
+        ml_compile_ctx_uninit(&compile);
+        return (result == ML_EVAL_RESULT_SUCCEED) ? ml_eval_run(ctx) : result;
+    }
+
+    std::string getOutput() {
+        int count = 0;
+        const char *buf = ml_eval_get_output(ctx, &count);
+        return std::string(buf, count);
+    }
+};
+
+class TestEvaluation : public BaseTextFixture {
+
+    CPPUNIT_TEST_SUITE(TestEvaluation);
+    CPPUNIT_TEST(testPrintFormat);
+    CPPUNIT_TEST(testPrecedence);
+    CPPUNIT_TEST(testFunction);
+    CPPUNIT_TEST(testUnsupported);
+    CPPUNIT_TEST(testSideEffectOrder);
+    CPPUNIT_TEST(testLimit);
+    CPPUNIT_TEST(testMemoize);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void testPrintFormat() {
+        Evaluator e;
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_SUCCEED, e.run({
+            "print 3.5",
+            "print 24",
+            "print 1 / 3",
+            "print 1 / 0",
+            "print 0 - 1 / 0",
+            "print 0 - 0",
+            "print 100000000000000000000",
+            "print 4503599627370495.5",
+        }));
+        CPPUNIT_ASSERT_EQUAL(std::string("3.500000\n24\n0.333333\ninf\n-inf\n0\n"
+                                         "100000000000000000000\n4503599627370495.500000\n"),
+                             e.getOutput());
+    }
+
+    void testPrecedence() {
+        Evaluator e;
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_SUCCEED, e.run({
+            "print 1 + 2 * 3 - 4 / 2",
+            "print (1 + 2) * 3",
+            "print -2 * -3",
+            "print 2 - - 3",
+            "print 8 / 4 / 2",
+            "print 8 - 4 - 2",
+        }));
+        CPPUNIT_ASSERT_EQUAL(std::string("5\n9\n6\n5\n1\n2\n"), e.getOutput());
+    }
+
+    void testFunction() {
+        Evaluator e;
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_SUCCEED, e.run({
+            "one <- 1",
+            "function increment value",
+            "\tvalue <- value + one",
+            "\treturn value",
+            "function nothing a",
+            "\ttotal <- total + a",
+            "function early a",
+            "\treturn a * 2",
+            "\tprint a",
+            "print increment(3) + increment(4)",
+            "nothing(5)",
+            "nothing(6)",
+            "print total",
+            "print nothing(1)",
+            "print early(21)",
+        }));
+        CPPUNIT_ASSERT_EQUAL(std::string("9\n11\n0\n42\n"), e.getOutput());
+    }
+
+    void testUnsupported() {
+        const std::vector<std::vector<RawString>> programs {
+            {"print arg0"},
+            {"print int"},
+            {"function sinf a", "\treturn a", "print sinf(1)"},
+            {"x <- 1, 2"},
+            {"print (1, 2)"},
+            {"print 0 / 0"},
+            {"function a", "\treturn b()", "function b", "\treturn 1", "print a()"},
+            {"function a x", "\treturn x", "print a(1, 2)"},
+            {"function a x", "\treturn x", "function b y", "\treturn x", "print b(1)"},
+        };
+        for (auto program : programs)
+            CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_UNSUPPORTED, Evaluator().run(std::move(program)));
+    }
+
+    void testSideEffectOrder() {
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_UNSUPPORTED, Evaluator().run({
+            "function show a",
+            "\tprint a",
+            "print show(1) + show(2)",
+        }));
+
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_UNSUPPORTED, Evaluator().run({
+            "function set a",
+            "\tx <- a",
+            "print set(1) + x",
+        }));
+
+        Evaluator e;
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_SUCCEED, e.run({
+            "function show a",
+            "\tprint a",
+            "function add a b",
+            "\treturn a + b",
+            "x <- show(add(1, 2)) + add(3, 4)",
+            "print x",
+        }));
+        CPPUNIT_ASSERT_EQUAL(std::string("3\n7\n"), e.getOutput());
+    }
+
+    void testLimit() {
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_LIMIT_EXCEEDED, Evaluator().run({
+            "function forever a",
+            "\treturn forever(a + 1)",
+            "print forever(1)",
+        }));
+
+        const ml_eval_ctx_init_args args {1 << 20, 64, 8, 0};
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_LIMIT_EXCEEDED, Evaluator(&args).run({
+            "print 1234567890",
+        }));
+    }
+
+    void testMemoize() {
+        const std::vector<RawString> lines {
+            "function a x",
+            "\treturn x + 1",
+            "function b x",
+            "\treturn a(x) + a(x) + a(x) + a(x)",
+            "function c x",
+            "\treturn b(x) + b(x) + b(x) + b(x)",
+            "function d x",
+            "\treturn c(x) + c(x) + c(x) + c(x)",
+            "function e x",
+            "\treturn d(x) + d(x) + d(x) + d(x)",
+            "print e(1)",
+        };
+
+        const ml_eval_ctx_init_args plain {256, 64, 1024, 0};
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_LIMIT_EXCEEDED,
+                             Evaluator(&plain).run(std::vector<RawString>(lines)));
+
+        const ml_eval_ctx_init_args memo {256, 64, 1024, ML_EVAL_FLAG_MEMOIZE};
+        Evaluator e(&memo);
+        CPPUNIT_ASSERT_EQUAL(ML_EVAL_RESULT_SUCCEED, e.run(std::vector<RawString>(lines)));
+        CPPUNIT_ASSERT_EQUAL(std::string("512\n"), e.getOutput());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TestEvaluation);
+
+}
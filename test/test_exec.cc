@@ -1,15 +1,27 @@
 extern "C" {
 #include "ml_exec.h"
+#include "ml_codegen.h"
+#include "ml_cache.h"
 }
 
 #include "base.h"
 
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <cstdarg>
+#include <string>
 #include <vector>
+#include <chrono>
+#include <thread>
 #include <algorithm>
 #include <initializer_list>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 namespace runml {
 
 class TestExecution : public BaseTextFixture {
@@ -28,12 +40,38 @@ class TestExecution : public BaseTextFixture {
     CPPUNIT_TEST(testForwardArgs);
     CPPUNIT_TEST(testCompilerFailure);
     CPPUNIT_TEST(testSyntaxError);
+    CPPUNIT_TEST(testUnknownOption);
+    CPPUNIT_TEST(testMemoize);
+    CPPUNIT_TEST(testEvaluateInPlace);
+    CPPUNIT_TEST(testCache);
+    CPPUNIT_TEST(testCacheEviction);
+    CPPUNIT_TEST(testPrintFormat);
+    CPPUNIT_TEST(testPrebuiltRuntime);
+    CPPUNIT_TEST(testTiered);
+    CPPUNIT_TEST(testCompilerDriver);
+    CPPUNIT_TEST(testSplit);
+    CPPUNIT_TEST(testStdoutFd);
+    CPPUNIT_TEST(testLimits);
+    CPPUNIT_TEST(testTrace);
+    CPPUNIT_TEST(testStats);
+    CPPUNIT_TEST(testBatch);
+    CPPUNIT_TEST(testBatchThreads);
+    CPPUNIT_TEST(testShared);
+    CPPUNIT_TEST(testForkServer);
+    CPPUNIT_TEST(testModule);
+    CPPUNIT_TEST(testDebugInfo);
+    CPPUNIT_TEST(testProfile);
     CPPUNIT_TEST_SUITE_END();
 
 private:
     std::string stderr_data;
     std::vector<std::string> stdout_lines;
     std::vector<std::string> temp_file_paths;
+    std::string cache_dir;
+    std::string runtime_path;
+    std::string config_path;
+    int stdout_fd = -1;
+    ml_exec_server *server = nullptr;
 
 private:
     static bool makeTempFilePath(void *opaque, ml_exec_path path, const char *suffix) {
@@ -48,6 +86,10 @@ private:
         return true;
     }
 
+    static int getStdoutFd(void *opaque) {
+        return reinterpret_cast<TestExecution*>(opaque)->stdout_fd;
+    }
+
     static void writeStdout(void *opaque, const char *buf, int n) {
         auto t = reinterpret_cast<TestExecution*>(opaque);
         if (t->stdout_lines.empty())
@@ -80,6 +122,18 @@ private:
 
     int runCode(std::initializer_list<const char*> params,
                 std::initializer_list<const char*> lines) {
+        return runCodeWithOptions({}, params, lines);
+    }
+
+    int runCodeWithOptions(std::initializer_list<const char*> options,
+                           std::initializer_list<const char*> params,
+                           std::initializer_list<const char*> lines) {
+        return runCodeWithLines(options, params, std::vector<const char*>(lines));
+    }
+
+    int runCodeWithLines(std::initializer_list<const char*> options,
+                         std::initializer_list<const char*> params,
+                         const std::vector<const char*> &lines) {
         // create a source code file
         std::string path = std::tmpnam(nullptr);
         std::FILE *f = fopen(path.c_str(), "w");
@@ -94,22 +148,65 @@ private:
         std::fclose(f);
 
         // make arguments
-        std::vector<const char*> argv {"?", path.c_str()};
+        std::vector<const char*> argv {"?"};
+        std::copy(options.begin(), options.end(), std::back_inserter(argv));
+        argv.push_back(path.c_str());
         std::copy(params.begin(), params.end(), std::back_inserter(argv));
         argv.push_back(nullptr);
 
         return runCode(argv.size() - 1, argv.data());
     }
 
+    std::string readFile(const std::string &path) {
+        std::string content;
+        std::FILE *f = std::fopen(path.c_str(), "r");
+        CPPUNIT_ASSERT(f);
+        char buf[4096];
+        while (size_t n = std::fread(buf, 1, sizeof(buf), f))
+            content.append(buf, n);
+        std::fclose(f);
+        return content;
+    }
+
+    std::string makeTempFile(const void *data, size_t size) {
+        std::string path = std::tmpnam(nullptr);
+        std::FILE *f = std::fopen(path.c_str(), "wb");
+        CPPUNIT_ASSERT(f);
+        temp_file_paths.push_back(path);
+        std::fwrite(data, 1, size, f);
+        std::fclose(f);
+        return path;
+    }
+
+    void stopServer() {
+        ml_exec_ctx ctx {};
+        ctx.server = server;
+        ml_exec_stop_server(&ctx);
+        server = ctx.server;
+    }
+
     int runCode(int argc, const char **argv) {
         // run code
         const ml_exec_run_fns fns {
             writeStdout,
             writeStderr,
             makeTempFilePath,
+            getStdoutFd,
         };
+        // neither the cache nor the config of the user is touched
+        if (cache_dir.empty())
+            cache_dir = std::tmpnam(nullptr);
+
         ml_exec_ctx ctx { &fns, this };
+        ctx.cache_dir = cache_dir.c_str();
+        ctx.config_path = config_path.c_str();
+        if (!runtime_path.empty())
+            ctx.runtime_path = runtime_path.c_str();
+
+        // a fork server is kept by the test, as if all runs shared one context
+        ctx.server = server;
         auto ret = ml_exec_run_main(&ctx, argc, const_cast<char**>(argv));
+        server = ctx.server;
 
         if (!stdout_lines.empty() && stdout_lines.back().empty())
             stdout_lines.pop_back();
@@ -119,9 +216,19 @@ private:
 
 public:
     virtual void tearDown() override {
+        stopServer();
         BaseTextFixture::tearDown();
         for (const auto &path : temp_file_paths)
             std::remove(path.c_str());
+
+        if (!cache_dir.empty()) {
+            if (DIR *dir = opendir(cache_dir.c_str())) {
+                while (dirent *entry = readdir(dir))
+                    std::remove((cache_dir + "/" + entry->d_name).c_str());
+                closedir(dir);
+            }
+            rmdir(cache_dir.c_str());
+        }
     }
 
 public:
@@ -253,6 +360,763 @@ public:
         CPPUNIT_ASSERT(stderr_data.find("! ") == 0);
         CPPUNIT_ASSERT(stderr_data.find("token") != std::string::npos);
     }
+
+    void testUnknownOption() {
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, runCodeWithOptions({"--what"}, {}, {
+            "print 1",
+        }));
+        CPPUNIT_ASSERT(stderr_data.find("unknown option") != std::string::npos);
+    }
+
+    void testMemoize() {
+        auto run = [this](std::initializer_list<const char*> options) {
+            stdout_lines.clear();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions(options, {"2"}, {
+                "function leaf a",
+                "\t return a * 2 + 1",
+                "function node a",
+                "\t return leaf(a) + leaf(a) - leaf(a)",
+                "function root a",
+                "\t return node(a) + node(a) + node(a)",
+                "function show a",
+                "\t print a",
+                "function shift a",
+                "\t return a + offset",
+                "print root(arg0)",
+                "offset <- 1",
+                "print shift(1)",
+                "offset <- 2",
+                "print shift(1)",
+                "show(root(0))",
+                "show(root(0))",
+            }));
+            CPPUNIT_ASSERT(checkList(stdout_lines, {"15", "2", "3", "3", "3"}));
+        };
+
+        // side effects and global reads should not be cached
+        run({});
+        run({"--no-memoize"});
+        run({"--no-compact"});
+    }
+
+    void testEvaluateInPlace() {
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCode({}, {
+            "function half a",
+            "\t return a / 2",
+            "print half(7)",
+            "print half(8)",
+        }));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"3.500000", "4"}));
+
+        // only the source file is created, so neither the compiler nor the executable is run
+        CPPUNIT_ASSERT_EQUAL(size_t(1), temp_file_paths.size());
+    }
+
+    void testCache() {
+        cache_dir = std::tmpnam(nullptr);
+        auto run = [this](const char *arg, const char *result, size_t temp_file_count) {
+            stdout_lines.clear();
+            temp_file_paths.clear();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({"--cache"}, {arg}, {
+                "function twice a",
+                "\t return a * 2",
+                "print twice(arg0)",
+            }));
+            CPPUNIT_ASSERT(checkList(stdout_lines, {result}));
+
+            // a cached result is replayed without running the compiler
+            CPPUNIT_ASSERT_EQUAL(temp_file_count, temp_file_paths.size());
+            std::for_each(temp_file_paths.begin(), temp_file_paths.end(), [](const std::string &s) {
+                std::remove(s.c_str());
+            });
+        };
+
+        run("3", "6", 3);
+        run("3", "6", 1);
+        run("4", "8", 3);
+
+        // arguments are compared by their values rather than their spellings
+        run("3.0", "6", 1);
+    }
+
+    void testCacheEviction() {
+        std::string dir = std::tmpnam(nullptr);
+        CPPUNIT_ASSERT_EQUAL(0, mkdir(dir.c_str(), 0700));
+
+        struct ml_cache_ctx *ctx = nullptr;
+        struct ml_cache_ctx_init_args args = {4, 1 << 10};
+        CPPUNIT_ASSERT(ml_cache_ctx_init(&ctx, dir.c_str(), &args));
+
+        struct ml_cache_key keys[4] = {{{1, 1}}, {{2, 2}}, {{3, 3}}, {{4, 4}}};
+        ml_cache_path out_path, so_path;
+        CPPUNIT_ASSERT(ml_cache_store(ctx, &keys[0], "a", 1));
+        CPPUNIT_ASSERT(ml_cache_get_path(ctx, &keys[0], ".out", out_path));
+        CPPUNIT_ASSERT(ml_cache_get_path(ctx, &keys[0], ".so", so_path));
+        std::fclose(std::fopen(so_path, "w"));
+
+        // artifacts of the first key look the least recently used
+        const struct timespec old_times[2] = {{1000, 0}, {1000, 0}};
+        CPPUNIT_ASSERT_EQUAL(0, utimensat(AT_FDCWD, out_path, old_times, 0));
+        CPPUNIT_ASSERT_EQUAL(0, utimensat(AT_FDCWD, so_path, old_times, 0));
+
+        // every artifact counts towards the limit, so the fourth key evicts all artifacts of the first one
+        for (int i = 1; i < 4; i++)
+            CPPUNIT_ASSERT(ml_cache_store(ctx, &keys[i], "b", 1));
+        CPPUNIT_ASSERT(access(out_path, F_OK) != 0);
+        CPPUNIT_ASSERT(access(so_path, F_OK) != 0);
+        for (int i = 1; i < 4; i++) {
+            ml_cache_path path;
+            CPPUNIT_ASSERT(ml_cache_get_path(ctx, &keys[i], ".out", path));
+            CPPUNIT_ASSERT_EQUAL(0, access(path, F_OK));
+            std::remove(path);
+        }
+
+        ml_cache_ctx_uninit(&ctx);
+        rmdir(dir.c_str());
+    }
+
+    void testPrintFormat() {
+        // values are passed as arguments, so that the compiled program rather than the evaluator prints them
+        std::initializer_list<const char*> values {
+            "0", "-0", "7", "-7", "0.5", "-0.25", "0.0078125", "0.0234375", "999999.9999995", "0.1",
+            "4503599627370495.5", "9007199254740993", "1e20", "1.5e300", "-1e-300", "1e-7", "0x1p-60",
+            "inf", "-inf", "nan",
+        };
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCode(values, {
+            "print arg0", "print arg1", "print arg2", "print arg3", "print arg4",
+            "print arg5", "print arg6", "print arg7", "print arg8", "print arg9",
+            "print arg10", "print arg11", "print arg12", "print arg13", "print arg14",
+            "print arg15", "print arg16", "print arg17", "print arg18", "print arg19",
+        }));
+
+        std::vector<std::string> expected;
+        for (const char *value : values) {
+            char buf[512];
+            double integral = 0;
+            double number = std::strtod(value, nullptr);
+            std::snprintf(buf, sizeof(buf), (std::modf(number, &integral) == 0) ? "%.0f" : "%.6f", number);
+            expected.emplace_back(buf);
+        }
+        CPPUNIT_ASSERT(stdout_lines == expected);
+    }
+
+    void testPrebuiltRuntime() {
+        std::string name = std::tmpnam(nullptr);
+        std::string src_path = name + ".c";
+        std::string obj_path = name + ".o";
+        runtime_path = name + ".a";
+        temp_file_paths.insert(temp_file_paths.end(), {src_path, obj_path, runtime_path});
+        CPPUNIT_ASSERT(ml_codegen_export_runtime(src_path.c_str()));
+        CPPUNIT_ASSERT_EQUAL(0, std::system(("cc -c -o " + obj_path + " " + src_path).c_str()));
+        CPPUNIT_ASSERT_EQUAL(0, std::system(("ar rcs " + runtime_path + " " + obj_path).c_str()));
+
+        auto run = [this]() {
+            stdout_lines.clear();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCode({"2.5", "-3"}, {
+                "function mul a b",
+                "\t return a * b",
+                "print mul(arg0, arg1)",
+                "print arg0 + 0.5",
+            }));
+            CPPUNIT_ASSERT(checkList(stdout_lines, {"-7.500000", "3"}));
+        };
+        run();
+
+        // the runtime is embedded into the program if the library is missing
+        runtime_path = name + ".missing.a";
+        run();
+    }
+
+    void testTiered() {
+        cache_dir = std::tmpnam(nullptr);
+        std::initializer_list<const char*> lines {
+            "function half a",
+            "\t return a / 2",
+            "print half(arg0)",
+        };
+        auto queryTier = [&]() {
+            stdout_lines.clear();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({"--tier-status"}, {}, lines));
+            CPPUNIT_ASSERT(!stdout_lines.empty());
+            return stdout_lines.front();
+        };
+        auto run = [&](const char *arg, const char *result) {
+            stdout_lines.clear();
+            temp_file_paths.clear();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({"--tiered"}, {arg}, lines));
+            CPPUNIT_ASSERT(checkList(stdout_lines, {result}));
+
+            // executables are kept in the cache directory rather than temporary files
+            CPPUNIT_ASSERT_EQUAL(size_t(1), temp_file_paths.size());
+        };
+
+        CPPUNIT_ASSERT_EQUAL(std::string("tier none"), queryTier());
+        run("3", "1.500000");
+
+        // the optimized build is finished in the background
+        for (int i = 0; i < 200 && queryTier() != "tier O2"; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CPPUNIT_ASSERT_EQUAL(std::string("tier O2"), queryTier());
+        CPPUNIT_ASSERT_EQUAL(size_t(3), stdout_lines.size());
+        CPPUNIT_ASSERT(stdout_lines[1].find("O0 compile") == 0);
+        CPPUNIT_ASSERT(stdout_lines[2].find("O2 compile") == 0);
+
+        run("4", "2");
+    }
+
+    void testCompilerDriver() {
+        auto run = [this](std::initializer_list<const char*> config) {
+            config_path = std::tmpnam(nullptr);
+            temp_file_paths.push_back(config_path);
+            std::FILE *f = std::fopen(config_path.c_str(), "w");
+            CPPUNIT_ASSERT(f);
+            for (const char *line : config)
+                std::fprintf(f, "%s\n", line);
+            std::fclose(f);
+
+            stdout_lines.clear();
+            return runCode({"5"}, {"print arg0 * 3"});
+        };
+
+        // available compilers are measured by the first build
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run({}));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"15"}));
+        std::FILE *f = std::fopen((cache_dir + "/compilers.probe").c_str(), "r");
+        CPPUNIT_ASSERT(f);
+        char name[64];
+        long elapsed = 0;
+        CPPUNIT_ASSERT_EQUAL(2, std::fscanf(f, "%63s %ld", name, &elapsed));
+        std::fclose(f);
+
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run({"# profiles", "compiler = cc", "profile = debug", "flags.debug = -g -O1"}));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"15"}));
+
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run({"compiler = /none/cc"}));
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run({"compiler = cc", "flags.fast-compile = -fno-such-flag"}));
+    }
+
+    void testSplit() {
+        // units are compiled separately, so every shared symbol must link
+        for (auto option : {"--split", "--no-memoize"}) {
+            stdout_lines.clear();
+            std::initializer_list<const char*> options = {"--split", option};
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions(options, {"3"}, {
+                "x <- arg0",
+                "function f a b",
+                "\treturn a * b + x",
+                "function g a",
+                "\treturn f(a, 2)",
+                "function h a",
+                "\ty <- a",
+                "\tprint g(y)",
+                "print f(x, 3)",
+                "h(5)",
+                "print y",
+            }));
+            CPPUNIT_ASSERT(checkList(stdout_lines, {"12", "13", "5"}));
+        }
+    }
+
+    void testStdoutFd() {
+        std::string path = std::tmpnam(nullptr);
+        temp_file_paths.push_back(path);
+        stdout_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+        CPPUNIT_ASSERT(stdout_fd >= 0);
+
+        auto run = [this](std::initializer_list<const char*> options) {
+            return runCodeWithOptions(options, {"3"}, {
+                "function f a",
+                "\tprint a",
+                "\treturn a * 2",
+                "print f(arg0)",
+            });
+        };
+
+        // the program writes to the descriptor by itself, even if the output is cached
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run({}));
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run({"--cache"}));
+
+        // a cache hit is replayed to the descriptor as well
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run({"--cache"}));
+        CPPUNIT_ASSERT(stdout_lines.empty());
+        close(stdout_fd);
+
+        std::FILE *f = std::fopen(path.c_str(), "r");
+        CPPUNIT_ASSERT(f);
+        char buf[64] = {0};
+        std::fread(buf, 1, sizeof(buf) - 1, f);
+        std::fclose(f);
+        CPPUNIT_ASSERT_EQUAL(std::string("3\n6\n3\n6\n3\n6\n"), std::string(buf));
+    }
+
+    void testLimits() {
+        // without memoization the call tree never finishes in time
+        auto makeName = [](int i) {
+            return std::string("f") + char('a' + i / 26) + char('a' + i % 26);
+        };
+        std::vector<std::string> source;
+        for (int i = 0; i < 48; i++) {
+            source.push_back("function " + makeName(i) + " x");
+            source.push_back(i ? ("\treturn " + makeName(i - 1) + "(x) + " + makeName(i - 1) + "(x)") : "\treturn x");
+        }
+        source.push_back("print " + makeName(47) + "(arg0)");
+
+        auto run = [&](std::initializer_list<const char*> options) {
+            stderr_data.clear();
+            std::vector<const char*> lines;
+            for (const auto &line : source)
+                lines.push_back(line.c_str());
+            return runCodeWithLines(options, {"1"}, lines);
+        };
+
+        CPPUNIT_ASSERT_EQUAL(int(ML_EXEC_EXIT_STATUS_TIMEOUT), run({"--no-memoize", "--wall-limit=2000"}));
+        CPPUNIT_ASSERT(stderr_data.find("wall clock limit of 2000 ms") != std::string::npos);
+
+        CPPUNIT_ASSERT_EQUAL(int(ML_EXEC_EXIT_STATUS_TIMEOUT), run({"--no-memoize", "--cpu-limit=1"}));
+        CPPUNIT_ASSERT(stderr_data.find("cpu time limit of 1 s") != std::string::npos);
+
+        // other failures keep the usual status
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run({"--memory-limit=1"}));
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run({"--wall-limit=0"}));
+        CPPUNIT_ASSERT(stderr_data.find("invalid option value") != std::string::npos);
+
+        // unbounded recursion runs out of stack rather than time
+        stderr_data.clear();
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, runCodeWithOptions({"--wall-limit=10000"}, {"1"}, {
+            "function f x",
+            "\treturn f(x) + 1",
+            "print f(arg0)",
+        }));
+        CPPUNIT_ASSERT(stderr_data.find("terminated by signal") != std::string::npos);
+
+        // memoized calls finish well within the same limits
+        stdout_lines.clear();
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run({"--wall-limit=10000", "--cpu-limit=10"}));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"140737488355328"}));
+    }
+
+    void testTrace() {
+        std::string path = std::tmpnam(nullptr);
+        temp_file_paths.push_back(path);
+        std::string option = "--trace=" + path;
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({option.c_str()}, {"2"}, {
+            "function f a",
+            "\treturn a * 3",
+            "print f(arg0)",
+        }));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"6"}));
+
+        std::FILE *f = std::fopen(path.c_str(), "r");
+        CPPUNIT_ASSERT(f);
+        std::string trace;
+        char buf[256];
+        size_t n = 0;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+            trace.append(buf, n);
+        std::fclose(f);
+
+        // every phase is a complete event, and the array is closed
+        CPPUNIT_ASSERT(trace.find("[\n") == 0);
+        CPPUNIT_ASSERT(trace.rfind("\n]\n") == trace.size() - 3);
+        for (auto name : {"load", "compile", "codegen", "cc", "exec", "runml"})
+            CPPUNIT_ASSERT(trace.find(std::string("{\"name\":\"") + name + "\",\"cat\":\"runml\",\"ph\":\"X\"") != std::string::npos);
+        CPPUNIT_ASSERT(trace.find("\"tokens\":22,\"functions\":1,\"variables\":1") != std::string::npos);
+    }
+
+    void testStats() {
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({"--stats"}, {"2"}, {
+            "function f a",
+            "\treturn a * 3",
+            "print f(arg0)",
+        }));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"6"}));
+
+        // statistics never go to the program output
+        for (auto line : {
+            "stats token bytes=41 refills=2 tokens=22\n",
+            "stats token.type function=1\n",
+            "stats memory token.token_buffer count=9 ",
+            "stats memory compile.symbol_chars count=4 ",
+            "stats memory compile.tokens_sub count=5 ",
+            "stats codegen flushes=1 ",
+        })
+            CPPUNIT_ASSERT(stderr_data.find(line) != std::string::npos);
+    }
+
+    void testBatch() {
+        // globals start from zero in every row, and each row prints all its lines before the next one
+        auto run = [this](const std::string &option) {
+            stdout_lines.clear();
+            return runCodeWithOptions({option.c_str()}, {}, {
+                "function f a b",
+                "\tprint a",
+                "\treturn a * b",
+                "total <- total + arg0",
+                "print total",
+                "print f(arg1, 2) / 4",
+            });
+        };
+
+        const char csv[] = "1,2\n3,4\n\n5\n7,8,9\r\n1.5,0.5";
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run("--batch=" + makeTempFile(csv, sizeof(csv) - 1)));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {
+            "1", "2", "1",
+            "3", "4", "2",
+            "5", "0", "0",
+            "7", "8", "4",
+            "1.500000", "0.500000", "0.250000",
+        }));
+
+        const double rows[] = {2, 6, -1, 1, 9};
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run("--batch-binary=" + makeTempFile(rows, sizeof(rows))));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"2", "6", "3", "-1", "1", "0.500000"}));
+
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run("--batch=" + makeTempFile("", 0)));
+        CPPUNIT_ASSERT(stdout_lines.empty());
+
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run("--batch=/none"));
+        CPPUNIT_ASSERT_EQUAL(std::string("not a readable batch file\n"), stderr_data);
+
+        // a line longer than the input buffer stops the batch after the rows before it
+        std::string long_csv = "1,2\n3," + std::string(70000, '0') + "1\n5,6\n";
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run("--batch=" + makeTempFile(long_csv.data(), long_csv.size())));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"1", "2", "1"}));
+    }
+
+    void testBatchThreads() {
+        // every thread takes a range of rows, and the output keeps the order of the rows
+        auto run = [this](const std::string &option, const std::string &threads) {
+            stdout_lines.clear();
+            return runCodeWithOptions({option.c_str(), threads.c_str()}, {}, {
+                "total <- total + arg0",
+                "print total * arg1",
+            });
+        };
+
+        std::string csv;
+        std::vector<double> rows;
+        std::vector<std::string> expected;
+        for (int i = 0; i < 1000; i++) {
+            csv += std::to_string(i) + "," + std::to_string(i % 7) + "\n";
+            rows.push_back(i);
+            rows.push_back(i % 7);
+            expected.push_back(std::to_string(i * (i % 7)));
+        }
+
+        for (auto threads : {"--batch-threads=1", "--batch-threads=3", "--batch-threads=64"}) {
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run("--batch=" + makeTempFile(csv.data(), csv.size()), threads));
+            CPPUNIT_ASSERT(stdout_lines == expected);
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run("--batch-binary=" + makeTempFile(rows.data(), rows.size() * sizeof(double)), threads));
+            CPPUNIT_ASSERT(stdout_lines == expected);
+        }
+
+        // fewer rows than threads, and no rows at all
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run("--batch=" + makeTempFile("5,2", 3), "--batch-threads=8"));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"10"}));
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, run("--batch=" + makeTempFile("", 0), "--batch-threads=8"));
+        CPPUNIT_ASSERT(stdout_lines.empty());
+
+        // a line longer than the input buffer stops the batch at the same row with or without threads
+        size_t cut = csv.find("500,");
+        std::string long_csv = csv.substr(0, cut) + "1," + std::string(70000, '0') + "1\n" + csv.substr(cut);
+        std::vector<std::string> head(expected.begin(), expected.begin() + 500);
+        for (auto threads : {"--batch-threads=1", "--batch-threads=3"}) {
+            CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run("--batch=" + makeTempFile(long_csv.data(), long_csv.size()), threads));
+            CPPUNIT_ASSERT(stdout_lines == head);
+        }
+
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run("--batch=" + makeTempFile("", 0), "--batch-threads=0"));
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, run("--batch=" + makeTempFile("", 0), "--batch-threads=65"));
+    }
+
+    void testShared() {
+        // the object is built once, and every call starts from zeroed globals
+        std::initializer_list<const char*> lines {
+            "function f a b",
+            "\treturn a * b + 1",
+            "total <- total + f(arg0, arg1)",
+            "print total",
+        };
+        auto run = [&](std::initializer_list<const char*> options, const char *arg, const char *result) {
+            stdout_lines.clear();
+            size_t temp_count = temp_file_paths.size();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions(options, {arg, "3"}, lines));
+            CPPUNIT_ASSERT(checkList(stdout_lines, {result}));
+            return temp_file_paths.size() - temp_count;
+        };
+        auto countObjects = [this]() {
+            int count = 0;
+            if (DIR *dir = opendir(cache_dir.c_str())) {
+                while (dirent *entry = readdir(dir)) {
+                    std::string name = entry->d_name;
+                    count += name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0;
+                }
+                closedir(dir);
+            }
+            return count;
+        };
+
+        cache_dir = std::tmpnam(nullptr);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), run({"--shared"}, "2", "7"));
+        CPPUNIT_ASSERT_EQUAL(1, countObjects());
+
+        // later runs only load the cached object, whatever their arguments are
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--shared"}, "2", "7"));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--shared"}, "4", "13"));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--shared", "--cache"}, "5", "16"));
+        CPPUNIT_ASSERT_EQUAL(1, countObjects());
+
+        // limited runs still go through a subprocess
+        CPPUNIT_ASSERT_EQUAL(size_t(3), run({"--shared", "--wall-limit=10000"}, "1", "4"));
+
+        // a crash of the program is reported instead of taking down the host, which can call again
+        stderr_data.clear();
+        CPPUNIT_ASSERT_EQUAL(EXIT_FAILURE, runCodeWithOptions({"--shared"}, {"1"}, {
+            "function f x",
+            "\treturn f(x) + 1",
+            "print f(arg0)",
+        }));
+        CPPUNIT_ASSERT(stderr_data.find("terminated by signal") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--shared"}, "2", "7"));
+    }
+
+    void testForkServer() {
+        // the program is built once, and every request runs in a child forked from zeroed globals
+        std::vector<const char*> lines {
+            "function f a b",
+            "\treturn a * b + 1",
+            "total <- total + f(arg0, arg1)",
+            "print total",
+        };
+        auto run = [&](std::initializer_list<const char*> options, const char *arg, const char *result) {
+            stdout_lines.clear();
+            size_t temp_count = temp_file_paths.size();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithLines(options, {arg, "3"}, lines));
+            if (result)
+                CPPUNIT_ASSERT(checkList(stdout_lines, {result}));
+            return temp_file_paths.size() - temp_count;
+        };
+
+        CPPUNIT_ASSERT_EQUAL(size_t(3), run({"--fork-server"}, "2", "7"));
+        CPPUNIT_ASSERT(server);
+        for (int i = 0; i < 20; i++) {
+            std::string arg = std::to_string(i);
+            std::string result = std::to_string(i * 3 + 1);
+            CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--fork-server"}, arg.c_str(), result.c_str()));
+        }
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--fork-server", "--cache"}, "5", "16"));
+
+        // the output goes to the descriptor of the host, including a replayed one
+        std::string path = std::tmpnam(nullptr);
+        temp_file_paths.push_back(path);
+        stdout_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+        CPPUNIT_ASSERT(stdout_fd >= 0);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--fork-server"}, "4", nullptr));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--fork-server", "--cache"}, "6", nullptr));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--fork-server", "--cache"}, "5", nullptr));
+        CPPUNIT_ASSERT(stdout_lines.empty());
+        close(stdout_fd);
+        stdout_fd = -1;
+
+        std::FILE *f = std::fopen(path.c_str(), "r");
+        CPPUNIT_ASSERT(f);
+        char buf[64] = {0};
+        std::fread(buf, 1, sizeof(buf) - 1, f);
+        std::fclose(f);
+        CPPUNIT_ASSERT_EQUAL(std::string("13\n19\n16\n"), std::string(buf));
+
+        // another program replaces the server, and limited runs never use it
+        lines = {"print arg0 - arg1"};
+        CPPUNIT_ASSERT_EQUAL(size_t(3), run({"--fork-server"}, "5", "2"));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), run({"--fork-server"}, "9", "6"));
+        CPPUNIT_ASSERT_EQUAL(size_t(3), run({"--fork-server", "--wall-limit=10000"}, "1", "-2"));
+
+        // empty arguments take one byte each, and requests too large are run by a normal executable
+        const char source[] = "print arg0 - arg1\n";
+        std::string source_path = makeTempFile(source, sizeof(source) - 1);
+        for (size_t count : {40000, 70000}) {
+            std::vector<const char*> argv {"?", "--fork-server", source_path.c_str(), "9", "6"};
+            argv.resize(argv.size() + count, "");
+            argv.push_back(nullptr);
+            stdout_lines.clear();
+            CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCode(argv.size() - 1, argv.data()));
+            CPPUNIT_ASSERT(checkList(stdout_lines, {"3"}));
+            CPPUNIT_ASSERT(server);
+        }
+        CPPUNIT_ASSERT(stderr_data.empty());
+
+        stopServer();
+        CPPUNIT_ASSERT(!server);
+    }
+
+    void testModule() {
+        const char source[] =
+            "function scale x\n"
+            "\treturn x * factor + arg0\n"
+            "function shift x\n"
+            "\treturn x + arg0\n"
+            "function show x\n"
+            "\tprint x * 2\n"
+            "\treturn x\n"
+            "factor <- 2\n"
+            "print scale(3)\n";
+        std::string path = makeTempFile(source, sizeof(source) - 1);
+
+        const ml_exec_run_fns fns {
+            writeStdout,
+            writeStderr,
+            makeTempFilePath,
+            getStdoutFd,
+        };
+        cache_dir = std::tmpnam(nullptr);
+        ml_exec_ctx ctx { &fns, this };
+        ctx.cache_dir = cache_dir.c_str();
+        ctx.config_path = config_path.c_str();
+
+        ml_exec_module *module = nullptr;
+        CPPUNIT_ASSERT(ml_exec_module_load(&ctx, path.c_str(), &module));
+        CPPUNIT_ASSERT(!ml_exec_module_find_func(module, "scale", 2));
+        CPPUNIT_ASSERT(!ml_exec_module_find_func(module, "none", 0));
+        CPPUNIT_ASSERT(!ml_exec_module_find_global(module, "x"));
+        CPPUNIT_ASSERT(!ml_exec_module_find_arg(module, 1));
+
+        // functions see the values written through the handles
+        ml_exec_func scale = ml_exec_module_find_func(module, "scale", 1);
+        double *factor = ml_exec_module_find_global(module, "factor");
+        double *arg = ml_exec_module_find_arg(module, 0);
+        CPPUNIT_ASSERT(scale && factor && arg);
+        const double x = 3;
+        CPPUNIT_ASSERT_EQUAL(0.0, scale(&x, 1));
+        *factor = 4;
+        *arg = 1;
+        CPPUNIT_ASSERT_EQUAL(13.0, scale(&x, 1));
+
+        // pure functions are memoized, but not across writes of the arguments
+        ml_exec_func shift = ml_exec_module_find_func(module, "shift", 1);
+        CPPUNIT_ASSERT(shift);
+        const double one = 1;
+        for (double value : {0.0, 5.0, 10.0}) {
+            *arg = value;
+            CPPUNIT_ASSERT_EQUAL(value + 1, shift(&one, 1));
+            CPPUNIT_ASSERT_EQUAL(value + 1, shift(&one, 1));
+        }
+
+        // the statements print through the context, and leave their globals behind
+        const char *argv[] = {"?", "5", nullptr};
+        CPPUNIT_ASSERT(ml_exec_module_run(module, 2, const_cast<char**>(argv)));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"11", ""}));
+        CPPUNIT_ASSERT_EQUAL(2.0, *factor);
+        CPPUNIT_ASSERT_EQUAL(11.0, scale(&x, 1));
+        CPPUNIT_ASSERT_EQUAL(6.0, shift(&one, 1));
+
+        // functions called directly print through the context too
+        ml_exec_func show = ml_exec_module_find_func(module, "show", 1);
+        CPPUNIT_ASSERT(show);
+        CPPUNIT_ASSERT_EQUAL(3.0, show(&x, 1));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"11", "6", ""}));
+
+        // another module of the same program is loaded from the cache, with globals of its own
+        size_t temp_count = temp_file_paths.size();
+        ml_exec_module *other = nullptr;
+        CPPUNIT_ASSERT(ml_exec_module_load(&ctx, path.c_str(), &other));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), temp_file_paths.size() - temp_count);
+        CPPUNIT_ASSERT_EQUAL(0.0, *ml_exec_module_find_global(other, "factor"));
+        CPPUNIT_ASSERT_EQUAL(2.0, *factor);
+
+        ml_exec_module_unload(&other);
+        ml_exec_module_unload(&module);
+        CPPUNIT_ASSERT(!module && !other);
+        CPPUNIT_ASSERT(stderr_data.empty());
+
+        CPPUNIT_ASSERT(!ml_exec_module_load(&ctx, "", &module));
+        CPPUNIT_ASSERT(!module);
+    }
+
+    void testDebugInfo() {
+        // even a program without arguments is built, and the build is kept with its source
+        cache_dir = std::tmpnam(nullptr);
+        temp_file_paths.clear();
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({"--debug-info"}, {}, {"x <- 2", "print x * 3"}));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"6"}));
+        CPPUNIT_ASSERT(stderr_data.empty());
+
+        std::string src_path;
+        std::string exec_path;
+        DIR *dir = opendir(cache_dir.c_str());
+        CPPUNIT_ASSERT(dir);
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 6 && name.compare(name.size() - 6, 6, ".dbg.c") == 0)
+                src_path = cache_dir + "/" + name;
+            else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".dbg") == 0)
+                exec_path = cache_dir + "/" + name;
+        }
+        closedir(dir);
+        CPPUNIT_ASSERT(!src_path.empty());
+        CPPUNIT_ASSERT_EQUAL(0, access(exec_path.c_str(), X_OK));
+
+        // statements point back to the absolute path of the ml file
+        char *source = realpath(temp_file_paths.front().c_str(), nullptr);
+        CPPUNIT_ASSERT(source);
+        std::string marker = "#line 2 \"" + std::string(source) + "\"\n";
+        std::free(source);
+
+        std::FILE *f = std::fopen(src_path.c_str(), "r");
+        CPPUNIT_ASSERT(f);
+        std::string content;
+        char buf[4096];
+        while (size_t n = std::fread(buf, 1, sizeof(buf), f))
+            content.append(buf, n);
+        std::fclose(f);
+        CPPUNIT_ASSERT(content.find(marker) != std::string::npos);
+        CPPUNIT_ASSERT(content.find("static int ml_memo_equal(double ml_a, double ml_b) {\n") != std::string::npos);
+
+        // the next debug run of the same program replaces them
+        stdout_lines.clear();
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({"--debug-info"}, {}, {"x <- 2", "", "print x * 3"}));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"6"}));
+        f = std::fopen(src_path.c_str(), "r");
+        CPPUNIT_ASSERT(f);
+        content.clear();
+        while (size_t n = std::fread(buf, 1, sizeof(buf), f))
+            content.append(buf, n);
+        std::fclose(f);
+        CPPUNIT_ASSERT(content.find("#line 3 ") != std::string::npos);
+    }
+
+    void testProfile() {
+        // even a program without arguments is built, and a memo hit counts as a call without its callees
+        std::string path = std::tmpnam(nullptr);
+        std::string option = "--profile=" + path;
+        temp_file_paths.push_back(path);
+        temp_file_paths.push_back(path + ".folded");
+        CPPUNIT_ASSERT_EQUAL(EXIT_SUCCESS, runCodeWithOptions({option.c_str()}, {}, {
+            "function sq x",
+            "\treturn x * x",
+            "function sum a b",
+            "\treturn sq(a) + sq(b)",
+            "function unused x",
+            "\treturn x",
+            "print sum(2, 3)",
+            "print sum(2, 3) + sq(2)",
+        }));
+        CPPUNIT_ASSERT(checkList(stdout_lines, {"13", "17"}));
+        CPPUNIT_ASSERT(stderr_data.empty());
+
+        // functions which are never called are left out
+        auto report = readFile(path);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), report.find("function\tcalls\tself_ns\ttotal_ns\tmax_depth\n"));
+        CPPUNIT_ASSERT(report.find("\nmain\t1\t") != std::string::npos);
+        CPPUNIT_ASSERT(report.find("\nsum\t2\t") != std::string::npos);
+        CPPUNIT_ASSERT(report.find("\nsq\t3\t") != std::string::npos);
+        CPPUNIT_ASSERT(report.find("unused") == std::string::npos);
+
+        // stacks start from main(), and each of them is followed by its self time
+        auto stacks = readFile(path + ".folded");
+        CPPUNIT_ASSERT(stacks.find("main;sum;sq ") != std::string::npos);
+        CPPUNIT_ASSERT(stacks.find("main;sq ") != std::string::npos);
+        CPPUNIT_ASSERT(stacks.find("unused") == std::string::npos);
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(TestExecution);
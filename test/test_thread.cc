@@ -0,0 +1,209 @@
+extern "C" {
+#include "ml_memory.h"
+#include "ml_allocator.h"
+#include "ml_compile.h"
+#include "ml_codegen.h"
+#include "ml_exec.h"
+}
+
+#include "base.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+namespace runml {
+
+class TestThread : public BaseTextFixture {
+
+    CPPUNIT_TEST_SUITE(TestThread);
+    CPPUNIT_TEST(testCompile);
+    CPPUNIT_TEST(testExecute);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static constexpr int THREAD_COUNT = 4;
+    static constexpr int SCRIPT_COUNT = 500;
+    static constexpr int RUN_COUNT = 20;
+
+    // everything a thread touches is its own, except the cache directory
+    struct Worker {
+        std::string prefix;
+        std::string source_path;
+        std::string output;
+        std::string errors;
+        std::vector<std::string> temp_file_paths;
+        bool succeed = true;
+    };
+
+private:
+    std::vector<std::string> temp_file_paths;
+    std::string cache_dir;
+
+private:
+    static bool makeTempFilePath(void *opaque, ml_exec_path path, const char *suffix) {
+        auto w = reinterpret_cast<Worker*>(opaque);
+        std::string name = w->prefix + "_" + std::to_string(w->temp_file_paths.size()) + suffix;
+        if (name.length() + 1 > sizeof(ml_exec_path))
+            return false;
+        name.copy(path, name.length());
+        path[name.length()] = 0;
+        w->temp_file_paths.push_back(name);
+        return true;
+    }
+
+    static int getStdoutFd(void *opaque) {
+        return -1;
+    }
+
+    static void writeStdout(void *opaque, const char *buf, int n) {
+        reinterpret_cast<Worker*>(opaque)->output.append(buf, n);
+    }
+
+    static void writeStderr(void *opaque, const char *fmt, ...) {
+        reinterpret_cast<Worker*>(opaque)->errors.append(fmt);
+    }
+
+    static std::string compileScript(int index, const ml_allocator *allocator) {
+        // every script is a little different, so no two threads generate the same code
+        std::vector<std::string> storage;
+        int functions = 1 + index % 5;
+        for (int i = 0; i < functions; i++) {
+            storage.push_back("function f" + std::string(1, 'a' + i) + " x");
+            storage.push_back("\treturn x * " + std::to_string(index + i));
+        }
+        storage.push_back("v <- fa(arg0)");
+        storage.push_back("print v + " + std::to_string(index));
+
+        std::vector<RawString> lines;
+        for (const auto &line : storage)
+            lines.emplace_back(line.c_str());
+
+        std::string output;
+        Tokenizer t(std::move(lines), {4, 32, allocator});
+        ml_compile_ctx *compile = nullptr;
+        const ml_compile_ctx_init_args args {4, 16, allocator};
+        if (!t.cast() || !ml_compile_ctx_init(&compile, &args))
+            return output;
+
+        char *buffer = nullptr;
+        int count = 0;
+        const ml_codegen_args codegen_args {
+            256, 2, static_cast<uint32_t>(index % 2 ? ML_CODEGEN_FLAG_PARALLEL : 0),
+        };
+        if (ml_compile_feed(compile, t.cast()) == ML_COMPILE_RESULT_SUCCEED
+            && ml_compile_get_func_count(compile) == functions
+            && ml_codegen_export_buffer(compile, &buffer, &count, &codegen_args)) {
+            output.assign(buffer, count);
+            ml_memory_free(buffer);
+        }
+        ml_compile_ctx_uninit(&compile);
+        return output;
+    }
+
+    static void runScripts(Worker *w, const char *cache_dir) {
+        const ml_exec_run_fns fns {
+            writeStdout,
+            writeStderr,
+            makeTempFilePath,
+            getStdoutFd,
+        };
+        ml_exec_ctx ctx { &fns, w };
+        ctx.cache_dir = cache_dir;
+        ctx.config_path = "";
+
+        // the program is evaluated in place without arguments, and compiled with them
+        const char *argv_eval[] = {"?", w->source_path.c_str(), nullptr};
+        for (int i = 0; i < RUN_COUNT; i++) {
+            w->output.clear();
+            if (ml_exec_run_main(&ctx, 2, const_cast<char**>(argv_eval)) != EXIT_SUCCESS
+                || w->output != "6\n")
+                w->succeed = false;
+        }
+
+        const char *argv_compile[] = {"?", w->source_path.c_str(), "5", nullptr};
+        w->output.clear();
+        if (ml_exec_run_main(&ctx, 3, const_cast<char**>(argv_compile)) != EXIT_SUCCESS
+            || w->output != "21\n")
+            w->succeed = false;
+    }
+
+public:
+    virtual void tearDown() override {
+        BaseTextFixture::tearDown();
+        for (const auto &path : temp_file_paths)
+            std::remove(path.c_str());
+
+        if (!cache_dir.empty()) {
+            if (DIR *dir = opendir(cache_dir.c_str())) {
+                while (dirent *entry = readdir(dir))
+                    std::remove((cache_dir + "/" + entry->d_name).c_str());
+                closedir(dir);
+            }
+            rmdir(cache_dir.c_str());
+        }
+    }
+
+public:
+    void testCompile() {
+        std::vector<std::string> outputs(THREAD_COUNT * SCRIPT_COUNT);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < THREAD_COUNT; i++) {
+            threads.emplace_back([i, &outputs]() {
+                // half of the threads take their memory from the thread local pool
+                ml_allocator pool;
+                ml_pool_get_allocator(&pool);
+                const ml_allocator *allocator = (i % 2) ? &pool : nullptr;
+                for (int j = i; j < outputs.size(); j += THREAD_COUNT)
+                    outputs[j] = compileScript(j, allocator);
+                ml_pool_trim();
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+
+        // the same script compiled alone gives the same code
+        for (int i = 0; i < outputs.size(); i++) {
+            CPPUNIT_ASSERT(!outputs[i].empty());
+            if (i % 97 == 0)
+                CPPUNIT_ASSERT_EQUAL(compileScript(i, nullptr), outputs[i]);
+        }
+    }
+
+    void testExecute() {
+        cache_dir = std::tmpnam(nullptr);
+
+        std::vector<Worker> workers(THREAD_COUNT);
+        for (auto &w : workers) {
+            w.prefix = std::tmpnam(nullptr);
+            w.source_path = std::tmpnam(nullptr);
+            temp_file_paths.push_back(w.source_path);
+
+            std::FILE *f = std::fopen(w.source_path.c_str(), "w");
+            CPPUNIT_ASSERT(f);
+            std::fputs("function f a\n\treturn a * 3\nprint f(arg0 + 2)\n", f);
+            std::fclose(f);
+        }
+
+        std::vector<std::thread> threads;
+        for (auto &w : workers)
+            threads.emplace_back(runScripts, &w, cache_dir.c_str());
+        for (auto &thread : threads)
+            thread.join();
+
+        for (auto &w : workers) {
+            temp_file_paths.insert(temp_file_paths.end(), w.temp_file_paths.begin(), w.temp_file_paths.end());
+            CPPUNIT_ASSERT_EQUAL(std::string(), w.errors);
+            CPPUNIT_ASSERT(w.succeed);
+        }
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TestThread);
+
+}
@@ -1,5 +1,6 @@
 extern "C" {
 #include "ml_token.h"
+#include "ml_memory.h"
 }
 
 #include "base.h"
@@ -17,6 +18,8 @@ class TestTokenBase : public BaseTextFixture {
     CPPUNIT_TEST(testGrowBufferFail);
     CPPUNIT_TEST(testClearInputData);
     CPPUNIT_TEST(testNullInputData);
+    CPPUNIT_TEST(testStats);
+    CPPUNIT_TEST(testPosition);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -70,6 +73,51 @@ public:
         CPPUNIT_ASSERT(checkList(names, {"a", "123", "b", ""}));
     }
 
+    void testStats() {
+        Tokenizer t("a + 12\nb # c");
+        int count = 0;
+        while (ml_token_iterate(t.cast(), nullptr) != ML_TOKEN_TYPE_EOF)
+            count++;
+
+        // the end of input is not a token
+        ml_token_stats stats;
+        ml_token_get_stats(t.cast(), &stats);
+        CPPUNIT_ASSERT_EQUAL(12LL, stats.bytes);
+        CPPUNIT_ASSERT_EQUAL(9LL, stats.tokens);
+        CPPUNIT_ASSERT_EQUAL(stats.tokens, (long long) count);
+        CPPUNIT_ASSERT_EQUAL(3LL, stats.types[ML_TOKEN_TYPE_SPACE]);
+        CPPUNIT_ASSERT_EQUAL(2LL, stats.types[ML_TOKEN_TYPE_NAME]);
+        CPPUNIT_ASSERT_EQUAL(1LL, stats.types[ML_TOKEN_TYPE_COMMENT]);
+        CPPUNIT_ASSERT_EQUAL(1LL, stats.types[ML_TOKEN_TYPE_EOF]);
+        CPPUNIT_ASSERT(stats.refills > 1);
+
+        // the longest token is "12" with its terminator, and the buffer never grows
+        ml_memory_stats memory[2];
+        CPPUNIT_ASSERT_EQUAL(2, ml_token_get_memory_stats(t.cast(), memory, 2));
+        CPPUNIT_ASSERT_EQUAL(std::string("token_buffer"), std::string(memory[1].name));
+        CPPUNIT_ASSERT_EQUAL(3, memory[1].count);
+        CPPUNIT_ASSERT_EQUAL(0LL, memory[1].grows);
+    }
+
+    void testPosition() {
+        // a small read buffer splits lines across refills
+        Tokenizer t("ab  12\r\tc <- 1..2\n#x\nd", {4, 4});
+        std::vector<std::string> positions;
+        while (true) {
+            ml_token_data data;
+            auto type = ml_token_iterate(t.cast(), &data);
+            if (type == ML_TOKEN_TYPE_EOF)
+                break;
+            positions.emplace_back(std::to_string(data.line) + ":" + std::to_string(data.column));
+        }
+        CPPUNIT_ASSERT(checkList(positions, {
+            "1:1", "1:3", "1:5", "1:7",
+            "2:1", "2:2", "2:3", "2:4", "2:6", "2:9", "2:11",
+            "3:1", "3:3",
+            "4:1",
+        }));
+    }
+
     void testNullInputData() {
         Tokenizer t("arg0 123 +-<- #\nabc");
         while (true) {